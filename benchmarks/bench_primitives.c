@@ -0,0 +1,350 @@
+/*
+ * Copyright (c) 2020, Rutgers Discovery Informatics Institute, Rutgers University
+ *
+ * See COPYRIGHT in top-level directory.
+ */
+
+/*
+ * Microbenchmarks of the storage primitives used by the provider:
+ * bounding box intersection, ssd_copy() (matrix_copy) and the
+ * ls_find_ods() index lookup. They run in a single process without a
+ * margo instance, so they can be used on a laptop to catch regressions.
+ *
+ * Usage: ./bench_primitives [-r reps] [-t min_time_sec] [-f filter]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <abt.h>
+#include "ss_data.h"
+
+static int reps_ = 5;
+static double min_time_ = 0.2;
+static const char *filter_ = NULL;
+
+static volatile uint64_t sink_;
+
+typedef void (*bench_fn)(void *arg);
+
+static double now_sec(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static int cmp_double(const void *a, const void *b)
+{
+    double x = *(const double*)a, y = *(const double*)b;
+    return (x > y) - (x < y);
+}
+
+/*
+  Run fn enough times to last min_time_, reps_ times, and report the
+  median time per operation. bytes is the payload moved by one call of
+  fn, 0 if bandwidth is meaningless.
+*/
+static void bench_run(const char *name, bench_fn fn, void *arg, uint64_t bytes)
+{
+    double *samples, t0, t, ns;
+    uint64_t iters = 1, i;
+    int r;
+
+    if(filter_ && !strstr(name, filter_))
+        return;
+
+    /* calibrate, which also serves as warm-up */
+    for(;;) {
+        t0 = now_sec();
+        for(i = 0; i < iters; i++)
+            fn(arg);
+        t = now_sec() - t0;
+        if(t >= min_time_ / 4 || iters >= (1ULL << 40))
+            break;
+        iters *= 2;
+    }
+    iters = (uint64_t)(iters * (min_time_ / (t > 0 ? t : 1e-9))) + 1;
+
+    samples = malloc(sizeof(*samples) * reps_);
+    for(r = 0; r < reps_; r++) {
+        t0 = now_sec();
+        for(i = 0; i < iters; i++)
+            fn(arg);
+        samples[r] = (now_sec() - t0) / iters;
+    }
+    qsort(samples, reps_, sizeof(*samples), cmp_double);
+    ns = samples[reps_ / 2] * 1e9;
+
+    if(bytes)
+        fprintf(stdout, "%-48s %14.1f ns/op %10.3f GB/s  (min %.1f max %.1f ns)\n",
+                name, ns, bytes / ns, samples[0] * 1e9, samples[reps_ - 1] * 1e9);
+    else
+        fprintf(stdout, "%-48s %14.1f ns/op %15s  (min %.1f max %.1f ns)\n",
+                name, ns, "", samples[0] * 1e9, samples[reps_ - 1] * 1e9);
+    free(samples);
+}
+
+static void set_bbox(struct bbox *bb, int ndim, const uint64_t *lb, const uint64_t *ub)
+{
+    memset(bb, 0, sizeof(*bb));
+    bb->num_dims = ndim;
+    memcpy(bb->lb.c, lb, sizeof(uint64_t) * ndim);
+    memcpy(bb->ub.c, ub, sizeof(uint64_t) * ndim);
+}
+
+static void set_odsc(obj_descriptor *odsc, const char *name, unsigned int ver,
+                     size_t elem_size, int ndim, const uint64_t *lb, const uint64_t *ub)
+{
+    memset(odsc, 0, sizeof(*odsc));
+    strncpy(odsc->name, name, sizeof(odsc->name)-1);
+    odsc->version = ver;
+    odsc->owner = -1;
+    odsc->st = column_major;
+    odsc->size = elem_size;
+    set_bbox(&odsc->bb, ndim, lb, ub);
+}
+
+/* bbox_intersect() over a table of random box pairs */
+
+#define NUM_BOX_PAIRS 1024
+
+struct bbox_arg {
+    struct bbox a[NUM_BOX_PAIRS], b[NUM_BOX_PAIRS];
+};
+
+static void bench_bbox(void *arg)
+{
+    struct bbox_arg *ba = arg;
+    struct bbox c;
+    uint64_t acc = 0;
+    int i;
+
+    for(i = 0; i < NUM_BOX_PAIRS; i++) {
+        if(bbox_does_intersect(&ba->a[i], &ba->b[i])) {
+            bbox_intersect(&ba->a[i], &ba->b[i], &c);
+            acc += c.ub.c[0];
+        }
+    }
+    sink_ += acc;
+}
+
+static void run_bbox(void)
+{
+    struct bbox_arg *ba = malloc(sizeof(*ba));
+    uint64_t lb[BBOX_MAX_NDIM], ub[BBOX_MAX_NDIM];
+    char name[128];
+    int ndim, i, d;
+
+    srand(1);
+    for(ndim = 1; ndim <= 4; ndim++) {
+        for(i = 0; i < NUM_BOX_PAIRS; i++) {
+            for(d = 0; d < ndim; d++) {
+                lb[d] = rand() % 1024;
+                ub[d] = lb[d] + rand() % 256;
+            }
+            set_bbox(&ba->a[i], ndim, lb, ub);
+            for(d = 0; d < ndim; d++) {
+                lb[d] = rand() % 1024;
+                ub[d] = lb[d] + rand() % 256;
+            }
+            set_bbox(&ba->b[i], ndim, lb, ub);
+        }
+        sprintf(name, "bbox_intersect/%dd/x%d", ndim, NUM_BOX_PAIRS);
+        bench_run(name, bench_bbox, ba, 0);
+    }
+    free(ba);
+}
+
+/* ssd_copy() from one stored piece into a requested box */
+
+struct copy_arg {
+    struct obj_data *to, *from;
+};
+
+static void bench_copy(void *arg)
+{
+    struct copy_arg *ca = arg;
+
+    sink_ += ssd_copy(ca->to, ca->from);
+}
+
+/*
+  Patterns, for an n^ndim piece:
+    full    request equals the stored piece
+    shift   request shifted by half a piece in every dimension
+    slab    request is a slab thin along the fastest dimension
+    pencil  request is one element wide along all but the slowest dimension
+*/
+static void run_copy_case(int ndim, size_t elem_size, uint64_t n, const char *pattern)
+{
+    obj_descriptor from_odsc, to_odsc;
+    uint64_t lb[BBOX_MAX_NDIM], ub[BBOX_MAX_NDIM];
+    uint64_t qlb[BBOX_MAX_NDIM], qub[BBOX_MAX_NDIM];
+    struct copy_arg ca;
+    struct bbox com;
+    char name[128];
+    int d;
+
+    for(d = 0; d < ndim; d++) {
+        lb[d] = 0;
+        ub[d] = n - 1;
+        if(!strcmp(pattern, "shift")) {
+            qlb[d] = n / 2;
+            qub[d] = n / 2 + n - 1;
+        } else if(!strcmp(pattern, "slab")) {
+            qlb[d] = 0;
+            qub[d] = (d == 0) ? 3 : n - 1;
+        } else if(!strcmp(pattern, "pencil")) {
+            qlb[d] = 0;
+            qub[d] = (d == ndim - 1) ? n - 1 : 0;
+        } else {
+            qlb[d] = 0;
+            qub[d] = n - 1;
+        }
+    }
+    set_odsc(&from_odsc, "bench", 1, elem_size, ndim, lb, ub);
+    set_odsc(&to_odsc, "bench", 1, elem_size, ndim, qlb, qub);
+
+    ca.from = obj_data_alloc(&from_odsc);
+    ca.to = obj_data_alloc(&to_odsc);
+    if(!ca.from || !ca.to) {
+        fprintf(stderr, "%s(): allocation failed\n", __func__);
+        obj_data_free(ca.from);
+        obj_data_free(ca.to);
+        return;
+    }
+    memset(ca.from->data, 1, obj_data_size(&from_odsc));
+    memset(ca.to->data, 0, obj_data_size(&to_odsc));
+
+    bbox_intersect(&from_odsc.bb, &to_odsc.bb, &com);
+    sprintf(name, "ssd_copy/%dd/n%" PRIu64 "/e%zu/%s", ndim, n, elem_size, pattern);
+    bench_run(name, bench_copy, &ca, bbox_volume(&com) * elem_size);
+
+    obj_data_free(ca.from);
+    obj_data_free(ca.to);
+}
+
+static void run_copy(void)
+{
+    static const char *patterns[] = {"full", "shift", "slab", "pencil"};
+    static const size_t elem_sizes[] = {4, 8, 16};
+    static const uint64_t sides[] = {0, 1 << 22, 1024, 128, 32};
+    int ndim, e, p;
+
+    for(ndim = 1; ndim <= 4; ndim++)
+        for(e = 0; e < 3; e++)
+            for(p = 0; p < 4; p++)
+                run_copy_case(ndim, elem_sizes[e], sides[ndim], patterns[p]);
+}
+
+/* ls_find_ods() over a store holding a grid of pieces */
+
+struct find_arg {
+    ss_storage *ls;
+    obj_descriptor q;
+};
+
+static void bench_find(void *arg)
+{
+    struct find_arg *fa = arg;
+    struct obj_data **od_tab;
+    int i, n;
+
+    n = ls_find_ods(fa->ls, &fa->q, &od_tab);
+    for(i = 0; i < n; i++)
+        obj_data_unref(od_tab[i]);
+    free(od_tab);
+    sink_ += n;
+}
+
+/*
+  Store a 3d domain split in p^3 pieces of b^3 elements, with nvars
+  variables and nver versions, and look up a box covering q^3 pieces.
+*/
+static void run_find_case(ss_storage *ls, int p, uint64_t b, int nvars, int q)
+{
+    struct find_arg fa;
+    uint64_t lb[3], ub[3];
+    char name[128];
+    int d;
+
+    for(d = 0; d < 3; d++) {
+        lb[d] = b / 2;
+        ub[d] = lb[d] + q * b - 1;
+    }
+    set_odsc(&fa.q, "var_0", 1, sizeof(double), 3, lb, ub);
+    fa.ls = ls;
+    sprintf(name, "ls_find_ods/pieces%d/vars%d/span%d", p * p * p, nvars, q);
+    bench_run(name, bench_find, &fa, 0);
+}
+
+static void run_find(void)
+{
+    static const int grids[] = {4, 8, 16};
+    const uint64_t b = 8;
+    const int nvars = 4, nver = 2;
+    obj_descriptor odsc;
+    uint64_t lb[3], ub[3];
+    char var[32];
+    int g, v, ver, x, y, z;
+
+    for(g = 0; g < 3; g++) {
+        int p = grids[g];
+        ss_storage *ls = ls_alloc(MAX_VERSIONS);
+
+        for(ver = 1; ver <= nver; ver++)
+        for(v = 0; v < nvars; v++) {
+            sprintf(var, "var_%d", v);
+            for(z = 0; z < p; z++)
+            for(y = 0; y < p; y++)
+            for(x = 0; x < p; x++) {
+                lb[0] = x * b; lb[1] = y * b; lb[2] = z * b;
+                ub[0] = lb[0] + b - 1; ub[1] = lb[1] + b - 1; ub[2] = lb[2] + b - 1;
+                set_odsc(&odsc, var, ver, sizeof(double), 3, lb, ub);
+                ls_add_obj(ls, obj_data_alloc(&odsc));
+            }
+        }
+        run_find_case(ls, p, b, nvars, 1);
+        run_find_case(ls, p, b, nvars, p / 2);
+        run_find_case(ls, p, b, nvars, p - 1);
+        ls_free(ls);
+    }
+}
+
+int main(int argc, char **argv)
+{
+    int opt;
+
+    while((opt = getopt(argc, argv, "r:t:f:")) != -1) {
+        switch(opt) {
+        case 'r':
+            reps_ = atoi(optarg);
+            break;
+        case 't':
+            min_time_ = atof(optarg);
+            break;
+        case 'f':
+            filter_ = optarg;
+            break;
+        default:
+            fprintf(stderr, "Usage: %s [-r reps] [-t min_time_sec] [-f filter]\n", argv[0]);
+            return -1;
+        }
+    }
+    if(reps_ < 1)
+        reps_ = 1;
+
+    /* the storage index uses Argobots locks */
+    ABT_init(argc, argv);
+
+    run_bbox();
+    run_copy();
+    run_find();
+
+    ABT_finalize();
+    return 0;
+}
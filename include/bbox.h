@@ -52,6 +52,7 @@ uint64_t bbox_dist(struct bbox *, int);
 int bbox_include(const struct bbox *, const struct bbox *);
 int bbox_does_intersect(const struct bbox *, const struct bbox *);
 void bbox_intersect(struct bbox *, const struct bbox *, struct bbox *);
+int bbox_subtract(const struct bbox *, const struct bbox *, struct bbox *);
 int bbox_equals(const struct bbox *, const struct bbox *);
 
 uint64_t bbox_volume(struct bbox *);
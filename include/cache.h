@@ -0,0 +1,53 @@
+/*
+ * Copyright (c) 2020, Rutgers Discovery Informatics Institute, Rutgers University
+ *
+ * See COPYRIGHT in top-level directory.
+ */
+
+#ifndef __CACHE_H_
+#define __CACHE_H_
+
+#include <stdint.h>
+#include <abt.h>
+#include "ss_data.h"
+
+/* a get whose uncovered part splits in more boxes is fetched whole */
+#define CACHE_MAX_MISSING       16
+
+/*
+  Cache of boxes of variables: the boxes a client read from the
+  providers, or the results of gets a provider assembled. A version is
+  immutable once written, so an entry stays valid until it is
+  overwritten or deleted. Entries are evicted least recently used
+  first to keep the payloads under the capacity.
+*/
+struct cache_entry {
+        struct list_head        entry;
+        /* provider the box comes from */
+        const void              *key;
+        struct obj_data         *od;
+};
+
+struct cache {
+        ABT_mutex               lock;
+        uint64_t                capacity;
+        uint64_t                size;
+        /* bumped by every invalidation, so that a box fetched while
+           the provider was overwriting it is not cached */
+        uint64_t                gen;
+        /* most recently used first */
+        struct list_head        lru;
+};
+
+struct cache *cache_alloc(uint64_t capacity);
+void cache_free(struct cache *);
+int cache_lookup(struct cache *, const void *key, struct obj_data *od,
+                struct bbox *missing, uint64_t *gen);
+struct obj_data *cache_find(struct cache *, const void *key,
+                obj_descriptor *odsc, uint64_t *gen);
+void cache_insert(struct cache *, const void *key, struct obj_data *od,
+                uint64_t gen);
+void cache_invalidate(struct cache *, obj_descriptor *odsc, uint32_t ver_hi);
+void cache_drop_key(struct cache *, const void *key);
+
+#endif /* __CACHE_H_ */
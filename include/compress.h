@@ -0,0 +1,57 @@
+/*
+ * Copyright (c) 2020, Rutgers Discovery Informatics Institute, Rutgers University
+ *
+ * See COPYRIGHT in top-level directory.
+ */
+
+#ifndef __COMPRESS_H_
+#define __COMPRESS_H_
+
+#include "ss_data.h"
+#include "ndstore-policy.h"
+
+/*
+  A compressed payload starts with this header, followed by a table of
+  num_chunks + 1 offsets (relative to the start of the payload) and the
+  compressed chunks.
+
+  The array is split in chunks that are contiguous in memory: a chunk
+  spans the whole extent of the dimensions below split_dim, 'run'
+  elements along split_dim and a single index along the dimensions
+  above it. The chunk boxes are derived from the object's bounding box,
+  so they are not stored.
+
+  Lossy chunks start with one byte naming the lossless codec applied
+  to the quantization codes (NDSTORE_CODEC_NONE if none helped).
+*/
+struct comp_hdr {
+        uint32_t                codec;
+        uint32_t                shuffle;
+        int32_t                 split_dim;
+        uint32_t                num_chunks;
+        uint64_t                run;
+        uint64_t                raw_size;
+        uint64_t                total_size;
+        /* absolute error bound of lossy codecs */
+        double                  error_bound;
+};
+
+static inline uint64_t *comp_offsets(const struct comp_hdr *h)
+{
+        return (uint64_t *)(h + 1);
+}
+
+struct comp_hdr *comp_encode(obj_descriptor *odsc, const void *data,
+                const struct ndstore_var_policy *policy);
+int comp_check(const struct comp_hdr *h, uint64_t size, obj_descriptor *odsc);
+int comp_meets_policy(const struct comp_hdr *h, obj_descriptor *odsc,
+                const void *data, const struct ndstore_var_policy *policy);
+void comp_chunk_bbox(const struct comp_hdr *h, const struct bbox *bb,
+                uint32_t i, struct bbox *out);
+uint64_t comp_chunk_raw_size(const struct comp_hdr *h, obj_descriptor *odsc,
+                uint32_t i);
+int comp_decode_chunk(const struct comp_hdr *h, obj_descriptor *odsc,
+                uint32_t i, void *out);
+int comp_decode(const struct comp_hdr *h, obj_descriptor *odsc, void *out);
+
+#endif /* __COMPRESS_H_ */
@@ -0,0 +1,25 @@
+/*
+ * Copyright (c) 2020, Rutgers Discovery Informatics Institute, Rutgers University
+ *
+ * See COPYRIGHT in top-level directory.
+ */
+
+#ifndef __GC_H_
+#define __GC_H_
+
+#include "ss_data.h"
+#include "policy.h"
+
+/* One version of a variable held in storage. */
+struct gc_version {
+        char                    name[POLICY_NAME_LEN];
+        unsigned int            version;
+        /* time the last piece of the version was put */
+        double                  t_put;
+        int                     drop;
+};
+
+int gc_run(ss_storage *ls, struct policy_table *policies, double now,
+                uint64_t *bytes, struct gc_version **dropped);
+
+#endif /* __GC_H_ */
@@ -0,0 +1,22 @@
+/*
+ * Copyright (c) 2020, Rutgers Discovery Informatics Institute, Rutgers University
+ *
+ * See COPYRIGHT in top-level directory.
+ */
+
+#ifndef __GRID_H_
+#define __GRID_H_
+
+#include "ss_data.h"
+
+int grid_applies(const uint64_t *grid, int num_dims);
+uint64_t grid_cells(const struct bbox *bb, const uint64_t *grid,
+                struct bbox *range);
+void grid_cell_bbox(const struct bbox *range, const uint64_t *grid,
+                uint64_t i, struct bbox *cell);
+int grid_split(ss_storage *ls, struct obj_data *od, const uint64_t *grid,
+                struct obj_data ***frags);
+struct obj_data *grid_merge(ss_storage *ls, struct obj_data *frag,
+                const uint64_t *grid);
+
+#endif /* __GRID_H_ */
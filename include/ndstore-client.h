@@ -8,8 +8,11 @@
 #ifndef __NDSTORE_CLIENT_H
 #define __NDSTORE_CLIENT_H
 
+#include <sys/uio.h>
 #include <margo.h>
 #include <ndstore-common.h>
+#include <ndstore-stats.h>
+#include <ndstore-policy.h>
 
 #if defined(__cplusplus)
 extern "C" {
@@ -40,6 +43,66 @@ int ndstore_client_init(margo_instance_id mid, ndstore_client_t* client);
  */
 int ndstore_client_finalize(ndstore_client_t client);
 
+/**
+ * @brief Enables per-call tracing of ndstore_put() and ndstore_get().
+ * The phase timestamps of the last capacity calls are kept in a ring
+ * buffer that the calling threads fill without locking.
+ *
+ * @param[in] client NDSTORE client
+ * @param[in] capacity number of calls kept in the trace
+ *
+ * @return NDSTORE_SUCCESS or error code defined in ndstore-common.h
+ */
+int ndstore_client_trace_enable(ndstore_client_t client, size_t capacity);
+
+/**
+ * @brief Writes the traced calls to a file in the Chrome trace event
+ * format, which chrome://tracing and Perfetto can open.
+ *
+ * @param[in] client NDSTORE client
+ * @param[in] path output file
+ *
+ * @return NDSTORE_SUCCESS or error code defined in ndstore-common.h
+ */
+int ndstore_client_trace_dump(ndstore_client_t client, const char *path);
+
+/**
+ * @brief Compresses the payload of puts and gets of at least threshold
+ * bytes. A put exposes the compressed buffer, which the provider keeps
+ * as is if the variable is stored with the same codec. A get asks the
+ * provider to compress its reply with the same codec; lossy codecs
+ * only apply to gets of objects already stored lossy. Calls fall back
+ * to raw transfers when compression does not pay off.
+ *
+ * @param[in] client NDSTORE client
+ * @param[in] policy codec and parameters, NULL to disable
+ * @param[in] threshold minimum transfer size in bytes
+ *
+ * @return NDSTORE_SUCCESS or error code defined in ndstore-common.h
+ */
+int ndstore_client_set_wire_compression(ndstore_client_t client,
+        const struct ndstore_var_policy *policy,
+        uint64_t threshold);
+
+/**
+ * @brief Enables a read-through cache of the boxes read with
+ * ndstore_get(). A get copies the parts the cache holds and only reads
+ * the boxes left from the provider. Providers report overwrites,
+ * deletes and collected versions to the client, which drops the stale
+ * entries. Reports are RPCs to the client, whose margo instance must
+ * therefore be in server mode. They are sent in the background: the
+ * client may serve the old data for a short while after a put or
+ * delete returned. The least recently used entries are evicted to keep the cached payloads
+ * under capacity bytes. ndstore_client_finalize() unsubscribes from the
+ * providers.
+ *
+ * @param[in] client NDSTORE client
+ * @param[in] capacity memory cap of the cache in bytes
+ *
+ * @return NDSTORE_SUCCESS or error code defined in ndstore-common.h
+ */
+int ndstore_client_cache_enable(ndstore_client_t client, uint64_t capacity);
+
 /**
  * @brief Creates a NDSTORE provider handle.
  *
@@ -56,6 +119,31 @@ int ndstore_provider_handle_create(
         uint16_t provider_id,
         ndstore_provider_handle_t* handle);
 
+/**
+ * @brief Adds a replica of the provider (see
+ * ndstore_provider_set_replicas()) to a provider handle. Gets through
+ * the handle then take turns between the provider and its replicas.
+ * Replicas are updated asynchronously, so a replica only serves a get
+ * once it has applied every update the handle saw from the provider:
+ * its own puts and deletes, and those the data it read reflects. A get
+ * that a replica turns away or fails is retried on the provider, and on
+ * the other replicas if the provider cannot be reached, e.g. after its
+ * server failed. Puts
+ * and deletes of other clients reach the handle through the replicas
+ * with some lag. Puts, deletes, gets through the client cache, and
+ * point, pull and multi-version gets always go to the provider.
+ *
+ * @param[in] handle provider handle
+ * @param[in] addr address of the replica
+ * @param[in] provider_id provider id of the replica
+ *
+ * @return NDSTORE_SUCCESS or error code defined in ndstore-common.h
+ */
+int ndstore_provider_handle_add_replica(
+        ndstore_provider_handle_t handle,
+        hg_addr_t addr,
+        uint16_t provider_id);
+
 /**
  * @brief Retrieves the information (string address and provider id)
  * from a provider handle. If any argument is NULL, the corresponding
@@ -171,6 +259,271 @@ int ndstore_get (ndstore_provider_handle_t provider,
         int ndim, uint64_t *lb, uint64_t *ub, 
         void *data); 
 
+/**
+ * @brief Same as ndstore_put(), but the block is a sub-array of a larger
+ * local array, e.g. the interior of an array with ghost cells. The
+ * block is sent straight from the array, without packing it first.
+ *
+ * @param[in] dims extents of the local array, in the order of lb and ub
+ * @param[in] offset index of the first element of the block in the
+ *              local array
+ * @param[in] data the local array
+ *
+ * Other arguments are those of ndstore_put().
+ *
+ * @return NDSTORE_SUCCESS or error code defined in ndstore-common.h
+ */
+int ndstore_put_layout(ndstore_provider_handle_t provider,
+        const char *var_name,
+        unsigned int ver, int size,
+        int ndim, uint64_t *lb, uint64_t *ub,
+        const uint64_t *dims, const uint64_t *offset,
+        void *data);
+
+/**
+ * @brief Same as ndstore_put(), but the elements of the block, in
+ * order, are gathered from the iovcnt buffers of iov, e.g. one field of
+ * an array of structs.
+ *
+ * @return NDSTORE_SUCCESS or error code defined in ndstore-common.h
+ */
+int ndstore_put_iov(ndstore_provider_handle_t provider,
+        const char *var_name,
+        unsigned int ver, int size,
+        int ndim, uint64_t *lb, uint64_t *ub,
+        int iovcnt, const struct iovec *iov);
+
+/**
+ * @brief Same as ndstore_get(), but the block is written into a
+ * sub-array of a larger local array, see ndstore_put_layout().
+ *
+ * @return NDSTORE_SUCCESS or error code defined in ndstore-common.h
+ */
+int ndstore_get_layout(ndstore_provider_handle_t provider,
+        const char *var_name,
+        unsigned int ver, int size,
+        int ndim, uint64_t *lb, uint64_t *ub,
+        const uint64_t *dims, const uint64_t *offset,
+        void *data);
+
+/**
+ * @brief Same as ndstore_get(), but the elements of the block, in
+ * order, are scattered to the iovcnt buffers of iov.
+ *
+ * @return NDSTORE_SUCCESS or error code defined in ndstore-common.h
+ */
+int ndstore_get_iov(ndstore_provider_handle_t provider,
+        const char *var_name,
+        unsigned int ver, int size,
+        int ndim, uint64_t *lb, uint64_t *ub,
+        int iovcnt, const struct iovec *iov);
+
+/**
+ * @brief Puts a multi-field object: num_fields named arrays of the same
+ * bounding box, e.g. the components of a vector field, stored together
+ * under one descriptor. Each field is a dense buffer as in ndstore_put().
+ * Multi-field objects are neither compressed nor re-chunked by the
+ * storage policy of the variable.
+ *
+ * @param[in] num_fields number of fields
+ * @param[in] field_names names of the fields, of at most 31 characters
+ * @param[in] data buffers of the fields
+ *
+ * Other arguments are those of ndstore_put().
+ *
+ * @return NDSTORE_SUCCESS or error code defined in ndstore-common.h
+ */
+int ndstore_put_fields(ndstore_provider_handle_t provider,
+        const char *var_name,
+        unsigned int ver, int size,
+        int ndim, uint64_t *lb, uint64_t *ub,
+        int num_fields, const char **field_names, void **data);
+
+/**
+ * @brief Gets a subset of the fields of multi-field objects put with
+ * ndstore_put_fields(), in any order. Fails if a piece of the bounding
+ * box lacks one of the fields.
+ *
+ * @param[in] num_fields number of fields
+ * @param[in] field_names names of the fields to get
+ * @param[in] data buffers of the fields
+ *
+ * Other arguments are those of ndstore_get().
+ *
+ * @return NDSTORE_SUCCESS or error code defined in ndstore-common.h
+ */
+int ndstore_get_fields(ndstore_provider_handle_t provider,
+        const char *var_name,
+        unsigned int ver, int size,
+        int ndim, uint64_t *lb, uint64_t *ub,
+        int num_fields, const char **field_names, void **data);
+
+/**
+ * @brief Same as ndstore_put(), for a patch of refinement level 'level'
+ * of an AMR variable, 0 being the coarsest. The bounding box is in the
+ * index space of the level. ndstore_put() puts level 0.
+ *
+ * @return NDSTORE_SUCCESS or error code defined in ndstore-common.h
+ */
+int ndstore_put_level(ndstore_provider_handle_t provider,
+        const char *var_name,
+        unsigned int ver, int size,
+        int ndim, unsigned int level, uint64_t *lb, uint64_t *ub,
+        void *data);
+
+/**
+ * @brief Gets a bounding box of refinement level 'level' of an AMR
+ * variable. With a refinement ratio, e.g. 2, the provider returns the
+ * finest data available: the parts of the box that no patch of 'level'
+ * covers are filled from the finest coarser level that does, each
+ * coarse element repeated over the fine elements it covers.
+ *
+ * @param[in] level refinement level of the box
+ * @param[in] refine ratio between the resolutions of successive
+ *              levels, 0 to get 'level' only
+ *
+ * Other arguments are those of ndstore_get().
+ *
+ * @return NDSTORE_SUCCESS or error code defined in ndstore-common.h
+ */
+int ndstore_get_level(ndstore_provider_handle_t provider,
+        const char *var_name,
+        unsigned int ver, int size,
+        int ndim, unsigned int level, unsigned int refine,
+        uint64_t *lb, uint64_t *ub,
+        void *data);
+
+/**
+ * @brief Puts a point object: num_points points of an ndim-dimensional
+ * domain, e.g. particles, each with a value of size bytes. The provider
+ * indexes the points on a grid over their bounding box, so that range
+ * gets only scan the cells they intersect.
+ *
+ * @param[in] provider provider handle
+ * @param[in] var_name name of the variable
+ * @param[in] ver version of the variable
+ * @param[in] size size in bytes of the value of a point
+ * @param[in] ndim number of dimensions of the domain
+ * @param[in] num_points number of points
+ * @param[in] coords coordinates of the points, ndim per point
+ * @param[in] data values of the points
+ *
+ * @return NDSTORE_SUCCESS or error code defined in ndstore-common.h
+ */
+int ndstore_put_points(ndstore_provider_handle_t provider,
+        const char *var_name,
+        unsigned int ver, int size, int ndim,
+        uint64_t num_points, uint64_t *coords, void *data);
+
+/**
+ * @brief Gets the points of the point objects of a variable that lie in
+ * a bounding box, in no particular order. If there are more than
+ * max_points of them, nothing is copied, NDSTORE_ERR_SIZE is returned
+ * and num_points tells how many there are; max_points may be 0 to only
+ * count them.
+ *
+ * @param[in] max_points number of points coords and data have room for
+ * @param[out] coords coordinates of the points, ndim per point
+ * @param[out] data values of the points
+ * @param[out] num_points number of points in the box, may be NULL
+ *
+ * Other arguments are those of ndstore_get().
+ *
+ * @return NDSTORE_SUCCESS or error code defined in ndstore-common.h
+ */
+int ndstore_get_points(ndstore_provider_handle_t provider,
+        const char *var_name,
+        unsigned int ver, int size,
+        int ndim, uint64_t *lb, uint64_t *ub,
+        uint64_t max_points, uint64_t *coords, void *data,
+        uint64_t *num_points);
+
+/**
+ * @brief Same as ndstore_get(), but the provider only exposes the
+ * stored pieces that intersect the bounding box; the client pulls them
+ * itself and copies them into place. This spares the provider the
+ * assembly of the result, which pays off for large gets spanning many
+ * pieces. Arguments are those of ndstore_get().
+ *
+ * @return NDSTORE_SUCCESS or error code defined in ndstore-common.h
+ */
+int ndstore_get_pull(ndstore_provider_handle_t provider,
+        const char *var_name,
+        unsigned int ver, int size,
+        int ndim, uint64_t *lb, uint64_t *ub,
+        void *data);
+
+/**
+ * @brief Gets the same bounding box of every version of a variable from
+ * ver_lo to ver_hi in a single call: the provider assembles them into
+ * one buffer and pushes it in one transfer. This suits time series,
+ * e.g. probing a point over many timesteps. Fails if one of the
+ * versions is not complete.
+ *
+ * @param[in] ver_lo first version
+ * @param[in] ver_hi last version
+ * @param[out] data (ver_hi - ver_lo + 1) boxes one after the other,
+ * oldest version first
+ *
+ * Other arguments are those of ndstore_get().
+ *
+ * @return NDSTORE_SUCCESS or error code defined in ndstore-common.h
+ */
+int ndstore_get_versions(ndstore_provider_handle_t provider,
+        const char *var_name,
+        unsigned int ver_lo, unsigned int ver_hi, int size,
+        int ndim, uint64_t *lb, uint64_t *ub,
+        void *data);
+
+/**
+ * @brief Retrieves a snapshot of the performance counters of a
+ * provider.
+ *
+ * @param[in] provider provider handle
+ * @param[out] stats statistics snapshot
+ *
+ * @return NDSTORE_SUCCESS or error code defined in ndstore-common.h
+ */
+int ndstore_get_stats(ndstore_provider_handle_t provider,
+        struct ndstore_stats *stats);
+
+/**
+ * @brief Sets the storage policy (e.g. compression) that a provider
+ * applies to the variables matching var_name. The provider forwards it
+ * to its replicas.
+ *
+ * @param[in] provider provider handle
+ * @param[in] var_name variable name, or prefix ending in '*'
+ * @param[in] policy policy to apply
+ *
+ * @return NDSTORE_SUCCESS or error code defined in ndstore-common.h
+ */
+int ndstore_set_var_policy(ndstore_provider_handle_t provider,
+        const char *var_name,
+        const struct ndstore_var_policy *policy);
+
+/**
+ * @brief Frees versions ver_lo to ver_hi of a variable on a provider,
+ * e.g. once a timestep has been consumed. With a bounding box, only
+ * the data inside it is freed and the stored pieces that cross its
+ * border are cut down to the part outside of it. Gets already in
+ * flight complete with the old data.
+ *
+ * @param[in] provider provider handle
+ * @param[in] var_name variable name
+ * @param[in] ver_lo first version to delete
+ * @param[in] ver_hi last version to delete
+ * @param[in] ndim number of dimensions of the box, 0 for all the data
+ * @param[in] lb lower corner of the box
+ * @param[in] ub upper corner of the box
+ *
+ * @return NDSTORE_SUCCESS or error code defined in ndstore-common.h
+ */
+int ndstore_delete(ndstore_provider_handle_t provider,
+        const char *var_name,
+        unsigned int ver_lo, unsigned int ver_hi,
+        int ndim, uint64_t *lb, uint64_t *ub);
+
 #if defined(__cplusplus)
 }
 #endif
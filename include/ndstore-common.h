@@ -20,7 +20,9 @@ extern "C" {
 #define NDSTORE_ERR_ARGOBOTS    -6 /* Argobots related error */
 #define NDSTORE_ERR_UNKNOWN_PR    -7 /* Could not find server */
 #define NDSTORE_ERR_UNKNOWN_OBJ    -8 /* Could not find the object*/
-#define NDSTORE_ERR_END         -9 /* End of range for valid error codes */
+#define NDSTORE_ERR_NOSPACE     -9 /* The provider's memory budget is exhausted */
+#define NDSTORE_ERR_STALE       -10 /* A replica is behind the updates the client saw */
+#define NDSTORE_ERR_END         -11 /* End of range for valid error codes */
 
 
 #if defined(__cplusplus)
@@ -0,0 +1,105 @@
+/*
+ * Copyright (c) 2020, Rutgers Discovery Informatics Institute, Rutgers University
+ *
+ * See COPYRIGHT in top-level directory.
+ */
+
+#ifndef __NDSTORE_POLICY_H
+#define __NDSTORE_POLICY_H
+
+#include <stdint.h>
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+#define NDSTORE_POLICY_MAX_DIMS 10
+
+/* Codecs for stored objects. Which ones are available depends on the
+ * libraries found when ndstore was built. */
+enum ndstore_codec {
+    NDSTORE_CODEC_NONE = 0,
+    NDSTORE_CODEC_LZ4,
+    NDSTORE_CODEC_ZSTD,
+    /* Lossy, error-bounded: each value is predicted from the previous
+     * one and the residual quantized. Floating-point variables only
+     * (element size 4 is float, 8 is double). Always available. */
+    NDSTORE_CODEC_QUANT
+};
+
+/* How error_bound is interpreted by lossy codecs. */
+enum ndstore_error_mode {
+    /* |x - x'| <= error_bound */
+    NDSTORE_BOUND_ABS = 0,
+    /* |x - x'| <= error_bound * (max - min) of the object */
+    NDSTORE_BOUND_REL
+};
+
+/*
+ * Storage policy of a variable. The provider applies the policy of the
+ * most specific matching name: an exact name, or a prefix ending in
+ * '*' ("*" alone matches every variable).
+ */
+struct ndstore_var_policy {
+    /* Lossless codec applied in the background after a put. */
+    int32_t codec;
+    /* Codec level, 0 for the codec default. */
+    int32_t level;
+    /* Byte-shuffle elements before compressing, which groups the
+     * exponent bytes of floating-point data together. */
+    int32_t shuffle;
+    /* Compress in the put handler, before the object is indexed, so
+     * raw payloads never pile up when puts outpace the background
+     * ULTs. Trades put latency for memory. */
+    int32_t sync;
+    /* Target uncompressed size of a chunk in bytes. Gets only
+     * decompress the chunks that intersect the requested box. */
+    uint64_t chunk_size;
+    /* Error bound of lossy codecs, see enum ndstore_error_mode. */
+    int32_t error_mode;
+    double error_bound;
+    /* Extent of the cells of a storage grid anchored at the origin.
+     * When set for every dimension of an object, a background ULT
+     * splits each put along the grid and merges the pieces of a cell
+     * once it is fully written, so reads of any shape touch whole
+     * cells whatever the writers' decomposition. 0 disables. */
+    uint64_t grid[NDSTORE_POLICY_MAX_DIMS];
+    /* Retention, enforced by a background GC ULT. A version is kept
+     * if it is one of the keep_last newest, was written less than
+     * keep_secs seconds ago, or is a multiple of keep_every; other
+     * versions are freed as a whole. With no rule set (all 0), old
+     * versions are only replaced by newer puts that overlap them. */
+    uint32_t keep_last;
+    uint32_t keep_every;
+    double keep_secs;
+    /* Delta encoding. When set, a put that covers exactly the box of
+     * a piece of the previous version is stored as the XOR with it,
+     * compressed with the lossless codec of the policy (zstd or lz4
+     * if none), and gets rebuild the data from the chain of previous
+     * versions. Every delta_keyframe-th version of a chain is stored
+     * in full, which bounds the cost of a get. Keyframes are then
+     * compressed in the put handler, as with sync. 0 disables. */
+    uint32_t delta_keyframe;
+};
+
+/**
+ * @brief Fills a policy with the defaults: objects stored uncompressed.
+ *
+ * @param[out] policy policy to initialize
+ */
+void ndstore_var_policy_init(struct ndstore_var_policy *policy);
+
+/**
+ * @brief Tells whether a codec was built into this library.
+ *
+ * @param[in] codec one of enum ndstore_codec
+ *
+ * @return 1 if available, 0 otherwise
+ */
+int ndstore_codec_available(int codec);
+
+#if defined(__cplusplus)
+}
+#endif
+
+#endif
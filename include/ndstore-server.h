@@ -10,6 +10,8 @@
 
 #include <margo.h>
 #include <ndstore-common.h>
+#include <ndstore-stats.h>
+#include <ndstore-policy.h>
 
 #if defined(__cplusplus)
 extern "C" {
@@ -17,6 +19,14 @@ extern "C" {
 
 #define NDSTORE_ABT_POOL_DEFAULT ABT_POOL_NULL
 
+/* Pages backing large payloads. */
+enum ndstore_pages {
+    NDSTORE_PAGES_DEFAULT = 0, /* malloc() */
+    NDSTORE_PAGES_THP,         /* mappings advised for transparent huge pages */
+    NDSTORE_PAGES_2M,          /* 2 MiB pages of the hugetlb pool */
+    NDSTORE_PAGES_1G           /* 1 GiB pages of the hugetlb pool */
+};
+
 typedef struct ndstore_provider* ndstore_provider_t;
 #define NDSTORE_PROVIDER_NULL ((ndstore_provider_t)NULL)
 #define NDSTORE_PROVIDER_IGNORE ((ndstore_provider_t*)NULL)
@@ -49,6 +59,160 @@ int ndstore_provider_register(
 int ndstore_provider_destroy(
         ndstore_provider_t provider);
 
+/**
+ * @brief Takes a snapshot of the provider's performance counters.
+ *
+ * @param[in] provider Ndstore provider
+ * @param[out] stats statistics snapshot
+ *
+ * @return NDSTORE_SUCCESS or error code defined in ndstore-common.h
+ */
+int ndstore_provider_get_stats(
+        ndstore_provider_t provider,
+        struct ndstore_stats *stats);
+
+/**
+ * @brief Starts a ULT in the provider's pool that appends a JSON
+ * snapshot of the performance counters to a file every interval
+ * seconds, and once more when the provider is finalized.
+ *
+ * @param[in] provider Ndstore provider
+ * @param[in] path file to append to
+ * @param[in] interval dump period in seconds
+ *
+ * @return NDSTORE_SUCCESS or error code defined in ndstore-common.h
+ */
+int ndstore_provider_stats_enable_dump(
+        ndstore_provider_t provider,
+        const char *path,
+        double interval);
+
+/**
+ * @brief Caps the payload bytes held by the provider. Puts that would
+ * exceed the budget fail with NDSTORE_ERR_NOSPACE until deletes or
+ * retention free enough memory.
+ *
+ * @param[in] provider Ndstore provider
+ * @param[in] bytes memory budget, 0 for no limit
+ *
+ * @return NDSTORE_SUCCESS or error code defined in ndstore-common.h
+ */
+int ndstore_provider_set_mem_budget(
+        ndstore_provider_t provider,
+        uint64_t bytes);
+
+/**
+ * @brief Backs the payloads of large objects, and of the results of
+ * large gets, with huge pages, which saves TLB misses in copies and
+ * makes bulk registration cheaper. Smaller pages are used for objects
+ * below the page size, or when the hugetlb pool is exhausted.
+ *
+ * @param[in] provider Ndstore provider
+ * @param[in] pages largest pages to use
+ *
+ * @return NDSTORE_SUCCESS or error code defined in ndstore-common.h
+ */
+int ndstore_provider_set_pages(
+        ndstore_provider_t provider,
+        enum ndstore_pages pages);
+
+/**
+ * @brief Sets how many ULTs of the provider's pool assemble the result
+ * of a get of 1 MiB or more that spans several stored pieces (8 by
+ * default). Each ULT copies a run of pieces of about the same volume.
+ *
+ * @param[in] provider Ndstore provider
+ * @param[in] num_ults number of ULTs, 1 to copy in the handler
+ *
+ * @return NDSTORE_SUCCESS or error code defined in ndstore-common.h
+ */
+int ndstore_provider_set_copy_ults(
+        ndstore_provider_t provider,
+        int num_ults);
+
+/**
+ * @brief Keeps the results of recent gets, up to bytes of them, and
+ * serves identical gets (same variable, version, box, element size and
+ * level) from them without assembling the pieces again. Identical gets
+ * that arrive while one is being assembled wait for its result. Puts
+ * that overwrite stored data and deletes drop the results they affect.
+ * Results are not counted in the memory budget. To be called before
+ * the provider serves requests.
+ *
+ * @param[in] provider Ndstore provider
+ * @param[in] bytes memory cap of the results kept
+ *
+ * @return NDSTORE_SUCCESS or error code defined in ndstore-common.h
+ */
+int ndstore_provider_set_result_cache(
+        ndstore_provider_t provider,
+        uint64_t bytes);
+
+/**
+ * @brief Replicates the objects of the provider on peer providers, for a
+ * replication factor of num_replicas + 1. Each put, each delete, each
+ * version the retention GC frees and each policy set is forwarded to
+ * every peer by a ULT of the provider's pool once it has been answered,
+ * in the order the provider applied them; peers apply them like the
+ * provider did and do not forward them further. A peer may replicate
+ * several providers, whose updates it keeps track of separately. A peer
+ * that is unreachable misses the updates meanwhile. Clients spread
+ * their gets over the peers with ndstore_provider_handle_add_replica().
+ * To be called once, before the provider serves requests.
+ *
+ * @param[in] provider Ndstore provider
+ * @param[in] num_replicas number of peers
+ * @param[in] addrs address of each peer
+ * @param[in] provider_ids provider id of each peer
+ *
+ * @return NDSTORE_SUCCESS or error code defined in ndstore-common.h
+ */
+int ndstore_provider_set_replicas(
+        ndstore_provider_t provider,
+        int num_replicas,
+        const char **addrs,
+        const uint16_t *provider_ids);
+
+/**
+ * @brief Spreads the payloads of new objects over NUMA nodes, by a
+ * hash of their lower corner, and makes gets copy each piece in a
+ * ULT of the pool of the node that holds it. To be called before the
+ * provider serves requests.
+ *
+ * @param[in] provider Ndstore provider
+ * @param[in] num_nodes number of nodes, 0 to disable
+ * @param[in] nodes NUMA node ids
+ * @param[in] pools pool of each node (e.g. served by xstreams bound to
+ *            its cpus), NULL or ABT_POOL_NULL entries to copy in the
+ *            handler
+ *
+ * @return NDSTORE_SUCCESS or error code defined in ndstore-common.h
+ */
+int ndstore_provider_set_numa(
+        ndstore_provider_t provider,
+        int num_nodes,
+        const int *nodes,
+        const ABT_pool *pools);
+
+/**
+ * @brief Sets the storage policy of the variables matching name.
+ * Objects put afterwards are compressed in the background by a ULT
+ * of the provider's pool, or in the put handler if policy->sync is
+ * set; gets decompress them transparently. Retention rules make a
+ * ULT free the versions they no longer keep about once per second;
+ * newer puts then only replace pieces of the same version.
+ *
+ * @param[in] provider Ndstore provider
+ * @param[in] name variable name, or prefix ending in '*'
+ * @param[in] policy policy to apply
+ *
+ * @return NDSTORE_SUCCESS or error code defined in ndstore-common.h
+ */
+int ndstore_provider_set_var_policy(
+        ndstore_provider_t provider,
+        const char *name,
+        const struct ndstore_var_policy *policy);
+
 #if defined(__cplusplus)
 }
 #endif
@@ -0,0 +1,76 @@
+/*
+ * Copyright (c) 2020, Rutgers Discovery Informatics Institute, Rutgers University
+ *
+ * See COPYRIGHT in top-level directory.
+ */
+
+#ifndef __NDSTORE_STATS_H
+#define __NDSTORE_STATS_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+/* Latency histograms use log2 buckets in microseconds: bucket i counts
+ * samples in [2^i, 2^(i+1)) us, bucket 0 also holds anything under 1 us
+ * and the last bucket holds everything above. */
+#define NDSTORE_STATS_HIST_BUCKETS 24
+
+/* RPCs served by a provider. */
+enum ndstore_stats_op {
+    NDSTORE_STATS_OP_PUT = 0,
+    NDSTORE_STATS_OP_GET,
+    NDSTORE_STATS_OP_GET_PIECES, /* client-pull get, see ndstore_get_pull() */
+    NDSTORE_STATS_NUM_OPS
+};
+
+/* Phases of an RPC handler. */
+enum ndstore_stats_phase {
+    NDSTORE_STATS_PH_DECODE = 0, /* input and descriptor decoding */
+    NDSTORE_STATS_PH_LOOKUP,     /* index lookup or insertion */
+    NDSTORE_STATS_PH_COPY,       /* assembly of the result in memory */
+    NDSTORE_STATS_PH_BULK,       /* bulk registration and transfer */
+    NDSTORE_STATS_PH_RESPOND,    /* sending the response */
+    NDSTORE_STATS_PH_TOTAL,      /* whole handler */
+    NDSTORE_STATS_NUM_PHASES
+};
+
+struct ndstore_op_stats {
+    uint64_t count;
+    uint64_t errors;
+    uint64_t bytes_in;
+    uint64_t bytes_out;
+    uint64_t time_ns[NDSTORE_STATS_NUM_PHASES];
+    uint64_t hist[NDSTORE_STATS_NUM_PHASES][NDSTORE_STATS_HIST_BUCKETS];
+};
+
+struct ndstore_stats {
+    /* Seconds since the provider was registered. */
+    double uptime;
+    /* Objects and payload bytes currently held in storage. */
+    uint64_t num_obj;
+    uint64_t bytes_resident;
+    /* Versions and payload bytes freed by the retention GC. */
+    uint64_t gc_versions;
+    uint64_t gc_bytes;
+    struct ndstore_op_stats ops[NDSTORE_STATS_NUM_OPS];
+};
+
+/**
+ * @brief Writes a statistics snapshot as one line of JSON.
+ *
+ * @param[in] fp output stream
+ * @param[in] stats statistics snapshot
+ *
+ * @return NDSTORE_SUCCESS or error code defined in ndstore-common.h
+ */
+int ndstore_stats_fprint(FILE *fp, const struct ndstore_stats *stats);
+
+#if defined(__cplusplus)
+}
+#endif
+
+#endif
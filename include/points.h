@@ -0,0 +1,50 @@
+/*
+ * Copyright (c) 2020, Rutgers Discovery Informatics Institute, Rutgers University
+ *
+ * See COPYRIGHT in top-level directory.
+ */
+
+#ifndef __POINTS_H_
+#define __POINTS_H_
+
+#include "ss_data.h"
+
+/*
+  The payload of a point object is the coordinates of its num_points
+  points, num_dims uint64_t each, followed by their values, size bytes
+  each. The bounding box of the object bounds the points.
+
+  Once stored, the points are sorted by the cell of a uniform grid over
+  the bounding box they fall in, and the index records where the points
+  of every cell start, so a range query only scans the cells it
+  intersects.
+*/
+struct point_index {
+        uint64_t                width[BBOX_MAX_NDIM];
+        uint64_t                cells[BBOX_MAX_NDIM];
+        uint64_t                num_cells;
+        /* num_cells + 1 offsets in the point arrays */
+        uint64_t                start[];
+};
+
+/* Average number of points per cell aimed at. */
+#define POINTS_PER_CELL 64
+
+static inline uint64_t *points_coords(struct obj_data *od)
+{
+        return (uint64_t *)od->data;
+}
+
+static inline char *points_values(struct obj_data *od)
+{
+        return (char *)od->data + od->obj_desc.num_points *
+                od->obj_desc.bb.num_dims * sizeof(uint64_t);
+}
+
+int points_index(struct obj_data *od);
+uint64_t points_select(struct obj_data *od, const struct bbox *bb,
+                uint64_t *coords, void *values, uint64_t max);
+int points_filter(struct obj_data *od, const struct bbox *bb,
+                struct obj_data **out);
+
+#endif /* __POINTS_H_ */
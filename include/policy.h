@@ -0,0 +1,44 @@
+/*
+ * Copyright (c) 2020, Rutgers Discovery Informatics Institute, Rutgers University
+ *
+ * See COPYRIGHT in top-level directory.
+ */
+
+#ifndef __POLICY_H_
+#define __POLICY_H_
+
+#include "ss_data.h"
+#include "ndstore-policy.h"
+
+/* Same length as obj_descriptor.name */
+#define POLICY_NAME_LEN 154
+
+/* Raw payload of the policy RPC, carried in an odsc_hdr. */
+struct policy_rec {
+        char                            name[POLICY_NAME_LEN];
+        struct ndstore_var_policy       policy;
+};
+
+MERCURY_GEN_PROC(policy_in_t,
+        ((odsc_hdr)(rec)))
+
+struct policy_entry {
+        struct list_head                entry;
+        struct policy_rec               rec;
+};
+
+/* Per-provider table of variable policies. */
+struct policy_table {
+        ABT_mutex                       lock;
+        struct list_head                list;
+};
+
+struct policy_table *policy_table_alloc(void);
+void policy_table_free(struct policy_table *);
+int policy_table_set(struct policy_table *, const char *name,
+                const struct ndstore_var_policy *);
+int policy_table_lookup(struct policy_table *, const char *name,
+                struct ndstore_var_policy *);
+int policy_has_retention(const struct ndstore_var_policy *);
+
+#endif /* __POLICY_H_ */
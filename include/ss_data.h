@@ -11,6 +11,7 @@
 
 #include "bbox.h"
 #include "list.h"
+#include "ndstore-policy.h"
 //#include <sys/mman.h>
 //#include <fcntl.h>
 //#include <sys/stat.h>
@@ -18,10 +19,16 @@
 #include <mercury_bulk.h>
 #include <mercury_atomic.h>
 #include <mercury_macros.h>
+#include <abt.h>
 
 #define BBOX_MAX_NDIM 10
+/* Number of bins of the object index, versions are hashed modulo it.
+   Without retention rules a put evicts older versions of its bin. */
 #define MAX_VERSIONS 10
 
+/* Longest name of a field of a multi-field object, with the NUL. */
+#define FIELD_NAME_LEN 32
+
 typedef struct {
 	void			*iov_base;
 	size_t			iov_len;
@@ -29,6 +36,10 @@ typedef struct {
 
 enum storage_type {row_major, column_major};
 
+/* Payload of an object: a dense array of its bounding box, or a list of
+   points within it (see points.h). */
+enum obj_kind {OBJ_DENSE, OBJ_POINTS};
+
 typedef struct{
         char                    name[154];
 
@@ -42,28 +53,117 @@ typedef struct{
 
         /* Size of one element of a data object. */
         size_t                  size;
+
+        /* Number of named fields of a multi-field object, stored one
+           after the other, each as an array of the whole box; 0 for
+           plain objects. The names are in the obj_data. */
+        uint32_t                num_fields;
+
+        enum obj_kind           kind;
+        /* Number of points of a point object; for a point get, the
+           most points the client can receive. */
+        uint64_t                num_points;
+
+        /* Refinement level of an AMR patch, 0 the coarsest. The box is
+           in the index space of the level; only objects of the same
+           level match. */
+        uint32_t                level;
+        /* For a get, refinement ratio between successive levels: parts
+           of the box that 'level' does not cover are filled from the
+           finest coarser level that does. 0 to get 'level' only. */
+        uint32_t                refine;
 } obj_descriptor;
 
 
+struct comp_hdr;
+struct point_index;
+struct ss_storage;
+
+/* Pages of object payloads, same values as enum ndstore_pages. */
+enum obj_pages {
+        OBJ_PAGES_DEFAULT = 0,
+        OBJ_PAGES_THP,
+        OBJ_PAGES_2M,
+        OBJ_PAGES_1G
+};
+
 struct obj_data {
         struct list_head        obj_entry;
 
         obj_descriptor   obj_desc;
         void                    *data;		/* Aligned pointer */
 
+        /* Compressed payload; when set, 'data' is NULL and readers
+           decompress the chunks they need (see compress.h). */
+        struct comp_hdr         *comp;
+
+        /* Names of the obj_desc.num_fields fields, FIELD_NAME_LEN
+           bytes each; NULL for plain objects. */
+        char                    (*fields)[FIELD_NAME_LEN];
+
+        /* Spatial index of the points of a point object. */
+        struct point_index      *pidx;
+
+        /* Previous version this object is stored as a delta against:
+           'comp' then holds the XOR of the two payloads, and readers
+           rebuild the data from the chain of bases. The object holds a
+           reference on its base, which may be evicted meanwhile.
+           delta_depth is the length of the chain, 0 for full objects. */
+        struct obj_data         *delta_base;
+        uint32_t                delta_depth;
+
+        /* Storage whose byte count includes the payload, and how many
+           holders keep it there: the bins while the object is indexed,
+           plus every delta stored against it (see ls_remove()). */
+        struct ss_storage       *acct;
+        hg_atomic_int32_t       acct_refs;
+
         /* Reference to the parent object; used only for sub-objects. */
         struct obj_data         *obj_ref;
 
-        /* Count how many references are to this data object. */
-        int                     refcnt;
+        /* Count how many references are to this data object. The
+           storage index holds one, and every reader that pinned the
+           object through ls_find_ods() holds one until it is done. */
+        hg_atomic_int32_t       refcnt;
+
+        /* Time the data was put, carried over by ls_swap(). */
+        double                  t_put;
 
-        /* Flag to mark if we should free this data object. */
+        /* NUMA node the payload is bound to, -1 if none. */
+        int                     numa_node;
+
+        /* Length of the mapping that holds the payload when it has
+           pages of its own (see obj_data_alloc_node()), 0 if it comes
+           from malloc(). Release it with obj_data_free_data(). */
+        uint64_t                map_size;
+
+        /* Flag to mark the object as evicted from the storage; the
+           memory is reclaimed when the last reference is dropped. */
         unsigned int            f_free:1;
 };
 
-typedef struct {
+struct ls_drop {
+        struct list_head        entry;
+        char                    name[154];
+        unsigned int            version;
+};
+
+typedef struct ss_storage {
         int                     num_obj;
+        /* Payload bytes held by the objects in the bins. */
+        uint64_t                num_bytes;
+        /* Payload bytes of objects gone from the bins that deltas
+           still depend on; see ls_bytes(). */
+        hg_atomic_int64_t       held_bytes;
         int                     size_hash;
+        /* Protects the hash bins; held only while walking or updating
+           the lists, never while copying object data. */
+        ABT_rwlock              lock;
+        /* Newest version of each variable that had pieces evicted or
+           collected, see ls_dropped(); drops_lost if one could not be
+           recorded. */
+        struct list_head        drops;
+        int                     drops_lost;
         /* List of data objects. */
         struct list_head        obj_hash[1];
 } ss_storage;
@@ -108,28 +208,118 @@ static inline hg_return_t hg_proc_odsc_hdr(hg_proc_t proc, void *arg)
 
 
 
+/* comp_codec/comp_size negotiate compressed transfers: on a put the
+   bulk holds a compressed payload of comp_size bytes, on a get the
+   client accepts a reply compressed with comp_codec. 'fields' holds
+   the names of the odsc.num_fields fields put or got, FIELD_NAME_LEN
+   bytes each. */
+/* seq numbers the updates a provider forwards to its replicas, origin
+   tells the providers apart: seq is the number of a forwarded put, and
+   for a get sent to a replica the last update the client saw from the
+   provider 'origin', 0 if none. */
 MERCURY_GEN_PROC(bulk_in_t,
         ((odsc_hdr)(odsc))\
+        ((hg_bulk_t)(handle))\
+        ((uint32_t)(comp_codec))\
+        ((uint64_t)(comp_size))\
+        ((odsc_hdr)(fields))\
+        ((uint64_t)(origin))\
+        ((uint64_t)(seq)))
+/* srv_time is the handler time in ns, for client side tracing.
+   comp_size is the size of a compressed get reply, 0 if raw. seq is
+   the number of the last update of the provider 'origin' the reply
+   reflects. */
+MERCURY_GEN_PROC(bulk_out_t,
+        ((int32_t)(ret))\
+        ((uint64_t)(srv_time))\
+        ((uint64_t)(comp_size))\
+        ((uint64_t)(origin))\
+        ((uint64_t)(seq)))
+
+/* Piece of a client-pull get: the elements of the box odsc.bb start
+   at 'offset' in the bulk handle of the reply. */
+struct piece_desc {
+        obj_descriptor          odsc;
+        uint64_t                offset;
+};
+
+/* 'pieces' is an array of struct piece_desc, readable through 'handle'
+   until the client releases 'lease'. */
+MERCURY_GEN_PROC(pieces_out_t,
+        ((int32_t)(ret))\
+        ((uint64_t)(srv_time))\
+        ((uint64_t)(lease))\
+        ((odsc_hdr)(pieces))\
+        ((hg_bulk_t)(handle)))
+
+MERCURY_GEN_PROC(lease_in_t,
+        ((uint64_t)(lease)))
+
+/* num_points is the number of points found in the box of a point get,
+   even when more than the client can receive. */
+MERCURY_GEN_PROC(points_out_t,
+        ((int32_t)(ret))\
+        ((uint64_t)(srv_time))\
+        ((uint64_t)(num_points)))
+
+/* odsc carries the name, the first version and the box to delete (all
+   of it if bb.num_dims is 0); ver_hi is the last version. origin and
+   seq number a delete forwarded to a replica, see bulk_in_t. */
+MERCURY_GEN_PROC(delete_in_t,
+        ((odsc_hdr)(odsc))\
+        ((uint32_t)(ver_hi))\
+        ((uint64_t)(origin))\
+        ((uint64_t)(seq)))
+
+/* odsc carries the name, the first version and the box of a time
+   series get; ver_hi is the last version. The boxes of all versions
+   are pushed back to back through 'handle', in version order. */
+MERCURY_GEN_PROC(versions_in_t,
+        ((odsc_hdr)(odsc))\
+        ((uint32_t)(ver_hi))\
         ((hg_bulk_t)(handle)))
-MERCURY_GEN_PROC(bulk_out_t, ((int32_t)(ret)))
 
 char * obj_desc_sprint(obj_descriptor *);
 int ssd_copy(struct obj_data *, struct obj_data *);
+int ssd_composite(struct obj_data *, struct obj_data **, int);
+uint64_t ssd_level_factor(uint32_t ratio, uint32_t level, uint32_t from);
+int ssd_delta_encode(struct obj_data *, struct obj_data *,
+                const struct ndstore_var_policy *);
+
+/* most pieces left of a piece cut by a box */
+#define LS_CUT_MAX      (2 * BBOX_MAX_NDIM)
 
 ss_storage *ls_alloc(int max_versions);
 void ls_free(ss_storage *);
 void ls_add_obj(ss_storage *, struct obj_data *);
+void ls_add_obj_version(ss_storage *, struct obj_data *);
+int ls_delete(ss_storage *, const char *name, unsigned int ver_lo,
+                unsigned int ver_hi, const struct bbox *);
 struct obj_data* ls_lookup(ss_storage *, char *);
-void ls_remove(ss_storage *, struct obj_data *);
+uint64_t ls_remove(ss_storage *, struct obj_data *);
+uint64_t ls_bytes(ss_storage *);
+uint64_t ls_drop(ss_storage *, struct obj_data *);
+int ls_dropped(ss_storage *, obj_descriptor *);
 void ls_try_remove_free(ss_storage *, struct obj_data *);
-int ls_find_ods(ss_storage *, obj_descriptor *, struct obj_data **);
+int ls_replace(ss_storage *, struct obj_data *, struct obj_data *);
+int ls_swap(ss_storage *, struct obj_data **, int, struct obj_data **, int);
+int ls_find_ods(ss_storage *, obj_descriptor *, struct obj_data ***);
+int ls_find_levels(ss_storage *, obj_descriptor *, struct obj_data ***);
 struct obj_data * ls_find_no_version(ss_storage *, obj_descriptor *);
 
 struct obj_data *obj_data_alloc(obj_descriptor *);
 struct obj_data *obj_data_alloc_with_data(obj_descriptor *, const void *);
-
+struct obj_data *obj_data_alloc_no_data(obj_descriptor *, void *);
+struct obj_data *obj_data_alloc_node(obj_descriptor *, int node, int pages);
+void obj_data_free_data(struct obj_data *od);
+int obj_data_set_fields(struct obj_data *od, const char *names);
+int obj_data_field(struct obj_data *od, const char *name);
+
+void obj_data_ref(struct obj_data *od);
+void obj_data_unref(struct obj_data *od);
 void obj_data_free(struct obj_data *od);
 uint64_t obj_data_size(obj_descriptor *);
+uint64_t obj_data_stored_size(struct obj_data *);
 
 int obj_desc_equals(obj_descriptor *, obj_descriptor *);
 int obj_desc_equals_no_owner(obj_descriptor *, obj_descriptor *);
@@ -0,0 +1,67 @@
+/*
+ * Copyright (c) 2020, Rutgers Discovery Informatics Institute, Rutgers University
+ *
+ * See COPYRIGHT in top-level directory.
+ */
+
+#ifndef __STATS_H_
+#define __STATS_H_
+
+#include <string.h>
+#include <abt.h>
+#include <mercury_atomic.h>
+#include "ndstore-stats.h"
+
+/* Counters of one RPC, updated with atomics by the handler ULTs. */
+struct stats_op_rec {
+        hg_atomic_int64_t       count;
+        hg_atomic_int64_t       errors;
+        hg_atomic_int64_t       bytes_in;
+        hg_atomic_int64_t       bytes_out;
+        hg_atomic_int64_t       time_ns[NDSTORE_STATS_NUM_PHASES];
+        hg_atomic_int64_t       hist[NDSTORE_STATS_NUM_PHASES][NDSTORE_STATS_HIST_BUCKETS];
+};
+
+struct stats_rec {
+        double                  start_time;
+        struct stats_op_rec     ops[NDSTORE_STATS_NUM_OPS];
+        hg_atomic_int64_t       gc_versions;
+        hg_atomic_int64_t       gc_bytes;
+};
+
+/* Per-call phase timer, kept on the stack of the handler ULT. */
+struct stats_timer {
+        double                  start;
+        double                  last;
+        double                  phase[NDSTORE_STATS_NUM_PHASES];
+};
+
+static inline void stats_timer_start(struct stats_timer *t)
+{
+        memset(t, 0, sizeof(*t));
+        t->start = t->last = ABT_get_wtime();
+}
+
+/* Charge the time elapsed since the previous mark to 'phase'. */
+static inline void stats_timer_mark(struct stats_timer *t, int phase)
+{
+        double now = ABT_get_wtime();
+
+        t->phase[phase] += now - t->last;
+        t->last = now;
+}
+
+/* Time spent in the handler so far, reported back to the client. */
+static inline uint64_t stats_timer_elapsed_ns(struct stats_timer *t)
+{
+        return (uint64_t)((ABT_get_wtime() - t->start) * 1e9);
+}
+
+const char *stats_op_name(int op);
+void stats_init(struct stats_rec *);
+void stats_record(struct stats_rec *, int op, struct stats_timer *,
+                uint64_t bytes_in, uint64_t bytes_out, int err);
+void stats_record_gc(struct stats_rec *, uint64_t versions, uint64_t bytes);
+void stats_snapshot(struct stats_rec *, struct ndstore_stats *);
+
+#endif /* __STATS_H_ */
@@ -0,0 +1,63 @@
+/*
+ * Copyright (c) 2020, Rutgers Discovery Informatics Institute, Rutgers University
+ *
+ * See COPYRIGHT in top-level directory.
+ */
+
+#ifndef __TRACE_H_
+#define __TRACE_H_
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <abt.h>
+#include <mercury_atomic.h>
+
+/* One traced client call. Timestamps are ABT_get_wtime() seconds. */
+struct trace_event {
+        /* 0 while the slot is being written, else ring index + 1. */
+        hg_atomic_int64_t       seq;
+        int                     op;
+        /* Execution stream the call was issued from. */
+        int                     tid;
+        char                    name[64];
+        unsigned int            version;
+        uint64_t                bytes;
+        int32_t                 ret;
+        double                  t_start;        /* call entered */
+        double                  t_reg;          /* bulk handle registered */
+        double                  t_sent;         /* request handed to mercury */
+        double                  t_reply;        /* response received */
+        double                  t_end;          /* call returns */
+        /* Handler time reported by the server in bulk_out_t. */
+        uint64_t                server_ns;
+};
+
+/*
+  Fixed size ring of trace events. Writers claim slots with an atomic
+  increment and never block; the oldest events are overwritten.
+*/
+struct trace_ring {
+        uint64_t                capacity;
+        hg_atomic_int64_t       head;
+        struct trace_event      *ev;
+};
+
+static inline void trace_event_init(struct trace_event *ev, int op,
+                const char *name, unsigned int version, uint64_t bytes)
+{
+        memset(ev, 0, sizeof(*ev));
+        ev->op = op;
+        strncpy(ev->name, name, sizeof(ev->name)-1);
+        ev->version = version;
+        ev->bytes = bytes;
+        ABT_xstream_self_rank(&ev->tid);
+        ev->t_start = ABT_get_wtime();
+}
+
+struct trace_ring *trace_ring_alloc(uint64_t capacity);
+void trace_ring_free(struct trace_ring *);
+void trace_ring_push(struct trace_ring *, const struct trace_event *);
+int trace_ring_dump_chrome(struct trace_ring *, FILE *);
+
+#endif /* __TRACE_H_ */
@@ -125,6 +125,49 @@ int bbox_does_intersect(const struct bbox *b0, const struct bbox *b1)
     //return 0;
 }
 
+/*
+  Test if bounding box b0 is included in b1 (on all dimensions).
+*/
+int bbox_include(const struct bbox *b0, const struct bbox *b1)
+{
+    int i;
+
+    for(i = 0; i < b0->num_dims; i++){
+        if(b0->lb.c[i] < b1->lb.c[i] || b0->ub.c[i] > b1->ub.c[i])
+            return 0;
+    }
+    return 1;
+}
+
+/*
+  Split the part of b0 that lies outside of b1 in disjoint boxes, at
+  most two per dimension, and store them in 'out'. Returns the number
+  of boxes.
+*/
+int bbox_subtract(const struct bbox *b0, const struct bbox *b1, struct bbox *out)
+{
+        struct bbox rest = *b0;
+        int i, n = 0;
+
+        if (!bbox_does_intersect(b0, b1)) {
+                out[0] = *b0;
+                return 1;
+        }
+        for (i = 0; i < b0->num_dims; i++) {
+                if (rest.lb.c[i] < b1->lb.c[i]) {
+                        out[n] = rest;
+                        out[n++].ub.c[i] = b1->lb.c[i] - 1;
+                        rest.lb.c[i] = b1->lb.c[i];
+                }
+                if (rest.ub.c[i] > b1->ub.c[i]) {
+                        out[n] = rest;
+                        out[n++].lb.c[i] = b1->ub.c[i] + 1;
+                        rest.ub.c[i] = b1->ub.c[i];
+                }
+        }
+        return n;
+}
+
 /*
   Compute the intersection of bounding boxes b0 and b1, and store it on
   b2. Implicit assumption: b0 and b1 intersect.
@@ -0,0 +1,247 @@
+/*
+ * Copyright (c) 2020, Rutgers Discovery Informatics Institute, Rutgers University
+ *
+ * See COPYRIGHT in top-level directory.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "cache.h"
+
+struct cache *cache_alloc(uint64_t capacity)
+{
+        struct cache *c;
+
+        if (!capacity)
+                return NULL;
+
+        c = calloc(1, sizeof(*c));
+        if (!c)
+                return NULL;
+        if (ABT_mutex_create(&c->lock) != ABT_SUCCESS) {
+                free(c);
+                return NULL;
+        }
+        c->capacity = capacity;
+        INIT_LIST_HEAD(&c->lru);
+
+        return c;
+}
+
+static void cache_remove(struct cache *c, struct cache_entry *ce)
+{
+        list_del(&ce->entry);
+        c->size -= obj_data_size(&ce->od->obj_desc);
+        obj_data_unref(ce->od);
+        free(ce);
+}
+
+void cache_free(struct cache *c)
+{
+        struct cache_entry *ce, *t;
+
+        if (!c)
+                return;
+        list_for_each_entry_safe(ce, t, &c->lru, struct cache_entry, entry)
+                cache_remove(c, ce);
+        ABT_mutex_free(&c->lock);
+        free(c);
+}
+
+static int cache_match(struct cache_entry *ce, const void *key,
+                obj_descriptor *odsc)
+{
+        obj_descriptor *e = &ce->od->obj_desc;
+
+        return ce->key == key && e->version == odsc->version &&
+                e->level == odsc->level && e->size == odsc->size &&
+                strcmp(e->name, odsc->name) == 0 &&
+                bbox_does_intersect(&e->bb, &odsc->bb);
+}
+
+/*
+  Copy the parts of 'od' held by the cache into it, and store the boxes
+  left to fetch in 'missing'. Returns their number, or -1 if they would
+  be more than CACHE_MAX_MISSING. 'gen' is to be passed to
+  cache_insert() with the boxes fetched. Entries are copied with the
+  lock held, so that an invalidation cannot free them meanwhile.
+*/
+int cache_lookup(struct cache *c, const void *key, struct obj_data *od,
+                struct bbox *missing, uint64_t *gen)
+{
+        struct cache_entry *ce, *t;
+        struct list_head hits;
+        struct bbox *cur, *next, *swap;
+        int i, n = 1, nn, max = CACHE_MAX_MISSING + 2 * BBOX_MAX_NDIM;
+
+        cur = malloc(sizeof(*cur) * max);
+        next = malloc(sizeof(*next) * max);
+        if (!cur || !next) {
+                free(cur);
+                free(next);
+                *gen = 0;
+                return -1;
+        }
+        cur[0] = od->obj_desc.bb;
+        INIT_LIST_HEAD(&hits);
+
+        ABT_mutex_lock(c->lock);
+        *gen = c->gen;
+        list_for_each_entry_safe(ce, t, &c->lru, struct cache_entry, entry) {
+                if (n == 0)
+                        break;
+                if (!cache_match(ce, key, &od->obj_desc))
+                        continue;
+                ssd_copy(od, ce->od);
+                list_del(&ce->entry);
+                list_add(&ce->entry, &hits);
+
+                for (i = 0, nn = 0; i < n && nn + 2 * BBOX_MAX_NDIM <= max; i++)
+                        nn += bbox_subtract(&cur[i], &ce->od->obj_desc.bb,
+                                        next + nn);
+                if (i < n || nn > CACHE_MAX_MISSING) {
+                        n = -1;
+                        break;
+                }
+                swap = cur;
+                cur = next;
+                next = swap;
+                n = nn;
+        }
+        list_for_each_entry_safe(ce, t, &hits, struct cache_entry, entry) {
+                list_del(&ce->entry);
+                list_add(&ce->entry, &c->lru);
+        }
+        ABT_mutex_unlock(c->lock);
+
+        if (n > 0)
+                memcpy(missing, cur, sizeof(*cur) * n);
+        free(cur);
+        free(next);
+
+        return n;
+}
+
+/*
+  Find the entry of exactly the box of 'odsc', pinned: the caller must
+  obj_data_unref() it. 'gen' is set as by cache_lookup().
+*/
+struct obj_data *cache_find(struct cache *c, const void *key,
+                obj_descriptor *odsc, uint64_t *gen)
+{
+        struct cache_entry *ce;
+        struct obj_data *od = NULL;
+
+        ABT_mutex_lock(c->lock);
+        *gen = c->gen;
+        list_for_each_entry(ce, &c->lru, struct cache_entry, entry) {
+                if (cache_match(ce, key, odsc) &&
+                    ce->od->obj_desc.refine == odsc->refine &&
+                    bbox_equals(&ce->od->obj_desc.bb, &odsc->bb)) {
+                        od = ce->od;
+                        obj_data_ref(od);
+                        list_del(&ce->entry);
+                        list_add(&ce->entry, &c->lru);
+                        break;
+                }
+        }
+        ABT_mutex_unlock(c->lock);
+
+        return od;
+}
+
+/*
+  Hand a box fetched from the provider 'key' over to the cache, which
+  drops it right away if it was invalidated since 'gen' was read or
+  does not fit. The cache takes over the caller's reference.
+*/
+void cache_insert(struct cache *c, const void *key, struct obj_data *od,
+                uint64_t gen)
+{
+        uint64_t size = obj_data_size(&od->obj_desc);
+        struct cache_entry *ce;
+
+        ce = malloc(sizeof(*ce));
+        if (!ce || size > c->capacity) {
+                free(ce);
+                obj_data_unref(od);
+                return;
+        }
+        ce->key = key;
+        ce->od = od;
+
+        ABT_mutex_lock(c->lock);
+        if (gen != c->gen) {
+                ABT_mutex_unlock(c->lock);
+                free(ce);
+                obj_data_unref(od);
+                return;
+        }
+        while (c->size + size > c->capacity)
+                cache_remove(c, list_entry(c->lru.prev,
+                                        struct cache_entry, entry));
+        list_add(&ce->entry, &c->lru);
+        c->size += size;
+        ABT_mutex_unlock(c->lock);
+}
+
+/*
+  Whether the entry 'e' holds data of the box odsc->bb. A composite of
+  refinement levels holds the data of the coarser levels, scaled to its
+  own index space.
+*/
+static int cache_overlaps(obj_descriptor *e, obj_descriptor *odsc)
+{
+        struct bbox bb = e->bb;
+        uint64_t f;
+        int d;
+
+        if (!odsc->bb.num_dims)
+                return 1;
+        if (e->refine && e->level > odsc->level) {
+                f = ssd_level_factor(e->refine, e->level, odsc->level);
+                if (!f)
+                        return 1;
+                for (d = 0; d < bb.num_dims; d++) {
+                        bb.lb.c[d] /= f;
+                        bb.ub.c[d] /= f;
+                }
+        }
+        return bbox_does_intersect(&bb, &odsc->bb);
+}
+
+/*
+  Drop the entries of the variable odsc->name with a version from
+  odsc->version to ver_hi that hold data of odsc->bb (all of them if
+  bb.num_dims is 0).
+*/
+void cache_invalidate(struct cache *c, obj_descriptor *odsc, uint32_t ver_hi)
+{
+        struct cache_entry *ce, *t;
+        obj_descriptor *e;
+
+        ABT_mutex_lock(c->lock);
+        c->gen++;
+        list_for_each_entry_safe(ce, t, &c->lru, struct cache_entry, entry) {
+                e = &ce->od->obj_desc;
+                if (e->version < odsc->version || e->version > ver_hi ||
+                    strcmp(e->name, odsc->name) != 0)
+                        continue;
+                if (!cache_overlaps(e, odsc))
+                        continue;
+                cache_remove(c, ce);
+        }
+        ABT_mutex_unlock(c->lock);
+}
+
+/* Drop the entries read from the provider 'key'. */
+void cache_drop_key(struct cache *c, const void *key)
+{
+        struct cache_entry *ce, *t;
+
+        ABT_mutex_lock(c->lock);
+        list_for_each_entry_safe(ce, t, &c->lru, struct cache_entry, entry)
+                if (ce->key == key)
+                        cache_remove(c, ce);
+        ABT_mutex_unlock(c->lock);
+}
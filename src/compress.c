@@ -0,0 +1,611 @@
+/*
+ * Copyright (c) 2020, Rutgers Discovery Informatics Institute, Rutgers University
+ *
+ * See COPYRIGHT in top-level directory.
+ */
+
+#include <errno.h>
+#include <math.h>
+#include "compress.h"
+#include "ndstore-common.h"
+
+#ifdef NDSTORE_HAVE_LZ4
+#include <lz4.h>
+#endif
+#ifdef NDSTORE_HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+#define COMP_DEFAULT_CHUNK_SIZE (64 * 1024)
+
+int ndstore_codec_available(int codec)
+{
+        switch (codec) {
+        case NDSTORE_CODEC_NONE:
+        case NDSTORE_CODEC_QUANT:
+                return 1;
+#ifdef NDSTORE_HAVE_LZ4
+        case NDSTORE_CODEC_LZ4:
+                return 1;
+#endif
+#ifdef NDSTORE_HAVE_ZSTD
+        case NDSTORE_CODEC_ZSTD:
+                return 1;
+#endif
+        default:
+                return 0;
+        }
+}
+
+static uint64_t codec_bound(int codec, uint64_t n)
+{
+        switch (codec) {
+#ifdef NDSTORE_HAVE_LZ4
+        case NDSTORE_CODEC_LZ4:
+                return LZ4_compressBound((int)n);
+#endif
+#ifdef NDSTORE_HAVE_ZSTD
+        case NDSTORE_CODEC_ZSTD:
+                return ZSTD_compressBound(n);
+#endif
+        default:
+                return 0;
+        }
+}
+
+/* Returns the compressed size, 0 on failure. */
+static uint64_t codec_compress(int codec, int level, const void *src,
+                uint64_t n, void *dst, uint64_t cap)
+{
+        switch (codec) {
+#ifdef NDSTORE_HAVE_LZ4
+        case NDSTORE_CODEC_LZ4: {
+                int r;
+
+                if (level > 1)
+                        r = LZ4_compress_fast(src, dst, (int)n, (int)cap, level);
+                else
+                        r = LZ4_compress_default(src, dst, (int)n, (int)cap);
+                return r > 0 ? (uint64_t)r : 0;
+        }
+#endif
+#ifdef NDSTORE_HAVE_ZSTD
+        case NDSTORE_CODEC_ZSTD: {
+                size_t r = ZSTD_compress(dst, cap, src, n, level ? level : 1);
+
+                return ZSTD_isError(r) ? 0 : r;
+        }
+#endif
+        default:
+                return 0;
+        }
+}
+
+/* Returns the decompressed size, -1 on failure. */
+static int64_t codec_decompress(int codec, const void *src, uint64_t n,
+                void *dst, uint64_t cap)
+{
+        switch (codec) {
+#ifdef NDSTORE_HAVE_LZ4
+        case NDSTORE_CODEC_LZ4: {
+                int r = LZ4_decompress_safe(src, dst, (int)n, (int)cap);
+
+                return r < 0 ? -1 : r;
+        }
+#endif
+#ifdef NDSTORE_HAVE_ZSTD
+        case NDSTORE_CODEC_ZSTD: {
+                size_t r = ZSTD_decompress(dst, cap, src, n);
+
+                return ZSTD_isError(r) ? -1 : (int64_t)r;
+        }
+#endif
+        default:
+                return -1;
+        }
+}
+
+/*
+  Byte transposition of 'n' elements of 'es' bytes: all first bytes,
+  then all second bytes, and so on.
+*/
+static void byte_shuffle(const char *src, char *dst, uint64_t n, size_t es)
+{
+        uint64_t i;
+        size_t b;
+
+        for (b = 0; b < es; b++)
+                for (i = 0; i < n; i++)
+                        dst[b * n + i] = src[i * es + b];
+}
+
+static void byte_unshuffle(const char *src, char *dst, uint64_t n, size_t es)
+{
+        uint64_t i;
+        size_t b;
+
+        for (b = 0; b < es; b++)
+                for (i = 0; i < n; i++)
+                        dst[i * es + b] = src[b * n + i];
+}
+
+/*
+  Error-bounded quantization. Each value is predicted by the previous
+  reconstructed value and the residual is quantized in steps of twice
+  the error bound. Codes are written as zigzag varints shifted by one;
+  a 0 byte escapes a value that is stored verbatim (non finite, too far
+  from the prediction, or not within the bound after rounding).
+*/
+#define QUANT_MAX_CODE  (1 << 30)
+
+static uint64_t quant_stream_bound(uint64_t n, size_t es)
+{
+        /* a 5 byte varint never exceeds an escaped float */
+        return n * (es + 1);
+}
+
+/* Lossless codec applied to the quantization codes. */
+static int quant_backend(void)
+{
+#if defined(NDSTORE_HAVE_ZSTD)
+        return NDSTORE_CODEC_ZSTD;
+#elif defined(NDSTORE_HAVE_LZ4)
+        return NDSTORE_CODEC_LZ4;
+#else
+        return NDSTORE_CODEC_NONE;
+#endif
+}
+
+/* Shared by encoder and decoder so that both round the same way. */
+static double quant_recon(double pred, double eb, int64_t q, size_t es)
+{
+        double x = pred + 2 * eb * (double)q;
+
+        return es == 4 ? (double)(float)x : x;
+}
+
+static uint64_t quant_encode(const char *src, uint64_t n, size_t es,
+                double eb, uint8_t *out)
+{
+        uint8_t *p = out;
+        double pred = 0, x, t, recon;
+        uint64_t i, v;
+        int64_t q;
+
+        for (i = 0; i < n; i++) {
+                x = es == 4 ? ((const float *)src)[i] : ((const double *)src)[i];
+                if (isfinite(x) && eb > 0) {
+                        t = (x - pred) / (2 * eb);
+                        if (fabs(t) < QUANT_MAX_CODE) {
+                                q = llround(t);
+                                recon = quant_recon(pred, eb, q, es);
+                                if (fabs(x - recon) <= eb) {
+                                        v = ((uint64_t)q << 1) ^ (uint64_t)(q >> 63);
+                                        v++;
+                                        while (v >= 0x80) {
+                                                *p++ = (uint8_t)(v | 0x80);
+                                                v >>= 7;
+                                        }
+                                        *p++ = (uint8_t)v;
+                                        pred = recon;
+                                        continue;
+                                }
+                        }
+                }
+                *p++ = 0;
+                memcpy(p, src + i * es, es);
+                p += es;
+                if (isfinite(x))
+                        pred = x;
+        }
+
+        return p - out;
+}
+
+static int quant_decode(const uint8_t *p, uint64_t len, uint64_t n,
+                size_t es, double eb, char *out)
+{
+        const uint8_t *end = p + len;
+        double pred = 0, x;
+        uint64_t i, v;
+        int64_t q;
+        int shift;
+
+        for (i = 0; i < n; i++) {
+                if (p >= end)
+                        return -1;
+                if (*p == 0) {
+                        if (end - p < (ptrdiff_t)(es + 1))
+                                return -1;
+                        memcpy(out + i * es, p + 1, es);
+                        p += es + 1;
+                        x = es == 4 ? ((float *)out)[i] : ((double *)out)[i];
+                        if (isfinite(x))
+                                pred = x;
+                        continue;
+                }
+                v = 0;
+                shift = 0;
+                do {
+                        if (p >= end || shift > 35)
+                                return -1;
+                        v |= (uint64_t)(*p & 0x7f) << shift;
+                        shift += 7;
+                } while (*p++ & 0x80);
+                v--;
+                q = (int64_t)(v >> 1) ^ -(int64_t)(v & 1);
+                x = quant_recon(pred, eb, q, es);
+                if (es == 4)
+                        ((float *)out)[i] = (float)x;
+                else
+                        ((double *)out)[i] = x;
+                pred = x;
+        }
+
+        return p == end ? 0 : -1;
+}
+
+static uint64_t quant_chunk_encode(const struct comp_hdr *h, int level,
+                const char *src, uint64_t n, size_t es, char *tmp,
+                char *dst, uint64_t cap)
+{
+        int backend = quant_backend();
+        uint64_t slen, clen = 0;
+
+        slen = quant_encode(src, n, es, h->error_bound, (uint8_t *)tmp);
+        if (backend != NDSTORE_CODEC_NONE)
+                clen = codec_compress(backend, level, tmp, slen, dst + 1, cap - 1);
+        if (clen == 0 || clen >= slen) {
+                backend = NDSTORE_CODEC_NONE;
+                memcpy(dst + 1, tmp, slen);
+                clen = slen;
+        }
+        dst[0] = (char)backend;
+
+        return clen + 1;
+}
+
+static int quant_chunk_decode(const struct comp_hdr *h, const char *src,
+                uint64_t len, uint64_t n, size_t es, void *out)
+{
+        uint64_t sb = quant_stream_bound(n, es);
+        int64_t slen;
+        char *tmp;
+        int ret;
+
+        if (len < 1)
+                return -1;
+        if (src[0] == NDSTORE_CODEC_NONE)
+                return quant_decode((const uint8_t *)src + 1, len - 1, n, es,
+                                h->error_bound, out);
+
+        tmp = malloc(sb);
+        if (!tmp)
+                return -ENOMEM;
+        slen = codec_decompress(src[0], src + 1, len - 1, tmp, sb);
+        ret = slen < 0 ? -1 : quant_decode((uint8_t *)tmp, slen, n, es,
+                                h->error_bound, out);
+        free(tmp);
+
+        return ret;
+}
+
+/* Absolute error bound of a lossy policy for the values in 'data'. */
+static double quant_error_bound(const struct ndstore_var_policy *policy,
+                const char *data, uint64_t n, size_t es)
+{
+        double x, lo = INFINITY, hi = -INFINITY;
+        uint64_t i;
+
+        if (policy->error_mode != NDSTORE_BOUND_REL)
+                return policy->error_bound;
+
+        for (i = 0; i < n; i++) {
+                x = es == 4 ? ((const float *)data)[i] : ((const double *)data)[i];
+                if (!isfinite(x))
+                        continue;
+                if (x < lo)
+                        lo = x;
+                if (x > hi)
+                        hi = x;
+        }
+
+        return hi > lo ? policy->error_bound * (hi - lo) : 0;
+}
+
+/* Worst-case compressed size of a chunk of 'len' raw bytes. */
+static uint64_t chunk_bound(const struct comp_hdr *h, uint64_t len, size_t es)
+{
+        uint64_t sb, cb;
+
+        if (h->codec != NDSTORE_CODEC_QUANT)
+                return codec_bound(h->codec, len);
+
+        sb = quant_stream_bound(len / es, es);
+        cb = codec_bound(quant_backend(), sb);
+        return 1 + (cb > sb ? cb : sb);
+}
+
+/* Elements spanned by the dimensions below split_dim. */
+static uint64_t comp_plane(const struct comp_hdr *h, const struct bbox *bb)
+{
+        uint64_t n = 1;
+        int i;
+
+        for (i = 0; i < h->split_dim; i++)
+                n *= bbox_dist((struct bbox *)bb, i);
+        return n;
+}
+
+static uint64_t comp_pieces(const struct comp_hdr *h, const struct bbox *bb)
+{
+        uint64_t d = bbox_dist((struct bbox *)bb, h->split_dim);
+
+        return (d + h->run - 1) / h->run;
+}
+
+/*
+  Choose the chunk layout for an array: grow the contiguous plane one
+  dimension at a time while it fits in the target size, then split the
+  next dimension in runs.
+*/
+static void comp_layout(struct comp_hdr *h, obj_descriptor *odsc, uint64_t chunk_size)
+{
+        struct bbox *bb = &odsc->bb;
+        uint64_t target, plane = 1, rows = 1;
+        int k = 0, i;
+
+        target = chunk_size / odsc->size;
+        if (target == 0)
+                target = 1;
+        while (k < bb->num_dims - 1 && plane * bbox_dist(bb, k) <= target) {
+                plane *= bbox_dist(bb, k);
+                k++;
+        }
+        h->split_dim = k;
+        h->run = target / plane;
+        if (h->run == 0)
+                h->run = 1;
+        if (h->run > bbox_dist(bb, k))
+                h->run = bbox_dist(bb, k);
+        for (i = k + 1; i < bb->num_dims; i++)
+                rows *= bbox_dist(bb, i);
+        h->num_chunks = comp_pieces(h, bb) * rows;
+}
+
+void comp_chunk_bbox(const struct comp_hdr *h, const struct bbox *bb,
+                uint32_t i, struct bbox *out)
+{
+        uint64_t pieces = comp_pieces(h, bb);
+        uint64_t j = i % pieces, row = i / pieces;
+        int k = h->split_dim, d;
+
+        *out = *bb;
+        out->lb.c[k] = bb->lb.c[k] + j * h->run;
+        out->ub.c[k] = min(out->lb.c[k] + h->run - 1, bb->ub.c[k]);
+        for (d = k + 1; d < bb->num_dims; d++) {
+                uint64_t dist = bbox_dist((struct bbox *)bb, d);
+
+                out->lb.c[d] = out->ub.c[d] = bb->lb.c[d] + row % dist;
+                row /= dist;
+        }
+}
+
+uint64_t comp_chunk_raw_size(const struct comp_hdr *h, obj_descriptor *odsc,
+                uint32_t i)
+{
+        struct bbox cb;
+
+        comp_chunk_bbox(h, &odsc->bb, i, &cb);
+        return bbox_volume(&cb) * odsc->size;
+}
+
+/* Byte offset of chunk 'i' in the uncompressed array. */
+static uint64_t comp_chunk_raw_offset(const struct comp_hdr *h,
+                obj_descriptor *odsc, uint32_t i)
+{
+        struct bbox *bb = &odsc->bb;
+        uint64_t pieces = comp_pieces(h, bb);
+        uint64_t plane = comp_plane(h, bb);
+        uint64_t j = i % pieces, row = i / pieces;
+
+        return (row * bbox_dist(bb, h->split_dim) + j * h->run) * plane * odsc->size;
+}
+
+/*
+  Compress an array according to 'policy'. Returns a newly allocated
+  payload, or NULL if the codec is not available or does not make the
+  array smaller.
+*/
+struct comp_hdr *comp_encode(obj_descriptor *odsc, const void *data,
+                const struct ndstore_var_policy *policy)
+{
+        struct comp_hdr hdr, *h;
+        uint64_t raw_size = obj_data_size(odsc), max_chunk = 0;
+        uint64_t bound, pos, len, tmp_size = 0, *off;
+        char *tmp = NULL, *out;
+        uint32_t i;
+
+        if (policy->codec == NDSTORE_CODEC_NONE ||
+            !ndstore_codec_available(policy->codec) || raw_size == 0)
+                return NULL;
+        if (policy->codec == NDSTORE_CODEC_QUANT &&
+            ((odsc->size != 4 && odsc->size != 8) ||
+             !(policy->error_bound >= 0)))
+                return NULL;
+
+        memset(&hdr, 0, sizeof(hdr));
+        hdr.codec = policy->codec;
+        hdr.shuffle = policy->shuffle && odsc->size > 1 &&
+                      policy->codec != NDSTORE_CODEC_QUANT;
+        hdr.raw_size = raw_size;
+        if (hdr.codec == NDSTORE_CODEC_QUANT)
+                hdr.error_bound = quant_error_bound(policy, data,
+                                raw_size / odsc->size, odsc->size);
+        comp_layout(&hdr, odsc, policy->chunk_size ? policy->chunk_size :
+                                COMP_DEFAULT_CHUNK_SIZE);
+
+        bound = 0;
+        for (i = 0; i < hdr.num_chunks; i++) {
+                len = comp_chunk_raw_size(&hdr, odsc, i);
+                bound += chunk_bound(&hdr, len, odsc->size);
+                if (len > max_chunk)
+                        max_chunk = len;
+        }
+        if (hdr.codec == NDSTORE_CODEC_QUANT)
+                tmp_size = quant_stream_bound(max_chunk / odsc->size, odsc->size);
+        else if (hdr.shuffle)
+                tmp_size = max_chunk;
+
+        pos = sizeof(hdr) + sizeof(uint64_t) * (hdr.num_chunks + 1);
+        h = malloc(pos + bound);
+        if (!h)
+                return NULL;
+        if (tmp_size) {
+                tmp = malloc(tmp_size);
+                if (!tmp) {
+                        free(h);
+                        return NULL;
+                }
+        }
+        *h = hdr;
+        off = comp_offsets(h);
+        out = (char *)h;
+
+        for (i = 0; i < hdr.num_chunks; i++) {
+                const char *src = (const char *)data + comp_chunk_raw_offset(&hdr, odsc, i);
+
+                len = comp_chunk_raw_size(&hdr, odsc, i);
+                off[i] = pos;
+                if (hdr.codec == NDSTORE_CODEC_QUANT) {
+                        len = quant_chunk_encode(&hdr, policy->level, src,
+                                        len / odsc->size, odsc->size, tmp,
+                                        out + pos, chunk_bound(&hdr, len, odsc->size));
+                } else {
+                        if (hdr.shuffle) {
+                                byte_shuffle(src, tmp, len / odsc->size, odsc->size);
+                                src = tmp;
+                        }
+                        len = codec_compress(hdr.codec, policy->level, src, len,
+                                        out + pos, codec_bound(hdr.codec, len));
+                }
+                if (len == 0 || pos + len >= raw_size)
+                        goto fail;
+                pos += len;
+        }
+        off[hdr.num_chunks] = pos;
+        h->total_size = pos;
+        free(tmp);
+
+        /* give back the unused part of the bound */
+        out = realloc(h, pos);
+        return out ? (struct comp_hdr *)out : h;
+
+fail:
+        free(tmp);
+        free(h);
+        return NULL;
+}
+
+/*
+  Whether a payload encoded as 'h' can be stored as is under 'policy',
+  which uses the same codec: always for lossless codecs, and for a
+  lossy one if its error bound is no looser than the policy's for the
+  decoded values in 'data'.
+*/
+int comp_meets_policy(const struct comp_hdr *h, obj_descriptor *odsc,
+                const void *data, const struct ndstore_var_policy *policy)
+{
+        double bound;
+
+        if (h->codec != NDSTORE_CODEC_QUANT)
+                return 1;
+        bound = quant_error_bound(policy, data, h->raw_size / odsc->size,
+                        odsc->size);
+        /* the decoded values are up to the bound off, so their range
+           may be up to twice that narrower than the original one */
+        if (policy->error_mode == NDSTORE_BOUND_REL)
+                bound += 2 * policy->error_bound * h->error_bound;
+        return h->error_bound <= bound;
+}
+
+/*
+  Validate a payload received from a peer against the descriptor of the
+  object it claims to hold.
+*/
+int comp_check(const struct comp_hdr *h, uint64_t size, obj_descriptor *odsc)
+{
+        const uint64_t *off;
+        uint64_t rows = 1;
+        uint32_t i;
+        int d;
+
+        if (size < sizeof(*h) || h->total_size != size ||
+            h->raw_size != obj_data_size(odsc) ||
+            !ndstore_codec_available(h->codec) ||
+            h->split_dim < 0 || h->split_dim >= odsc->bb.num_dims ||
+            h->run == 0 || h->run > bbox_dist(&odsc->bb, h->split_dim))
+                return -EINVAL;
+        if (h->codec == NDSTORE_CODEC_QUANT &&
+            ((odsc->size != 4 && odsc->size != 8) ||
+             !(h->error_bound >= 0) || isinf(h->error_bound)))
+                return -EINVAL;
+
+        for (d = h->split_dim + 1; d < odsc->bb.num_dims; d++)
+                rows *= bbox_dist(&odsc->bb, d);
+        if ((uint64_t)h->num_chunks != comp_pieces(h, &odsc->bb) * rows)
+                return -EINVAL;
+        if (sizeof(*h) + sizeof(uint64_t) * ((uint64_t)h->num_chunks + 1) > size)
+                return -EINVAL;
+
+        off = comp_offsets(h);
+        for (i = 0; i < h->num_chunks; i++)
+                if (off[i] > off[i + 1] || off[i + 1] > size)
+                        return -EINVAL;
+
+        return 0;
+}
+
+int comp_decode_chunk(const struct comp_hdr *h, obj_descriptor *odsc,
+                uint32_t i, void *out)
+{
+        const uint64_t *off = comp_offsets(h);
+        uint64_t len = comp_chunk_raw_size(h, odsc, i);
+        const char *src = (const char *)h + off[i];
+        char *tmp;
+        int ret;
+
+        if (h->codec == NDSTORE_CODEC_QUANT)
+                return quant_chunk_decode(h, src, off[i + 1] - off[i],
+                                len / odsc->size, odsc->size, out);
+
+        if (!h->shuffle)
+                return codec_decompress(h->codec, src, off[i + 1] - off[i],
+                                out, len) == (int64_t)len ? 0 : -1;
+
+        tmp = malloc(len);
+        if (!tmp)
+                return -ENOMEM;
+        ret = codec_decompress(h->codec, src, off[i + 1] - off[i], tmp, len)
+                == (int64_t)len ? 0 : -1;
+        if (ret == 0)
+                byte_unshuffle(tmp, out, len / odsc->size, odsc->size);
+        free(tmp);
+
+        return ret;
+}
+
+/* Decompress the whole array into 'out'. */
+int comp_decode(const struct comp_hdr *h, obj_descriptor *odsc, void *out)
+{
+        uint32_t i;
+        int ret;
+
+        for (i = 0; i < h->num_chunks; i++) {
+                ret = comp_decode_chunk(h, odsc, i,
+                        (char *)out + comp_chunk_raw_offset(h, odsc, i));
+                if (ret != 0)
+                        return ret;
+        }
+        return 0;
+}
@@ -0,0 +1,157 @@
+/*
+ * Copyright (c) 2020, Rutgers Discovery Informatics Institute, Rutgers University
+ *
+ * See COPYRIGHT in top-level directory.
+ */
+
+/*
+  Garbage collection of old versions according to the retention rules
+  of the variable policies. The versions held in storage are listed
+  under the read lock, the ones to drop are chosen without holding any
+  lock, and all their pieces are then freed in a single pass under the
+  write lock. A version put in between is not in the list and is kept
+  until the next run.
+*/
+
+#include <errno.h>
+#include <stdlib.h>
+#include "gc.h"
+
+/* By name, newest version first. */
+static int gc_version_cmp(const void *a, const void *b)
+{
+        const struct gc_version *va = a, *vb = b;
+        int c = strcmp(va->name, vb->name);
+
+        if (c)
+                return c;
+        if (va->version != vb->version)
+                return va->version > vb->version ? -1 : 1;
+        return 0;
+}
+
+/*
+  List the distinct versions in storage, sorted with gc_version_cmp().
+  Returns the number of versions, or -ENOMEM.
+*/
+static int gc_collect(ss_storage *ls, struct gc_version **tab)
+{
+        struct gc_version *v;
+        struct obj_data *od;
+        int i, n = 0, num;
+
+        ABT_rwlock_rdlock(ls->lock);
+        v = malloc(sizeof(*v) * (ls->num_obj + 1));
+        if (!v) {
+                ABT_rwlock_unlock(ls->lock);
+                return -ENOMEM;
+        }
+        for (i = 0; i < ls->size_hash; i++) {
+                list_for_each_entry(od, &ls->obj_hash[i], struct obj_data, obj_entry) {
+                        memcpy(v[n].name, od->obj_desc.name, sizeof(v[n].name));
+                        v[n].version = od->obj_desc.version;
+                        v[n].t_put = od->t_put;
+                        v[n].drop = 0;
+                        n++;
+                }
+        }
+        ABT_rwlock_unlock(ls->lock);
+
+        qsort(v, n, sizeof(*v), gc_version_cmp);
+        for (i = 0, num = 0; i < n; i++) {
+                if (num && gc_version_cmp(&v[num - 1], &v[i]) == 0) {
+                        if (v[i].t_put > v[num - 1].t_put)
+                                v[num - 1].t_put = v[i].t_put;
+                        continue;
+                }
+                v[num++] = v[i];
+        }
+
+        *tab = v;
+        return num;
+}
+
+/*
+  Mark the versions of one variable, newest first, that no retention
+  rule keeps. Returns the number of versions to drop.
+*/
+static int gc_select(struct gc_version *v, int n,
+                const struct ndstore_var_policy *p, double now)
+{
+        int i, num = 0;
+
+        for (i = 0; i < n; i++) {
+                if (p->keep_last && (uint32_t)i < p->keep_last)
+                        continue;
+                if (p->keep_secs > 0 && now - v[i].t_put < p->keep_secs)
+                        continue;
+                if (p->keep_every && v[i].version % p->keep_every == 0)
+                        continue;
+                v[i].drop = 1;
+                num++;
+        }
+        return num;
+}
+
+/*
+  Free the versions that the retention rules of their variable no
+  longer keep. Returns the number of versions freed and stores the
+  payload bytes released in 'bytes', which leaves out the objects that
+  deltas still depend on. If 'dropped' is not NULL, it is
+  set to a table of the versions freed, to be free()d by the caller.
+*/
+int gc_run(ss_storage *ls, struct policy_table *policies, double now,
+                uint64_t *bytes, struct gc_version **dropped)
+{
+        struct ndstore_var_policy policy;
+        struct gc_version *tab, *v, key;
+        struct obj_data *od, *t;
+        int i, j, n, num = 0;
+
+        *bytes = 0;
+        if (dropped)
+                *dropped = NULL;
+        n = gc_collect(ls, &tab);
+        if (n <= 0)
+                return 0;
+
+        for (i = 0; i < n; i = j) {
+                for (j = i + 1; j < n; j++)
+                        if (strcmp(tab[i].name, tab[j].name) != 0)
+                                break;
+                policy_table_lookup(policies, tab[i].name, &policy);
+                if (policy_has_retention(&policy))
+                        num += gc_select(&tab[i], j - i, &policy, now);
+        }
+        if (!num) {
+                free(tab);
+                return 0;
+        }
+
+        ABT_rwlock_wrlock(ls->lock);
+        for (i = 0; i < ls->size_hash; i++) {
+                list_for_each_entry_safe(od, t, &ls->obj_hash[i], struct obj_data, obj_entry) {
+                        memcpy(key.name, od->obj_desc.name, sizeof(key.name));
+                        key.version = od->obj_desc.version;
+                        v = bsearch(&key, tab, n, sizeof(*tab), gc_version_cmp);
+                        if (!v || !v->drop)
+                                continue;
+
+                        /* same as eviction: readers that pinned the
+                           object keep it alive until they are done,
+                           and deltas against it until they are freed */
+                        *bytes += ls_drop(ls, od);
+                }
+        }
+        ABT_rwlock_unlock(ls->lock);
+
+        if (dropped) {
+                for (i = 0, j = 0; i < n; i++)
+                        if (tab[i].drop)
+                                tab[j++] = tab[i];
+                *dropped = tab;
+        } else {
+                free(tab);
+        }
+        return num;
+}
@@ -0,0 +1,165 @@
+/*
+ * Copyright (c) 2020, Rutgers Discovery Informatics Institute, Rutgers University
+ *
+ * See COPYRIGHT in top-level directory.
+ */
+
+/*
+  Re-chunking of stored objects along a fixed grid. Cells are anchored
+  at the origin; an object is first split in the fragments that fall
+  in each cell, and the fragments of a cell are merged into a single
+  object once they cover it. Cells at the border of the domain may
+  never be covered and stay as fragments.
+*/
+
+#include <errno.h>
+#include "grid.h"
+
+int grid_applies(const uint64_t *grid, int num_dims)
+{
+        int i;
+
+        for (i = 0; i < num_dims; i++)
+                if (grid[i] == 0)
+                        return 0;
+        return num_dims > 0;
+}
+
+/*
+  Range of cell indices intersected by 'bb'. Returns the number of
+  cells.
+*/
+uint64_t grid_cells(const struct bbox *bb, const uint64_t *grid,
+                struct bbox *range)
+{
+        uint64_t n = 1;
+        int i;
+
+        memset(range, 0, sizeof(*range));
+        range->num_dims = bb->num_dims;
+        for (i = 0; i < bb->num_dims; i++) {
+                range->lb.c[i] = bb->lb.c[i] / grid[i];
+                range->ub.c[i] = bb->ub.c[i] / grid[i];
+                n *= range->ub.c[i] - range->lb.c[i] + 1;
+        }
+        return n;
+}
+
+/* Box of the i-th cell of 'range', dimension 0 varying fastest. */
+void grid_cell_bbox(const struct bbox *range, const uint64_t *grid,
+                uint64_t i, struct bbox *cell)
+{
+        uint64_t n, idx;
+        int d;
+
+        memset(cell, 0, sizeof(*cell));
+        cell->num_dims = range->num_dims;
+        for (d = 0; d < range->num_dims; d++) {
+                n = range->ub.c[d] - range->lb.c[d] + 1;
+                idx = range->lb.c[d] + i % n;
+                i /= n;
+                cell->lb.c[d] = idx * grid[d];
+                cell->ub.c[d] = idx * grid[d] + grid[d] - 1;
+        }
+}
+
+/*
+  Split 'od' in its intersections with the grid cells and swap them
+  into the storage. The fragments are returned pinned in 'frags', to be
+  released with obj_data_unref() and free(). An object that lies in a
+  single cell is returned as is. Returns the number of fragments, 0 if
+  'od' was evicted meanwhile or on allocation failure.
+*/
+int grid_split(ss_storage *ls, struct obj_data *od, const uint64_t *grid,
+                struct obj_data ***frags)
+{
+        struct obj_data **tab;
+        obj_descriptor odsc = od->obj_desc;
+        struct bbox range, cell;
+        uint64_t n, i, j;
+
+        n = grid_cells(&od->obj_desc.bb, grid, &range);
+        tab = malloc(sizeof(*tab) * n);
+        if (!tab)
+                return 0;
+        if (n == 1) {
+                obj_data_ref(od);
+                tab[0] = od;
+                *frags = tab;
+                return 1;
+        }
+
+        for (i = 0; i < n; i++) {
+                grid_cell_bbox(&range, grid, i, &cell);
+                bbox_intersect(&cell, &od->obj_desc.bb, &odsc.bb);
+                tab[i] = obj_data_alloc(&odsc);
+                if (!tab[i] || ssd_copy(tab[i], od) < 0) {
+                        obj_data_free(tab[i]);
+                        goto fail;
+                }
+                /* one reference for the storage, one for the caller */
+                obj_data_ref(tab[i]);
+        }
+        if (ls_swap(ls, &od, 1, tab, n) != 0)
+                goto fail;
+
+        *frags = tab;
+        return n;
+
+fail:
+        for (j = 0; j < i; j++)
+                obj_data_free(tab[j]);
+        free(tab);
+        return 0;
+}
+
+/*
+  Merge the fragments of the cell that contains 'frag' if they cover
+  it. Returns the pinned cell object, or NULL if the cell is not
+  complete yet, already merged, or changed under us.
+*/
+struct obj_data *grid_merge(ss_storage *ls, struct obj_data *frag,
+                const uint64_t *grid)
+{
+        struct obj_data **tab, *c = NULL;
+        obj_descriptor odsc = frag->obj_desc;
+        struct bbox range;
+        uint64_t vol = 0;
+        int i, n;
+
+        grid_cells(&frag->obj_desc.bb, grid, &range);
+        grid_cell_bbox(&range, grid, 0, &odsc.bb);
+
+        n = ls_find_ods(ls, &odsc, &tab);
+        for (i = 0; i < n; i++) {
+                if (!bbox_include(&tab[i]->obj_desc.bb, &odsc.bb) ||
+                    tab[i]->obj_desc.size != odsc.size)
+                        break;
+                vol += bbox_volume(&tab[i]->obj_desc.bb);
+        }
+        if (i < n || vol != bbox_volume(&odsc.bb) ||
+            (n == 1 && bbox_equals(&tab[0]->obj_desc.bb, &odsc.bb)))
+                goto out;
+
+        c = obj_data_alloc(&odsc);
+        if (!c)
+                goto out;
+        for (i = 0; i < n; i++) {
+                if (ssd_copy(c, tab[i]) < 0) {
+                        obj_data_free(c);
+                        c = NULL;
+                        goto out;
+                }
+        }
+        obj_data_ref(c);
+        if (ls_swap(ls, tab, n, &c, 1) != 0) {
+                obj_data_free(c);
+                c = NULL;
+        }
+
+out:
+        for (i = 0; i < n; i++)
+                obj_data_unref(tab[i]);
+        free(tab);
+        return c;
+}
@@ -5,24 +5,101 @@
  */
 
 #include "ss_data.h"
+#include "stats.h"
+#include "trace.h"
+#include "policy.h"
+#include "compress.h"
+#include "cache.h"
 #include "ndstore-client.h"
 
 static enum storage_type st = column_major;
 
+/* a provider that does not acknowledge our unsubscription within this
+ * many milliseconds is left alone, it drops us on its own */
+#define NDSTORE_UNSUBSCRIBE_TIMEOUT_MS 1000.0
+
+/* a get through a handle with replicas that is not answered within
+ * this many milliseconds is retried on another peer */
+#define NDSTORE_FAILOVER_TIMEOUT_MS 10000.0
+
+/* a provider that reports overwrites to our cache */
+struct ndstore_sub {
+    hg_addr_t addr;
+    uint16_t provider_id;
+};
+
 struct ndstore_client {
     margo_instance_id mid;
     hg_id_t ndstore_put_id;
     hg_id_t ndstore_get_id;
+    hg_id_t ndstore_stats_id;
+    hg_id_t ndstore_policy_id;
+    hg_id_t ndstore_delete_id;
+    hg_id_t ndstore_get_pieces_id;
+    hg_id_t ndstore_release_id;
+    hg_id_t ndstore_get_points_id;
+    hg_id_t ndstore_get_versions_id;
+    hg_id_t ndstore_subscribe_id;
+    hg_id_t ndstore_unsubscribe_id;
+    hg_id_t ndstore_invalidate_id;
     uint64_t num_provider_handles;
+    /* per-call tracing, NULL when disabled */
+    struct trace_ring *trace;
+    /* compressed transfers of at least wire_threshold bytes */
+    struct ndstore_var_policy wire;
+    uint64_t wire_threshold;
+    /* boxes read with ndstore_get(), NULL when disabled, and the
+     * providers that report overwrites to it */
+    struct cache *cache;
+    struct ndstore_sub *subs;
+    int num_subs;
 };
 
+
 struct ndstore_provider_handle {
     ndstore_client_t client;
     hg_addr_t      addr;
     uint16_t       provider_id;
     uint64_t       refcount;
+    /* the provider reports overwrites and deletes to our cache */
+    int            subscribed;
+    /* peers replicating the provider, which gets take turns with */
+    int            num_replicas;
+    hg_addr_t      *replica_addrs;
+    uint16_t       *replica_ids;
+    uint64_t       next_read;
+    /* last update of the provider seen through the handle, which a
+     * replica must have applied to serve our gets, and the number the
+     * replicas know the provider by */
+    hg_atomic_int64_t origin;
+    hg_atomic_int64_t seen_seq;
 };
 
+DECLARE_MARGO_RPC_HANDLER(ndstore_invalidate_ult);
+static void ndstore_invalidate_ult(hg_handle_t h);
+
+/* Raise the last update of the provider seen through a handle. */
+static void ndstore_saw(ndstore_provider_handle_t provider, uint64_t origin,
+        uint64_t seq)
+{
+    int64_t v;
+
+    if(!origin)
+        return;
+    /* a provider that restarted numbers its updates from 1 again */
+    v = hg_atomic_get64(&provider->origin);
+    if((uint64_t)v != origin) {
+        if(hg_atomic_cas64(&provider->origin, v, (int64_t)origin))
+            hg_atomic_set64(&provider->seen_seq, (int64_t)seq);
+        return;
+    }
+    do {
+        v = hg_atomic_get64(&provider->seen_seq);
+        if((uint64_t)v >= seq)
+            return;
+    } while(!hg_atomic_cas64(&provider->seen_seq, v, (int64_t)seq));
+}
+
 static int ndstore_client_register(ndstore_client_t client, margo_instance_id mid)
 {
     client->mid = mid;
@@ -35,6 +112,15 @@ static int ndstore_client_register(ndstore_client_t client, margo_instance_id mi
     if(flag == HG_TRUE) { /* RPCs already registered */
         margo_registered_name(mid, "ndstore_put_rpc",                   &client->ndstore_put_id,                   &flag);
         margo_registered_name(mid, "ndstore_get_rpc",                   &client->ndstore_get_id,                   &flag);
+        margo_registered_name(mid, "ndstore_stats_rpc",                 &client->ndstore_stats_id,                 &flag);
+        margo_registered_name(mid, "ndstore_policy_rpc",                &client->ndstore_policy_id,                &flag);
+        margo_registered_name(mid, "ndstore_delete_rpc",                &client->ndstore_delete_id,                &flag);
+        margo_registered_name(mid, "ndstore_get_pieces_rpc",            &client->ndstore_get_pieces_id,            &flag);
+        margo_registered_name(mid, "ndstore_release_rpc",               &client->ndstore_release_id,               &flag);
+        margo_registered_name(mid, "ndstore_get_points_rpc",            &client->ndstore_get_points_id,            &flag);
+        margo_registered_name(mid, "ndstore_get_versions_rpc",          &client->ndstore_get_versions_id,          &flag);
+        margo_registered_name(mid, "ndstore_subscribe_rpc",             &client->ndstore_subscribe_id,             &flag);
+        margo_registered_name(mid, "ndstore_unsubscribe_rpc",           &client->ndstore_unsubscribe_id,           &flag);
    
     } else {
 
@@ -42,6 +128,24 @@ static int ndstore_client_register(ndstore_client_t client, margo_instance_id mi
             MARGO_REGISTER(mid, "ndstore_put_rpc", bulk_in_t, bulk_out_t, NULL);
         client->ndstore_get_id =
             MARGO_REGISTER(mid, "ndstore_get_rpc", bulk_in_t, bulk_out_t, NULL);
+        client->ndstore_stats_id =
+            MARGO_REGISTER(mid, "ndstore_stats_rpc", bulk_in_t, bulk_out_t, NULL);
+        client->ndstore_policy_id =
+            MARGO_REGISTER(mid, "ndstore_policy_rpc", policy_in_t, bulk_out_t, NULL);
+        client->ndstore_delete_id =
+            MARGO_REGISTER(mid, "ndstore_delete_rpc", delete_in_t, bulk_out_t, NULL);
+        client->ndstore_get_pieces_id =
+            MARGO_REGISTER(mid, "ndstore_get_pieces_rpc", bulk_in_t, pieces_out_t, NULL);
+        client->ndstore_release_id =
+            MARGO_REGISTER(mid, "ndstore_release_rpc", lease_in_t, bulk_out_t, NULL);
+        client->ndstore_get_points_id =
+            MARGO_REGISTER(mid, "ndstore_get_points_rpc", bulk_in_t, points_out_t, NULL);
+        client->ndstore_get_versions_id =
+            MARGO_REGISTER(mid, "ndstore_get_versions_rpc", versions_in_t, bulk_out_t, NULL);
+        client->ndstore_subscribe_id =
+            MARGO_REGISTER(mid, "ndstore_subscribe_rpc", void, bulk_out_t, NULL);
+        client->ndstore_unsubscribe_id =
+            MARGO_REGISTER(mid, "ndstore_unsubscribe_rpc", void, bulk_out_t, NULL);
     }
 
     return NDSTORE_SUCCESS;
@@ -62,6 +166,32 @@ int ndstore_client_init(margo_instance_id mid, ndstore_client_t* client)
 }
 
 
+/*
+ * Tell the providers we subscribed to that we stop caching, so that
+ * they do not wait for us on their next invalidation.
+ */
+static void ndstore_unsubscribe_all(ndstore_client_t client)
+{
+    hg_handle_t handle;
+    bulk_out_t out;
+    int i;
+
+    for(i = 0; i < client->num_subs; i++) {
+        if(margo_create(client->mid, client->subs[i].addr,
+                client->ndstore_unsubscribe_id, &handle) == HG_SUCCESS) {
+            if(margo_provider_forward_timed(client->subs[i].provider_id,
+                    handle, NULL, NDSTORE_UNSUBSCRIBE_TIMEOUT_MS) == HG_SUCCESS &&
+               margo_get_output(handle, &out) == HG_SUCCESS)
+                margo_free_output(handle, &out);
+            margo_destroy(handle);
+        }
+        margo_addr_free(client->mid, client->subs[i].addr);
+    }
+    free(client->subs);
+    client->subs = NULL;
+    client->num_subs = 0;
+}
+
 int ndstore_client_finalize(ndstore_client_t client)
 {
     if(client->num_provider_handles != 0) {
@@ -69,10 +199,124 @@ int ndstore_client_finalize(ndstore_client_t client)
                 "[NDSTORE] Warning: %" PRIu64 " provider handles not released before ndstore_client_finalize was called\n",
                 client->num_provider_handles);
     }
+    trace_ring_free(client->trace);
+    ndstore_unsubscribe_all(client);
+    if(client->cache) {
+        margo_register_data(client->mid, client->ndstore_invalidate_id, NULL, NULL);
+        cache_free(client->cache);
+    }
     free(client);
     return NDSTORE_SUCCESS;
 }
 
+int ndstore_client_trace_enable(ndstore_client_t client, size_t capacity)
+{
+    if(client == NDSTORE_CLIENT_NULL || capacity == 0)
+        return NDSTORE_ERR_INVALID_ARG;
+    if(client->trace)
+        return NDSTORE_ERR_INVALID_ARG;
+
+    client->trace = trace_ring_alloc(capacity);
+    if(!client->trace)
+        return NDSTORE_ERR_ALLOCATION;
+
+    return NDSTORE_SUCCESS;
+}
+
+int ndstore_client_trace_dump(ndstore_client_t client, const char *path)
+{
+    FILE *fp;
+
+    if(client == NDSTORE_CLIENT_NULL || !client->trace || !path)
+        return NDSTORE_ERR_INVALID_ARG;
+
+    fp = fopen(path, "w");
+    if(!fp) {
+        fprintf(stderr,"[NDSTORE] could not open %s in ndstore_client_trace_dump()\n", path);
+        return NDSTORE_ERR_INVALID_ARG;
+    }
+    trace_ring_dump_chrome(client->trace, fp);
+    fclose(fp);
+
+    return NDSTORE_SUCCESS;
+}
+
+int ndstore_client_cache_enable(ndstore_client_t client, uint64_t capacity)
+{
+    if(client == NDSTORE_CLIENT_NULL || capacity == 0 || client->cache)
+        return NDSTORE_ERR_INVALID_ARG;
+    /* invalidations are RPCs from the providers */
+    if(margo_is_listening(client->mid) == HG_FALSE) {
+        fprintf(stderr,"[NDSTORE] ndstore_client_cache_enable() needs a margo instance in server mode\n");
+        return NDSTORE_ERR_INVALID_ARG;
+    }
+
+    client->cache = cache_alloc(capacity);
+    if(!client->cache)
+        return NDSTORE_ERR_ALLOCATION;
+
+    /* a provider sharing our margo instance may have registered it
+     * already, without a handler */
+    client->ndstore_invalidate_id =
+        MARGO_REGISTER(client->mid, "ndstore_invalidate_rpc", delete_in_t, bulk_out_t,
+                ndstore_invalidate_ult);
+    margo_register_data(client->mid, client->ndstore_invalidate_id, client, NULL);
+
+    return NDSTORE_SUCCESS;
+}
+
+static void ndstore_invalidate_ult(hg_handle_t handle)
+{
+    delete_in_t in;
+    bulk_out_t out;
+    obj_descriptor odsc;
+
+    out.srv_time = 0;
+    out.comp_size = 0;
+    out.origin = 0;
+    out.seq = 0;
+
+    margo_instance_id mid = margo_hg_handle_get_instance(handle);
+    const struct hg_info* info = margo_get_info(handle);
+    ndstore_client_t client = (ndstore_client_t)margo_registered_data(mid, info->id);
+
+    out.ret = NDSTORE_SUCCESS;
+    if(margo_get_input(handle, &in) != HG_SUCCESS) {
+        out.ret = NDSTORE_ERR_MERCURY;
+    } else {
+        if(client && client->cache && in.odsc.size == sizeof(odsc)) {
+            memcpy(&odsc, in.odsc.raw_odsc, sizeof(odsc));
+            odsc.name[sizeof(odsc.name)-1] = '\0';
+            cache_invalidate(client->cache, &odsc, in.ver_hi);
+        }
+        margo_free_input(handle, &in);
+    }
+    margo_respond(handle, &out);
+    margo_destroy(handle);
+}
+DEFINE_MARGO_RPC_HANDLER(ndstore_invalidate_ult)
+
+int ndstore_client_set_wire_compression(ndstore_client_t client,
+        const struct ndstore_var_policy *policy,
+        uint64_t threshold)
+{
+    if(client == NDSTORE_CLIENT_NULL)
+        return NDSTORE_ERR_INVALID_ARG;
+
+    if(!policy || policy->codec == NDSTORE_CODEC_NONE) {
+        client->wire.codec = NDSTORE_CODEC_NONE;
+        return NDSTORE_SUCCESS;
+    }
+    if(!ndstore_codec_available(policy->codec))
+        return NDSTORE_ERR_INVALID_ARG;
+    if(policy->codec == NDSTORE_CODEC_QUANT && !(policy->error_bound >= 0))
+        return NDSTORE_ERR_INVALID_ARG;
+
+    client->wire = *policy;
+    client->wire_threshold = threshold;
+    return NDSTORE_SUCCESS;
+}
+
 int ndstore_provider_handle_create(
         ndstore_client_t client,
         hg_addr_t addr,
@@ -96,6 +340,8 @@ int ndstore_provider_handle_create(
     provider->client      = client;
     provider->provider_id = provider_id;
     provider->refcount    = 1;
+    hg_atomic_init64(&provider->origin, 0);
+    hg_atomic_init64(&provider->seen_seq, 0);
 
     client->num_provider_handles += 1;
 
@@ -104,6 +350,36 @@ int ndstore_provider_handle_create(
 }
 
 
+int ndstore_provider_handle_add_replica(
+        ndstore_provider_handle_t handle,
+        hg_addr_t addr,
+        uint16_t provider_id)
+{
+    hg_addr_t *addrs;
+    uint16_t *ids;
+    int n;
+
+    if(handle == NDSTORE_PROVIDER_HANDLE_NULL)
+        return NDSTORE_ERR_INVALID_ARG;
+
+    n = handle->num_replicas;
+    addrs = realloc(handle->replica_addrs, sizeof(*addrs) * (n + 1));
+    if(!addrs)
+        return NDSTORE_ERR_ALLOCATION;
+    handle->replica_addrs = addrs;
+    ids = realloc(handle->replica_ids, sizeof(*ids) * (n + 1));
+    if(!ids)
+        return NDSTORE_ERR_ALLOCATION;
+    handle->replica_ids = ids;
+
+    if(margo_addr_dup(handle->client->mid, addr, &addrs[n]) != HG_SUCCESS)
+        return NDSTORE_ERR_MERCURY;
+    ids[n] = provider_id;
+    handle->num_replicas++;
+
+    return NDSTORE_SUCCESS;
+}
+
 int ndstore_provider_handle_get_info(
         ndstore_provider_handle_t ph,
         ndstore_client_t* client,
@@ -134,7 +410,15 @@ int ndstore_provider_handle_release(ndstore_provider_handle_t handle)
     if(handle == NDSTORE_PROVIDER_HANDLE_NULL) return -1;
     handle->refcount -= 1;
     if(handle->refcount == 0) {
+        /* entries are keyed by the handle, whose address may be reused */
+        if(handle->client->cache)
+            cache_drop_key(handle->client->cache, handle);
         margo_addr_free(handle->client->mid, handle->addr);
+        while(handle->num_replicas > 0)
+            margo_addr_free(handle->client->mid,
+                    handle->replica_addrs[--handle->num_replicas]);
+        free(handle->replica_addrs);
+        free(handle->replica_ids);
         handle->client->num_provider_handles -= 1;
         free(handle);
     }
@@ -142,46 +426,165 @@ int ndstore_provider_handle_release(ndstore_provider_handle_t handle)
 }
 
 
-int ndstore_put (ndstore_provider_handle_t provider,
-		const char *var_name,
+/*
+  Segments of the block lb..ub of an array with extents 'dims', the
+  block starting at index 'offset' of the array. Dimensions the block
+  spans entirely are merged into the segments, so a dense block is a
+  single segment.
+*/
+static int ndstore_layout_segments(int elem_size, int ndim,
+        uint64_t *lb, uint64_t *ub,
+        const uint64_t *dims, const uint64_t *offset, void *data,
+        void ***ptrs, hg_size_t **sizes)
+{
+    uint64_t ext[BBOX_MAX_NDIM], stride[BBOX_MAX_NDIM], idx[BBOX_MAX_NDIM];
+    uint64_t run, num = 1, pos;
+    int d, k;
+    uint64_t i;
+
+    if(ndim < 1 || ndim > BBOX_MAX_NDIM)
+        return NDSTORE_ERR_INVALID_ARG;
+    for(d = 0; d < ndim; d++) {
+        if(ub[d] < lb[d])
+            return NDSTORE_ERR_INVALID_ARG;
+        ext[d] = ub[d] - lb[d] + 1;
+        if(offset[d] + ext[d] > dims[d])
+            return NDSTORE_ERR_INVALID_ARG;
+        stride[d] = d ? stride[d-1] * dims[d-1] : 1;
+    }
+
+    run = ext[0];
+    for(k = 1; k < ndim && ext[k-1] == dims[k-1]; k++)
+        run *= ext[k];
+    for(d = k; d < ndim; d++)
+        num *= ext[d];
+
+    *ptrs = malloc(sizeof(**ptrs) * num);
+    *sizes = malloc(sizeof(**sizes) * num);
+    if(!*ptrs || !*sizes) {
+        free(*ptrs);
+        free(*sizes);
+        return NDSTORE_ERR_ALLOCATION;
+    }
+
+    memset(idx, 0, sizeof(idx));
+    for(i = 0; i < num; i++) {
+        pos = 0;
+        for(d = 0; d < ndim; d++)
+            pos += (offset[d] + idx[d]) * stride[d];
+        (*ptrs)[i] = (char*)data + pos * elem_size;
+        (*sizes)[i] = run * elem_size;
+        for(d = k; d < ndim && ++idx[d] == ext[d]; d++)
+            idx[d] = 0;
+    }
+
+    return (int)num;
+}
+
+static int ndstore_iov_segments(int iovcnt, const struct iovec *iov,
+        void ***ptrs, hg_size_t **sizes)
+{
+    int i;
+
+    if(iovcnt < 1 || !iov)
+        return NDSTORE_ERR_INVALID_ARG;
+    *ptrs = malloc(sizeof(**ptrs) * iovcnt);
+    *sizes = malloc(sizeof(**sizes) * iovcnt);
+    if(!*ptrs || !*sizes) {
+        free(*ptrs);
+        free(*sizes);
+        return NDSTORE_ERR_ALLOCATION;
+    }
+    for(i = 0; i < iovcnt; i++) {
+        (*ptrs)[i] = iov[i].iov_base;
+        (*sizes)[i] = iov[i].iov_len;
+    }
+    return NDSTORE_SUCCESS;
+}
+
+static void ndstore_odsc_init(obj_descriptor *odsc, const char *var_name,
         unsigned int ver, int elem_size,
-        int ndim, uint64_t *lb, uint64_t *ub, 
-        void *data)
+        int ndim, uint64_t *lb, uint64_t *ub)
+{
+    memset(odsc, 0, sizeof(*odsc));
+    odsc->version = ver;
+    odsc->owner = -1;
+    odsc->st = st;
+    odsc->size = elem_size;
+    odsc->bb.num_dims = ndim;
+
+    memcpy(odsc->bb.lb.c, lb, sizeof(uint64_t)*ndim);
+    memcpy(odsc->bb.ub.c, ub, sizeof(uint64_t)*ndim);
+
+    strncpy(odsc->name, var_name, sizeof(odsc->name)-1);
+}
+
+static int ndstore_put_segments(ndstore_provider_handle_t provider,
+        obj_descriptor *odsc, char *fields,
+        uint32_t count, void **ptrs, hg_size_t *sizes)
 {
 	hg_return_t hret;
     int ret = NDSTORE_SUCCESS;
     hg_handle_t handle;
+    margo_request req;
+    struct trace_ring *trace = provider->client->trace;
+    struct trace_event ev;
 
-    obj_descriptor odsc = {
-            .version = ver, .owner = -1, 
-            .st = st,
-            .size = elem_size,
-            .bb = {.num_dims = ndim,}
-    };
+    bulk_in_t in;
+    bulk_out_t out;
 
-    memset(odsc.bb.lb.c, 0, sizeof(uint64_t)*BBOX_MAX_NDIM);
-    memset(odsc.bb.ub.c, 0, sizeof(uint64_t)*BBOX_MAX_NDIM);
+    in.odsc.size = sizeof(*odsc);
+    in.odsc.raw_odsc = (char*)odsc;
+    in.comp_codec = NDSTORE_CODEC_NONE;
+    in.comp_size = 0;
+    in.origin = 0;
+    in.seq = 0;
+    in.fields.size = odsc->num_fields * FIELD_NAME_LEN;
+    in.fields.raw_odsc = fields;
+    hg_size_t rdma_size = obj_data_size(odsc);
 
-    memcpy(odsc.bb.lb.c, lb, sizeof(uint64_t)*ndim);
-    memcpy(odsc.bb.ub.c, ub, sizeof(uint64_t)*ndim);
+    hg_size_t total = 0;
+    uint32_t i;
 
-    strncpy(odsc.name, var_name, sizeof(odsc.name)-1);
-    odsc.name[sizeof(odsc.name)-1] = '\0';
+    for(i = 0; i < count; i++)
+        total += sizes[i];
+    if(total != rdma_size)
+        return NDSTORE_ERR_INVALID_ARG;
 
-    bulk_in_t in;
-    bulk_out_t out;
+    if(trace)
+        trace_event_init(&ev, NDSTORE_STATS_OP_PUT, odsc->name, odsc->version, rdma_size);
 
-    in.odsc.size = sizeof(odsc);
-    in.odsc.raw_odsc = (char*)(&odsc);
-     hg_size_t rdma_size = (elem_size)*bbox_volume(&odsc.bb);
+    /* expose the compressed payload instead when it is worth it; the
+     * codec needs the block in a single buffer */
+    struct comp_hdr *wire = NULL;
+    if(count == 1 && !odsc->num_fields &&
+       provider->client->wire.codec != NDSTORE_CODEC_NONE &&
+       rdma_size >= provider->client->wire_threshold) {
+        wire = comp_encode(odsc, ptrs[0], &provider->client->wire);
+        if(wire) {
+            in.comp_codec = wire->codec;
+            in.comp_size = wire->total_size;
+        }
+    }
 
-    hret = margo_bulk_create(provider->client->mid, 1, (void**)&data, &rdma_size,
-                            HG_BULK_READ_ONLY, &in.handle);
+    if(wire) {
+        void *buffer = wire;
+        hg_size_t xfer = wire->total_size;
+
+        hret = margo_bulk_create(provider->client->mid, 1, &buffer, &xfer,
+                                HG_BULK_READ_ONLY, &in.handle);
+    } else
+        hret = margo_bulk_create(provider->client->mid, count, ptrs, sizes,
+                                HG_BULK_READ_ONLY, &in.handle);
     if(hret != HG_SUCCESS) {
         fprintf(stderr,"[NDSTORE] margo_bulk_create() failed in ndstore_put()\n");
+        free(wire);
         return NDSTORE_ERR_MERCURY;
     }
     
+    if(trace)
+        ev.t_reg = ABT_get_wtime();
+
     /* create handle */
     hret = margo_create(
             provider->client->mid,
@@ -191,79 +594,212 @@ int ndstore_put (ndstore_provider_handle_t provider,
     if(hret != HG_SUCCESS) {
         fprintf(stderr,"[NDSTORE] margo_create() failed in ndstore_put()\n");
         margo_bulk_free(in.handle);
+        free(wire);
         return NDSTORE_ERR_MERCURY;
     }
 
-    hret = margo_provider_forward(provider->provider_id, handle, &in);
+    hret = margo_provider_iforward(provider->provider_id, handle, &in, &req);
+    if(hret != HG_SUCCESS) {
+        fprintf(stderr,"[NDSTORE] margo_iforward() failed in ndstore_put()\n");
+        margo_bulk_free(in.handle);
+        free(wire);
+        margo_destroy(handle);
+        return NDSTORE_ERR_MERCURY;
+    }
+    if(trace)
+        ev.t_sent = ABT_get_wtime();
+
+    hret = margo_wait(req);
     if(hret != HG_SUCCESS) {
-        fprintf(stderr,"[NDSTORE] margo_forward() failed in ndstore_put() \n");
+        fprintf(stderr,"[NDSTORE] margo_wait() failed in ndstore_put()\n");
         margo_bulk_free(in.handle);
+        free(wire);
         margo_destroy(handle);
         return NDSTORE_ERR_MERCURY;
     }
+    if(trace)
+        ev.t_reply = ABT_get_wtime();
 
     hret = margo_get_output(handle, &out);
     if(hret != HG_SUCCESS) {
         fprintf(stderr,"[NDSTORE] margo_get_output() failed in ndstore_put()\n");
         margo_bulk_free(in.handle);
+        free(wire);
         margo_destroy(handle);
         return NDSTORE_ERR_MERCURY;
     }
 
     ret = out.ret;
+    if(ret == NDSTORE_SUCCESS)
+        ndstore_saw(provider, out.origin, out.seq);
+    if(trace) {
+        ev.ret = out.ret;
+        ev.server_ns = out.srv_time;
+    }
     margo_free_output(handle, &out);
     margo_bulk_free(in.handle);
+    free(wire);
+
+    /* our own copy is stale even if the provider cannot tell us */
+    if(ret == NDSTORE_SUCCESS && provider->client->cache)
+        cache_invalidate(provider->client->cache, odsc, odsc->version);
 
     margo_destroy(handle);
+    if(trace) {
+        ev.t_end = ABT_get_wtime();
+        trace_ring_push(trace, &ev);
+    }
 	return ret;
 
 }
 
-int ndstore_get (ndstore_provider_handle_t provider,
+int ndstore_put (ndstore_provider_handle_t provider,
+		const char *var_name,
+        unsigned int ver, int elem_size,
+        int ndim, uint64_t *lb, uint64_t *ub,
+        void *data)
+{
+    obj_descriptor odsc;
+    hg_size_t rdma_size;
+
+    ndstore_odsc_init(&odsc, var_name, ver, elem_size, ndim, lb, ub);
+    rdma_size = obj_data_size(&odsc);
+    return ndstore_put_segments(provider, &odsc, NULL, 1, &data, &rdma_size);
+}
+
+int ndstore_put_layout(ndstore_provider_handle_t provider,
         const char *var_name,
         unsigned int ver, int elem_size,
-        int ndim, uint64_t *lb, uint64_t *ub, 
+        int ndim, uint64_t *lb, uint64_t *ub,
+        const uint64_t *dims, const uint64_t *offset,
         void *data)
 {
-    hg_return_t hret;
-    int ret = NDSTORE_SUCCESS;
-    hg_handle_t handle;
+    obj_descriptor odsc;
+    void **ptrs;
+    hg_size_t *sizes;
+    int ret, num;
 
-    obj_descriptor odsc = {
-            .version = ver, .owner = -1, 
-            .st = st,
-            .size = elem_size,
-            .bb = {.num_dims = ndim,}
-    };
+    num = ndstore_layout_segments(elem_size, ndim, lb, ub, dims, offset,
+            data, &ptrs, &sizes);
+    if(num < 0)
+        return num;
+    ndstore_odsc_init(&odsc, var_name, ver, elem_size, ndim, lb, ub);
+    ret = ndstore_put_segments(provider, &odsc, NULL, num, ptrs, sizes);
+    free(ptrs);
+    free(sizes);
+    return ret;
+}
 
-    memset(odsc.bb.lb.c, 0, sizeof(uint64_t)*BBOX_MAX_NDIM);
-    memset(odsc.bb.ub.c, 0, sizeof(uint64_t)*BBOX_MAX_NDIM);
+int ndstore_put_iov(ndstore_provider_handle_t provider,
+        const char *var_name,
+        unsigned int ver, int elem_size,
+        int ndim, uint64_t *lb, uint64_t *ub,
+        int iovcnt, const struct iovec *iov)
+{
+    obj_descriptor odsc;
+    void **ptrs;
+    hg_size_t *sizes;
+    int ret;
 
-    memcpy(odsc.bb.lb.c, lb, sizeof(uint64_t)*ndim);
-    memcpy(odsc.bb.ub.c, ub, sizeof(uint64_t)*ndim);
+    ret = ndstore_iov_segments(iovcnt, iov, &ptrs, &sizes);
+    if(ret != NDSTORE_SUCCESS)
+        return ret;
+    ndstore_odsc_init(&odsc, var_name, ver, elem_size, ndim, lb, ub);
+    ret = ndstore_put_segments(provider, &odsc, NULL, iovcnt, ptrs, sizes);
+    free(ptrs);
+    free(sizes);
+    return ret;
+}
 
-    strncpy(odsc.name, var_name, sizeof(odsc.name)-1);
-    odsc.name[sizeof(odsc.name)-1] = '\0';
+/* Expand a compressed get reply that was pushed into 'data'. */
+static int ndstore_get_expand(obj_descriptor *odsc, uint64_t comp_size, void *data)
+{
+    struct comp_hdr *wire;
+    int err;
+
+    if(comp_size >= obj_data_size(odsc))
+        return NDSTORE_ERR_MERCURY;
+    wire = malloc(comp_size);
+    if(!wire)
+        return NDSTORE_ERR_ALLOCATION;
+    memcpy(wire, data, comp_size);
+
+    err = comp_check(wire, comp_size, odsc);
+    if(err == 0)
+        err = comp_decode(wire, odsc, data);
+    free(wire);
+    if(err != 0) {
+        fprintf(stderr,"[NDSTORE] corrupted compressed reply in ndstore_get()\n");
+        return NDSTORE_ERR_MERCURY;
+    }
+    return NDSTORE_SUCCESS;
+}
+
+/*
+  Get from the provider, or from one of its replicas, which then turns
+  the get away if it has not applied the updates the handle saw.
+*/
+static int ndstore_get_segments_from(ndstore_provider_handle_t provider,
+        hg_addr_t addr, uint16_t provider_id, int replica, obj_descriptor *odsc,
+        char *fields, uint32_t count, void **ptrs, hg_size_t *sizes)
+{
+    hg_return_t hret;
+    int ret = NDSTORE_SUCCESS;
+    hg_handle_t handle;
+    margo_request req;
+    struct trace_ring *trace = provider->client->trace;
+    struct trace_event ev;
 
     bulk_in_t in;
     bulk_out_t out;
 
-    in.odsc.size = sizeof(odsc);
-    in.odsc.raw_odsc = (char*)(&odsc);
+    in.odsc.size = sizeof(*odsc);
+    in.odsc.raw_odsc = (char*)odsc;
+    in.comp_codec = NDSTORE_CODEC_NONE;
+    in.comp_size = 0;
+    in.origin = 0;
+    in.seq = 0;
+    in.fields.size = odsc->num_fields * FIELD_NAME_LEN;
+    in.fields.raw_odsc = fields;
+    if(replica) {
+        in.origin = hg_atomic_get64(&provider->origin);
+        in.seq = hg_atomic_get64(&provider->seen_seq);
+    }
+
+    hg_size_t rdma_size = obj_data_size(odsc);
+    hg_size_t total = 0;
+    uint64_t comp_size;
+    uint32_t i;
 
-    hg_size_t rdma_size = (elem_size)*bbox_volume(&odsc.bb);
+    for(i = 0; i < count; i++)
+        total += sizes[i];
+    if(total != rdma_size)
+        return NDSTORE_ERR_INVALID_ARG;
+
+    /* the server may reply with a compressed payload at the start of
+     * our buffer, which we then expand in place */
+    if(count == 1 && !odsc->num_fields &&
+       provider->client->wire.codec != NDSTORE_CODEC_NONE &&
+       rdma_size >= provider->client->wire_threshold)
+        in.comp_codec = provider->client->wire.codec;
 
-    hret = margo_bulk_create(provider->client->mid, 1, (void**)(&data), &rdma_size,
+    if(trace)
+        trace_event_init(&ev, NDSTORE_STATS_OP_GET, odsc->name, odsc->version, rdma_size);
+
+    hret = margo_bulk_create(provider->client->mid, count, ptrs, sizes,
                             HG_BULK_WRITE_ONLY, &in.handle);
     if(hret != HG_SUCCESS) {
         fprintf(stderr,"[NDSTORE] margo_bulk_create() failed in ndstore_put()\n");
         return NDSTORE_ERR_MERCURY;
     }
 
+    if(trace)
+        ev.t_reg = ABT_get_wtime();
+
     /* create handle */
     hret = margo_create(
             provider->client->mid,
-            provider->addr,
+            addr,
             provider->client->ndstore_get_id,
             &handle);
     if(hret != HG_SUCCESS) {
@@ -272,13 +808,30 @@ int ndstore_get (ndstore_provider_handle_t provider,
         return NDSTORE_ERR_MERCURY;
     }
 
-    hret = margo_provider_forward(provider->provider_id, handle, &in);
+    /* a peer that is down must not hold the get up */
+    if(provider->num_replicas)
+        hret = margo_provider_iforward_timed(provider_id, handle, &in,
+                NDSTORE_FAILOVER_TIMEOUT_MS, &req);
+    else
+        hret = margo_provider_iforward(provider_id, handle, &in, &req);
+    if(hret != HG_SUCCESS) {
+        fprintf(stderr,"[NDSTORE] margo_iforward() failed in ndstore_get()\n");
+        margo_bulk_free(in.handle);
+        margo_destroy(handle);
+        return NDSTORE_ERR_MERCURY;
+    }
+    if(trace)
+        ev.t_sent = ABT_get_wtime();
+
+    hret = margo_wait(req);
     if(hret != HG_SUCCESS) {
-        fprintf(stderr,"[NDSTORE] margo_forward() failed in ndstore_put()\n");
+        fprintf(stderr,"[NDSTORE] margo_wait() failed in ndstore_get()\n");
         margo_bulk_free(in.handle);
         margo_destroy(handle);
         return NDSTORE_ERR_MERCURY;
     }
+    if(trace)
+        ev.t_reply = ABT_get_wtime();
 
     hret = margo_get_output(handle, &out);
     if(hret != HG_SUCCESS) {
@@ -289,10 +842,933 @@ int ndstore_get (ndstore_provider_handle_t provider,
     }
 
     ret = out.ret;
+    comp_size = out.comp_size;
+    if(ret == NDSTORE_SUCCESS && !replica)
+        ndstore_saw(provider, out.origin, out.seq);
+    if(trace) {
+        ev.ret = out.ret;
+        ev.server_ns = out.srv_time;
+    }
     margo_free_output(handle, &out);
     margo_bulk_free(in.handle);
 
     margo_destroy(handle);
+
+    if(ret == NDSTORE_SUCCESS && comp_size)
+        ret = ndstore_get_expand(odsc, comp_size, ptrs[0]);
+    if(trace) {
+        ev.t_end = ABT_get_wtime();
+        trace_ring_push(trace, &ev);
+    }
+    return ret;
+
+}
+
+/*
+  Gets take turns between the provider and its replicas. A replica may
+  not have applied the updates seen through the handle yet, or be down:
+  the provider, which is always up to date, is then asked. If the
+  provider cannot be reached either, the other replicas are, which
+  serve the get if they applied what the handle saw.
+*/
+static int ndstore_get_segments(ndstore_provider_handle_t provider,
+        obj_descriptor *odsc, char *fields,
+        uint32_t count, void **ptrs, hg_size_t *sizes)
+{
+    uint64_t r = 0;
+    int i, ret;
+
+    if(provider->num_replicas)
+        r = provider->next_read++ % (provider->num_replicas + 1);
+    if(r && ndstore_get_segments_from(provider, provider->replica_addrs[r - 1],
+            provider->replica_ids[r - 1], 1, odsc, fields, count, ptrs,
+            sizes) == NDSTORE_SUCCESS)
+        return NDSTORE_SUCCESS;
+
+    ret = ndstore_get_segments_from(provider, provider->addr,
+            provider->provider_id, 0, odsc, fields, count, ptrs, sizes);
+    for(i = 0; i < provider->num_replicas && ret == NDSTORE_ERR_MERCURY; i++)
+        if((uint64_t)i + 1 != r &&
+           ndstore_get_segments_from(provider, provider->replica_addrs[i],
+                provider->replica_ids[i], 1, odsc, fields, count, ptrs,
+                sizes) == NDSTORE_SUCCESS)
+            ret = NDSTORE_SUCCESS;
+    return ret;
+}
+
+/* Remember a provider we subscribed to, see ndstore_unsubscribe_all(). */
+static void ndstore_subscribed(ndstore_provider_handle_t provider)
+{
+    ndstore_client_t client = provider->client;
+    struct ndstore_sub *subs;
+    int i;
+
+    for(i = 0; i < client->num_subs; i++)
+        if(client->subs[i].provider_id == provider->provider_id &&
+           margo_addr_cmp(client->mid, client->subs[i].addr, provider->addr))
+            return;
+    subs = realloc(client->subs, sizeof(*subs) * (i + 1));
+    if(!subs)
+        return;
+    client->subs = subs;
+    if(margo_addr_dup(client->mid, provider->addr, &subs[i].addr) != HG_SUCCESS)
+        return;
+    subs[i].provider_id = provider->provider_id;
+    client->num_subs++;
+}
+
+/* Asks the provider to report overwrites and deletes to our cache. */
+static int ndstore_subscribe(ndstore_provider_handle_t provider)
+{
+    hg_return_t hret;
+    hg_handle_t handle;
+    bulk_out_t out;
+    int ret;
+
+    hret = margo_create(
+            provider->client->mid,
+            provider->addr,
+            provider->client->ndstore_subscribe_id,
+            &handle);
+    if(hret != HG_SUCCESS) {
+        fprintf(stderr,"[NDSTORE] margo_create() failed in ndstore_subscribe()\n");
+        return NDSTORE_ERR_MERCURY;
+    }
+    hret = margo_provider_forward(provider->provider_id, handle, NULL);
+    if(hret != HG_SUCCESS) {
+        fprintf(stderr,"[NDSTORE] margo_forward() failed in ndstore_subscribe()\n");
+        margo_destroy(handle);
+        return NDSTORE_ERR_MERCURY;
+    }
+    hret = margo_get_output(handle, &out);
+    if(hret != HG_SUCCESS) {
+        fprintf(stderr,"[NDSTORE] margo_get_output() failed in ndstore_subscribe()\n");
+        margo_destroy(handle);
+        return NDSTORE_ERR_MERCURY;
+    }
+    ret = out.ret;
+    margo_free_output(handle, &out);
+    margo_destroy(handle);
+    if(ret == NDSTORE_SUCCESS)
+        ndstore_subscribed(provider);
+    return ret;
+}
+
+/*
+ * Get through the client cache: the parts it holds are copied locally,
+ * only the boxes left are read from the provider, and then cached.
+ * Without a subscription to the provider the cache is bypassed, since
+ * we would not hear about overwrites.
+ */
+static int ndstore_get_cached(ndstore_provider_handle_t provider,
+        obj_descriptor *odsc, void *data)
+{
+    struct cache *cache = provider->client->cache;
+    struct bbox missing[CACHE_MAX_MISSING];
+    struct obj_data *dst, *part;
+    obj_descriptor q = *odsc;
+    hg_size_t size;
+    uint64_t gen;
+    int i, n, ret = NDSTORE_SUCCESS;
+
+    if(!provider->subscribed && ndstore_subscribe(provider) == NDSTORE_SUCCESS)
+        provider->subscribed = 1;
+    dst = obj_data_alloc_no_data(odsc, data);
+    if(!provider->subscribed || !dst) {
+        obj_data_free(dst);
+        size = obj_data_size(odsc);
+        return ndstore_get_segments(provider, odsc, NULL, 1, &data, &size);
+    }
+
+    n = cache_lookup(cache, provider, dst, missing, &gen);
+    if(n < 0) {
+        n = 1;
+        missing[0] = odsc->bb;
+    }
+    for(i = 0; i < n && ret == NDSTORE_SUCCESS; i++) {
+        q.bb = missing[i];
+        part = obj_data_alloc(&q);
+        if(!part) {
+            ret = NDSTORE_ERR_ALLOCATION;
+            break;
+        }
+        /* from the provider only: the invalidations that keep the
+         * cache fresh tell nothing about what a replica lacks */
+        size = obj_data_size(&q);
+        ret = ndstore_get_segments_from(provider, provider->addr,
+                provider->provider_id, 0, &q, NULL, 1, &part->data, &size);
+        if(ret == NDSTORE_SUCCESS) {
+            ssd_copy(dst, part);
+            cache_insert(cache, provider, part, gen);
+        } else {
+            obj_data_free(part);
+        }
+    }
+    dst->data = NULL;
+    obj_data_free(dst);
     return ret;
+}
 
+int ndstore_get (ndstore_provider_handle_t provider,
+        const char *var_name,
+        unsigned int ver, int elem_size,
+        int ndim, uint64_t *lb, uint64_t *ub,
+        void *data)
+{
+    obj_descriptor odsc;
+    hg_size_t rdma_size;
+
+    ndstore_odsc_init(&odsc, var_name, ver, elem_size, ndim, lb, ub);
+    if(provider->client->cache)
+        return ndstore_get_cached(provider, &odsc, data);
+    rdma_size = obj_data_size(&odsc);
+    return ndstore_get_segments(provider, &odsc, NULL, 1, &data, &rdma_size);
+}
+
+int ndstore_get_layout(ndstore_provider_handle_t provider,
+        const char *var_name,
+        unsigned int ver, int elem_size,
+        int ndim, uint64_t *lb, uint64_t *ub,
+        const uint64_t *dims, const uint64_t *offset,
+        void *data)
+{
+    obj_descriptor odsc;
+    void **ptrs;
+    hg_size_t *sizes;
+    int ret, num;
+
+    num = ndstore_layout_segments(elem_size, ndim, lb, ub, dims, offset,
+            data, &ptrs, &sizes);
+    if(num < 0)
+        return num;
+    ndstore_odsc_init(&odsc, var_name, ver, elem_size, ndim, lb, ub);
+    ret = ndstore_get_segments(provider, &odsc, NULL, num, ptrs, sizes);
+    free(ptrs);
+    free(sizes);
+    return ret;
+}
+
+int ndstore_get_iov(ndstore_provider_handle_t provider,
+        const char *var_name,
+        unsigned int ver, int elem_size,
+        int ndim, uint64_t *lb, uint64_t *ub,
+        int iovcnt, const struct iovec *iov)
+{
+    obj_descriptor odsc;
+    void **ptrs;
+    hg_size_t *sizes;
+    int ret;
+
+    ret = ndstore_iov_segments(iovcnt, iov, &ptrs, &sizes);
+    if(ret != NDSTORE_SUCCESS)
+        return ret;
+    ndstore_odsc_init(&odsc, var_name, ver, elem_size, ndim, lb, ub);
+    ret = ndstore_get_segments(provider, &odsc, NULL, iovcnt, ptrs, sizes);
+    free(ptrs);
+    free(sizes);
+    return ret;
+}
+
+/*
+  Names of the fields of a multi-field put or get, packed for the wire,
+  and one segment per field. Returns the number of fields.
+*/
+static int ndstore_field_segments(int elem_size, int ndim,
+        uint64_t *lb, uint64_t *ub,
+        int num_fields, const char **field_names, void **data,
+        char **fields, hg_size_t **sizes)
+{
+    hg_size_t len = (hg_size_t)elem_size;
+    int i, j, d;
+
+    if(num_fields < 1 || !field_names || !data)
+        return NDSTORE_ERR_INVALID_ARG;
+    for(i = 0; i < num_fields; i++) {
+        if(!field_names[i] || !field_names[i][0] ||
+           strlen(field_names[i]) >= FIELD_NAME_LEN)
+            return NDSTORE_ERR_INVALID_ARG;
+        for(j = 0; j < i; j++)
+            if(strcmp(field_names[i], field_names[j]) == 0)
+                return NDSTORE_ERR_INVALID_ARG;
+    }
+    for(d = 0; d < ndim; d++)
+        len *= ub[d] - lb[d] + 1;
+
+    *fields = calloc(num_fields, FIELD_NAME_LEN);
+    *sizes = malloc(sizeof(**sizes) * num_fields);
+    if(!*fields || !*sizes) {
+        free(*fields);
+        free(*sizes);
+        return NDSTORE_ERR_ALLOCATION;
+    }
+    for(i = 0; i < num_fields; i++) {
+        strcpy(*fields + i * FIELD_NAME_LEN, field_names[i]);
+        (*sizes)[i] = len;
+    }
+    return num_fields;
+}
+
+int ndstore_put_fields(ndstore_provider_handle_t provider,
+        const char *var_name,
+        unsigned int ver, int elem_size,
+        int ndim, uint64_t *lb, uint64_t *ub,
+        int num_fields, const char **field_names, void **data)
+{
+    obj_descriptor odsc;
+    char *fields;
+    hg_size_t *sizes;
+    int ret, num;
+
+    num = ndstore_field_segments(elem_size, ndim, lb, ub, num_fields,
+            field_names, data, &fields, &sizes);
+    if(num < 0)
+        return num;
+    ndstore_odsc_init(&odsc, var_name, ver, elem_size, ndim, lb, ub);
+    odsc.num_fields = num;
+    ret = ndstore_put_segments(provider, &odsc, fields, num, data, sizes);
+    free(fields);
+    free(sizes);
+    return ret;
+}
+
+int ndstore_get_fields(ndstore_provider_handle_t provider,
+        const char *var_name,
+        unsigned int ver, int elem_size,
+        int ndim, uint64_t *lb, uint64_t *ub,
+        int num_fields, const char **field_names, void **data)
+{
+    obj_descriptor odsc;
+    char *fields;
+    hg_size_t *sizes;
+    int ret, num;
+
+    num = ndstore_field_segments(elem_size, ndim, lb, ub, num_fields,
+            field_names, data, &fields, &sizes);
+    if(num < 0)
+        return num;
+    ndstore_odsc_init(&odsc, var_name, ver, elem_size, ndim, lb, ub);
+    odsc.num_fields = num;
+    ret = ndstore_get_segments(provider, &odsc, fields, num, data, sizes);
+    free(fields);
+    free(sizes);
+    return ret;
+}
+
+int ndstore_put_level(ndstore_provider_handle_t provider,
+        const char *var_name,
+        unsigned int ver, int elem_size,
+        int ndim, unsigned int level, uint64_t *lb, uint64_t *ub,
+        void *data)
+{
+    obj_descriptor odsc;
+    hg_size_t rdma_size;
+
+    ndstore_odsc_init(&odsc, var_name, ver, elem_size, ndim, lb, ub);
+    odsc.level = level;
+    rdma_size = obj_data_size(&odsc);
+    return ndstore_put_segments(provider, &odsc, NULL, 1, &data, &rdma_size);
+}
+
+int ndstore_get_level(ndstore_provider_handle_t provider,
+        const char *var_name,
+        unsigned int ver, int elem_size,
+        int ndim, unsigned int level, unsigned int refine,
+        uint64_t *lb, uint64_t *ub,
+        void *data)
+{
+    obj_descriptor odsc;
+    hg_size_t rdma_size;
+
+    if(refine == 1)
+        return NDSTORE_ERR_INVALID_ARG;
+    ndstore_odsc_init(&odsc, var_name, ver, elem_size, ndim, lb, ub);
+    odsc.level = level;
+    odsc.refine = refine;
+    rdma_size = obj_data_size(&odsc);
+    return ndstore_get_segments(provider, &odsc, NULL, 1, &data, &rdma_size);
+}
+
+int ndstore_put_points(ndstore_provider_handle_t provider,
+        const char *var_name,
+        unsigned int ver, int elem_size, int ndim,
+        uint64_t num_points, uint64_t *coords, void *data)
+{
+    obj_descriptor odsc;
+    uint64_t lb[BBOX_MAX_NDIM], ub[BBOX_MAX_NDIM], i;
+    void *ptrs[2] = {coords, data};
+    hg_size_t sizes[2];
+    int d;
+
+    if(ndim < 1 || ndim > BBOX_MAX_NDIM || !num_points || !coords || !data)
+        return NDSTORE_ERR_INVALID_ARG;
+
+    /* the bounding box of the points */
+    for(d = 0; d < ndim; d++)
+        lb[d] = ub[d] = coords[d];
+    for(i = 1; i < num_points; i++) {
+        for(d = 0; d < ndim; d++) {
+            uint64_t c = coords[i * ndim + d];
+            if(c < lb[d])
+                lb[d] = c;
+            if(c > ub[d])
+                ub[d] = c;
+        }
+    }
+
+    ndstore_odsc_init(&odsc, var_name, ver, elem_size, ndim, lb, ub);
+    odsc.kind = OBJ_POINTS;
+    odsc.num_points = num_points;
+    sizes[0] = num_points * ndim * sizeof(uint64_t);
+    sizes[1] = num_points * elem_size;
+    return ndstore_put_segments(provider, &odsc, NULL, 2, ptrs, sizes);
+}
+
+int ndstore_get_points(ndstore_provider_handle_t provider,
+        const char *var_name,
+        unsigned int ver, int elem_size,
+        int ndim, uint64_t *lb, uint64_t *ub,
+        uint64_t max_points, uint64_t *coords, void *data,
+        uint64_t *num_points)
+{
+    hg_return_t hret;
+    int ret = NDSTORE_SUCCESS;
+    hg_handle_t handle;
+    obj_descriptor odsc;
+    bulk_in_t in;
+    points_out_t out;
+
+    if(ndim < 1 || ndim > BBOX_MAX_NDIM || (max_points && (!coords || !data)))
+        return NDSTORE_ERR_INVALID_ARG;
+
+    ndstore_odsc_init(&odsc, var_name, ver, elem_size, ndim, lb, ub);
+    odsc.kind = OBJ_POINTS;
+    odsc.num_points = max_points;
+
+    in.odsc.size = sizeof(odsc);
+    in.odsc.raw_odsc = (char*)(&odsc);
+    in.comp_codec = NDSTORE_CODEC_NONE;
+    in.comp_size = 0;
+    in.origin = 0;
+    in.seq = 0;
+    in.fields.size = 0;
+    in.fields.raw_odsc = NULL;
+    in.handle = HG_BULK_NULL;
+
+    /* coordinates first, then the values */
+    if(max_points) {
+        void *ptrs[2] = {coords, data};
+        hg_size_t sizes[2] = {max_points * ndim * sizeof(uint64_t),
+                              max_points * elem_size};
+
+        hret = margo_bulk_create(provider->client->mid, 2, ptrs, sizes,
+                                HG_BULK_WRITE_ONLY, &in.handle);
+        if(hret != HG_SUCCESS) {
+            fprintf(stderr,"[NDSTORE] margo_bulk_create() failed in ndstore_get_points()\n");
+            return NDSTORE_ERR_MERCURY;
+        }
+    }
+
+    hret = margo_create(
+            provider->client->mid,
+            provider->addr,
+            provider->client->ndstore_get_points_id,
+            &handle);
+    if(hret != HG_SUCCESS) {
+        fprintf(stderr,"[NDSTORE] margo_create() failed in ndstore_get_points()\n");
+        if(in.handle != HG_BULK_NULL)
+            margo_bulk_free(in.handle);
+        return NDSTORE_ERR_MERCURY;
+    }
+
+    hret = margo_provider_forward(provider->provider_id, handle, &in);
+    if(hret != HG_SUCCESS) {
+        fprintf(stderr,"[NDSTORE] margo_forward() failed in ndstore_get_points()\n");
+        if(in.handle != HG_BULK_NULL)
+            margo_bulk_free(in.handle);
+        margo_destroy(handle);
+        return NDSTORE_ERR_MERCURY;
+    }
+
+    hret = margo_get_output(handle, &out);
+    if(hret != HG_SUCCESS) {
+        fprintf(stderr,"[NDSTORE] margo_get_output() failed in ndstore_get_points()\n");
+        if(in.handle != HG_BULK_NULL)
+            margo_bulk_free(in.handle);
+        margo_destroy(handle);
+        return NDSTORE_ERR_MERCURY;
+    }
+
+    ret = out.ret;
+    if(num_points)
+        *num_points = out.num_points;
+    margo_free_output(handle, &out);
+    if(in.handle != HG_BULK_NULL)
+        margo_bulk_free(in.handle);
+    margo_destroy(handle);
+    return ret;
+}
+
+/* Lets the provider unpin the pieces of a client-pull get. */
+static void ndstore_release(ndstore_provider_handle_t provider, uint64_t lease)
+{
+    hg_return_t hret;
+    hg_handle_t handle;
+    lease_in_t in;
+    bulk_out_t out;
+
+    in.lease = lease;
+    hret = margo_create(
+            provider->client->mid,
+            provider->addr,
+            provider->client->ndstore_release_id,
+            &handle);
+    if(hret != HG_SUCCESS) {
+        fprintf(stderr,"[NDSTORE] margo_create() failed in ndstore_release()\n");
+        return;
+    }
+    hret = margo_provider_forward(provider->provider_id, handle, &in);
+    if(hret == HG_SUCCESS && margo_get_output(handle, &out) == HG_SUCCESS)
+        margo_free_output(handle, &out);
+    margo_destroy(handle);
+}
+
+/* Copy the pieces pulled into 'stage' to their place in 'dst'. */
+static int ndstore_get_unpack(struct obj_data *dst, struct piece_desc *pd,
+        void *stage)
+{
+    struct obj_data *from;
+
+    from = obj_data_alloc_no_data(&pd->odsc, (char*)stage + pd->offset);
+    if(!from)
+        return NDSTORE_ERR_ALLOCATION;
+    ssd_copy(dst, from);
+    from->data = NULL;
+    obj_data_free(from);
+    return NDSTORE_SUCCESS;
+}
+
+int ndstore_get_pull(ndstore_provider_handle_t provider,
+        const char *var_name,
+        unsigned int ver, int elem_size,
+        int ndim, uint64_t *lb, uint64_t *ub,
+        void *data)
+{
+    hg_return_t hret;
+    int ret = NDSTORE_SUCCESS;
+    hg_handle_t handle;
+    struct trace_ring *trace = provider->client->trace;
+    struct trace_event ev;
+
+    obj_descriptor odsc = {
+            .version = ver, .owner = -1,
+            .st = st,
+            .size = elem_size,
+            .bb = {.num_dims = ndim,}
+    };
+
+    memset(odsc.bb.lb.c, 0, sizeof(uint64_t)*BBOX_MAX_NDIM);
+    memset(odsc.bb.ub.c, 0, sizeof(uint64_t)*BBOX_MAX_NDIM);
+
+    memcpy(odsc.bb.lb.c, lb, sizeof(uint64_t)*ndim);
+    memcpy(odsc.bb.ub.c, ub, sizeof(uint64_t)*ndim);
+
+    strncpy(odsc.name, var_name, sizeof(odsc.name)-1);
+    odsc.name[sizeof(odsc.name)-1] = '\0';
+
+    bulk_in_t in;
+    pieces_out_t out;
+
+    in.odsc.size = sizeof(odsc);
+    in.odsc.raw_odsc = (char*)(&odsc);
+    in.comp_codec = NDSTORE_CODEC_NONE;
+    in.comp_size = 0;
+    in.origin = 0;
+    in.seq = 0;
+    in.handle = HG_BULK_NULL;
+    in.fields.size = 0;
+    in.fields.raw_odsc = NULL;
+
+    if(trace)
+        trace_event_init(&ev, NDSTORE_STATS_OP_GET_PIECES, var_name, ver,
+                elem_size * bbox_volume(&odsc.bb));
+
+    hret = margo_create(
+            provider->client->mid,
+            provider->addr,
+            provider->client->ndstore_get_pieces_id,
+            &handle);
+    if(hret != HG_SUCCESS) {
+        fprintf(stderr,"[NDSTORE] margo_create() failed in ndstore_get_pull()\n");
+        return NDSTORE_ERR_MERCURY;
+    }
+    if(trace)
+        ev.t_reg = ev.t_sent = ABT_get_wtime();
+
+    hret = margo_provider_forward(provider->provider_id, handle, &in);
+    if(hret != HG_SUCCESS) {
+        fprintf(stderr,"[NDSTORE] margo_forward() failed in ndstore_get_pull()\n");
+        margo_destroy(handle);
+        return NDSTORE_ERR_MERCURY;
+    }
+    if(trace)
+        ev.t_reply = ABT_get_wtime();
+
+    hret = margo_get_output(handle, &out);
+    if(hret != HG_SUCCESS) {
+        fprintf(stderr,"[NDSTORE] margo_get_output() failed in ndstore_get_pull()\n");
+        margo_destroy(handle);
+        return NDSTORE_ERR_MERCURY;
+    }
+    ret = out.ret;
+    if(trace) {
+        ev.ret = out.ret;
+        ev.server_ns = out.srv_time;
+    }
+    if(ret != NDSTORE_SUCCESS) {
+        margo_free_output(handle, &out);
+        margo_destroy(handle);
+        return ret;
+    }
+
+    /* pull every piece to its offset in a staging buffer laid out like
+     * the pieces on the provider, and unpack each one as it arrives */
+    struct piece_desc *pd = (struct piece_desc*)out.pieces.raw_odsc;
+    int i, num = out.pieces.size / sizeof(*pd);
+    hg_size_t total = 0;
+    void *stage = NULL;
+    hg_bulk_t local = HG_BULK_NULL;
+    margo_request *reqs = NULL;
+    struct obj_data *dst = NULL;
+
+    for(i = 0; i < num; i++) {
+        if(pd[i].odsc.size != (uint64_t)elem_size || pd[i].offset != total)
+            ret = NDSTORE_ERR_MERCURY;
+        total += obj_data_size(&pd[i].odsc);
+    }
+    if(ret == NDSTORE_SUCCESS) {
+        stage = malloc(total);
+        reqs = calloc(num, sizeof(*reqs));
+        dst = obj_data_alloc_no_data(&odsc, data);
+        if(!stage || !reqs || !dst)
+            ret = NDSTORE_ERR_ALLOCATION;
+    }
+    if(ret == NDSTORE_SUCCESS) {
+        hret = margo_bulk_create(provider->client->mid, 1, &stage, &total,
+                                HG_BULK_WRITE_ONLY, &local);
+        if(hret != HG_SUCCESS) {
+            fprintf(stderr,"[NDSTORE] margo_bulk_create() failed in ndstore_get_pull()\n");
+            local = HG_BULK_NULL;
+            ret = NDSTORE_ERR_MERCURY;
+        }
+    }
+    for(i = 0; i < num && ret == NDSTORE_SUCCESS; i++) {
+        hret = margo_bulk_itransfer(provider->client->mid, HG_BULK_PULL,
+                provider->addr, out.handle, pd[i].offset, local, pd[i].offset,
+                obj_data_size(&pd[i].odsc), &reqs[i]);
+        if(hret != HG_SUCCESS) {
+            fprintf(stderr,"[NDSTORE] margo_bulk_itransfer() failed in ndstore_get_pull()\n");
+            ret = NDSTORE_ERR_MERCURY;
+        }
+    }
+    /* wait for every transfer issued, even after a failure, since they
+     * write to the staging buffer */
+    for(i = 0; i < num && reqs && reqs[i]; i++) {
+        hret = margo_wait(reqs[i]);
+        if(hret != HG_SUCCESS) {
+            fprintf(stderr,"[NDSTORE] margo_wait() failed in ndstore_get_pull()\n");
+            ret = NDSTORE_ERR_MERCURY;
+        }
+        if(ret == NDSTORE_SUCCESS)
+            ret = ndstore_get_unpack(dst, &pd[i], stage);
+    }
+
+    if(local != HG_BULK_NULL)
+        margo_bulk_free(local);
+    if(dst) {
+        dst->data = NULL;
+        obj_data_free(dst);
+    }
+    free(reqs);
+    free(stage);
+
+    uint64_t lease = out.lease;
+    margo_free_output(handle, &out);
+    margo_destroy(handle);
+    ndstore_release(provider, lease);
+
+    if(trace) {
+        ev.ret = ret;
+        ev.t_end = ABT_get_wtime();
+        trace_ring_push(trace, &ev);
+    }
+    return ret;
+}
+
+int ndstore_get_versions(ndstore_provider_handle_t provider,
+        const char *var_name,
+        unsigned int ver_lo, unsigned int ver_hi, int elem_size,
+        int ndim, uint64_t *lb, uint64_t *ub,
+        void *data)
+{
+    hg_return_t hret;
+    int ret = NDSTORE_SUCCESS;
+    hg_handle_t handle;
+    obj_descriptor odsc;
+    versions_in_t in;
+    bulk_out_t out;
+    struct trace_ring *trace = provider->client->trace;
+    struct trace_event ev;
+
+    if(ver_hi < ver_lo)
+        return NDSTORE_ERR_INVALID_ARG;
+
+    ndstore_odsc_init(&odsc, var_name, ver_lo, elem_size, ndim, lb, ub);
+    in.odsc.size = sizeof(odsc);
+    in.odsc.raw_odsc = (char*)(&odsc);
+    in.ver_hi = ver_hi;
+
+    hg_size_t rdma_size = ((hg_size_t)ver_hi - ver_lo + 1) * obj_data_size(&odsc);
+
+    if(trace)
+        trace_event_init(&ev, NDSTORE_STATS_OP_GET, odsc.name, ver_lo, rdma_size);
+
+    hret = margo_bulk_create(provider->client->mid, 1, &data, &rdma_size,
+                            HG_BULK_WRITE_ONLY, &in.handle);
+    if(hret != HG_SUCCESS) {
+        fprintf(stderr,"[NDSTORE] margo_bulk_create() failed in ndstore_get_versions()\n");
+        return NDSTORE_ERR_MERCURY;
+    }
+    if(trace)
+        ev.t_reg = ABT_get_wtime();
+
+    hret = margo_create(
+            provider->client->mid,
+            provider->addr,
+            provider->client->ndstore_get_versions_id,
+            &handle);
+    if(hret != HG_SUCCESS) {
+        fprintf(stderr,"[NDSTORE] margo_create() failed in ndstore_get_versions()\n");
+        margo_bulk_free(in.handle);
+        return NDSTORE_ERR_MERCURY;
+    }
+
+    hret = margo_provider_forward(provider->provider_id, handle, &in);
+    if(hret != HG_SUCCESS) {
+        fprintf(stderr,"[NDSTORE] margo_forward() failed in ndstore_get_versions()\n");
+        margo_bulk_free(in.handle);
+        margo_destroy(handle);
+        return NDSTORE_ERR_MERCURY;
+    }
+    if(trace)
+        ev.t_sent = ev.t_reply = ABT_get_wtime();
+
+    hret = margo_get_output(handle, &out);
+    if(hret != HG_SUCCESS) {
+        fprintf(stderr,"[NDSTORE] margo_get_output() failed in ndstore_get_versions()\n");
+        margo_bulk_free(in.handle);
+        margo_destroy(handle);
+        return NDSTORE_ERR_MERCURY;
+    }
+
+    ret = out.ret;
+    if(trace) {
+        ev.ret = out.ret;
+        ev.server_ns = out.srv_time;
+    }
+    margo_free_output(handle, &out);
+    margo_bulk_free(in.handle);
+    margo_destroy(handle);
+
+    if(trace) {
+        ev.t_end = ABT_get_wtime();
+        trace_ring_push(trace, &ev);
+    }
+    return ret;
+}
+
+int ndstore_get_stats(ndstore_provider_handle_t provider,
+        struct ndstore_stats *stats)
+{
+    hg_return_t hret;
+    int ret = NDSTORE_SUCCESS;
+    hg_handle_t handle;
+
+    bulk_in_t in;
+    bulk_out_t out;
+
+    in.odsc.size = 0;
+    in.odsc.raw_odsc = NULL;
+    in.comp_codec = NDSTORE_CODEC_NONE;
+    in.comp_size = 0;
+    in.origin = 0;
+    in.seq = 0;
+    in.fields.size = 0;
+    in.fields.raw_odsc = NULL;
+
+    hg_size_t rdma_size = sizeof(*stats);
+
+    hret = margo_bulk_create(provider->client->mid, 1, (void**)(&stats), &rdma_size,
+                            HG_BULK_WRITE_ONLY, &in.handle);
+    if(hret != HG_SUCCESS) {
+        fprintf(stderr,"[NDSTORE] margo_bulk_create() failed in ndstore_get_stats()\n");
+        return NDSTORE_ERR_MERCURY;
+    }
+
+    hret = margo_create(
+            provider->client->mid,
+            provider->addr,
+            provider->client->ndstore_stats_id,
+            &handle);
+    if(hret != HG_SUCCESS) {
+        fprintf(stderr,"[NDSTORE] margo_create() failed in ndstore_get_stats()\n");
+        margo_bulk_free(in.handle);
+        return NDSTORE_ERR_MERCURY;
+    }
+
+    hret = margo_provider_forward(provider->provider_id, handle, &in);
+    if(hret != HG_SUCCESS) {
+        fprintf(stderr,"[NDSTORE] margo_forward() failed in ndstore_get_stats()\n");
+        margo_bulk_free(in.handle);
+        margo_destroy(handle);
+        return NDSTORE_ERR_MERCURY;
+    }
+
+    hret = margo_get_output(handle, &out);
+    if(hret != HG_SUCCESS) {
+        fprintf(stderr,"[NDSTORE] margo_get_output() failed in ndstore_get_stats()\n");
+        margo_bulk_free(in.handle);
+        margo_destroy(handle);
+        return NDSTORE_ERR_MERCURY;
+    }
+
+    ret = out.ret;
+    margo_free_output(handle, &out);
+    margo_bulk_free(in.handle);
+
+    margo_destroy(handle);
+    return ret;
+}
+
+int ndstore_set_var_policy(ndstore_provider_handle_t provider,
+        const char *var_name,
+        const struct ndstore_var_policy *policy)
+{
+    hg_return_t hret;
+    int ret = NDSTORE_SUCCESS;
+    hg_handle_t handle;
+    struct policy_rec rec;
+
+    policy_in_t in;
+    bulk_out_t out;
+
+    if(!var_name || !policy || strlen(var_name) >= POLICY_NAME_LEN)
+        return NDSTORE_ERR_INVALID_ARG;
+
+    memset(&rec, 0, sizeof(rec));
+    strcpy(rec.name, var_name);
+    rec.policy = *policy;
+    in.rec.size = sizeof(rec);
+    in.rec.raw_odsc = (char*)&rec;
+
+    hret = margo_create(
+            provider->client->mid,
+            provider->addr,
+            provider->client->ndstore_policy_id,
+            &handle);
+    if(hret != HG_SUCCESS) {
+        fprintf(stderr,"[NDSTORE] margo_create() failed in ndstore_set_var_policy()\n");
+        return NDSTORE_ERR_MERCURY;
+    }
+
+    hret = margo_provider_forward(provider->provider_id, handle, &in);
+    if(hret != HG_SUCCESS) {
+        fprintf(stderr,"[NDSTORE] margo_forward() failed in ndstore_set_var_policy()\n");
+        margo_destroy(handle);
+        return NDSTORE_ERR_MERCURY;
+    }
+
+    hret = margo_get_output(handle, &out);
+    if(hret != HG_SUCCESS) {
+        fprintf(stderr,"[NDSTORE] margo_get_output() failed in ndstore_set_var_policy()\n");
+        margo_destroy(handle);
+        return NDSTORE_ERR_MERCURY;
+    }
+
+    ret = out.ret;
+    margo_free_output(handle, &out);
+    margo_destroy(handle);
+    return ret;
+}
+
+int ndstore_delete(ndstore_provider_handle_t provider,
+        const char *var_name,
+        unsigned int ver_lo, unsigned int ver_hi,
+        int ndim, uint64_t *lb, uint64_t *ub)
+{
+    hg_return_t hret;
+    int ret = NDSTORE_SUCCESS;
+    hg_handle_t handle;
+
+    if(!var_name || ndim < 0 || ndim > BBOX_MAX_NDIM ||
+       (ndim && (!lb || !ub)))
+        return NDSTORE_ERR_INVALID_ARG;
+
+    obj_descriptor odsc = {
+            .version = ver_lo, .owner = -1,
+            .st = st,
+            .bb = {.num_dims = ndim,}
+    };
+
+    memset(odsc.bb.lb.c, 0, sizeof(uint64_t)*BBOX_MAX_NDIM);
+    memset(odsc.bb.ub.c, 0, sizeof(uint64_t)*BBOX_MAX_NDIM);
+
+    if(ndim) {
+        memcpy(odsc.bb.lb.c, lb, sizeof(uint64_t)*ndim);
+        memcpy(odsc.bb.ub.c, ub, sizeof(uint64_t)*ndim);
+    }
+
+    strncpy(odsc.name, var_name, sizeof(odsc.name)-1);
+    odsc.name[sizeof(odsc.name)-1] = '\0';
+
+    delete_in_t in;
+    bulk_out_t out;
+
+    in.odsc.size = sizeof(odsc);
+    in.odsc.raw_odsc = (char*)(&odsc);
+    in.ver_hi = ver_hi;
+    in.origin = 0;
+    in.seq = 0;
+
+    hret = margo_create(
+            provider->client->mid,
+            provider->addr,
+            provider->client->ndstore_delete_id,
+            &handle);
+    if(hret != HG_SUCCESS) {
+        fprintf(stderr,"[NDSTORE] margo_create() failed in ndstore_delete()\n");
+        return NDSTORE_ERR_MERCURY;
+    }
+
+    hret = margo_provider_forward(provider->provider_id, handle, &in);
+    if(hret != HG_SUCCESS) {
+        fprintf(stderr,"[NDSTORE] margo_forward() failed in ndstore_delete()\n");
+        margo_destroy(handle);
+        return NDSTORE_ERR_MERCURY;
+    }
+
+    hret = margo_get_output(handle, &out);
+    if(hret != HG_SUCCESS) {
+        fprintf(stderr,"[NDSTORE] margo_get_output() failed in ndstore_delete()\n");
+        margo_destroy(handle);
+        return NDSTORE_ERR_MERCURY;
+    }
+
+    ret = out.ret;
+    if(ret == NDSTORE_SUCCESS)
+        ndstore_saw(provider, out.origin, out.seq);
+    margo_free_output(handle, &out);
+    margo_destroy(handle);
+    if(ret == NDSTORE_SUCCESS && provider->client->cache)
+        cache_invalidate(provider->client->cache, &odsc, ver_hi);
+    return ret;
 }
@@ -4,27 +4,211 @@
  * See COPYRIGHT in top-level directory.
  */
 
+#include <time.h>
+#include <unistd.h>
 #include "ss_data.h"
+#include "stats.h"
+#include "policy.h"
+#include "compress.h"
+#include "grid.h"
+#include "gc.h"
+#include "points.h"
+#include "cache.h"
 #include "ndstore-server.h"
 
 static enum storage_type st = column_major;
 
+/* period of the retention GC and of the lease reaping, in seconds */
+#define NDSTORE_GC_INTERVAL 1.0
+
+/* gets smaller than this are assembled by the handler alone */
+#define NDSTORE_COPY_MIN_SIZE (1 << 20)
+#define NDSTORE_COPY_ULTS 8
+
+/* pieces of a client-pull get that are not released after this many
+ * seconds are reclaimed */
+#define NDSTORE_LEASE_TIMEOUT 60.0
+
+/* clients that do not acknowledge an invalidation within this many
+ * milliseconds are dropped from the subscribers */
+#define NDSTORE_INVALIDATE_TIMEOUT_MS 1000.0
+
+/* a replica that does not answer a forwarded put or delete within this
+ * many milliseconds misses it */
+#define NDSTORE_REPLICATE_TIMEOUT_MS 10000.0
+
+/* a peer provider holding a replica of the objects put here */
+struct replica {
+    char *addr_str;
+    hg_addr_t addr;
+    uint16_t provider_id;
+};
+
+/* a change of versions odsc->version to ver_hi in odsc->bb that the
+ * subscribed clients are still to be told about */
+struct invalidate_op {
+    struct list_head entry;
+    obj_descriptor odsc;
+    uint32_t ver_hi;
+};
+
+/* last update of the provider 'origin' a replica applied in order */
+struct applied {
+    uint64_t origin;
+    uint64_t seq;
+};
+
+/* a put (od, pinned), a delete (odsc to ver_hi) or a policy (rec) still
+ * to be forwarded to the replicas */
+struct replicate_op {
+    struct list_head entry;
+    struct obj_data *od;
+    obj_descriptor odsc;
+    uint32_t ver_hi;
+    struct policy_rec *rec;
+    uint64_t seq;
+};
+
 struct ndstore_provider{
     margo_instance_id mid;
+    ABT_pool pool;
     hg_id_t ndstore_put_id;
     hg_id_t ndstore_get_id;
+    hg_id_t ndstore_stats_id;
+    hg_id_t ndstore_policy_id;
+    hg_id_t ndstore_delete_id;
+    hg_id_t ndstore_get_pieces_id;
+    hg_id_t ndstore_release_id;
+    hg_id_t ndstore_get_points_id;
+    hg_id_t ndstore_get_versions_id;
+    hg_id_t ndstore_subscribe_id;
+    hg_id_t ndstore_invalidate_id;
+    hg_id_t ndstore_unsubscribe_id;
+    hg_id_t ndstore_replicate_id;
+    hg_id_t ndstore_replicate_delete_id;
+    hg_id_t ndstore_replicate_policy_id;
+    /* the same RPCs, to forward to the replicas */
+    hg_id_t ndstore_replicate_fwd_id;
+    hg_id_t ndstore_replicate_delete_fwd_id;
+    hg_id_t ndstore_replicate_policy_fwd_id;
     ss_storage *ls;
+    /* bytes the storage may hold, 0 for no limit, and the bytes of
+     * the puts admitted but not stored yet */
+    uint64_t mem_budget;
+    hg_atomic_int64_t reserved;
+    /* NUMA nodes the payloads are spread over, and the pools in which
+     * gets copy the pieces held by each node */
+    int num_numa;
+    int *numa_nodes;
+    ABT_pool *numa_pools;
+    /* pages of large payloads, enum ndstore_pages */
+    int pages;
+    /* most ULTs assembling the result of one get */
+    int copy_ults;
+
+    /* pieces exposed to client-pull gets until they are released */
+    ABT_mutex lease_lock;
+    struct list_head leases;
+    uint64_t next_lease;
+
+    /* clients caching what they read, told about overwrites and
+     * deletes by a ULT draining the queue of invalidations, started
+     * with the first subscription */
+    ABT_mutex sub_lock;
+    hg_addr_t *subs;
+    int num_subs;
+    ABT_cond inval_cond;
+    struct list_head inval_ops;
+    int inval_stop;
+    ABT_thread inval_ult;
 
+    /* results of recent gets, NULL when disabled, and the gets being
+     * assembled, which identical ones wait for */
+    struct cache *results;
+    ABT_mutex inflight_lock;
+    struct list_head inflight;
+
+    /* peers the puts and deletes are forwarded to, in arrival order,
+     * by a ULT draining the queue */
+    struct replica *replicas;
+    int num_replicas;
+    ABT_mutex repl_lock;
+    ABT_cond repl_cond;
+    struct list_head repl_ops;
+    int repl_stop;
+    ABT_thread repl_ult;
+    /* number of the last update queued for the replicas, which the
+     * replicas know this provider by as 'origin' and, as a replica, the
+     * last update applied in order of each provider forwarding here
+     * (see ndstore_applied()), all under repl_lock */
+    uint64_t origin;
+    uint64_t repl_seq;
+    struct applied *applied;
+    int num_applied;
+
+    struct policy_table *policies;
+    /* background compression and re-chunking ULTs still running */
+    hg_atomic_int32_t bg_pending;
+    /* retention GC and lease reaping, started with the provider; the
+     * GC itself only runs once a policy needs it */
+    hg_atomic_int32_t gc_started;
+    int gc_retention;
+    int gc_stop;
+    ABT_thread gc_ult;
+
+    struct stats_rec stats;
+    /* periodic dump of the statistics */
+    char *stats_path;
+    double stats_interval;
+    int stats_stop;
+    ABT_thread stats_ult;
 };
 
 
 DECLARE_MARGO_RPC_HANDLER(ndstore_put_ult);
 DECLARE_MARGO_RPC_HANDLER(ndstore_get_ult);
+DECLARE_MARGO_RPC_HANDLER(ndstore_stats_ult);
+DECLARE_MARGO_RPC_HANDLER(ndstore_policy_ult);
+DECLARE_MARGO_RPC_HANDLER(ndstore_delete_ult);
+DECLARE_MARGO_RPC_HANDLER(ndstore_get_pieces_ult);
+DECLARE_MARGO_RPC_HANDLER(ndstore_release_ult);
+DECLARE_MARGO_RPC_HANDLER(ndstore_get_points_ult);
+DECLARE_MARGO_RPC_HANDLER(ndstore_get_versions_ult);
+DECLARE_MARGO_RPC_HANDLER(ndstore_subscribe_ult);
+DECLARE_MARGO_RPC_HANDLER(ndstore_unsubscribe_ult);
 
 static void ndstore_put_ult(hg_handle_t h);
 static void ndstore_get_ult(hg_handle_t h);
+static void ndstore_stats_ult(hg_handle_t h);
+static void ndstore_policy_ult(hg_handle_t h);
+static void ndstore_delete_ult(hg_handle_t h);
+static void ndstore_get_pieces_ult(hg_handle_t h);
+static void ndstore_release_ult(hg_handle_t h);
+static void ndstore_get_points_ult(hg_handle_t h);
+static void ndstore_get_versions_ult(hg_handle_t h);
+static void ndstore_subscribe_ult(hg_handle_t h);
+static void ndstore_unsubscribe_ult(hg_handle_t h);
 
 static void ndstore_finalize_provider(void* p);
+static void ndstore_lease_reap(ndstore_provider_t provider, double now);
+static int ndstore_gc_start(ndstore_provider_t provider);
+static int ndstore_overwrites(ndstore_provider_t provider, obj_descriptor *odsc);
+static void ndstore_invalidate(ndstore_provider_t provider, obj_descriptor *odsc,
+        uint32_t ver_hi);
+static void ndstore_notify_ult(void *arg);
+static uint64_t ndstore_replicate(ndstore_provider_t provider, struct obj_data *od,
+        obj_descriptor *odsc, uint32_t ver_hi);
+static void ndstore_replicate_policy(ndstore_provider_t provider,
+        const char *name, const struct ndstore_var_policy *policy);
+static int ndstore_set_var_policy(ndstore_provider_t provider,
+        const char *name, const struct ndstore_var_policy *policy,
+        int forward);
+static void ndstore_applied(ndstore_provider_t provider, uint64_t origin,
+        uint64_t seq);
+static uint64_t ndstore_seq(ndstore_provider_t provider);
+static uint64_t ndstore_applied_seq(ndstore_provider_t provider, uint64_t origin);
+static uint64_t ndstore_origin(margo_instance_id mid, uint16_t provider_id);
+static void ndstore_replicate_ult(void *arg);
 
 int ndstore_provider_register(
         margo_instance_id mid,
@@ -59,6 +243,61 @@ int ndstore_provider_register(
         return NDSTORE_ERR_ALLOCATION;
 
     server->mid = mid;
+    server->pool = pool;
+    if(pool == NDSTORE_ABT_POOL_DEFAULT)
+        margo_get_handler_pool(mid, &server->pool);
+    stats_init(&server->stats);
+    hg_atomic_init32(&server->bg_pending, 0);
+    hg_atomic_init32(&server->gc_started, 0);
+    hg_atomic_init64(&server->reserved, 0);
+    server->copy_ults = NDSTORE_COPY_ULTS;
+    server->origin = ndstore_origin(mid, provider_id);
+    INIT_LIST_HEAD(&server->leases);
+    if(ABT_mutex_create(&server->lease_lock) != ABT_SUCCESS) {
+        free(server);
+        return NDSTORE_ERR_ARGOBOTS;
+    }
+    if(ABT_mutex_create(&server->sub_lock) != ABT_SUCCESS) {
+        ABT_mutex_free(&server->lease_lock);
+        free(server);
+        return NDSTORE_ERR_ARGOBOTS;
+    }
+    INIT_LIST_HEAD(&server->inval_ops);
+    if(ABT_cond_create(&server->inval_cond) != ABT_SUCCESS) {
+        ABT_mutex_free(&server->sub_lock);
+        ABT_mutex_free(&server->lease_lock);
+        free(server);
+        return NDSTORE_ERR_ARGOBOTS;
+    }
+    server->inval_ult = ABT_THREAD_NULL;
+    INIT_LIST_HEAD(&server->inflight);
+    if(ABT_mutex_create(&server->inflight_lock) != ABT_SUCCESS) {
+        ABT_cond_free(&server->inval_cond);
+        ABT_mutex_free(&server->sub_lock);
+        ABT_mutex_free(&server->lease_lock);
+        free(server);
+        return NDSTORE_ERR_ARGOBOTS;
+    }
+    INIT_LIST_HEAD(&server->repl_ops);
+    if(ABT_mutex_create(&server->repl_lock) != ABT_SUCCESS) {
+        ABT_mutex_free(&server->inflight_lock);
+        ABT_cond_free(&server->inval_cond);
+        ABT_mutex_free(&server->sub_lock);
+        ABT_mutex_free(&server->lease_lock);
+        free(server);
+        return NDSTORE_ERR_ARGOBOTS;
+    }
+    if(ABT_cond_create(&server->repl_cond) != ABT_SUCCESS) {
+        ABT_mutex_free(&server->repl_lock);
+        ABT_mutex_free(&server->inflight_lock);
+        ABT_cond_free(&server->inval_cond);
+        ABT_mutex_free(&server->sub_lock);
+        ABT_mutex_free(&server->lease_lock);
+        free(server);
+        return NDSTORE_ERR_ARGOBOTS;
+    }
+    server->repl_ult = ABT_THREAD_NULL;
+
     hg_id_t rpc_id;
     rpc_id = MARGO_REGISTER_PROVIDER(mid, "ndstore_put_rpc",
             bulk_in_t, bulk_out_t,
@@ -71,6 +310,113 @@ int ndstore_provider_register(
             ndstore_get_ult, provider_id, pool);
     margo_register_data(mid, rpc_id, (void*)server, NULL);
     server->ndstore_get_id = rpc_id;
+
+    rpc_id = MARGO_REGISTER_PROVIDER(mid, "ndstore_stats_rpc",
+            bulk_in_t, bulk_out_t,
+            ndstore_stats_ult, provider_id, pool);
+    margo_register_data(mid, rpc_id, (void*)server, NULL);
+    server->ndstore_stats_id = rpc_id;
+
+    rpc_id = MARGO_REGISTER_PROVIDER(mid, "ndstore_policy_rpc",
+            policy_in_t, bulk_out_t,
+            ndstore_policy_ult, provider_id, pool);
+    margo_register_data(mid, rpc_id, (void*)server, NULL);
+    server->ndstore_policy_id = rpc_id;
+
+    rpc_id = MARGO_REGISTER_PROVIDER(mid, "ndstore_delete_rpc",
+            delete_in_t, bulk_out_t,
+            ndstore_delete_ult, provider_id, pool);
+    margo_register_data(mid, rpc_id, (void*)server, NULL);
+    server->ndstore_delete_id = rpc_id;
+
+    rpc_id = MARGO_REGISTER_PROVIDER(mid, "ndstore_get_pieces_rpc",
+            bulk_in_t, pieces_out_t,
+            ndstore_get_pieces_ult, provider_id, pool);
+    margo_register_data(mid, rpc_id, (void*)server, NULL);
+    server->ndstore_get_pieces_id = rpc_id;
+
+    rpc_id = MARGO_REGISTER_PROVIDER(mid, "ndstore_release_rpc",
+            lease_in_t, bulk_out_t,
+            ndstore_release_ult, provider_id, pool);
+    margo_register_data(mid, rpc_id, (void*)server, NULL);
+    server->ndstore_release_id = rpc_id;
+
+    rpc_id = MARGO_REGISTER_PROVIDER(mid, "ndstore_get_points_rpc",
+            bulk_in_t, points_out_t,
+            ndstore_get_points_ult, provider_id, pool);
+    margo_register_data(mid, rpc_id, (void*)server, NULL);
+    server->ndstore_get_points_id = rpc_id;
+
+    rpc_id = MARGO_REGISTER_PROVIDER(mid, "ndstore_get_versions_rpc",
+            versions_in_t, bulk_out_t,
+            ndstore_get_versions_ult, provider_id, pool);
+    margo_register_data(mid, rpc_id, (void*)server, NULL);
+    server->ndstore_get_versions_id = rpc_id;
+
+    rpc_id = MARGO_REGISTER_PROVIDER(mid, "ndstore_subscribe_rpc",
+            void, bulk_out_t,
+            ndstore_subscribe_ult, provider_id, pool);
+    margo_register_data(mid, rpc_id, (void*)server, NULL);
+    server->ndstore_subscribe_id = rpc_id;
+
+    rpc_id = MARGO_REGISTER_PROVIDER(mid, "ndstore_unsubscribe_rpc",
+            void, bulk_out_t,
+            ndstore_unsubscribe_ult, provider_id, pool);
+    margo_register_data(mid, rpc_id, (void*)server, NULL);
+    server->ndstore_unsubscribe_id = rpc_id;
+
+    /* served by the clients, which may share our margo instance */
+    {
+        hg_bool_t flag;
+
+        margo_registered_name(mid, "ndstore_invalidate_rpc", &rpc_id, &flag);
+        if(flag != HG_TRUE)
+            rpc_id = MARGO_REGISTER(mid, "ndstore_invalidate_rpc",
+                    delete_in_t, bulk_out_t, NULL);
+        server->ndstore_invalidate_id = rpc_id;
+    }
+
+    /* puts, deletes and policies forwarded by a peer: applied like the
+     * client ones, but not forwarded again */
+    rpc_id = MARGO_REGISTER_PROVIDER(mid, "ndstore_replicate_rpc",
+            bulk_in_t, bulk_out_t,
+            ndstore_put_ult, provider_id, pool);
+    margo_register_data(mid, rpc_id, (void*)server, NULL);
+    server->ndstore_replicate_id = rpc_id;
+
+    rpc_id = MARGO_REGISTER_PROVIDER(mid, "ndstore_replicate_delete_rpc",
+            delete_in_t, bulk_out_t,
+            ndstore_delete_ult, provider_id, pool);
+    margo_register_data(mid, rpc_id, (void*)server, NULL);
+    server->ndstore_replicate_delete_id = rpc_id;
+
+    rpc_id = MARGO_REGISTER_PROVIDER(mid, "ndstore_replicate_policy_rpc",
+            policy_in_t, bulk_out_t,
+            ndstore_policy_ult, provider_id, pool);
+    margo_register_data(mid, rpc_id, (void*)server, NULL);
+    server->ndstore_replicate_policy_id = rpc_id;
+
+    {
+        hg_bool_t flag;
+
+        margo_registered_name(mid, "ndstore_replicate_rpc", &rpc_id, &flag);
+        if(flag != HG_TRUE)
+            rpc_id = MARGO_REGISTER(mid, "ndstore_replicate_rpc",
+                    bulk_in_t, bulk_out_t, NULL);
+        server->ndstore_replicate_fwd_id = rpc_id;
+
+        margo_registered_name(mid, "ndstore_replicate_delete_rpc", &rpc_id, &flag);
+        if(flag != HG_TRUE)
+            rpc_id = MARGO_REGISTER(mid, "ndstore_replicate_delete_rpc",
+                    delete_in_t, bulk_out_t, NULL);
+        server->ndstore_replicate_delete_fwd_id = rpc_id;
+
+        margo_registered_name(mid, "ndstore_replicate_policy_rpc", &rpc_id, &flag);
+        if(flag != HG_TRUE)
+            rpc_id = MARGO_REGISTER(mid, "ndstore_replicate_policy_rpc",
+                    policy_in_t, bulk_out_t, NULL);
+        server->ndstore_replicate_policy_fwd_id = rpc_id;
+    }
     /* add other RPC registration here */
 
     server->ls = ls_alloc(MAX_VERSIONS);
@@ -80,6 +426,20 @@ int ndstore_provider_register(
             return NDSTORE_ERR_ALLOCATION;
         }
 
+    server->policies = policy_table_alloc();
+    if (!server->policies) {
+            fprintf(stderr, "ndstore_provider_register(): Error policy table allcation failed\n");
+            ndstore_provider_destroy(server);
+            return NDSTORE_ERR_ALLOCATION;
+        }
+
+    /* expired leases are reaped even if no get ever comes again */
+    ret = ndstore_gc_start(server);
+    if(ret != NDSTORE_SUCCESS) {
+        ndstore_provider_destroy(server);
+        return ret;
+    }
+
     margo_provider_push_finalize_callback(mid, server, &ndstore_finalize_provider, server);
 
     *provider = server;
@@ -91,10 +451,91 @@ static void ndstore_finalize_provider(void* p)
     ndstore_provider_t provider = (ndstore_provider_t)p;
     margo_instance_id mid = provider->mid;
 
+    if(provider->stats_ult != ABT_THREAD_NULL) {
+        provider->stats_stop = 1;
+        ABT_thread_join(provider->stats_ult);
+        ABT_thread_free(&provider->stats_ult);
+    }
+    free(provider->stats_path);
+
+    if(provider->gc_ult != ABT_THREAD_NULL) {
+        provider->gc_stop = 1;
+        ABT_thread_join(provider->gc_ult);
+        ABT_thread_free(&provider->gc_ult);
+    }
+
+    /* background ULTs swap objects in the storage, let them finish */
+    while(hg_atomic_get32(&provider->bg_pending) > 0)
+        ABT_thread_yield();
+
+    /* the clients are not told about what is left in the queue: the
+     * data is going away */
+    if(provider->inval_ult != ABT_THREAD_NULL) {
+        ABT_mutex_lock(provider->sub_lock);
+        provider->inval_stop = 1;
+        ABT_cond_signal(provider->inval_cond);
+        ABT_mutex_unlock(provider->sub_lock);
+        ABT_thread_join(provider->inval_ult);
+        ABT_thread_free(&provider->inval_ult);
+    }
+
+    /* the replicas get what was queued before the shutdown */
+    if(provider->repl_ult != ABT_THREAD_NULL) {
+        ABT_mutex_lock(provider->repl_lock);
+        provider->repl_stop = 1;
+        ABT_cond_signal(provider->repl_cond);
+        ABT_mutex_unlock(provider->repl_lock);
+        ABT_thread_join(provider->repl_ult);
+        ABT_thread_free(&provider->repl_ult);
+    }
+
     margo_deregister(mid, provider->ndstore_put_id);
     margo_deregister(mid, provider->ndstore_get_id);
+    margo_deregister(mid, provider->ndstore_stats_id);
+    margo_deregister(mid, provider->ndstore_policy_id);
+    margo_deregister(mid, provider->ndstore_delete_id);
+    margo_deregister(mid, provider->ndstore_get_pieces_id);
+    margo_deregister(mid, provider->ndstore_release_id);
+    margo_deregister(mid, provider->ndstore_get_points_id);
+    margo_deregister(mid, provider->ndstore_get_versions_id);
+    margo_deregister(mid, provider->ndstore_subscribe_id);
+    margo_deregister(mid, provider->ndstore_unsubscribe_id);
+    margo_deregister(mid, provider->ndstore_replicate_id);
+    margo_deregister(mid, provider->ndstore_replicate_delete_id);
+    margo_deregister(mid, provider->ndstore_replicate_policy_id);
     /* deregister other RPC ids ... */
+    ndstore_lease_reap(provider, 0);
+    ABT_mutex_free(&provider->lease_lock);
+    while(provider->num_subs > 0)
+        margo_addr_free(mid, provider->subs[--provider->num_subs]);
+    free(provider->subs);
+    {
+        struct invalidate_op *op, *t;
+
+        list_for_each_entry_safe(op, t, &provider->inval_ops, struct invalidate_op, entry) {
+            list_del(&op->entry);
+            free(op);
+        }
+    }
+    ABT_cond_free(&provider->inval_cond);
+    ABT_mutex_free(&provider->sub_lock);
+    cache_free(provider->results);
+    ABT_mutex_free(&provider->inflight_lock);
+    while(provider->num_replicas > 0) {
+        struct replica *r = &provider->replicas[--provider->num_replicas];
+
+        if(r->addr != HG_ADDR_NULL)
+            margo_addr_free(mid, r->addr);
+        free(r->addr_str);
+    }
+    free(provider->replicas);
+    free(provider->applied);
+    ABT_cond_free(&provider->repl_cond);
+    ABT_mutex_free(&provider->repl_lock);
     ls_free(provider->ls);
+    policy_table_free(provider->policies);
+    free(provider->numa_nodes);
+    free(provider->numa_pools);
     free(provider);
 }
 
@@ -109,180 +550,2540 @@ int ndstore_provider_destroy(
     return NDSTORE_SUCCESS;
 }
 
+int ndstore_provider_get_stats(
+        ndstore_provider_t provider,
+        struct ndstore_stats *stats)
+{
+    if(!provider || !stats)
+        return NDSTORE_ERR_INVALID_ARG;
 
+    stats_snapshot(&provider->stats, stats);
+    ABT_rwlock_rdlock(provider->ls->lock);
+    stats->num_obj = provider->ls->num_obj;
+    ABT_rwlock_unlock(provider->ls->lock);
+    stats->bytes_resident = ls_bytes(provider->ls);
 
-static void ndstore_put_ult(hg_handle_t handle)
+    return NDSTORE_SUCCESS;
+}
+
+static int ndstore_stats_dump(ndstore_provider_t provider)
 {
-    hg_return_t hret;
-    bulk_in_t in;
-    bulk_out_t out;
-    hg_bulk_t bulk_handle;
+    struct ndstore_stats stats;
+    FILE *fp;
 
-    margo_instance_id mid = margo_hg_handle_get_instance(handle);
+    fp = fopen(provider->stats_path, "a");
+    if(!fp) {
+        fprintf(stderr, "Error (ndstore_stats_dump): could not open %s\n",
+                provider->stats_path);
+        return NDSTORE_ERR_INVALID_ARG;
+    }
+    ndstore_provider_get_stats(provider, &stats);
+    ndstore_stats_fprint(fp, &stats);
+    fclose(fp);
 
-    const struct hg_info* info = margo_get_info(handle);
-    ndstore_provider_t provider = (ndstore_provider_t)margo_registered_data(mid, info->id);
+    return NDSTORE_SUCCESS;
+}
 
-     if(!provider) {
-        fprintf(stderr, "Error (ndstore_put_ult): NDSTORE could not find provider\n"); 
-        out.ret = NDSTORE_ERR_UNKNOWN_PR;
-        margo_respond(handle, &out);
-        margo_destroy(handle);
-        return;
-    }
+static void ndstore_stats_dump_ult(void *arg)
+{
+    ndstore_provider_t provider = (ndstore_provider_t)arg;
+    double next = ABT_get_wtime() + provider->stats_interval;
 
-    hret = margo_get_input(handle, &in);
-    if(hret != HG_SUCCESS) {
-        out.ret = NDSTORE_ERR_MERCURY;
-        margo_respond(handle, &out);
-        margo_destroy(handle);
-        return;
+    /* sleep in short slices so that finalize does not wait a full
+     * interval for this ULT to notice the stop flag */
+    while(!provider->stats_stop) {
+        margo_thread_sleep(provider->mid, 100.0);
+        if(ABT_get_wtime() < next)
+            continue;
+        ndstore_stats_dump(provider);
+        next += provider->stats_interval;
     }
+    ndstore_stats_dump(provider);
+}
 
-    obj_descriptor in_odsc;
-    memcpy(&in_odsc, in.odsc.raw_odsc, sizeof(in_odsc));
+int ndstore_provider_stats_enable_dump(
+        ndstore_provider_t provider,
+        const char *path,
+        double interval)
+{
+    int ret;
 
-    struct obj_data *od;
-    od = obj_data_alloc(&in_odsc);
-    if(!od)
-        fprintf(stderr, "Obj_data_alloc error\n");
-    hg_size_t size = (in_odsc.size)*bbox_volume(&(in_odsc.bb));
+    if(!provider || !path || interval <= 0)
+        return NDSTORE_ERR_INVALID_ARG;
+    if(provider->stats_ult != ABT_THREAD_NULL)
+        return NDSTORE_ERR_INVALID_ARG;
 
-    void *buffer = (void*) od->data;
-    hret = margo_bulk_create(mid, 1, (void**)&(od->data), &size,
-                HG_BULK_WRITE_ONLY, &bulk_handle);
+    provider->stats_path = strdup(path);
+    provider->stats_interval = interval;
+    provider->stats_stop = 0;
 
-    if(hret != HG_SUCCESS) {
-        fprintf(stderr, "Error in margo_bulk_create\n");
-        out.ret = NDSTORE_ERR_MERCURY;
-        margo_respond(handle, &out);
-        margo_free_input(handle, &in);
-        margo_destroy(handle);
-        return;
-	}
-    
-    hret = margo_bulk_transfer(mid, HG_BULK_PULL, info->addr, in.handle, 0,
-            bulk_handle, 0, size);
-    if(hret != HG_SUCCESS) {
-        fprintf(stderr, "Error in margo_bulk_transfer\n");
-        out.ret = NDSTORE_ERR_MERCURY;
-        margo_respond(handle, &out);
-        margo_free_input(handle, &in);
-        margo_bulk_free(bulk_handle);
-        margo_destroy(handle);
-        return;
+    ret = ABT_thread_create(provider->pool, ndstore_stats_dump_ult, provider,
+            ABT_THREAD_ATTR_NULL, &provider->stats_ult);
+    if(ret != ABT_SUCCESS) {
+        free(provider->stats_path);
+        provider->stats_path = NULL;
+        provider->stats_ult = ABT_THREAD_NULL;
+        return NDSTORE_ERR_ARGOBOTS;
     }
 
-    out.ret = NDSTORE_SUCCESS;
-    ls_add_obj(provider->ls, od);
+    return NDSTORE_SUCCESS;
+}
 
-    margo_bulk_free(bulk_handle);
-    margo_respond(handle, &out);
-    margo_free_input(handle, &in);
-    margo_destroy(handle);
+static void ndstore_gc_ult(void *arg)
+{
+    ndstore_provider_t provider = (ndstore_provider_t)arg;
+    double next = ABT_get_wtime() + NDSTORE_GC_INTERVAL;
+    struct gc_version *dropped;
+    obj_descriptor odsc;
+    uint64_t bytes;
+    int i, num;
+
+    while(!provider->gc_stop) {
+        margo_thread_sleep(provider->mid, 100.0);
+        if(ABT_get_wtime() < next)
+            continue;
+        /* a client that never releases its pieces only holds them for
+         * a while */
+        ndstore_lease_reap(provider, ABT_get_wtime());
+        if(!provider->gc_retention) {
+            next = ABT_get_wtime() + NDSTORE_GC_INTERVAL;
+            continue;
+        }
+        num = gc_run(provider->ls, provider->policies, ABT_get_wtime(), &bytes,
+                &dropped);
+        stats_record_gc(&provider->stats, num, bytes);
+        /* cached copies of collected versions must not outlive them */
+        memset(&odsc, 0, sizeof(odsc));
+        for(i = 0; i < num; i++) {
+            memcpy(odsc.name, dropped[i].name, sizeof(odsc.name));
+            odsc.version = dropped[i].version;
+            if(provider->results)
+                cache_invalidate(provider->results, &odsc, odsc.version);
+            ndstore_invalidate(provider, &odsc, odsc.version);
+            /* the replicas must not serve what we no longer hold */
+            if(provider->num_replicas)
+                ndstore_replicate(provider, NULL, &odsc, odsc.version);
+        }
+        free(dropped);
+        next = ABT_get_wtime() + NDSTORE_GC_INTERVAL;
+    }
 }
-DEFINE_MARGO_RPC_HANDLER(ndstore_put_ult)
 
+static int ndstore_gc_start(ndstore_provider_t provider)
+{
+    int ret;
+
+    if(!hg_atomic_cas32(&provider->gc_started, 0, 1))
+        return NDSTORE_SUCCESS;
 
-static void ndstore_get_ult(hg_handle_t handle)
+    provider->gc_stop = 0;
+    ret = ABT_thread_create(provider->pool, ndstore_gc_ult, provider,
+            ABT_THREAD_ATTR_NULL, &provider->gc_ult);
+    if(ret != ABT_SUCCESS) {
+        provider->gc_ult = ABT_THREAD_NULL;
+        hg_atomic_set32(&provider->gc_started, 0);
+        return NDSTORE_ERR_ARGOBOTS;
+    }
+
+    return NDSTORE_SUCCESS;
+}
+
+/*
+ * Admit 'need' more bytes under the memory budget. The bytes stay
+ * reserved until the put stores its object or fails, so concurrent puts
+ * cannot all pass the check. The reservations are read before the
+ * storage: a put that stores its object and then releases its bytes is
+ * counted at least once.
+ */
+static int ndstore_reserve(ndstore_provider_t provider, uint64_t need)
 {
-    hg_return_t hret;
-    bulk_in_t in;
-    bulk_out_t out;
-    hg_bulk_t bulk_handle;
+    int64_t r;
 
-    margo_instance_id mid = margo_hg_handle_get_instance(handle);
+    do {
+        r = hg_atomic_get64(&provider->reserved);
+        if(ls_bytes(provider->ls) + r + need > provider->mem_budget)
+            return 0;
+    } while(!hg_atomic_cas64(&provider->reserved, r, r + (int64_t)need));
 
-    const struct hg_info* info = margo_get_info(handle);
-    ndstore_provider_t provider = (ndstore_provider_t)margo_registered_data(mid, info->id);
+    return 1;
+}
 
-     if(!provider) {
-        fprintf(stderr, "Error (ndstore_put_ult): NDSTORE could not find provider\n"); 
-        out.ret = NDSTORE_ERR_UNKNOWN_PR;
-        margo_respond(handle, &out);
-        margo_destroy(handle);
+static void ndstore_unreserve(ndstore_provider_t provider, uint64_t need)
+{
+    int64_t r;
+
+    if(!need)
         return;
-    }
+    do {
+        r = hg_atomic_get64(&provider->reserved);
+    } while(!hg_atomic_cas64(&provider->reserved, r, r - (int64_t)need));
+}
 
+int ndstore_provider_set_mem_budget(
+        ndstore_provider_t provider,
+        uint64_t bytes)
+{
+    if(!provider)
+        return NDSTORE_ERR_INVALID_ARG;
 
-    hret = margo_get_input(handle, &in);
-    if(hret != HG_SUCCESS) {
-        out.ret = NDSTORE_ERR_MERCURY;
-        margo_respond(handle, &out);
-        margo_destroy(handle);
-        return;
-    }
+    provider->mem_budget = bytes;
+    return NDSTORE_SUCCESS;
+}
 
-    obj_descriptor in_odsc;
-    memcpy(&in_odsc, in.odsc.raw_odsc, sizeof(in_odsc));
-     
-    struct obj_data *od, *from_obj;
-    struct obj_data **od_tab;
-    od_tab = malloc(sizeof(*od_tab) * provider->ls->num_obj);
+int ndstore_provider_set_pages(
+        ndstore_provider_t provider,
+        enum ndstore_pages pages)
+{
+    if(!provider || pages < NDSTORE_PAGES_DEFAULT || pages > NDSTORE_PAGES_1G)
+        return NDSTORE_ERR_INVALID_ARG;
 
-    int obj_nums = 0;
-    obj_nums = ls_find_ods(provider->ls, &in_odsc, od_tab);
+    provider->pages = pages;
+    return NDSTORE_SUCCESS;
+}
 
-    if (obj_nums == 0) {
-        char *str;
-        str = obj_desc_sprint(&in_odsc);
-        fprintf(stderr, "Error (ndstore_put_ult): No objects found for %s", str);
-        free(str);
-        out.ret = NDSTORE_ERR_UNKNOWN_OBJ;
-        margo_respond(handle, &out);
-        margo_free_input(handle, &in);
-        margo_destroy(handle);
-        return;
+int ndstore_provider_set_copy_ults(
+        ndstore_provider_t provider,
+        int num_ults)
+{
+    if(!provider || num_ults < 1)
+        return NDSTORE_ERR_INVALID_ARG;
+
+    provider->copy_ults = num_ults;
+    return NDSTORE_SUCCESS;
+}
+
+int ndstore_provider_set_result_cache(
+        ndstore_provider_t provider,
+        uint64_t bytes)
+{
+    if(!provider || !bytes || provider->results)
+        return NDSTORE_ERR_INVALID_ARG;
+
+    provider->results = cache_alloc(bytes);
+    if(!provider->results)
+        return NDSTORE_ERR_ALLOCATION;
+    return NDSTORE_SUCCESS;
+}
+
+int ndstore_provider_set_replicas(
+        ndstore_provider_t provider,
+        int num_replicas,
+        const char **addrs,
+        const uint16_t *provider_ids)
+{
+    struct replica *r;
+    int i;
+
+    if(!provider || num_replicas < 1 || !addrs || !provider_ids ||
+       provider->num_replicas)
+        return NDSTORE_ERR_INVALID_ARG;
+
+    r = calloc(num_replicas, sizeof(*r));
+    if(!r)
+        return NDSTORE_ERR_ALLOCATION;
+    for(i = 0; i < num_replicas; i++) {
+        r[i].addr = HG_ADDR_NULL;
+        r[i].provider_id = provider_ids[i];
+        r[i].addr_str = strdup(addrs[i]);
+        if(!r[i].addr_str) {
+            while(i > 0)
+                free(r[--i].addr_str);
+            free(r);
+            return NDSTORE_ERR_ALLOCATION;
+        }
     }
 
-    od = obj_data_alloc(&in_odsc);
-    int i, total_elems_found;
-    total_elems_found = 0;
-    for(i=0; i<obj_nums; i++){
-        total_elems_found += ssd_copy(od, od_tab[i]);
+    if(ABT_thread_create(provider->pool, ndstore_replicate_ult, provider,
+            ABT_THREAD_ATTR_NULL, &provider->repl_ult) != ABT_SUCCESS) {
+        provider->repl_ult = ABT_THREAD_NULL;
+        for(i = 0; i < num_replicas; i++)
+            free(r[i].addr_str);
+        free(r);
+        return NDSTORE_ERR_ARGOBOTS;
     }
-    free(od_tab);
+    provider->replicas = r;
+    provider->num_replicas = num_replicas;
 
-    if(total_elems_found!=bbox_volume(&(in_odsc.bb))){
-        out.ret = NDSTORE_ERR_UNKNOWN_OBJ;
-        fprintf(stderr, "Error (ndstore_put_ult): Only partial objecyt is found. Returning Error to the client\n");
-        obj_data_free(od);
-        margo_respond(handle, &out);
-        margo_free_input(handle, &in);
-        margo_destroy(handle);
-        return;
+    /* policies set so far */
+    {
+        struct policy_entry *pe;
+
+        ABT_mutex_lock(provider->policies->lock);
+        list_for_each_entry(pe, &provider->policies->list, struct policy_entry, entry)
+            ndstore_replicate_policy(provider, pe->rec.name, &pe->rec.policy);
+        ABT_mutex_unlock(provider->policies->lock);
     }
-    
-    hg_size_t size = (in_odsc.size)*bbox_volume(&(in_odsc.bb));
-    void *buffer = (void*) od->data;
-    hret = margo_bulk_create(mid, 1, (void**)&buffer, &size,
-                HG_BULK_READ_ONLY, &bulk_handle);
 
-    if(hret != HG_SUCCESS) {
-        fprintf(stderr,"Error in margo_bulk_create()\n");
-        out.ret = NDSTORE_ERR_MERCURY;
-        margo_respond(handle, &out);
-        margo_free_input(handle, &in);
-        margo_destroy(handle);
-        return;
-	}
+    return NDSTORE_SUCCESS;
+}
 
-    hret = margo_bulk_transfer(mid, HG_BULK_PUSH, info->addr, in.handle, 0,
-            bulk_handle, 0, size);
-    if(hret != HG_SUCCESS) {
-        fprintf(stderr,"Error in margo_bulk_transfer()\n");
-        out.ret = NDSTORE_ERR_MERCURY;
-        margo_respond(handle, &out);
+int ndstore_provider_set_numa(
+        ndstore_provider_t provider,
+        int num_nodes,
+        const int *nodes,
+        const ABT_pool *pools)
+{
+    int i, *n;
+    ABT_pool *p;
+
+    if(!provider || num_nodes < 0 || (num_nodes && !nodes))
+        return NDSTORE_ERR_INVALID_ARG;
+
+    n = calloc(num_nodes + 1, sizeof(*n));
+    p = calloc(num_nodes + 1, sizeof(*p));
+    if(!n || !p) {
+        free(n);
+        free(p);
+        return NDSTORE_ERR_ALLOCATION;
+    }
+    for(i = 0; i < num_nodes; i++) {
+        n[i] = nodes[i];
+        p[i] = pools ? pools[i] : ABT_POOL_NULL;
+    }
+
+    free(provider->numa_nodes);
+    free(provider->numa_pools);
+    provider->numa_nodes = n;
+    provider->numa_pools = p;
+    provider->num_numa = num_nodes;
+
+    return NDSTORE_SUCCESS;
+}
+
+/* Node of a new piece; pieces with the same lower corner share a node
+ * across versions. */
+static int ndstore_numa_node(ndstore_provider_t provider, const struct bbox *bb)
+{
+    uint64_t h = 14695981039346656037ULL;
+    int i;
+
+    if(!provider->num_numa)
+        return -1;
+    for(i = 0; i < bb->num_dims; i++) {
+        h ^= bb->lb.c[i];
+        h *= 1099511628211ULL;
+    }
+    return provider->numa_nodes[h % provider->num_numa];
+}
+
+int ndstore_provider_set_var_policy(
+        ndstore_provider_t provider,
+        const char *name,
+        const struct ndstore_var_policy *policy)
+{
+    return ndstore_set_var_policy(provider, name, policy, 1);
+}
+
+/*
+ * Set a policy, and forward it to the replicas unless it came from the
+ * provider they replicate, so that they store and collect the objects
+ * like the provider does.
+ */
+static int ndstore_set_var_policy(ndstore_provider_t provider,
+        const char *name, const struct ndstore_var_policy *policy,
+        int forward)
+{
+    if(!provider || !name || !policy)
+        return NDSTORE_ERR_INVALID_ARG;
+    if(!ndstore_codec_available(policy->codec)) {
+        fprintf(stderr, "Error (ndstore_provider_set_var_policy): codec %d not built in\n",
+                policy->codec);
+        return NDSTORE_ERR_INVALID_ARG;
+    }
+    if(policy->codec == NDSTORE_CODEC_QUANT &&
+       (!(policy->error_bound >= 0) ||
+        (policy->error_mode != NDSTORE_BOUND_ABS &&
+         policy->error_mode != NDSTORE_BOUND_REL))) {
+        fprintf(stderr, "Error (ndstore_provider_set_var_policy): invalid error bound\n");
+        return NDSTORE_ERR_INVALID_ARG;
+    }
+    if(policy->keep_secs < 0) {
+        fprintf(stderr, "Error (ndstore_provider_set_var_policy): invalid retention\n");
+        return NDSTORE_ERR_INVALID_ARG;
+    }
+    if(policy_table_set(provider->policies, name, policy) != 0)
+        return NDSTORE_ERR_INVALID_ARG;
+    if(forward && provider->num_replicas)
+        ndstore_replicate_policy(provider, name, policy);
+
+    if(policy_has_retention(policy))
+        provider->gc_retention = 1;
+
+    return NDSTORE_SUCCESS;
+}
+
+struct bg_args {
+    ndstore_provider_t provider;
+    struct obj_data *od;
+    struct ndstore_var_policy policy;
+};
+
+/*
+ * Compress a stored object and swap it in. Gets that pinned the raw
+ * object keep reading it; new gets find the compressed one.
+ */
+static void ndstore_compress_obj(ndstore_provider_t provider, struct obj_data *od,
+        const struct ndstore_var_policy *policy)
+{
+    struct obj_data *cod;
+    struct comp_hdr *comp;
+
+    if(policy->codec == NDSTORE_CODEC_NONE || od->comp || od->f_free ||
+       od->obj_desc.num_fields)
+        return;
+
+    comp = comp_encode(&od->obj_desc, od->data, policy);
+    if(!comp)
+        return;
+
+    cod = obj_data_alloc_no_data(&od->obj_desc, NULL);
+    if(!cod) {
+        free(comp);
+        return;
+    }
+    cod->comp = comp;
+
+    /* the object may have been evicted while we were compressing */
+    if(ls_replace(provider->ls, od, cod) != 0)
+        obj_data_free(cod);
+}
+
+/*
+ * Store a put as a delta against the piece of the previous version with
+ * the same box, unless that chain is due for a keyframe.
+ */
+static int ndstore_delta_encode(ndstore_provider_t provider, struct obj_data *od,
+        const struct ndstore_var_policy *policy)
+{
+    struct ndstore_var_policy dp = *policy;
+    struct obj_data **od_tab, *base = NULL;
+    obj_descriptor q = od->obj_desc;
+    int i, num, ret = -1;
+
+    /* the XOR payload must be rebuilt exactly */
+    if(dp.codec != NDSTORE_CODEC_LZ4 && dp.codec != NDSTORE_CODEC_ZSTD)
+        dp.codec = ndstore_codec_available(NDSTORE_CODEC_ZSTD) ?
+            NDSTORE_CODEC_ZSTD : NDSTORE_CODEC_LZ4;
+    if(!ndstore_codec_available(dp.codec))
+        return -1;
+    dp.shuffle = 1;
+
+    q.version--;
+    num = ls_find_ods(provider->ls, &q, &od_tab);
+    for(i = 0; i < num; i++) {
+        if(!base && bbox_equals(&od_tab[i]->obj_desc.bb, &q.bb))
+            base = od_tab[i];
+    }
+    if(base && base->delta_depth + 1 < dp.delta_keyframe)
+        ret = ssd_delta_encode(od, base, &dp);
+    for(i = 0; i < num; i++)
+        obj_data_unref(od_tab[i]);
+    free(od_tab);
+
+    return ret;
+}
+
+static void ndstore_compress_ult(void *arg)
+{
+    struct bg_args *ba = (struct bg_args*)arg;
+
+    ndstore_compress_obj(ba->provider, ba->od, &ba->policy);
+
+    obj_data_unref(ba->od);
+    hg_atomic_decr32(&ba->provider->bg_pending);
+    free(ba);
+}
+
+/*
+ * Split a stored object along the variable's grid, merge the cells it
+ * completes, then compress what was produced.
+ */
+static void ndstore_rechunk_ult(void *arg)
+{
+    struct bg_args *ba = (struct bg_args*)arg;
+    ndstore_provider_t provider = ba->provider;
+    struct obj_data **frags, *cell;
+    int i, n;
+
+    n = grid_split(provider->ls, ba->od, ba->policy.grid, &frags);
+    for(i = 0; i < n; i++) {
+        if(frags[i]->f_free)
+            continue;
+        cell = grid_merge(provider->ls, frags[i], ba->policy.grid);
+        if(cell) {
+            ndstore_compress_obj(provider, cell, &ba->policy);
+            obj_data_unref(cell);
+        }
+    }
+    for(i = 0; i < n; i++) {
+        /* border fragments that no cell absorbed */
+        ndstore_compress_obj(provider, frags[i], &ba->policy);
+        obj_data_unref(frags[i]);
+    }
+    if(n)
+        free(frags);
+
+    obj_data_unref(ba->od);
+    hg_atomic_decr32(&provider->bg_pending);
+    free(ba);
+}
+
+static void ndstore_spawn_bg(ndstore_provider_t provider, struct obj_data *od,
+        const struct ndstore_var_policy *policy, void (*fn)(void *))
+{
+    struct bg_args *ba;
+
+    ba = malloc(sizeof(*ba));
+    if(!ba)
+        return;
+    ba->provider = provider;
+    ba->od = od;
+    ba->policy = *policy;
+
+    obj_data_ref(od);
+    hg_atomic_incr32(&provider->bg_pending);
+    if(ABT_thread_create(provider->pool, fn, ba,
+            ABT_THREAD_ATTR_NULL, NULL) != ABT_SUCCESS) {
+        /* keep the object as it is */
+        hg_atomic_decr32(&provider->bg_pending);
+        obj_data_unref(od);
+        free(ba);
+    }
+}
+
+
+static void ndstore_put_ult(hg_handle_t handle)
+{
+    hg_return_t hret;
+    bulk_in_t in;
+    bulk_out_t out;
+    out.srv_time = 0;
+    out.comp_size = 0;
+    out.origin = 0;
+    out.seq = 0;
+    hg_bulk_t bulk_handle;
+    struct stats_timer timer;
+
+    stats_timer_start(&timer);
+
+    margo_instance_id mid = margo_hg_handle_get_instance(handle);
+
+    const struct hg_info* info = margo_get_info(handle);
+    ndstore_provider_t provider = (ndstore_provider_t)margo_registered_data(mid, info->id);
+
+     if(!provider) {
+        fprintf(stderr, "Error (ndstore_put_ult): NDSTORE could not find provider\n"); 
+        out.ret = NDSTORE_ERR_UNKNOWN_PR;
+        margo_respond(handle, &out);
+        margo_destroy(handle);
+        return;
+    }
+
+    hret = margo_get_input(handle, &in);
+    if(hret != HG_SUCCESS) {
+        out.ret = NDSTORE_ERR_MERCURY;
+        margo_respond(handle, &out);
+        margo_destroy(handle);
+        stats_record(&provider->stats, NDSTORE_STATS_OP_PUT, &timer, 0, 0, out.ret);
+        return;
+    }
+
+    obj_descriptor in_odsc;
+    memcpy(&in_odsc, in.odsc.raw_odsc, sizeof(in_odsc));
+    hg_size_t size = obj_data_size(&in_odsc);
+
+    struct ndstore_var_policy policy;
+    policy_table_lookup(provider->policies, in_odsc.name, &policy);
+    stats_timer_mark(&timer, NDSTORE_STATS_PH_DECODE);
+
+    /* multi-field and point objects are stored as put, neither
+     * compressed, delta-encoded nor re-chunked */
+    if(in_odsc.num_fields || in_odsc.kind != OBJ_DENSE) {
+        if(in.fields.size != in_odsc.num_fields * FIELD_NAME_LEN ||
+           in.comp_codec != NDSTORE_CODEC_NONE ||
+           (in_odsc.kind == OBJ_POINTS &&
+            (in_odsc.num_fields || !in_odsc.num_points)) ||
+           in_odsc.kind > OBJ_POINTS) {
+            out.ret = NDSTORE_ERR_INVALID_ARG;
+            margo_respond(handle, &out);
+            margo_free_input(handle, &in);
+            margo_destroy(handle);
+            stats_record(&provider->stats, NDSTORE_STATS_OP_PUT, &timer, 0, 0, out.ret);
+            return;
+        }
+        policy.codec = NDSTORE_CODEC_NONE;
+        policy.delta_keyframe = 0;
+        memset(policy.grid, 0, sizeof(policy.grid));
+    }
+    /* the pieces of a re-chunked put are new objects */
+    if(grid_applies(policy.grid, in_odsc.bb.num_dims))
+        policy.delta_keyframe = 0;
+
+    uint64_t need = 0;
+    if(provider->mem_budget) {
+        need = in.comp_codec != NDSTORE_CODEC_NONE ? in.comp_size : size;
+        if(!ndstore_reserve(provider, need)) {
+            out.ret = NDSTORE_ERR_NOSPACE;
+            margo_respond(handle, &out);
+            margo_free_input(handle, &in);
+            margo_destroy(handle);
+            stats_record(&provider->stats, NDSTORE_STATS_OP_PUT, &timer, 0, 0, out.ret);
+            return;
+        }
+    }
+
+    /* a compressed transfer is kept as is when the variable is stored
+     * with the same codec, otherwise it is expanded after the pull. A
+     * lossy one from a client is expanded too, and only kept if its
+     * error bound is within the variable's; replicas get what the
+     * provider stored. */
+    struct obj_data *od;
+    struct comp_hdr *wire = NULL;
+    hg_size_t xfer = size;
+    void *buffer;
+    int keep_wire = policy.codec == (int32_t)in.comp_codec &&
+        (in.comp_codec != NDSTORE_CODEC_QUANT ||
+         info->id == provider->ndstore_replicate_id);
+    if(in.comp_codec != NDSTORE_CODEC_NONE) {
+        if(in.comp_size == 0 || in.comp_size >= size ||
+           !ndstore_codec_available(in.comp_codec)) {
+            fprintf(stderr, "Error (ndstore_put_ult): unsupported compressed transfer\n");
+            out.ret = NDSTORE_ERR_INVALID_ARG;
+            ndstore_unreserve(provider, need);
+            margo_respond(handle, &out);
+            margo_free_input(handle, &in);
+            margo_destroy(handle);
+            stats_record(&provider->stats, NDSTORE_STATS_OP_PUT, &timer, 0, 0, out.ret);
+            return;
+        }
+        xfer = in.comp_size;
+        wire = malloc(xfer);
+        if(keep_wire)
+            od = obj_data_alloc_no_data(&in_odsc, NULL);
+        else
+            od = obj_data_alloc_node(&in_odsc,
+                    ndstore_numa_node(provider, &in_odsc.bb), provider->pages);
+        buffer = wire;
+    } else {
+        od = obj_data_alloc_node(&in_odsc,
+                ndstore_numa_node(provider, &in_odsc.bb), provider->pages);
+        buffer = od ? od->data : NULL;
+    }
+    if(!od || !buffer ||
+       obj_data_set_fields(od, in.fields.raw_odsc) != 0) {
+        fprintf(stderr, "Obj_data_alloc error\n");
+        out.ret = NDSTORE_ERR_ALLOCATION;
+        free(wire);
+        obj_data_free(od);
+        ndstore_unreserve(provider, need);
+        margo_respond(handle, &out);
+        margo_free_input(handle, &in);
+        margo_destroy(handle);
+        stats_record(&provider->stats, NDSTORE_STATS_OP_PUT, &timer, 0, 0, out.ret);
+        return;
+    }
+
+    hret = margo_bulk_create(mid, 1, (void**)&buffer, &xfer,
+                HG_BULK_WRITE_ONLY, &bulk_handle);
+
+    if(hret != HG_SUCCESS) {
+        fprintf(stderr, "Error in margo_bulk_create\n");
+        out.ret = NDSTORE_ERR_MERCURY;
+        free(wire);
+        obj_data_free(od);
+        ndstore_unreserve(provider, need);
+        margo_respond(handle, &out);
+        margo_free_input(handle, &in);
+        margo_destroy(handle);
+        stats_record(&provider->stats, NDSTORE_STATS_OP_PUT, &timer, 0, 0, out.ret);
+        return;
+	}
+    
+    hret = margo_bulk_transfer(mid, HG_BULK_PULL, info->addr, in.handle, 0,
+            bulk_handle, 0, xfer);
+    if(hret != HG_SUCCESS) {
+        fprintf(stderr, "Error in margo_bulk_transfer\n");
+        out.ret = NDSTORE_ERR_MERCURY;
+        free(wire);
+        obj_data_free(od);
+        ndstore_unreserve(provider, need);
+        margo_respond(handle, &out);
         margo_free_input(handle, &in);
         margo_bulk_free(bulk_handle);
         margo_destroy(handle);
+        stats_record(&provider->stats, NDSTORE_STATS_OP_PUT, &timer, 0, 0, out.ret);
         return;
     }
     margo_bulk_free(bulk_handle);
+    stats_timer_mark(&timer, NDSTORE_STATS_PH_BULK);
+
+    /* decompression and synchronous compression are charged to the
+     * copy phase */
+    if(wire) {
+        int err = comp_check(wire, xfer, &in_odsc);
+        if(err == 0 && od->data)
+            err = comp_decode(wire, &in_odsc, od->data);
+        if(err != 0) {
+            fprintf(stderr, "Error (ndstore_put_ult): corrupted compressed transfer\n");
+            out.ret = NDSTORE_ERR_INVALID_ARG;
+            free(wire);
+            obj_data_free(od);
+            ndstore_unreserve(provider, need);
+            margo_respond(handle, &out);
+            margo_free_input(handle, &in);
+            margo_destroy(handle);
+            stats_record(&provider->stats, NDSTORE_STATS_OP_PUT, &timer, xfer, 0, out.ret);
+            return;
+        }
+        if(od->data && policy.codec == (int32_t)in.comp_codec &&
+           comp_meets_policy(wire, &in_odsc, od->data, &policy)) {
+            obj_data_free_data(od);
+            od->comp = wire;
+        } else if(od->data) {
+            /* compressed again according to the policy below */
+            free(wire);
+        } else {
+            od->comp = wire;
+        }
+        stats_timer_mark(&timer, NDSTORE_STATS_PH_COPY);
+    }
+
+    if(in_odsc.kind == OBJ_POINTS) {
+        if(points_index(od) != 0) {
+            fprintf(stderr, "Error (ndstore_put_ult): points outside of their bounding box\n");
+            out.ret = NDSTORE_ERR_INVALID_ARG;
+            obj_data_free(od);
+            ndstore_unreserve(provider, need);
+            margo_respond(handle, &out);
+            margo_free_input(handle, &in);
+            margo_destroy(handle);
+            stats_record(&provider->stats, NDSTORE_STATS_OP_PUT, &timer, xfer, 0, out.ret);
+            return;
+        }
+        stats_timer_mark(&timer, NDSTORE_STATS_PH_COPY);
+    }
+
+    if(policy.delta_keyframe && od->data && in_odsc.version > 0) {
+        ndstore_delta_encode(provider, od, &policy);
+        stats_timer_mark(&timer, NDSTORE_STATS_PH_COPY);
+    }
+
+    /* keyframes are compressed before later versions refer to them, a
+     * delta would otherwise pin the raw payload after the swap */
+    if(policy.codec != NDSTORE_CODEC_NONE && !od->comp &&
+       (policy.sync || policy.delta_keyframe)) {
+        od->comp = comp_encode(&od->obj_desc, od->data, &policy);
+        if(od->comp)
+            obj_data_free_data(od);
+        stats_timer_mark(&timer, NDSTORE_STATS_PH_COPY);
+    }
+
     out.ret = NDSTORE_SUCCESS;
-    obj_data_free(od);
+    /* take a reference for the compression ULT before the storage owns
+     * the object, a concurrent put could evict it right away */
+    obj_data_ref(od);
+    int overwrite = ndstore_overwrites(provider, &in_odsc);
+    if(provider->num_replicas && info->id != provider->ndstore_replicate_id) {
+        out.origin = provider->origin;
+        out.seq = ndstore_replicate(provider, od, NULL, 0);
+    }
+    if(policy_has_retention(&policy))
+        ls_add_obj_version(provider->ls, od);
+    else
+        ls_add_obj(provider->ls, od);
+    /* the storage accounts for the object now */
+    ndstore_unreserve(provider, need);
+    if(info->id == provider->ndstore_replicate_id)
+        ndstore_applied(provider, in.origin, in.seq);
+    /* cheap enough to do for every put, overwrite or not */
+    if(provider->results)
+        cache_invalidate(provider->results, &in_odsc, in_odsc.version);
+    if(overwrite)
+        ndstore_invalidate(provider, &in_odsc, in_odsc.version);
+    stats_timer_mark(&timer, NDSTORE_STATS_PH_LOOKUP);
+    out.srv_time = stats_timer_elapsed_ns(&timer);
+
     margo_respond(handle, &out);
     margo_free_input(handle, &in);
     margo_destroy(handle);
+    stats_timer_mark(&timer, NDSTORE_STATS_PH_RESPOND);
+    stats_record(&provider->stats, NDSTORE_STATS_OP_PUT, &timer, xfer, 0, out.ret);
+
+    if(grid_applies(policy.grid, in_odsc.bb.num_dims))
+        ndstore_spawn_bg(provider, od, &policy, ndstore_rechunk_ult);
+    else if(policy.codec != NDSTORE_CODEC_NONE && !od->comp)
+        ndstore_spawn_bg(provider, od, &policy, ndstore_compress_ult);
+    obj_data_unref(od);
 }
-DEFINE_MARGO_RPC_HANDLER(ndstore_get_ult)
+DEFINE_MARGO_RPC_HANDLER(ndstore_put_ult)
+
+
+/*
+ * A stored piece can be pushed without decompressing it when it is
+ * exactly the requested box and the client accepts its codec. Lossy
+ * payloads are always accepted: the stored data is already lossy.
+ */
+static int ndstore_comp_passthrough(struct obj_data *from, obj_descriptor *odsc,
+        uint32_t codec)
+{
+    return from->comp && !from->delta_base && from->obj_desc.size == odsc->size &&
+           bbox_equals(&from->obj_desc.bb, &odsc->bb) &&
+           (from->comp->codec == codec ||
+            from->comp->codec == NDSTORE_CODEC_QUANT);
+}
+
+struct copy_args {
+    struct obj_data *to;
+    struct obj_data **from;
+    int num;
+    int found;
+};
+
+static void ndstore_copy_ult(void *arg)
+{
+    struct copy_args *ca = (struct copy_args *)arg;
+    int i, n;
+
+    for(i = 0; i < ca->num; i++) {
+        n = ssd_copy(ca->to, ca->from[i]);
+        if(n > 0)
+            ca->found += n;
+    }
+}
+
+/* Bucket of a piece: the index of its NUMA node, or num_numa. */
+static int ndstore_copy_bucket(ndstore_provider_t provider, struct obj_data *od)
+{
+    int k;
+
+    for(k = 0; k < provider->num_numa; k++)
+        if(od->numa_node == provider->numa_nodes[k])
+            break;
+    return k;
+}
+
+/*
+ * Assemble the result of a get from its pieces. Small gets are copied
+ * by the handler. Larger ones are split in runs of pieces of about the
+ * same volume, each copied by a ULT: in the pool of the NUMA node that
+ * holds the pieces, or in the provider's pool. Pieces write disjoint
+ * parts of 'od', so the ULTs need no locking. Returns the number of
+ * elements copied.
+ */
+static int ndstore_copy_pieces(ndstore_provider_t provider, struct obj_data *od,
+        struct obj_data **od_tab, int num)
+{
+    int nb = provider->num_numa + 1;
+    int max_ults = provider->copy_ults + nb;
+    struct copy_args *args;
+    ABT_thread *ults;
+    struct obj_data **sorted;
+    uint64_t *vol, total, acc;
+    struct bbox bb;
+    int bnum[nb];
+    int b, i, j, k, first, nu = 0, found = 0;
+
+    if(num == 1 || (provider->num_numa == 0 && (provider->copy_ults <= 1 ||
+       obj_data_size(&od->obj_desc) < NDSTORE_COPY_MIN_SIZE))) {
+        struct copy_args ca = {od, od_tab, num, 0};
+        ndstore_copy_ult(&ca);
+        return ca.found;
+    }
+
+    sorted = malloc(sizeof(*sorted) * num);
+    vol = malloc(sizeof(*vol) * num);
+    args = calloc(max_ults, sizeof(*args));
+    ults = calloc(max_ults, sizeof(*ults));
+    if(!sorted || !vol || !args || !ults) {
+        struct copy_args ca = {od, od_tab, num, 0};
+        ndstore_copy_ult(&ca);
+        free(sorted);
+        free(vol);
+        free(args);
+        free(ults);
+        return ca.found;
+    }
+
+    /* group the pieces by bucket */
+    memset(bnum, 0, sizeof(bnum));
+    for(i = 0; i < num; i++)
+        bnum[ndstore_copy_bucket(provider, od_tab[i])]++;
+    for(b = 0, k = 0; b < nb; b++) {
+        int n = bnum[b];
+        bnum[b] = k;
+        k += n;
+    }
+    for(i = 0; i < num; i++)
+        sorted[bnum[ndstore_copy_bucket(provider, od_tab[i])]++] = od_tab[i];
+
+    for(b = 0, first = 0; b < nb; first = bnum[b++]) {
+        int n = bnum[b] - first, u;
+        ABT_pool pool = provider->pool;
+
+        if(n == 0)
+            continue;
+        if(b < provider->num_numa && provider->numa_pools[b] != ABT_POOL_NULL)
+            pool = provider->numa_pools[b];
+
+        /* the bucket gets its share of the ULTs, cut by volume */
+        u = (int)((int64_t)provider->copy_ults * n / num);
+        if(u < 1)
+            u = 1;
+        if(u > n)
+            u = n;
+        total = 0;
+        for(i = first; i < first + n; i++) {
+            bbox_intersect(&od->obj_desc.bb, &sorted[i]->obj_desc.bb, &bb);
+            vol[i] = bbox_volume(&bb);
+            total += vol[i];
+        }
+        for(j = 0, i = first, acc = 0; j < u && i < first + n; j++) {
+            struct copy_args *ca = &args[nu];
+
+            ca->to = od;
+            ca->from = &sorted[i];
+            while(i < first + n && (ca->num == 0 || j == u - 1 ||
+                  acc + vol[i] / 2 < total * (j + 1) / u)) {
+                acc += vol[i++];
+                ca->num++;
+            }
+            ults[nu] = ABT_THREAD_NULL;
+            if(ABT_thread_create(pool, ndstore_copy_ult, ca,
+                    ABT_THREAD_ATTR_NULL, &ults[nu]) != ABT_SUCCESS) {
+                ults[nu] = ABT_THREAD_NULL;
+                ndstore_copy_ult(ca);
+            }
+            nu++;
+        }
+    }
+
+    for(k = 0; k < nu; k++) {
+        if(ults[k] != ABT_THREAD_NULL) {
+            ABT_thread_join(ults[k]);
+            ABT_thread_free(&ults[k]);
+        }
+        found += args[k].found;
+    }
+    free(sorted);
+    free(vol);
+    free(args);
+    free(ults);
+
+    return found;
+}
+
+/* A get being assembled, which identical gets wait for. */
+struct inflight {
+    struct list_head entry;
+    obj_descriptor odsc;
+    ABT_eventual ev;
+    /* the result, with a reference for each waiter; NULL if the get
+     * failed */
+    struct obj_data *od;
+    int waiters;
+    /* held by the assembling get and each waiter */
+    int refs;
+};
+
+static int ndstore_same_get(obj_descriptor *a, obj_descriptor *b)
+{
+    return a->version == b->version && a->size == b->size &&
+           a->level == b->level && a->refine == b->refine &&
+           strcmp(a->name, b->name) == 0 && bbox_equals(&a->bb, &b->bb);
+}
+
+static void ndstore_inflight_release(ndstore_provider_t provider, struct inflight *f)
+{
+    int last;
+
+    ABT_mutex_lock(provider->inflight_lock);
+    last = --f->refs == 0;
+    ABT_mutex_unlock(provider->inflight_lock);
+    if(last) {
+        ABT_eventual_free(&f->ev);
+        free(f);
+    }
+}
+
+/*
+ * Look a get up in the result cache. On a miss, wait for an identical
+ * get being assembled, or become the one assembling it: *inf is then
+ * set, to be passed to ndstore_result_done(). Returns the result
+ * pinned, or NULL if the caller has to assemble it.
+ */
+static struct obj_data *ndstore_result_get(ndstore_provider_t provider,
+        obj_descriptor *odsc, struct inflight **inf, uint64_t *gen)
+{
+    struct inflight *f;
+    struct obj_data *od;
+    int found = 0;
+
+    *inf = NULL;
+    od = cache_find(provider->results, provider, odsc, gen);
+    if(od)
+        return od;
+
+    ABT_mutex_lock(provider->inflight_lock);
+    list_for_each_entry(f, &provider->inflight, struct inflight, entry) {
+        if(ndstore_same_get(&f->odsc, odsc)) {
+            found = 1;
+            break;
+        }
+    }
+    if(found) {
+        f->waiters++;
+        f->refs++;
+        ABT_mutex_unlock(provider->inflight_lock);
+        ABT_eventual_wait(f->ev, NULL);
+        od = f->od;
+        ndstore_inflight_release(provider, f);
+        return od;
+    }
+
+    /* the last assembly may have completed since we looked */
+    od = cache_find(provider->results, provider, odsc, gen);
+    if(!od) {
+        f = calloc(1, sizeof(*f));
+        if(f && ABT_eventual_create(0, &f->ev) == ABT_SUCCESS) {
+            f->odsc = *odsc;
+            f->refs = 1;
+            list_add(&f->entry, &provider->inflight);
+            *inf = f;
+        } else {
+            free(f);
+        }
+    }
+    ABT_mutex_unlock(provider->inflight_lock);
+
+    return od;
+}
+
+/*
+ * Hand the result of an assembled get to the gets waiting for it, and
+ * cache it unless the variable was overwritten since 'gen'. 'od' is
+ * NULL if the get failed. A compressed piece pushed as is goes to the
+ * waiters only: it is in the storage already.
+ */
+static void ndstore_result_done(ndstore_provider_t provider, struct inflight *f,
+        struct obj_data *od, uint64_t gen)
+{
+    int i;
+
+    if(od && !od->comp) {
+        obj_data_ref(od);
+        cache_insert(provider->results, provider, od, gen);
+    }
+    ABT_mutex_lock(provider->inflight_lock);
+    list_del(&f->entry);
+    for(i = 0; od && i < f->waiters; i++)
+        obj_data_ref(od);
+    f->od = od;
+    ABT_mutex_unlock(provider->inflight_lock);
+    ABT_eventual_set(f->ev, NULL, 0);
+    ndstore_inflight_release(provider, f);
+}
+
+static void ndstore_get_ult(hg_handle_t handle)
+{
+    hg_return_t hret;
+    bulk_in_t in;
+    bulk_out_t out;
+    out.srv_time = 0;
+    out.comp_size = 0;
+    out.origin = 0;
+    out.seq = 0;
+    hg_bulk_t bulk_handle;
+    struct stats_timer timer;
+
+    stats_timer_start(&timer);
+
+    margo_instance_id mid = margo_hg_handle_get_instance(handle);
+
+    const struct hg_info* info = margo_get_info(handle);
+    ndstore_provider_t provider = (ndstore_provider_t)margo_registered_data(mid, info->id);
+
+     if(!provider) {
+        fprintf(stderr, "Error (ndstore_put_ult): NDSTORE could not find provider\n"); 
+        out.ret = NDSTORE_ERR_UNKNOWN_PR;
+        margo_respond(handle, &out);
+        margo_destroy(handle);
+        return;
+    }
+
+
+    hret = margo_get_input(handle, &in);
+    if(hret != HG_SUCCESS) {
+        out.ret = NDSTORE_ERR_MERCURY;
+        margo_respond(handle, &out);
+        margo_destroy(handle);
+        stats_record(&provider->stats, NDSTORE_STATS_OP_GET, &timer, 0, 0, out.ret);
+        return;
+    }
+
+    obj_descriptor in_odsc;
+    memcpy(&in_odsc, in.odsc.raw_odsc, sizeof(in_odsc));
+    stats_timer_mark(&timer, NDSTORE_STATS_PH_DECODE);
+
+    if(in_odsc.kind != OBJ_DENSE ||
+       in.fields.size != in_odsc.num_fields * FIELD_NAME_LEN ||
+       (in_odsc.refine && in_odsc.num_fields)) {
+        out.ret = NDSTORE_ERR_INVALID_ARG;
+        margo_respond(handle, &out);
+        margo_free_input(handle, &in);
+        margo_destroy(handle);
+        stats_record(&provider->stats, NDSTORE_STATS_OP_GET, &timer, 0, 0, out.ret);
+        return;
+    }
+    /* a replica only serves clients that saw no update it lacks */
+    if(in.seq > ndstore_applied_seq(provider, in.origin)) {
+        out.ret = NDSTORE_ERR_STALE;
+        margo_respond(handle, &out);
+        margo_free_input(handle, &in);
+        margo_destroy(handle);
+        stats_record(&provider->stats, NDSTORE_STATS_OP_GET, &timer, 0, 0, out.ret);
+        return;
+    }
+    /* the fields selected are sent back raw, in the order asked */
+    if(in_odsc.num_fields)
+        in.comp_codec = NDSTORE_CODEC_NONE;
+
+    struct obj_data *od = NULL, *pin = NULL;
+    struct obj_data **od_tab = NULL;
+    struct comp_hdr *wire = NULL;
+    struct inflight *inf = NULL;
+    uint64_t gen = 0;
+
+    /* identical gets share one assembly, whose result is cached */
+    if(provider->results && !in_odsc.num_fields)
+        od = ndstore_result_get(provider, &in_odsc, &inf, &gen);
+    /* the get we waited for pushed a stored piece as is: push it too if
+     * we accept its codec, otherwise expand it (or look the pieces up
+     * again if that fails) */
+    if(od && od->comp) {
+        if(in.comp_codec != NDSTORE_CODEC_NONE &&
+           ndstore_comp_passthrough(od, &in_odsc, in.comp_codec)) {
+            pin = od;
+            od = NULL;
+        } else {
+            struct obj_data *tmp = obj_data_alloc_node(&in_odsc, -1, provider->pages);
+
+            if(tmp && (uint64_t)ssd_copy(tmp, od) != bbox_volume(&in_odsc.bb)) {
+                obj_data_unref(tmp);
+                tmp = NULL;
+            }
+            obj_data_unref(od);
+            od = tmp;
+        }
+    }
+
+    /* the pieces found are pinned, so a concurrent put that evicts
+     * them cannot free the memory while we are still copying */
+    int obj_nums = 0;
+    if(!od && !pin && in_odsc.refine)
+        obj_nums = ls_find_levels(provider->ls, &in_odsc, &od_tab);
+    else if(!od && !pin)
+        obj_nums = ls_find_ods(provider->ls, &in_odsc, &od_tab);
+    stats_timer_mark(&timer, NDSTORE_STATS_PH_LOOKUP);
+
+    if (!od && !pin && obj_nums == 0) {
+        char *str;
+        str = obj_desc_sprint(&in_odsc);
+        fprintf(stderr, "Error (ndstore_put_ult): No objects found for %s", str);
+        free(str);
+        if(inf)
+            ndstore_result_done(provider, inf, NULL, 0);
+        out.ret = NDSTORE_ERR_UNKNOWN_OBJ;
+        margo_respond(handle, &out);
+        margo_free_input(handle, &in);
+        margo_destroy(handle);
+        stats_record(&provider->stats, NDSTORE_STATS_OP_GET, &timer, 0, 0, out.ret);
+        return;
+    }
+
+    hg_size_t size = obj_data_size(&in_odsc);
+    hg_size_t xfer = size;
+    void *buffer;
+    uint64_t total_elems_found = 0;
+    int i;
+
+    if(od || pin) {
+        total_elems_found = bbox_volume(&in_odsc.bb);
+    } else if(in.comp_codec != NDSTORE_CODEC_NONE && obj_nums == 1 &&
+       od_tab[0]->obj_desc.level == in_odsc.level &&
+       ndstore_comp_passthrough(od_tab[0], &in_odsc, in.comp_codec)) {
+        /* keep the piece pinned until the push is done */
+        pin = od_tab[0];
+        total_elems_found = bbox_volume(&in_odsc.bb);
+    } else {
+        od = obj_data_alloc_node(&in_odsc, -1, provider->pages);
+        if(od && obj_data_set_fields(od, in.fields.raw_odsc) != 0) {
+            obj_data_unref(od);
+            od = NULL;
+        }
+        /* compressed pieces only decode the chunks we need; levels are
+         * composited coarsest first, finer ones overwriting them */
+        if(od && in_odsc.refine)
+            total_elems_found = ssd_composite(od, od_tab, obj_nums);
+        else if(od)
+            total_elems_found = ndstore_copy_pieces(provider, od, od_tab, obj_nums);
+        for(i=0; i<obj_nums; i++)
+            obj_data_unref(od_tab[i]);
+    }
+    free(od_tab);
+    if(inf && total_elems_found != bbox_volume(&in_odsc.bb))
+        ndstore_result_done(provider, inf, NULL, 0);
+    else if(inf)
+        ndstore_result_done(provider, inf, pin ? pin : od, gen);
+    stats_timer_mark(&timer, NDSTORE_STATS_PH_COPY);
+
+    if(total_elems_found!=bbox_volume(&(in_odsc.bb))){
+        out.ret = NDSTORE_ERR_UNKNOWN_OBJ;
+        fprintf(stderr, "Error (ndstore_put_ult): Only partial objecyt is found. Returning Error to the client\n");
+        obj_data_unref(od);
+        margo_respond(handle, &out);
+        margo_free_input(handle, &in);
+        margo_destroy(handle);
+        stats_record(&provider->stats, NDSTORE_STATS_OP_GET, &timer, 0, 0, out.ret);
+        return;
+    }
+
+    if(pin) {
+        buffer = pin->comp;
+        xfer = pin->comp->total_size;
+        out.comp_size = xfer;
+    } else {
+        buffer = od->data;
+        /* lossy codecs need an error bound, only the client's lossless
+         * codec is applied here */
+        if(in.comp_codec != NDSTORE_CODEC_NONE &&
+           in.comp_codec != NDSTORE_CODEC_QUANT) {
+            struct ndstore_var_policy wp;
+            ndstore_var_policy_init(&wp);
+            wp.codec = in.comp_codec;
+            wire = comp_encode(&in_odsc, od->data, &wp);
+            if(wire) {
+                buffer = wire;
+                xfer = wire->total_size;
+                out.comp_size = xfer;
+            }
+            stats_timer_mark(&timer, NDSTORE_STATS_PH_COPY);
+        }
+    }
+
+    hret = margo_bulk_create(mid, 1, (void**)&buffer, &xfer,
+                HG_BULK_READ_ONLY, &bulk_handle);
+
+    if(hret != HG_SUCCESS) {
+        fprintf(stderr,"Error in margo_bulk_create()\n");
+        out.ret = NDSTORE_ERR_MERCURY;
+        out.comp_size = 0;
+        free(wire);
+        obj_data_unref(od);
+        obj_data_unref(pin);
+        margo_respond(handle, &out);
+        margo_free_input(handle, &in);
+        margo_destroy(handle);
+        stats_record(&provider->stats, NDSTORE_STATS_OP_GET, &timer, 0, 0, out.ret);
+        return;
+	}
+
+    hret = margo_bulk_transfer(mid, HG_BULK_PUSH, info->addr, in.handle, 0,
+            bulk_handle, 0, xfer);
+    if(hret != HG_SUCCESS) {
+        fprintf(stderr,"Error in margo_bulk_transfer()\n");
+        out.ret = NDSTORE_ERR_MERCURY;
+        out.comp_size = 0;
+        free(wire);
+        obj_data_unref(od);
+        obj_data_unref(pin);
+        margo_respond(handle, &out);
+        margo_free_input(handle, &in);
+        margo_bulk_free(bulk_handle);
+        margo_destroy(handle);
+        stats_record(&provider->stats, NDSTORE_STATS_OP_GET, &timer, 0, 0, out.ret);
+        return;
+    }
+    margo_bulk_free(bulk_handle);
+    free(wire);
+    obj_data_unref(od);
+    obj_data_unref(pin);
+    stats_timer_mark(&timer, NDSTORE_STATS_PH_BULK);
+
+    out.ret = NDSTORE_SUCCESS;
+    out.origin = provider->origin;
+    out.seq = ndstore_seq(provider);
+    out.srv_time = stats_timer_elapsed_ns(&timer);
+    margo_respond(handle, &out);
+    margo_free_input(handle, &in);
+    margo_destroy(handle);
+    stats_timer_mark(&timer, NDSTORE_STATS_PH_RESPOND);
+    stats_record(&provider->stats, NDSTORE_STATS_OP_GET, &timer, 0, xfer, out.ret);
+}
+DEFINE_MARGO_RPC_HANDLER(ndstore_get_ult)
+
+
+static void ndstore_stats_ult(hg_handle_t handle)
+{
+    hg_return_t hret;
+    bulk_in_t in;
+    bulk_out_t out;
+    out.srv_time = 0;
+    out.comp_size = 0;
+    out.origin = 0;
+    out.seq = 0;
+    hg_bulk_t bulk_handle;
+    struct ndstore_stats stats;
+
+    margo_instance_id mid = margo_hg_handle_get_instance(handle);
+
+    const struct hg_info* info = margo_get_info(handle);
+    ndstore_provider_t provider = (ndstore_provider_t)margo_registered_data(mid, info->id);
+
+     if(!provider) {
+        fprintf(stderr, "Error (ndstore_stats_ult): NDSTORE could not find provider\n");
+        out.ret = NDSTORE_ERR_UNKNOWN_PR;
+        margo_respond(handle, &out);
+        margo_destroy(handle);
+        return;
+    }
+
+    hret = margo_get_input(handle, &in);
+    if(hret != HG_SUCCESS) {
+        out.ret = NDSTORE_ERR_MERCURY;
+        margo_respond(handle, &out);
+        margo_destroy(handle);
+        return;
+    }
+
+    ndstore_provider_get_stats(provider, &stats);
+
+    /* the snapshot is too large for an eager response, so push it into
+     * the buffer exposed by the client like any other get */
+    hg_size_t size = sizeof(stats);
+    void *buffer = (void*) &stats;
+    hret = margo_bulk_create(mid, 1, (void**)&buffer, &size,
+                HG_BULK_READ_ONLY, &bulk_handle);
+    if(hret != HG_SUCCESS) {
+        fprintf(stderr,"Error in margo_bulk_create()\n");
+        out.ret = NDSTORE_ERR_MERCURY;
+        margo_respond(handle, &out);
+        margo_free_input(handle, &in);
+        margo_destroy(handle);
+        return;
+    }
+
+    hret = margo_bulk_transfer(mid, HG_BULK_PUSH, info->addr, in.handle, 0,
+            bulk_handle, 0, size);
+    margo_bulk_free(bulk_handle);
+    out.ret = (hret == HG_SUCCESS) ? NDSTORE_SUCCESS : NDSTORE_ERR_MERCURY;
+    margo_respond(handle, &out);
+    margo_free_input(handle, &in);
+    margo_destroy(handle);
+}
+DEFINE_MARGO_RPC_HANDLER(ndstore_stats_ult)
+
+
+static void ndstore_policy_ult(hg_handle_t handle)
+{
+    hg_return_t hret;
+    policy_in_t in;
+    bulk_out_t out;
+    out.srv_time = 0;
+    out.comp_size = 0;
+    out.origin = 0;
+    out.seq = 0;
+    struct policy_rec rec;
+
+    margo_instance_id mid = margo_hg_handle_get_instance(handle);
+
+    const struct hg_info* info = margo_get_info(handle);
+    ndstore_provider_t provider = (ndstore_provider_t)margo_registered_data(mid, info->id);
+
+     if(!provider) {
+        fprintf(stderr, "Error (ndstore_policy_ult): NDSTORE could not find provider\n");
+        out.ret = NDSTORE_ERR_UNKNOWN_PR;
+        margo_respond(handle, &out);
+        margo_destroy(handle);
+        return;
+    }
+
+    hret = margo_get_input(handle, &in);
+    if(hret != HG_SUCCESS) {
+        out.ret = NDSTORE_ERR_MERCURY;
+        margo_respond(handle, &out);
+        margo_destroy(handle);
+        return;
+    }
+
+    if(in.rec.size != sizeof(rec)) {
+        out.ret = NDSTORE_ERR_INVALID_ARG;
+        margo_respond(handle, &out);
+        margo_free_input(handle, &in);
+        margo_destroy(handle);
+        return;
+    }
+    memcpy(&rec, in.rec.raw_odsc, sizeof(rec));
+    rec.name[POLICY_NAME_LEN-1] = '\0';
+
+    out.ret = ndstore_set_var_policy(provider, rec.name, &rec.policy,
+            info->id != provider->ndstore_replicate_policy_id);
+    margo_respond(handle, &out);
+    margo_free_input(handle, &in);
+    margo_destroy(handle);
+}
+DEFINE_MARGO_RPC_HANDLER(ndstore_policy_ult)
+
+/*
+ * Whether a put of 'odsc' replaces data that subscribed clients may
+ * hold: data still stored, or a version that was evicted or collected
+ * since it was read. A new version or box needs no invalidation.
+ */
+static int ndstore_overwrites(ndstore_provider_t provider, obj_descriptor *odsc)
+{
+    struct obj_data **od_tab;
+    int i, num;
+
+    if(!provider->num_subs)
+        return 0;
+    if(ls_dropped(provider->ls, odsc))
+        return 1;
+    num = ls_find_ods(provider->ls, odsc, &od_tab);
+    for(i = 0; i < num; i++)
+        obj_data_unref(od_tab[i]);
+    free(od_tab);
+    return num > 0;
+}
+
+/*
+ * Queue the news that the versions odsc->version to ver_hi of a
+ * variable changed in the box odsc->bb (everywhere if bb.num_dims is 0)
+ * for the subscribed clients. Handlers do not wait for the clients: a
+ * client may serve the old data from its cache until the notification
+ * reaches it.
+ */
+static void ndstore_invalidate(ndstore_provider_t provider, obj_descriptor *odsc,
+        uint32_t ver_hi)
+{
+    struct invalidate_op *op;
+
+    if(!provider->num_subs)
+        return;
+    op = malloc(sizeof(*op));
+    if(!op) {
+        fprintf(stderr, "Error (ndstore_invalidate): could not notify the clients\n");
+        return;
+    }
+    op->odsc = *odsc;
+    op->ver_hi = ver_hi;
+
+    ABT_mutex_lock(provider->sub_lock);
+    if(provider->inval_ult == ABT_THREAD_NULL || provider->inval_stop) {
+        ABT_mutex_unlock(provider->sub_lock);
+        free(op);
+        return;
+    }
+    list_add_tail(&op->entry, &provider->inval_ops);
+    ABT_cond_signal(provider->inval_cond);
+    ABT_mutex_unlock(provider->sub_lock);
+}
+
+/*
+ * Send a notification to all subscribed clients at once, then wait for
+ * them. Clients that do not answer in time are dropped, so a slow or
+ * dead client holds the queue up once only.
+ */
+static void ndstore_invalidate_send(ndstore_provider_t provider,
+        obj_descriptor *odsc, uint32_t ver_hi)
+{
+    margo_instance_id mid = provider->mid;
+    hg_addr_t *subs;
+    hg_handle_t *h;
+    margo_request *reqs;
+    hg_return_t hret;
+    delete_in_t in;
+    bulk_out_t out;
+    int i, j, n;
+
+    ABT_mutex_lock(provider->sub_lock);
+    n = provider->num_subs;
+    subs = calloc(n, sizeof(*subs));
+    for(i = 0; subs && i < n; i++)
+        if(margo_addr_dup(mid, provider->subs[i], &subs[i]) != HG_SUCCESS)
+            subs[i] = HG_ADDR_NULL;
+    ABT_mutex_unlock(provider->sub_lock);
+    h = calloc(n, sizeof(*h));
+    reqs = calloc(n, sizeof(*reqs));
+    if(!n || !subs || !h || !reqs) {
+        if(n)
+            fprintf(stderr, "Error (ndstore_invalidate): could not notify the clients\n");
+        for(i = 0; subs && i < n; i++)
+            if(subs[i] != HG_ADDR_NULL)
+                margo_addr_free(mid, subs[i]);
+        free(subs);
+        free(h);
+        free(reqs);
+        return;
+    }
+
+    in.odsc.size = sizeof(*odsc);
+    in.odsc.raw_odsc = (char*)odsc;
+    in.ver_hi = ver_hi;
+    in.origin = 0;
+    in.seq = 0;
+
+    /* all clients are notified at once, then waited for */
+    for(i = 0; i < n; i++) {
+        h[i] = HG_HANDLE_NULL;
+        if(subs[i] == HG_ADDR_NULL ||
+           margo_create(mid, subs[i], provider->ndstore_invalidate_id, &h[i]) != HG_SUCCESS)
+            continue;
+        if(margo_iforward_timed(h[i], &in, NDSTORE_INVALIDATE_TIMEOUT_MS, &reqs[i]) != HG_SUCCESS) {
+            margo_destroy(h[i]);
+            h[i] = HG_HANDLE_NULL;
+        }
+    }
+    for(i = 0; i < n; i++) {
+        hret = HG_OTHER_ERROR;
+        if(h[i] != HG_HANDLE_NULL) {
+            hret = margo_wait(reqs[i]);
+            if(hret == HG_SUCCESS)
+                hret = margo_get_output(h[i], &out);
+            if(hret == HG_SUCCESS)
+                margo_free_output(h[i], &out);
+            margo_destroy(h[i]);
+        }
+        if(hret != HG_SUCCESS && subs[i] != HG_ADDR_NULL) {
+            ABT_mutex_lock(provider->sub_lock);
+            for(j = 0; j < provider->num_subs; j++) {
+                if(margo_addr_cmp(mid, provider->subs[j], subs[i])) {
+                    margo_addr_free(mid, provider->subs[j]);
+                    provider->subs[j] = provider->subs[--provider->num_subs];
+                    break;
+                }
+            }
+            ABT_mutex_unlock(provider->sub_lock);
+        }
+        if(subs[i] != HG_ADDR_NULL)
+            margo_addr_free(mid, subs[i]);
+    }
+    free(subs);
+    free(h);
+    free(reqs);
+}
+
+/* Send the queued notifications, in order, until the provider stops. */
+static void ndstore_notify_ult(void *arg)
+{
+    ndstore_provider_t provider = (ndstore_provider_t)arg;
+    struct invalidate_op *op;
+
+    for(;;) {
+        ABT_mutex_lock(provider->sub_lock);
+        while(list_empty(&provider->inval_ops) && !provider->inval_stop)
+            ABT_cond_wait(provider->inval_cond, provider->sub_lock);
+        if(provider->inval_stop) {
+            ABT_mutex_unlock(provider->sub_lock);
+            break;
+        }
+        op = list_entry(provider->inval_ops.next, struct invalidate_op, entry);
+        list_del(&op->entry);
+        ABT_mutex_unlock(provider->sub_lock);
+
+        ndstore_invalidate_send(provider, &op->odsc, op->ver_hi);
+        free(op);
+    }
+}
+
+/*
+ * Queue a put of 'od' (which the queue pins), or a delete of the
+ * versions odsc->version to ver_hi when 'od' is NULL, for the replicas.
+ * The handler does not wait for them: a replica lags behind the provider
+ * by the ops still queued. Returns the number of the update, which the
+ * replicas apply in order; handlers queue it before the update is
+ * visible, so that the number a get reports covers what it read.
+ */
+static uint64_t ndstore_replicate(ndstore_provider_t provider, struct obj_data *od,
+        obj_descriptor *odsc, uint32_t ver_hi)
+{
+    struct replicate_op *op;
+    uint64_t seq;
+
+    op = calloc(1, sizeof(*op));
+    if(!op)
+        fprintf(stderr, "Error (ndstore_replicate): the replicas miss an update\n");
+    else if(od) {
+        obj_data_ref(od);
+        op->od = od;
+    } else {
+        op->odsc = *odsc;
+        op->ver_hi = ver_hi;
+    }
+
+    /* a missed update still takes a number, the gap keeps the clients
+     * that saw it away from the replicas */
+    ABT_mutex_lock(provider->repl_lock);
+    seq = ++provider->repl_seq;
+    if(op) {
+        op->seq = seq;
+        list_add_tail(&op->entry, &provider->repl_ops);
+        ABT_cond_signal(provider->repl_cond);
+    }
+    ABT_mutex_unlock(provider->repl_lock);
+
+    return seq;
+}
+
+/*
+ * Queue a policy for the replicas. Policies are not numbered: a replica
+ * that misses one still holds the same data.
+ */
+static void ndstore_replicate_policy(ndstore_provider_t provider,
+        const char *name, const struct ndstore_var_policy *policy)
+{
+    struct replicate_op *op;
+
+    op = calloc(1, sizeof(*op));
+    if(op)
+        op->rec = calloc(1, sizeof(*op->rec));
+    if(!op || !op->rec) {
+        fprintf(stderr, "Error (ndstore_replicate_policy): the replicas miss the policy of %s\n",
+                name);
+        free(op);
+        return;
+    }
+    strncpy(op->rec->name, name, POLICY_NAME_LEN - 1);
+    op->rec->policy = *policy;
+
+    ABT_mutex_lock(provider->repl_lock);
+    list_add_tail(&op->entry, &provider->repl_ops);
+    ABT_cond_signal(provider->repl_cond);
+    ABT_mutex_unlock(provider->repl_lock);
+}
+
+/*
+ * As a replica, record that the update 'seq' of the provider 'origin'
+ * was applied. Each provider numbers its updates on its own, and sends
+ * them one at a time, in order: after one that was missed, the replica
+ * turns away the clients that saw later ones of that provider.
+ */
+static void ndstore_applied(ndstore_provider_t provider, uint64_t origin,
+        uint64_t seq)
+{
+    struct applied *a;
+    int i;
+
+    ABT_mutex_lock(provider->repl_lock);
+    for(i = 0; i < provider->num_applied; i++)
+        if(provider->applied[i].origin == origin)
+            break;
+    if(i == provider->num_applied) {
+        a = realloc(provider->applied, sizeof(*a) * (i + 1));
+        if(!a) {
+            ABT_mutex_unlock(provider->repl_lock);
+            return;
+        }
+        provider->applied = a;
+        a[i].origin = origin;
+        a[i].seq = 0;
+        provider->num_applied++;
+    }
+    if(seq == provider->applied[i].seq + 1)
+        provider->applied[i].seq = seq;
+    ABT_mutex_unlock(provider->repl_lock);
+}
+
+/* Number of the last update queued for the replicas. */
+static uint64_t ndstore_seq(ndstore_provider_t provider)
+{
+    uint64_t seq;
+
+    ABT_mutex_lock(provider->repl_lock);
+    seq = provider->repl_seq;
+    ABT_mutex_unlock(provider->repl_lock);
+
+    return seq;
+}
+
+/* Number of the last update of the provider 'origin' applied here. */
+static uint64_t ndstore_applied_seq(ndstore_provider_t provider, uint64_t origin)
+{
+    uint64_t seq = 0;
+    int i;
+
+    ABT_mutex_lock(provider->repl_lock);
+    for(i = 0; i < provider->num_applied; i++)
+        if(provider->applied[i].origin == origin)
+            seq = provider->applied[i].seq;
+    ABT_mutex_unlock(provider->repl_lock);
+
+    return seq;
+}
+
+/*
+ * A number the replicas tell this provider apart by, from the others
+ * forwarding to them and from itself before a restart, whose updates
+ * are numbered from 1 again.
+ */
+static uint64_t ndstore_origin(margo_instance_id mid, uint16_t provider_id)
+{
+    char str[256] = {0};
+    hg_size_t size = sizeof(str);
+    hg_addr_t self;
+    uint64_t h = 14695981039346656037ULL;
+    uint64_t salt[3] = {provider_id, (uint64_t)getpid(), (uint64_t)time(NULL)};
+    size_t i;
+
+    if(margo_addr_self(mid, &self) == HG_SUCCESS) {
+        margo_addr_to_string(mid, str, &size, self);
+        margo_addr_free(mid, self);
+    }
+    /* FNV-1a */
+    for(i = 0; i < strlen(str); i++)
+        h = (h ^ (unsigned char)str[i]) * 1099511628211ULL;
+    for(i = 0; i < sizeof(salt); i++)
+        h = (h ^ ((unsigned char *)salt)[i]) * 1099511628211ULL;
+
+    return h ? h : 1;
+}
+
+/*
+ * Put an object on a replica. The object is sent as stored when it is
+ * compressed on its own, otherwise its data is sent raw (rebuilt from
+ * its delta chain or compressed payload if need be).
+ */
+static int ndstore_replicate_put(ndstore_provider_t provider,
+        struct replica *r, struct obj_data *od, uint64_t seq)
+{
+    margo_instance_id mid = provider->mid;
+    struct obj_data *raw = NULL;
+    hg_size_t size = obj_data_size(&od->obj_desc);
+    hg_handle_t h;
+    hg_return_t hret;
+    bulk_in_t in;
+    bulk_out_t out;
+    void *buffer = od->data;
+    int ret;
+
+    in.comp_codec = NDSTORE_CODEC_NONE;
+    in.comp_size = 0;
+    if(od->comp && !od->delta_base && od->comp->total_size < size) {
+        buffer = od->comp;
+        size = od->comp->total_size;
+        in.comp_codec = od->comp->codec;
+        in.comp_size = size;
+    } else if(!buffer) {
+        raw = obj_data_alloc(&od->obj_desc);
+        if(!raw)
+            return NDSTORE_ERR_ALLOCATION;
+        ssd_copy(raw, od);
+        buffer = raw->data;
+    }
+    in.odsc.size = sizeof(od->obj_desc);
+    in.odsc.raw_odsc = (char*)&od->obj_desc;
+    in.fields.size = od->obj_desc.num_fields * FIELD_NAME_LEN;
+    in.fields.raw_odsc = (char*)od->fields;
+    in.origin = provider->origin;
+    in.seq = seq;
+
+    hret = margo_bulk_create(mid, 1, &buffer, &size, HG_BULK_READ_ONLY,
+            &in.handle);
+    if(hret != HG_SUCCESS) {
+        obj_data_free(raw);
+        return NDSTORE_ERR_MERCURY;
+    }
+    hret = margo_create(mid, r->addr, provider->ndstore_replicate_fwd_id, &h);
+    if(hret != HG_SUCCESS) {
+        margo_bulk_free(in.handle);
+        obj_data_free(raw);
+        return NDSTORE_ERR_MERCURY;
+    }
+
+    ret = NDSTORE_ERR_MERCURY;
+    hret = margo_provider_forward_timed(r->provider_id, h, &in,
+            NDSTORE_REPLICATE_TIMEOUT_MS);
+    if(hret == HG_SUCCESS && margo_get_output(h, &out) == HG_SUCCESS) {
+        ret = out.ret;
+        margo_free_output(h, &out);
+    }
+    margo_destroy(h);
+    margo_bulk_free(in.handle);
+    obj_data_free(raw);
+
+    return ret;
+}
+
+static int ndstore_replicate_delete(ndstore_provider_t provider,
+        struct replica *r, struct replicate_op *op)
+{
+    hg_handle_t h;
+    delete_in_t in;
+    bulk_out_t out;
+    int ret = NDSTORE_ERR_MERCURY;
+
+    in.odsc.size = sizeof(op->odsc);
+    in.odsc.raw_odsc = (char*)&op->odsc;
+    in.ver_hi = op->ver_hi;
+    in.origin = provider->origin;
+    in.seq = op->seq;
+
+    if(margo_create(provider->mid, r->addr,
+            provider->ndstore_replicate_delete_fwd_id, &h) != HG_SUCCESS)
+        return ret;
+    if(margo_provider_forward_timed(r->provider_id, h, &in,
+            NDSTORE_REPLICATE_TIMEOUT_MS) == HG_SUCCESS &&
+       margo_get_output(h, &out) == HG_SUCCESS) {
+        ret = out.ret;
+        margo_free_output(h, &out);
+    }
+    margo_destroy(h);
+
+    return ret;
+}
+
+static int ndstore_replicate_set_policy(ndstore_provider_t provider,
+        struct replica *r, struct replicate_op *op)
+{
+    hg_handle_t h;
+    policy_in_t in;
+    bulk_out_t out;
+    int ret = NDSTORE_ERR_MERCURY;
+
+    in.rec.size = sizeof(*op->rec);
+    in.rec.raw_odsc = (char*)op->rec;
+
+    if(margo_create(provider->mid, r->addr,
+            provider->ndstore_replicate_policy_fwd_id, &h) != HG_SUCCESS)
+        return ret;
+    if(margo_provider_forward_timed(r->provider_id, h, &in,
+            NDSTORE_REPLICATE_TIMEOUT_MS) == HG_SUCCESS &&
+       margo_get_output(h, &out) == HG_SUCCESS) {
+        ret = out.ret;
+        margo_free_output(h, &out);
+    }
+    margo_destroy(h);
+
+    return ret;
+}
+
+/*
+ * Forward the queued puts, deletes and policies to every replica, one at a time so
+ * that each replica applies them in the order the provider did. A replica
+ * whose address cannot be resolved, or that fails an op, misses it; the
+ * clients reading from it fall back to the provider.
+ */
+static void ndstore_replicate_ult(void *arg)
+{
+    ndstore_provider_t provider = (ndstore_provider_t)arg;
+    struct replicate_op *op;
+    struct replica *r;
+    int i, ret;
+
+    for(;;) {
+        ABT_mutex_lock(provider->repl_lock);
+        while(list_empty(&provider->repl_ops) && !provider->repl_stop)
+            ABT_cond_wait(provider->repl_cond, provider->repl_lock);
+        if(list_empty(&provider->repl_ops)) {
+            ABT_mutex_unlock(provider->repl_lock);
+            break;
+        }
+        op = list_entry(provider->repl_ops.next, struct replicate_op, entry);
+        list_del(&op->entry);
+        ABT_mutex_unlock(provider->repl_lock);
+
+        for(i = 0; i < provider->num_replicas; i++) {
+            r = &provider->replicas[i];
+            if(r->addr == HG_ADDR_NULL &&
+               margo_addr_lookup(provider->mid, r->addr_str, &r->addr) != HG_SUCCESS) {
+                r->addr = HG_ADDR_NULL;
+                ret = NDSTORE_ERR_MERCURY;
+            } else if(op->od) {
+                ret = ndstore_replicate_put(provider, r, op->od, op->seq);
+            } else if(op->rec) {
+                ret = ndstore_replicate_set_policy(provider, r, op);
+            } else {
+                ret = ndstore_replicate_delete(provider, r, op);
+            }
+            if(ret != NDSTORE_SUCCESS && op->rec)
+                fprintf(stderr, "Error (ndstore_replicate_ult): replica %s (%d) missed the policy of %s: %d\n",
+                        r->addr_str, r->provider_id, op->rec->name, ret);
+            else if(ret != NDSTORE_SUCCESS)
+                fprintf(stderr, "Error (ndstore_replicate_ult): replica %s (%d) missed the %s of %s version %u: %d\n",
+                        r->addr_str, r->provider_id, op->od ? "put" : "delete",
+                        op->od ? op->od->obj_desc.name : op->odsc.name,
+                        op->od ? op->od->obj_desc.version : op->odsc.version, ret);
+        }
+
+        if(op->od)
+            obj_data_unref(op->od);
+        free(op->rec);
+        free(op);
+    }
+}
+
+/*
+ * Register the caller as a client that caches what it reads, see
+ * ndstore_client_cache_enable().
+ */
+static void ndstore_subscribe_ult(hg_handle_t handle)
+{
+    bulk_out_t out;
+    out.srv_time = 0;
+    out.comp_size = 0;
+    out.origin = 0;
+    out.seq = 0;
+    hg_addr_t *subs;
+    int i;
+
+    margo_instance_id mid = margo_hg_handle_get_instance(handle);
+
+    const struct hg_info* info = margo_get_info(handle);
+    ndstore_provider_t provider = (ndstore_provider_t)margo_registered_data(mid, info->id);
+
+     if(!provider) {
+        fprintf(stderr, "Error (ndstore_subscribe_ult): NDSTORE could not find provider\n");
+        out.ret = NDSTORE_ERR_UNKNOWN_PR;
+        margo_respond(handle, &out);
+        margo_destroy(handle);
+        return;
+    }
+
+    out.ret = NDSTORE_SUCCESS;
+    ABT_mutex_lock(provider->sub_lock);
+    for(i = 0; i < provider->num_subs; i++)
+        if(margo_addr_cmp(mid, provider->subs[i], info->addr))
+            break;
+    if(i == provider->num_subs) {
+        subs = realloc(provider->subs, sizeof(*subs) * (i + 1));
+        if(!subs) {
+            out.ret = NDSTORE_ERR_ALLOCATION;
+        } else {
+            provider->subs = subs;
+            if(margo_addr_dup(mid, info->addr, &subs[i]) == HG_SUCCESS)
+                provider->num_subs++;
+            else
+                out.ret = NDSTORE_ERR_MERCURY;
+        }
+    }
+    if(out.ret == NDSTORE_SUCCESS && provider->inval_ult == ABT_THREAD_NULL &&
+       ABT_thread_create(provider->pool, ndstore_notify_ult, provider,
+            ABT_THREAD_ATTR_NULL, &provider->inval_ult) != ABT_SUCCESS) {
+        provider->inval_ult = ABT_THREAD_NULL;
+        out.ret = NDSTORE_ERR_ARGOBOTS;
+    }
+    ABT_mutex_unlock(provider->sub_lock);
+
+    margo_respond(handle, &out);
+    margo_destroy(handle);
+}
+DEFINE_MARGO_RPC_HANDLER(ndstore_subscribe_ult)
+
+/* Forget a client that stops caching, e.g. as it exits. */
+static void ndstore_unsubscribe_ult(hg_handle_t handle)
+{
+    bulk_out_t out;
+    out.srv_time = 0;
+    out.comp_size = 0;
+    out.origin = 0;
+    out.seq = 0;
+    int i;
+
+    margo_instance_id mid = margo_hg_handle_get_instance(handle);
+
+    const struct hg_info* info = margo_get_info(handle);
+    ndstore_provider_t provider = (ndstore_provider_t)margo_registered_data(mid, info->id);
+
+     if(!provider) {
+        fprintf(stderr, "Error (ndstore_unsubscribe_ult): NDSTORE could not find provider\n");
+        out.ret = NDSTORE_ERR_UNKNOWN_PR;
+        margo_respond(handle, &out);
+        margo_destroy(handle);
+        return;
+    }
+
+    ABT_mutex_lock(provider->sub_lock);
+    for(i = 0; i < provider->num_subs; i++) {
+        if(margo_addr_cmp(mid, provider->subs[i], info->addr)) {
+            margo_addr_free(mid, provider->subs[i]);
+            provider->subs[i] = provider->subs[--provider->num_subs];
+            break;
+        }
+    }
+    ABT_mutex_unlock(provider->sub_lock);
+
+    out.ret = NDSTORE_SUCCESS;
+    margo_respond(handle, &out);
+    margo_destroy(handle);
+}
+DEFINE_MARGO_RPC_HANDLER(ndstore_unsubscribe_ult)
+
+static void ndstore_delete_ult(hg_handle_t handle)
+{
+    hg_return_t hret;
+    delete_in_t in;
+    bulk_out_t out;
+    out.srv_time = 0;
+    out.comp_size = 0;
+    out.origin = 0;
+    out.seq = 0;
+    obj_descriptor in_odsc;
+
+    margo_instance_id mid = margo_hg_handle_get_instance(handle);
+
+    const struct hg_info* info = margo_get_info(handle);
+    ndstore_provider_t provider = (ndstore_provider_t)margo_registered_data(mid, info->id);
+
+     if(!provider) {
+        fprintf(stderr, "Error (ndstore_delete_ult): NDSTORE could not find provider\n");
+        out.ret = NDSTORE_ERR_UNKNOWN_PR;
+        margo_respond(handle, &out);
+        margo_destroy(handle);
+        return;
+    }
+
+    hret = margo_get_input(handle, &in);
+    if(hret != HG_SUCCESS) {
+        out.ret = NDSTORE_ERR_MERCURY;
+        margo_respond(handle, &out);
+        margo_destroy(handle);
+        return;
+    }
+
+    if(in.odsc.size != sizeof(in_odsc)) {
+        out.ret = NDSTORE_ERR_INVALID_ARG;
+        margo_respond(handle, &out);
+        margo_free_input(handle, &in);
+        margo_destroy(handle);
+        return;
+    }
+    memcpy(&in_odsc, in.odsc.raw_odsc, sizeof(in_odsc));
+    in_odsc.name[sizeof(in_odsc.name)-1] = '\0';
+    if(in_odsc.bb.num_dims < 0 || in_odsc.bb.num_dims > BBOX_MAX_NDIM) {
+        out.ret = NDSTORE_ERR_INVALID_ARG;
+        margo_respond(handle, &out);
+        margo_free_input(handle, &in);
+        margo_destroy(handle);
+        return;
+    }
+
+    if(provider->num_replicas && info->id != provider->ndstore_replicate_delete_id) {
+        out.origin = provider->origin;
+        out.seq = ndstore_replicate(provider, NULL, &in_odsc, in.ver_hi);
+    }
+    /* the reply only waits for the unlink; payloads still pinned by
+     * in-flight gets are freed by the last of them */
+    ls_delete(provider->ls, in_odsc.name, in_odsc.version, in.ver_hi,
+            in_odsc.bb.num_dims ? &in_odsc.bb : NULL);
+    if(info->id == provider->ndstore_replicate_delete_id)
+        ndstore_applied(provider, in.origin, in.seq);
+    if(provider->results)
+        cache_invalidate(provider->results, &in_odsc, in.ver_hi);
+    ndstore_invalidate(provider, &in_odsc, in.ver_hi);
+
+    out.ret = NDSTORE_SUCCESS;
+    margo_respond(handle, &out);
+    margo_free_input(handle, &in);
+    margo_destroy(handle);
+}
+DEFINE_MARGO_RPC_HANDLER(ndstore_delete_ult)
+
+struct lease {
+    struct list_head entry;
+    uint64_t id;
+    double expire;
+    hg_bulk_t bulk;
+    int num;
+    struct obj_data **pieces;
+};
+
+static void ndstore_lease_free(struct lease *l)
+{
+    int i;
+
+    if(l->bulk != HG_BULK_NULL)
+        margo_bulk_free(l->bulk);
+    for(i = 0; i < l->num; i++)
+        obj_data_unref(l->pieces[i]);
+    free(l->pieces);
+    free(l);
+}
+
+/* Free the leases that expired before 'now', or all of them if 0. */
+static void ndstore_lease_reap(ndstore_provider_t provider, double now)
+{
+    struct lease *l, *t;
+    struct list_head dead;
+
+    INIT_LIST_HEAD(&dead);
+    ABT_mutex_lock(provider->lease_lock);
+    list_for_each_entry_safe(l, t, &provider->leases, struct lease, entry) {
+        if(now && l->expire > now)
+            continue;
+        list_del(&l->entry);
+        list_add(&l->entry, &dead);
+    }
+    ABT_mutex_unlock(provider->lease_lock);
+
+    list_for_each_entry_safe(l, t, &dead, struct lease, entry)
+        ndstore_lease_free(l);
+}
+
+/*
+ * Expose the pieces that intersect a get to the client, which pulls
+ * them and assembles the result itself. Stored pieces are exposed as
+ * they are and stay pinned until the client releases them; compressed
+ * pieces, and pieces mostly outside of the request, are first copied
+ * to a temporary holding only the intersection.
+ */
+static void ndstore_get_pieces_ult(hg_handle_t handle)
+{
+    hg_return_t hret;
+    bulk_in_t in;
+    pieces_out_t out;
+    out.srv_time = 0;
+    out.lease = 0;
+    out.pieces.size = 0;
+    out.pieces.raw_odsc = NULL;
+    out.handle = HG_BULK_NULL;
+    struct stats_timer timer;
+
+    stats_timer_start(&timer);
+
+    margo_instance_id mid = margo_hg_handle_get_instance(handle);
+
+    const struct hg_info* info = margo_get_info(handle);
+    ndstore_provider_t provider = (ndstore_provider_t)margo_registered_data(mid, info->id);
+
+     if(!provider) {
+        fprintf(stderr, "Error (ndstore_get_pieces_ult): NDSTORE could not find provider\n");
+        out.ret = NDSTORE_ERR_UNKNOWN_PR;
+        margo_respond(handle, &out);
+        margo_destroy(handle);
+        return;
+    }
+
+    hret = margo_get_input(handle, &in);
+    if(hret != HG_SUCCESS) {
+        out.ret = NDSTORE_ERR_MERCURY;
+        margo_respond(handle, &out);
+        margo_destroy(handle);
+        stats_record(&provider->stats, NDSTORE_STATS_OP_GET_PIECES, &timer, 0, 0, out.ret);
+        return;
+    }
+
+    obj_descriptor in_odsc;
+    memcpy(&in_odsc, in.odsc.raw_odsc, sizeof(in_odsc));
+    stats_timer_mark(&timer, NDSTORE_STATS_PH_DECODE);
+
+    struct obj_data **od_tab;
+    int obj_nums = ls_find_ods(provider->ls, &in_odsc, &od_tab);
+    stats_timer_mark(&timer, NDSTORE_STATS_PH_LOOKUP);
+
+    if(obj_nums == 0) {
+        out.ret = NDSTORE_ERR_UNKNOWN_OBJ;
+        margo_respond(handle, &out);
+        margo_free_input(handle, &in);
+        margo_destroy(handle);
+        stats_record(&provider->stats, NDSTORE_STATS_OP_GET_PIECES, &timer, 0, 0, out.ret);
+        return;
+    }
+
+    struct lease *lease = calloc(1, sizeof(*lease));
+    struct piece_desc *descs = malloc(sizeof(*descs) * obj_nums);
+    void **ptrs = malloc(sizeof(*ptrs) * obj_nums);
+    hg_size_t *sizes = malloc(sizeof(*sizes) * obj_nums);
+    struct obj_data *p, *t;
+    obj_descriptor odsc;
+    struct bbox bb;
+    uint64_t vol, found = 0, off = 0;
+    int i;
+
+    out.ret = NDSTORE_SUCCESS;
+    if(lease)
+        lease->pieces = malloc(sizeof(*lease->pieces) * obj_nums);
+    if(!lease || !lease->pieces || !descs || !ptrs || !sizes)
+        out.ret = NDSTORE_ERR_ALLOCATION;
+    for(i = 0; i < obj_nums; i++) {
+        p = od_tab[i];
+        /* multi-field and point pieces have gets of their own */
+        if(out.ret != NDSTORE_SUCCESS || p->obj_desc.num_fields ||
+           p->obj_desc.kind != OBJ_DENSE) {
+            obj_data_unref(p);
+            continue;
+        }
+        bbox_intersect(&in_odsc.bb, &p->obj_desc.bb, &bb);
+        vol = bbox_volume(&bb);
+        if(p->comp || 2 * vol < bbox_volume(&p->obj_desc.bb)) {
+            odsc = p->obj_desc;
+            odsc.bb = bb;
+            t = obj_data_alloc(&odsc);
+            if(t)
+                ssd_copy(t, p);
+            obj_data_unref(p);
+            if(!t) {
+                out.ret = NDSTORE_ERR_ALLOCATION;
+                continue;
+            }
+            p = t;
+        }
+        found += vol;
+        descs[lease->num].odsc = p->obj_desc;
+        descs[lease->num].offset = off;
+        ptrs[lease->num] = p->data;
+        sizes[lease->num] = obj_data_size(&p->obj_desc);
+        off += sizes[lease->num];
+        lease->pieces[lease->num++] = p;
+    }
+    free(od_tab);
+    stats_timer_mark(&timer, NDSTORE_STATS_PH_COPY);
+
+    if(out.ret == NDSTORE_SUCCESS && found != bbox_volume(&in_odsc.bb))
+        out.ret = NDSTORE_ERR_UNKNOWN_OBJ;
+    if(out.ret != NDSTORE_SUCCESS) {
+        if(lease)
+            ndstore_lease_free(lease);
+        free(descs);
+        free(ptrs);
+        free(sizes);
+        margo_respond(handle, &out);
+        margo_free_input(handle, &in);
+        margo_destroy(handle);
+        stats_record(&provider->stats, NDSTORE_STATS_OP_GET_PIECES, &timer, 0, 0, out.ret);
+        return;
+    }
+
+    hret = margo_bulk_create(mid, lease->num, ptrs, sizes,
+                HG_BULK_READ_ONLY, &lease->bulk);
+    free(ptrs);
+    free(sizes);
+    if(hret != HG_SUCCESS) {
+        fprintf(stderr,"Error in margo_bulk_create()\n");
+        out.ret = NDSTORE_ERR_MERCURY;
+        lease->bulk = HG_BULK_NULL;
+        ndstore_lease_free(lease);
+        free(descs);
+        margo_respond(handle, &out);
+        margo_free_input(handle, &in);
+        margo_destroy(handle);
+        stats_record(&provider->stats, NDSTORE_STATS_OP_GET_PIECES, &timer, 0, 0, out.ret);
+        return;
+    }
+    stats_timer_mark(&timer, NDSTORE_STATS_PH_BULK);
+
+    ABT_mutex_lock(provider->lease_lock);
+    lease->id = ++provider->next_lease;
+    lease->expire = ABT_get_wtime() + NDSTORE_LEASE_TIMEOUT;
+    list_add(&lease->entry, &provider->leases);
+    ABT_mutex_unlock(provider->lease_lock);
+
+    out.ret = NDSTORE_SUCCESS;
+    out.lease = lease->id;
+    out.pieces.size = sizeof(*descs) * lease->num;
+    out.pieces.raw_odsc = (char*)descs;
+    out.handle = lease->bulk;
+    out.srv_time = stats_timer_elapsed_ns(&timer);
+    margo_respond(handle, &out);
+    free(descs);
+    margo_free_input(handle, &in);
+    margo_destroy(handle);
+    stats_timer_mark(&timer, NDSTORE_STATS_PH_RESPOND);
+    stats_record(&provider->stats, NDSTORE_STATS_OP_GET_PIECES, &timer, 0, off, out.ret);
+}
+DEFINE_MARGO_RPC_HANDLER(ndstore_get_pieces_ult)
+
+static void ndstore_release_ult(hg_handle_t handle)
+{
+    hg_return_t hret;
+    lease_in_t in;
+    bulk_out_t out;
+    out.srv_time = 0;
+    out.comp_size = 0;
+    out.origin = 0;
+    out.seq = 0;
+    struct lease *l, *t, *found = NULL;
+
+    margo_instance_id mid = margo_hg_handle_get_instance(handle);
+
+    const struct hg_info* info = margo_get_info(handle);
+    ndstore_provider_t provider = (ndstore_provider_t)margo_registered_data(mid, info->id);
+
+     if(!provider) {
+        fprintf(stderr, "Error (ndstore_release_ult): NDSTORE could not find provider\n");
+        out.ret = NDSTORE_ERR_UNKNOWN_PR;
+        margo_respond(handle, &out);
+        margo_destroy(handle);
+        return;
+    }
+
+    hret = margo_get_input(handle, &in);
+    if(hret != HG_SUCCESS) {
+        out.ret = NDSTORE_ERR_MERCURY;
+        margo_respond(handle, &out);
+        margo_destroy(handle);
+        return;
+    }
+
+    ABT_mutex_lock(provider->lease_lock);
+    list_for_each_entry_safe(l, t, &provider->leases, struct lease, entry) {
+        if(l->id == in.lease) {
+            list_del(&l->entry);
+            found = l;
+            break;
+        }
+    }
+    ABT_mutex_unlock(provider->lease_lock);
+
+    out.ret = found ? NDSTORE_SUCCESS : NDSTORE_ERR_UNKNOWN_OBJ;
+    margo_respond(handle, &out);
+    margo_free_input(handle, &in);
+    margo_destroy(handle);
+    if(found)
+        ndstore_lease_free(found);
+}
+DEFINE_MARGO_RPC_HANDLER(ndstore_release_ult)
+
+/*
+ * Push the points of the point objects that lie in the box of the
+ * request: their coordinates to the start of the client's buffer and
+ * their values after room for in_odsc.num_points coordinates. When
+ * there are more points than that, only their number is returned.
+ */
+static void ndstore_get_points_ult(hg_handle_t handle)
+{
+    hg_return_t hret;
+    bulk_in_t in;
+    points_out_t out;
+    out.srv_time = 0;
+    out.num_points = 0;
+    hg_bulk_t bulk_handle;
+    struct stats_timer timer;
+
+    stats_timer_start(&timer);
+
+    margo_instance_id mid = margo_hg_handle_get_instance(handle);
+
+    const struct hg_info* info = margo_get_info(handle);
+    ndstore_provider_t provider = (ndstore_provider_t)margo_registered_data(mid, info->id);
+
+     if(!provider) {
+        fprintf(stderr, "Error (ndstore_get_points_ult): NDSTORE could not find provider\n");
+        out.ret = NDSTORE_ERR_UNKNOWN_PR;
+        margo_respond(handle, &out);
+        margo_destroy(handle);
+        return;
+    }
+
+    hret = margo_get_input(handle, &in);
+    if(hret != HG_SUCCESS) {
+        out.ret = NDSTORE_ERR_MERCURY;
+        margo_respond(handle, &out);
+        margo_destroy(handle);
+        stats_record(&provider->stats, NDSTORE_STATS_OP_GET, &timer, 0, 0, out.ret);
+        return;
+    }
+
+    obj_descriptor in_odsc;
+    memcpy(&in_odsc, in.odsc.raw_odsc, sizeof(in_odsc));
+    int nd = in_odsc.bb.num_dims;
+    stats_timer_mark(&timer, NDSTORE_STATS_PH_DECODE);
+
+    if(in_odsc.kind != OBJ_POINTS || nd < 1 || nd > BBOX_MAX_NDIM ||
+       (in_odsc.num_points && in.handle == HG_BULK_NULL)) {
+        out.ret = NDSTORE_ERR_INVALID_ARG;
+        margo_respond(handle, &out);
+        margo_free_input(handle, &in);
+        margo_destroy(handle);
+        stats_record(&provider->stats, NDSTORE_STATS_OP_GET, &timer, 0, 0, out.ret);
+        return;
+    }
+
+    struct obj_data **od_tab;
+    int i, obj_nums = ls_find_ods(provider->ls, &in_odsc, &od_tab);
+    uint64_t found = 0;
+    stats_timer_mark(&timer, NDSTORE_STATS_PH_LOOKUP);
+
+    for(i = 0; i < obj_nums; i++)
+        if(od_tab[i]->obj_desc.kind == OBJ_POINTS &&
+           od_tab[i]->obj_desc.size == in_odsc.size)
+            found += points_select(od_tab[i], &in_odsc.bb, NULL, NULL, 0);
+
+    uint64_t coord_size = nd * sizeof(uint64_t);
+    void *bufs[2] = {NULL, NULL};
+    hg_size_t sizes[2] = {found * coord_size, found * in_odsc.size};
+    uint64_t n = 0;
+
+    out.ret = NDSTORE_SUCCESS;
+    out.num_points = found;
+    if(found > in_odsc.num_points) {
+        out.ret = NDSTORE_ERR_SIZE;
+    } else if(found) {
+        bufs[0] = malloc(sizes[0]);
+        bufs[1] = malloc(sizes[1]);
+        if(!bufs[0] || !bufs[1])
+            out.ret = NDSTORE_ERR_ALLOCATION;
+        for(i = 0; i < obj_nums && out.ret == NDSTORE_SUCCESS; i++)
+            if(od_tab[i]->obj_desc.kind == OBJ_POINTS &&
+               od_tab[i]->obj_desc.size == in_odsc.size)
+                n += points_select(od_tab[i], &in_odsc.bb,
+                        (uint64_t*)bufs[0] + n * nd,
+                        (char*)bufs[1] + n * in_odsc.size, found - n);
+    }
+    for(i = 0; i < obj_nums; i++)
+        obj_data_unref(od_tab[i]);
+    free(od_tab);
+    stats_timer_mark(&timer, NDSTORE_STATS_PH_COPY);
+
+    if(out.ret == NDSTORE_SUCCESS && found) {
+        hret = margo_bulk_create(mid, 2, bufs, sizes,
+                    HG_BULK_READ_ONLY, &bulk_handle);
+        if(hret == HG_SUCCESS) {
+            hret = margo_bulk_transfer(mid, HG_BULK_PUSH, info->addr,
+                    in.handle, 0, bulk_handle, 0, sizes[0]);
+            if(hret == HG_SUCCESS)
+                hret = margo_bulk_transfer(mid, HG_BULK_PUSH, info->addr,
+                        in.handle, in_odsc.num_points * coord_size,
+                        bulk_handle, sizes[0], sizes[1]);
+            margo_bulk_free(bulk_handle);
+        }
+        if(hret != HG_SUCCESS) {
+            fprintf(stderr,"Error (ndstore_get_points_ult): could not push the points\n");
+            out.ret = NDSTORE_ERR_MERCURY;
+        }
+        stats_timer_mark(&timer, NDSTORE_STATS_PH_BULK);
+    }
+    free(bufs[0]);
+    free(bufs[1]);
+
+    out.srv_time = stats_timer_elapsed_ns(&timer);
+    margo_respond(handle, &out);
+    margo_free_input(handle, &in);
+    margo_destroy(handle);
+    stats_timer_mark(&timer, NDSTORE_STATS_PH_RESPOND);
+    stats_record(&provider->stats, NDSTORE_STATS_OP_GET, &timer, 0,
+            out.ret == NDSTORE_SUCCESS ? sizes[0] + sizes[1] : 0, out.ret);
+}
+DEFINE_MARGO_RPC_HANDLER(ndstore_get_points_ult)
+
+/*
+ * Time series get: the box of every version from odsc.version to
+ * ver_hi is assembled into one buffer, version after version, and
+ * pushed in a single transfer. Fails if a version is not complete.
+ */
+static void ndstore_get_versions_ult(hg_handle_t handle)
+{
+    hg_return_t hret;
+    versions_in_t in;
+    bulk_out_t out;
+    out.srv_time = 0;
+    out.comp_size = 0;
+    out.origin = 0;
+    out.seq = 0;
+    hg_bulk_t bulk_handle;
+    struct stats_timer timer;
+
+    stats_timer_start(&timer);
+
+    margo_instance_id mid = margo_hg_handle_get_instance(handle);
+
+    const struct hg_info* info = margo_get_info(handle);
+    ndstore_provider_t provider = (ndstore_provider_t)margo_registered_data(mid, info->id);
+
+     if(!provider) {
+        fprintf(stderr, "Error (ndstore_get_versions_ult): NDSTORE could not find provider\n");
+        out.ret = NDSTORE_ERR_UNKNOWN_PR;
+        margo_respond(handle, &out);
+        margo_destroy(handle);
+        return;
+    }
+
+    hret = margo_get_input(handle, &in);
+    if(hret != HG_SUCCESS) {
+        out.ret = NDSTORE_ERR_MERCURY;
+        margo_respond(handle, &out);
+        margo_destroy(handle);
+        stats_record(&provider->stats, NDSTORE_STATS_OP_GET, &timer, 0, 0, out.ret);
+        return;
+    }
+
+    obj_descriptor in_odsc;
+    memcpy(&in_odsc, in.odsc.raw_odsc, sizeof(in_odsc));
+    stats_timer_mark(&timer, NDSTORE_STATS_PH_DECODE);
+
+    if(in_odsc.kind != OBJ_DENSE || in_odsc.num_fields || in_odsc.refine ||
+       in.ver_hi < in_odsc.version) {
+        out.ret = NDSTORE_ERR_INVALID_ARG;
+        margo_respond(handle, &out);
+        margo_free_input(handle, &in);
+        margo_destroy(handle);
+        stats_record(&provider->stats, NDSTORE_STATS_OP_GET, &timer, 0, 0, out.ret);
+        return;
+    }
+
+    uint32_t ver_lo = in_odsc.version, v;
+    uint64_t num_ver = (uint64_t)in.ver_hi - ver_lo + 1;
+    hg_size_t size = obj_data_size(&in_odsc);
+    hg_size_t xfer = num_ver * size;
+    uint64_t vol = bbox_volume(&in_odsc.bb);
+    struct obj_data **od_tab, *od;
+    char *buffer;
+    int i, obj_nums, found;
+
+    buffer = malloc(xfer);
+    od = obj_data_alloc_no_data(&in_odsc, NULL);
+    out.ret = (buffer && od) ? NDSTORE_SUCCESS : NDSTORE_ERR_ALLOCATION;
+
+    /* each version is copied in place, its pieces pinned meanwhile */
+    for(v = ver_lo; out.ret == NDSTORE_SUCCESS; v++) {
+        od->obj_desc.version = v;
+        od->data = buffer + (v - ver_lo) * size;
+        obj_nums = ls_find_ods(provider->ls, &od->obj_desc, &od_tab);
+        found = 0;
+        if(obj_nums)
+            found = ndstore_copy_pieces(provider, od, od_tab, obj_nums);
+        for(i = 0; i < obj_nums; i++)
+            obj_data_unref(od_tab[i]);
+        free(od_tab);
+        if((uint64_t)found != vol) {
+            fprintf(stderr, "Error (ndstore_get_versions_ult): version %u of %s is not complete\n",
+                    v, in_odsc.name);
+            out.ret = NDSTORE_ERR_UNKNOWN_OBJ;
+        }
+        if(v == in.ver_hi)
+            break;
+    }
+    if(od)
+        od->data = NULL;
+    obj_data_free(od);
+    stats_timer_mark(&timer, NDSTORE_STATS_PH_COPY);
+
+    if(out.ret != NDSTORE_SUCCESS) {
+        free(buffer);
+        margo_respond(handle, &out);
+        margo_free_input(handle, &in);
+        margo_destroy(handle);
+        stats_record(&provider->stats, NDSTORE_STATS_OP_GET, &timer, 0, 0, out.ret);
+        return;
+    }
+
+    hret = margo_bulk_create(mid, 1, (void**)&buffer, &xfer,
+                HG_BULK_READ_ONLY, &bulk_handle);
+    if(hret == HG_SUCCESS) {
+        hret = margo_bulk_transfer(mid, HG_BULK_PUSH, info->addr, in.handle, 0,
+                bulk_handle, 0, xfer);
+        margo_bulk_free(bulk_handle);
+    }
+    free(buffer);
+    if(hret != HG_SUCCESS) {
+        fprintf(stderr,"Error (ndstore_get_versions_ult): could not push the versions\n");
+        out.ret = NDSTORE_ERR_MERCURY;
+        xfer = 0;
+    }
+    stats_timer_mark(&timer, NDSTORE_STATS_PH_BULK);
+
+    out.srv_time = stats_timer_elapsed_ns(&timer);
+    margo_respond(handle, &out);
+    margo_free_input(handle, &in);
+    margo_destroy(handle);
+    stats_timer_mark(&timer, NDSTORE_STATS_PH_RESPOND);
+    stats_record(&provider->stats, NDSTORE_STATS_OP_GET, &timer, 0, xfer, out.ret);
+}
+DEFINE_MARGO_RPC_HANDLER(ndstore_get_versions_ult)
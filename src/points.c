@@ -0,0 +1,224 @@
+/*
+ * Copyright (c) 2020, Rutgers Discovery Informatics Institute, Rutgers University
+ *
+ * See COPYRIGHT in top-level directory.
+ */
+
+/*
+  Spatial index of point objects, see points.h.
+*/
+
+#include <errno.h>
+#include "points.h"
+
+static int point_in(const uint64_t *c, const struct bbox *bb)
+{
+        int i;
+
+        for (i = 0; i < bb->num_dims; i++)
+                if (c[i] < bb->lb.c[i] || c[i] > bb->ub.c[i])
+                        return 0;
+        return 1;
+}
+
+static uint64_t point_cell(const struct point_index *idx,
+                const struct bbox *bb, const uint64_t *c)
+{
+        uint64_t cell = 0;
+        int i;
+
+        for (i = bb->num_dims - 1; i >= 0; i--)
+                cell = cell * idx->cells[i] +
+                        (c[i] - bb->lb.c[i]) / idx->width[i];
+        return cell;
+}
+
+/*
+  Sort the points of a freshly put object by cell and index them.
+  Fails if a point lies outside of the bounding box.
+*/
+int points_index(struct obj_data *od)
+{
+        struct bbox *bb = &od->obj_desc.bb;
+        int nd = bb->num_dims;
+        uint64_t n = od->obj_desc.num_points;
+        uint64_t size = od->obj_desc.size;
+        uint64_t width[BBOX_MAX_NDIM], cells[BBOX_MAX_NDIM];
+        uint64_t target, c, ext, i, *cell, *pos, *coords;
+        struct point_index *idx;
+        char *tmp, *values;
+        int d;
+
+        if (nd < 1 || n == 0 || od->obj_desc.kind != OBJ_POINTS)
+                return -EINVAL;
+        coords = points_coords(od);
+        for (i = 0; i < n; i++)
+                if (!point_in(coords + i * nd, bb))
+                        return -EINVAL;
+
+        /* as many cells along every dimension, about POINTS_PER_CELL
+           points in each */
+        target = n / POINTS_PER_CELL;
+        for (c = 1; ; c++) {
+                uint64_t p = 1;
+
+                for (d = 0; d < nd && p <= target; d++)
+                        p *= c + 1;
+                if (p > target)
+                        break;
+        }
+
+        ext = 1;
+        for (d = 0; d < nd; d++) {
+                uint64_t e = bb->ub.c[d] - bb->lb.c[d] + 1;
+                uint64_t k;
+
+                if (e == 0)     /* the whole range of uint64_t */
+                        e = UINT64_MAX;
+                k = c < e ? c : e;
+                width[d] = (e + k - 1) / k;
+                cells[d] = (e + width[d] - 1) / width[d];
+                ext *= cells[d];
+        }
+
+        idx = calloc(1, sizeof(*idx) + (ext + 1) * sizeof(uint64_t));
+        cell = malloc(n * sizeof(uint64_t));
+        tmp = malloc(obj_data_size(&od->obj_desc));
+        if (!idx || !cell || !tmp) {
+                free(idx);
+                free(cell);
+                free(tmp);
+                return -ENOMEM;
+        }
+        idx->num_cells = ext;
+        memcpy(idx->width, width, sizeof(width));
+        memcpy(idx->cells, cells, sizeof(cells));
+
+        /* counting sort by cell */
+        pos = idx->start;
+        for (i = 0; i < n; i++) {
+                cell[i] = point_cell(idx, bb, coords + i * nd);
+                pos[cell[i] + 1]++;
+        }
+        for (i = 0; i < ext; i++)
+                pos[i + 1] += pos[i];
+
+        values = points_values(od);
+        for (i = 0; i < n; i++) {
+                uint64_t j = pos[cell[i]]++;
+
+                memcpy((uint64_t *)tmp + j * nd, coords + i * nd,
+                       nd * sizeof(uint64_t));
+                memcpy(tmp + n * nd * sizeof(uint64_t) + j * size,
+                       values + i * size, size);
+        }
+        memcpy(od->data, tmp, obj_data_size(&od->obj_desc));
+
+        /* the sort advanced every start to the start of the next cell */
+        memmove(pos + 1, pos, ext * sizeof(uint64_t));
+        pos[0] = 0;
+
+        free(cell);
+        free(tmp);
+        free(od->pidx);
+        od->pidx = idx;
+        return 0;
+}
+
+/*
+  Count the points of 'od' inside 'bb' and copy the first 'max' of them
+  to 'coords' and 'values', which may be NULL if 'max' is 0. Returns the
+  number of points inside 'bb'.
+*/
+uint64_t points_select(struct obj_data *od, const struct bbox *bb,
+                uint64_t *coords, void *values, uint64_t max)
+{
+        struct point_index *idx = od->pidx;
+        struct bbox *obb = &od->obj_desc.bb;
+        int nd = obb->num_dims;
+        uint64_t size = od->obj_desc.size;
+        uint64_t lo[BBOX_MAX_NDIM], hi[BBOX_MAX_NDIM], at[BBOX_MAX_NDIM];
+        uint64_t cell, i, *oc = points_coords(od), found = 0;
+        char *ov = points_values(od);
+        struct bbox com;
+        int d;
+
+        if (!idx || bb->num_dims != nd || !bbox_does_intersect(obb, bb))
+                return 0;
+        bbox_intersect(obb, bb, &com);
+        for (d = 0; d < nd; d++) {
+                lo[d] = (com.lb.c[d] - obb->lb.c[d]) / idx->width[d];
+                hi[d] = (com.ub.c[d] - obb->lb.c[d]) / idx->width[d];
+                at[d] = lo[d];
+        }
+
+        for (;;) {
+                cell = 0;
+                for (d = nd - 1; d >= 0; d--)
+                        cell = cell * idx->cells[d] + at[d];
+                for (i = idx->start[cell]; i < idx->start[cell + 1]; i++) {
+                        if (!point_in(oc + i * nd, bb))
+                                continue;
+                        if (found < max) {
+                                memcpy(coords + found * nd, oc + i * nd,
+                                       nd * sizeof(uint64_t));
+                                memcpy((char *)values + found * size,
+                                       ov + i * size, size);
+                        }
+                        found++;
+                }
+                for (d = 0; d < nd && at[d] == hi[d]; d++)
+                        at[d] = lo[d];
+                if (d == nd)
+                        break;
+                at[d]++;
+        }
+
+        return found;
+}
+
+/*
+  Copy the points of 'od' that lie outside of 'bb' to a new object,
+  e.g. to delete a region of a point object. '*out' is NULL if no point
+  is left.
+*/
+int points_filter(struct obj_data *od, const struct bbox *bb,
+                struct obj_data **out)
+{
+        obj_descriptor odsc = od->obj_desc;
+        int nd = odsc.bb.num_dims;
+        uint64_t size = odsc.size;
+        uint64_t i, n = 0, *oc = points_coords(od), *nc;
+        char *ov = points_values(od), *nv;
+        struct obj_data *nod;
+        int err;
+
+        *out = NULL;
+        for (i = 0; i < od->obj_desc.num_points; i++)
+                if (!point_in(oc + i * nd, bb))
+                        n++;
+        if (n == 0)
+                return 0;
+
+        odsc.num_points = n;
+        nod = obj_data_alloc_node(&odsc, od->numa_node, OBJ_PAGES_DEFAULT);
+        if (!nod)
+                return -ENOMEM;
+        nc = points_coords(nod);
+        nv = points_values(nod);
+        for (n = 0, i = 0; i < od->obj_desc.num_points; i++) {
+                if (point_in(oc + i * nd, bb))
+                        continue;
+                memcpy(nc + n * nd, oc + i * nd, nd * sizeof(uint64_t));
+                memcpy(nv + n * size, ov + i * size, size);
+                n++;
+        }
+
+        err = points_index(nod);
+        if (err) {
+                obj_data_free(nod);
+                return err;
+        }
+        *out = nod;
+        return 0;
+}
@@ -0,0 +1,131 @@
+/*
+ * Copyright (c) 2020, Rutgers Discovery Informatics Institute, Rutgers University
+ *
+ * See COPYRIGHT in top-level directory.
+ */
+
+#include <errno.h>
+#include "policy.h"
+#include "ndstore-common.h"
+
+void ndstore_var_policy_init(struct ndstore_var_policy *policy)
+{
+        memset(policy, 0, sizeof(*policy));
+        policy->codec = NDSTORE_CODEC_NONE;
+        policy->shuffle = 1;
+        policy->chunk_size = 64 * 1024;
+}
+
+struct policy_table *policy_table_alloc(void)
+{
+        struct policy_table *pt;
+
+        pt = malloc(sizeof(*pt));
+        if (!pt)
+                return NULL;
+        if (ABT_mutex_create(&pt->lock) != ABT_SUCCESS) {
+                free(pt);
+                return NULL;
+        }
+        INIT_LIST_HEAD(&pt->list);
+
+        return pt;
+}
+
+void policy_table_free(struct policy_table *pt)
+{
+        struct policy_entry *pe, *t;
+
+        if (!pt)
+                return;
+        list_for_each_entry_safe(pe, t, &pt->list, struct policy_entry, entry) {
+                list_del(&pe->entry);
+                free(pe);
+        }
+        ABT_mutex_free(&pt->lock);
+        free(pt);
+}
+
+/*
+  Length of the name prefix matched by 'pattern', or -1 if it does not
+  match. An exact match scores above every prefix.
+*/
+static int policy_match(const char *pattern, const char *name)
+{
+        size_t len = strlen(pattern);
+
+        if (len && pattern[len - 1] == '*') {
+                if (strncmp(pattern, name, len - 1) == 0)
+                        return len - 1;
+                return -1;
+        }
+        if (strcmp(pattern, name) == 0)
+                return POLICY_NAME_LEN;
+        return -1;
+}
+
+/*
+  Add or update the policy for 'name' (an exact name or a prefix
+  ending in '*').
+*/
+int policy_table_set(struct policy_table *pt, const char *name,
+                const struct ndstore_var_policy *policy)
+{
+        struct policy_entry *pe;
+
+        if (strlen(name) >= POLICY_NAME_LEN)
+                return -EINVAL;
+
+        ABT_mutex_lock(pt->lock);
+        list_for_each_entry(pe, &pt->list, struct policy_entry, entry) {
+                if (strcmp(pe->rec.name, name) == 0) {
+                        pe->rec.policy = *policy;
+                        ABT_mutex_unlock(pt->lock);
+                        return 0;
+                }
+        }
+        pe = malloc(sizeof(*pe));
+        if (!pe) {
+                ABT_mutex_unlock(pt->lock);
+                return -ENOMEM;
+        }
+        memset(pe, 0, sizeof(*pe));
+        strcpy(pe->rec.name, name);
+        pe->rec.policy = *policy;
+        list_add_tail(&pe->entry, &pt->list);
+        ABT_mutex_unlock(pt->lock);
+
+        return 0;
+}
+
+/*
+  Copy the most specific policy matching 'name' into 'policy'. Returns
+  0 and the defaults if no policy matches.
+*/
+int policy_table_lookup(struct policy_table *pt, const char *name,
+                struct ndstore_var_policy *policy)
+{
+        struct policy_entry *pe;
+        int score, best = -1;
+
+        ndstore_var_policy_init(policy);
+
+        ABT_mutex_lock(pt->lock);
+        list_for_each_entry(pe, &pt->list, struct policy_entry, entry) {
+                score = policy_match(pe->rec.name, name);
+                if (score > best) {
+                        best = score;
+                        *policy = pe->rec.policy;
+                }
+        }
+        ABT_mutex_unlock(pt->lock);
+
+        return best >= 0;
+}
+
+/* Whether old versions of the variable are freed by the retention GC. */
+int policy_has_retention(const struct ndstore_var_policy *policy)
+{
+        return policy->keep_last || policy->keep_every ||
+                policy->keep_secs > 0;
+}
@@ -34,7 +34,12 @@
 
 #include <math.h>
 #include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
 #include "ss_data.h"
+#include "compress.h"
+#include "points.h"
 
 
 /*
@@ -201,27 +206,386 @@ char *obj_desc_sprint(obj_descriptor *odsc)
     return str;
 }
 /*
+  Copy from a compressed object: only the chunks that intersect 'bbcom'
+  are decompressed, one at a time into a scratch buffer.
 */
-int ssd_copy(struct obj_data *to_obj, struct obj_data *from_obj)
+static int ssd_copy_comp(struct obj_data *to_obj, struct obj_data *from_obj,
+                         struct bbox *bbcom)
 {
+        struct comp_hdr *h = from_obj->comp;
+        obj_descriptor *odsc = &from_obj->obj_desc;
         struct matrix to_mat, from_mat;
-        struct bbox bbcom;
+        struct bbox cb, sub;
         int copied_elems = 0;
+        uint32_t i;
+        void *buf;
+
+        /* The first chunk of a row is never shorter than the others. */
+        buf = malloc(comp_chunk_raw_size(h, odsc, 0));
+        if (!buf)
+                return -ENOMEM;
+
+        for (i = 0; i < h->num_chunks; i++) {
+                comp_chunk_bbox(h, &odsc->bb, i, &cb);
+                if (!bbox_does_intersect(&cb, bbcom))
+                        continue;
+                if (comp_decode_chunk(h, odsc, i, buf) != 0) {
+                        fprintf(stderr, "%s(): corrupted chunk %u of %s\n",
+                                __func__, i, odsc->name);
+                        free(buf);
+                        return -EIO;
+                }
+                bbox_intersect(&cb, bbcom, &sub);
 
-        bbox_intersect(&to_obj->obj_desc.bb, &from_obj->obj_desc.bb, &bbcom);
+                matrix_init(&from_mat, odsc->st, &cb, &sub, buf, odsc->size);
+                matrix_init(&to_mat, to_obj->obj_desc.st,
+                            &to_obj->obj_desc.bb, &sub,
+                            to_obj->data, to_obj->obj_desc.size);
+                copied_elems += matrix_copy(&to_mat, &from_mat);
+        }
+        free(buf);
+
+        return copied_elems;
+}
+
+/*
+*/
+static int ssd_copy_data(struct obj_data *to_obj, void *to_data,
+                struct obj_data *from_obj, void *from_data,
+                struct bbox *bbcom)
+{
+        struct matrix to_mat, from_mat;
 
         matrix_init(&from_mat, from_obj->obj_desc.st,
-                    &from_obj->obj_desc.bb, &bbcom, 
-                    from_obj->data, from_obj->obj_desc.size);
+                    &from_obj->obj_desc.bb, bbcom,
+                    from_data, from_obj->obj_desc.size);
+
+        matrix_init(&to_mat, to_obj->obj_desc.st,
+                    &to_obj->obj_desc.bb, bbcom,
+                    to_data, to_obj->obj_desc.size);
+
+        return matrix_copy(&to_mat, &from_mat);
+}
+
+static void xor_bytes(void *to, const void *from, uint64_t len)
+{
+        unsigned char *t = to;
+        const unsigned char *f = from;
+        uint64_t i;
+
+        for (i = 0; i < len; i++)
+                t[i] ^= f[i];
+}
+
+/*
+  Copy from a delta object: the part 'bbcom' of the XOR payloads down
+  the chain of bases is folded into one scratch object, so rebuilding
+  the data takes two buffers whatever the length of the chain.
+*/
+static int ssd_copy_delta(struct obj_data *to_obj, struct obj_data *from_obj,
+                          struct bbox *bbcom)
+{
+        obj_descriptor sub = from_obj->obj_desc;
+        struct obj_data *acc, *tmp, *od;
+        int ret;
+
+        if (!bbox_does_intersect(&to_obj->obj_desc.bb, &from_obj->obj_desc.bb))
+                return 0;
+        sub.bb = *bbcom;
+        acc = obj_data_alloc(&sub);
+        tmp = obj_data_alloc(&sub);
+        if (!acc || !tmp) {
+                obj_data_free(acc);
+                obj_data_free(tmp);
+                return -ENOMEM;
+        }
+
+        ret = ssd_copy_comp(acc, from_obj, bbcom);
+        for (od = from_obj->delta_base; od && ret >= 0; od = od->delta_base) {
+                if (od->delta_base)
+                        ret = ssd_copy_comp(tmp, od, bbcom);
+                else
+                        ret = ssd_copy(tmp, od);
+                xor_bytes(acc->data, tmp->data, obj_data_size(&sub));
+        }
+        if (ret >= 0)
+                ret = ssd_copy_data(to_obj, to_obj->data, acc, acc->data, bbcom);
+
+        obj_data_free(acc);
+        obj_data_free(tmp);
+
+        return ret;
+}
+
+static void ls_held_add(ss_storage *ls, int64_t n)
+{
+        int64_t v;
+
+        do {
+                v = hg_atomic_get64(&ls->held_bytes);
+        } while (!hg_atomic_cas64(&ls->held_bytes, v, v + n));
+}
+
+/*
+  Keep the payload of 'base' counted in its storage for a delta stored
+  against it. Fails if it already left the storage for good, so that
+  the bytes it pins are never missed.
+*/
+static int obj_data_hold(struct obj_data *base)
+{
+        int32_t n;
+
+        if (!base->acct)
+                return 0;
+        do {
+                n = hg_atomic_get32(&base->acct_refs);
+                if (n == 0)
+                        return -1;
+        } while (!hg_atomic_cas32(&base->acct_refs, n, n + 1));
+        return 0;
+}
+
+static void obj_data_release(struct obj_data *base)
+{
+        if (base->acct && hg_atomic_decr32(&base->acct_refs) == 0)
+                ls_held_add(base->acct, -(int64_t)obj_data_stored_size(base));
+}
+
+/*
+  Store 'od' as a delta against 'base', a previous version of the same
+  box: the XOR of the two payloads, compressed according to 'policy'.
+  Returns 0, or -1 and leaves 'od' as it was when the delta does not
+  compress.
+*/
+int ssd_delta_encode(struct obj_data *od, struct obj_data *base,
+                const struct ndstore_var_policy *policy)
+{
+        struct obj_data *tmp;
+        struct comp_hdr *comp;
+        int ret;
+
+        if (!od->data || od->obj_desc.kind != OBJ_DENSE ||
+            od->obj_desc.num_fields || base->obj_desc.num_fields ||
+            !bbox_equals(&od->obj_desc.bb, &base->obj_desc.bb) ||
+            od->obj_desc.size != base->obj_desc.size)
+                return -1;
+
+        tmp = obj_data_alloc(&od->obj_desc);
+        if (!tmp)
+                return -1;
+        ret = ssd_copy(tmp, base);
+        if (ret < 0 || (uint64_t)ret != bbox_volume(&od->obj_desc.bb)) {
+                obj_data_free(tmp);
+                return -1;
+        }
+        xor_bytes(tmp->data, od->data, obj_data_size(&od->obj_desc));
+        comp = comp_encode(&od->obj_desc, tmp->data, policy);
+        obj_data_free(tmp);
+        if (!comp)
+                return -1;
+        if (obj_data_hold(base) != 0) {
+                free(comp);
+                return -1;
+        }
 
-        matrix_init(&to_mat, to_obj->obj_desc.st, 
-                    &to_obj->obj_desc.bb, &bbcom,
-                    to_obj->data, to_obj->obj_desc.size);
+        obj_data_free_data(od);
+        od->comp = comp;
+        obj_data_ref(base);
+        od->delta_base = base;
+        od->delta_depth = base->delta_depth + 1;
 
-        copied_elems = matrix_copy(&to_mat, &from_mat);
+        return 0;
+}
+
+/*
+  Copy the intersection of two dense objects. The fields of a
+  multi-field 'to_obj' are looked up by name in 'from_obj'; nothing is
+  copied and 0 returned when one is missing, or when only one of the
+  objects has named fields.
+*/
+int ssd_copy(struct obj_data *to_obj, struct obj_data *from_obj)
+{
+        struct bbox bbcom;
+        uint64_t to_len, from_len;
+        uint32_t i;
+        int j, copied_elems = 0;
+
+        bbox_intersect(&to_obj->obj_desc.bb, &from_obj->obj_desc.bb, &bbcom);
+
+        if (!to_obj->obj_desc.num_fields != !from_obj->obj_desc.num_fields ||
+            to_obj->obj_desc.kind != OBJ_DENSE ||
+            from_obj->obj_desc.kind != OBJ_DENSE)
+                return 0;
+
+        if (from_obj->delta_base)
+                return ssd_copy_delta(to_obj, from_obj, &bbcom);
+        if (from_obj->comp)
+                return ssd_copy_comp(to_obj, from_obj, &bbcom);
+
+        if (!to_obj->obj_desc.num_fields)
+                return ssd_copy_data(to_obj, to_obj->data,
+                                from_obj, from_obj->data, &bbcom);
+
+        for (i = 0; i < to_obj->obj_desc.num_fields; i++)
+                if (obj_data_field(from_obj, to_obj->fields[i]) < 0)
+                        return 0;
+
+        to_len = to_obj->obj_desc.size * bbox_volume(&to_obj->obj_desc.bb);
+        from_len = from_obj->obj_desc.size * bbox_volume(&from_obj->obj_desc.bb);
+        for (i = 0; i < to_obj->obj_desc.num_fields; i++) {
+                j = obj_data_field(from_obj, to_obj->fields[i]);
+                copied_elems = ssd_copy_data(to_obj,
+                                (char *)to_obj->data + i * to_len, from_obj,
+                                (char *)from_obj->data + j * from_len, &bbcom);
+        }
         return copied_elems;
 }
 
+/* Factor between the resolutions of level 'level' and a coarser level
+   'from', 0 if it does not fit in 64 bits. */
+uint64_t ssd_level_factor(uint32_t ratio, uint32_t level, uint32_t from)
+{
+        uint64_t f = 1;
+
+        if (ratio == 0)
+                return from == level;
+        for (; from < level; from++) {
+                if (f > UINT64_MAX / ratio)
+                        return 0;
+                f *= ratio;
+        }
+        return f;
+}
+
+/*
+  Visit the runs along dimension 0 of the part 'box' of the array of
+  'bb': call fn() with the offset of the first element of each run.
+*/
+static void bbox_runs(const struct bbox *bb, const struct bbox *box,
+                void (*fn)(void *, uint64_t, const uint64_t *), void *arg)
+{
+        uint64_t at[BBOX_MAX_NDIM], off, stride;
+        int d, nd = bb->num_dims;
+
+        for (d = 0; d < nd; d++)
+                at[d] = box->lb.c[d];
+        for (;;) {
+                off = 0;
+                stride = 1;
+                for (d = 0; d < nd; d++) {
+                        off += (at[d] - bb->lb.c[d]) * stride;
+                        stride *= bb->ub.c[d] - bb->lb.c[d] + 1;
+                }
+                fn(arg, off, at);
+                for (d = 1; d < nd && at[d] == box->ub.c[d]; d++)
+                        at[d] = box->lb.c[d];
+                if (d >= nd)
+                        break;
+                at[d]++;
+        }
+}
+
+struct refine_args {
+        struct obj_data *to, *from;
+        uint64_t f, len;
+        unsigned char *mask;
+};
+
+/* Fill a run of 'to' from the coarser 'from', each coarse element
+   repeated along the f fine elements it covers. */
+static void refine_run(void *arg, uint64_t off, const uint64_t *at)
+{
+        struct refine_args *ra = arg;
+        struct bbox *fbb = &ra->from->obj_desc.bb;
+        size_t size = ra->to->obj_desc.size;
+        char *dst = (char *)ra->to->data + off * size;
+        uint64_t src = 0, stride = 1, x;
+        int d;
+
+        for (d = 1; d < fbb->num_dims; d++) {
+                stride *= fbb->ub.c[d - 1] - fbb->lb.c[d - 1] + 1;
+                src += (at[d] / ra->f - fbb->lb.c[d]) * stride;
+        }
+        for (x = 0; x < ra->len; x++)
+                memcpy(dst + x * size, (char *)ra->from->data +
+                       (src + (at[0] + x) / ra->f - fbb->lb.c[0]) * size,
+                       size);
+}
+
+static void mask_run(void *arg, uint64_t off, const uint64_t *at)
+{
+        struct refine_args *ra = arg;
+
+        (void)at;
+        memset(ra->mask + off, 1, ra->len);
+}
+
+/*
+  Composite the pieces of several refinement levels, found with
+  ls_find_levels(), into 'to': coarser pieces are refined by injection
+  and finer pieces overwrite them. Returns the number of elements of
+  'to' covered by some piece.
+*/
+int ssd_composite(struct obj_data *to, struct obj_data **tab, int n)
+{
+        obj_descriptor *odsc = &to->obj_desc;
+        struct refine_args ra = {.to = to};
+        struct obj_data *from;
+        obj_descriptor sub;
+        struct bbox fine, part;
+        uint64_t f, vol = bbox_volume(&odsc->bb), covered = 0, i;
+        int k, d;
+
+        ra.mask = calloc(vol, 1);
+        if (!ra.mask)
+                return -ENOMEM;
+
+        for (k = 0; k < n; k++) {
+                from = tab[k];
+                f = ssd_level_factor(odsc->refine, odsc->level,
+                                from->obj_desc.level);
+                if (!f || from->obj_desc.kind != OBJ_DENSE ||
+                    from->obj_desc.num_fields)
+                        continue;
+
+                /* the part of 'to' the piece covers */
+                fine.num_dims = odsc->bb.num_dims;
+                for (d = 0; d < fine.num_dims; d++) {
+                        fine.lb.c[d] = from->obj_desc.bb.lb.c[d] * f;
+                        fine.ub.c[d] = from->obj_desc.bb.ub.c[d] * f + f - 1;
+                }
+                if (!bbox_does_intersect(&fine, &odsc->bb))
+                        continue;
+                bbox_intersect(&fine, &odsc->bb, &part);
+                ra.len = part.ub.c[0] - part.lb.c[0] + 1;
+
+                if (f == 1) {
+                        ssd_copy(to, from);
+                } else {
+                        /* the coarse elements needed, decompressed if
+                           need be */
+                        sub = from->obj_desc;
+                        for (d = 0; d < part.num_dims; d++) {
+                                sub.bb.lb.c[d] = part.lb.c[d] / f;
+                                sub.bb.ub.c[d] = part.ub.c[d] / f;
+                        }
+                        ra.from = obj_data_alloc(&sub);
+                        if (!ra.from)
+                                continue;
+                        ssd_copy(ra.from, from);
+                        ra.f = f;
+                        bbox_runs(&odsc->bb, &part, refine_run, &ra);
+                        obj_data_free(ra.from);
+                }
+                bbox_runs(&odsc->bb, &part, mask_run, &ra);
+        }
+
+        for (i = 0; i < vol; i++)
+                covered += ra.mask[i];
+        free(ra.mask);
+        return covered;
+}
+
 
 /*
   Allocate and init the local storage structure.
@@ -238,10 +602,18 @@ ss_storage *ls_alloc(int max_versions)
         }
 
         memset(ls, 0, sizeof(*ls));
+        hg_atomic_init64(&ls->held_bytes, 0);
+        INIT_LIST_HEAD(&ls->drops);
         for (i = 0; i < max_versions; i++)
                 INIT_LIST_HEAD(&ls->obj_hash[i]);
         ls->size_hash = max_versions;
 
+        if (ABT_rwlock_create(&ls->lock) != ABT_SUCCESS) {
+                free(ls);
+                errno = ENOMEM;
+                return NULL;
+        }
+
         return ls;
 }
 
@@ -251,115 +623,570 @@ void ls_free(ss_storage *ls)
 
     struct obj_data *od, *t;
     struct list_head *list;
+    struct ls_drop *d, *dt;
     int i;
 
+    ABT_rwlock_wrlock(ls->lock);
     for (i = 0; i < ls->size_hash; i++) {
         list = &ls->obj_hash[i];
         list_for_each_entry_safe(od, t, list, struct obj_data, obj_entry ) {
             ls_remove(ls, od);
-            obj_data_free(od);
+            od->f_free = 1;
+            obj_data_unref(od);
         }
     }
+    ABT_rwlock_unlock(ls->lock);
 
     if (ls->num_obj != 0) {
         fprintf(stderr, "%s(): ERROR ls->num_obj is %d not 0\n", __func__, ls->num_obj);
     }
+    list_for_each_entry_safe(d, dt, &ls->drops, struct ls_drop, entry) {
+        list_del(&d->entry);
+        free(d);
+    }
+    ABT_rwlock_free(&ls->lock);
     free(ls);
 }
 
 /*
-  Add an object to the local storage.
+  Index 'od' in 'bin'. Caller must hold the storage lock for writing.
 */
-void ls_add_obj(ss_storage *ls, struct obj_data *od)
+static void ls_insert(ss_storage *ls, struct obj_data *od,
+                struct list_head *bin)
+{
+        list_add(&od->obj_entry, bin);
+        ls->num_obj++;
+        ls->num_bytes += obj_data_stored_size(od);
+        od->acct = ls;
+        hg_atomic_incr32(&od->acct_refs);
+}
+
+/*
+  Make copies of the parts of the piece 'od' that lie outside of 'bb',
+  or of its points outside of it, in 'new' (LS_CUT_MAX of them at
+  most). Returns their number, or -ENOMEM.
+*/
+static int ls_cut(struct obj_data *od, const struct bbox *bb,
+                struct obj_data **new)
+{
+        struct bbox rest[LS_CUT_MAX];
+        obj_descriptor odsc;
+        int i, n, err;
+
+        if (od->obj_desc.kind == OBJ_POINTS) {
+                err = points_filter(od, bb, &new[0]);
+                if (err)
+                        return err;
+                return new[0] ? 1 : 0;
+        }
+
+        n = bbox_subtract(&od->obj_desc.bb, bb, rest);
+        for (i = 0; i < n; i++) {
+                odsc = od->obj_desc;
+                odsc.bb = rest[i];
+                new[i] = obj_data_alloc_node(&odsc, od->numa_node,
+                                OBJ_PAGES_DEFAULT);
+                if (new[i] && od->fields &&
+                    obj_data_set_fields(new[i], od->fields[0]) != 0) {
+                        obj_data_free(new[i]);
+                        new[i] = NULL;
+                }
+                if (!new[i]) {
+                        while (i > 0)
+                                obj_data_free(new[--i]);
+                        return -ENOMEM;
+                }
+                new[i]->t_put = od->t_put;
+                ssd_copy(new[i], od);
+        }
+        return n;
+}
+
+/*
+  Pieces of the version of 'od' that it only covers in part keep the
+  rest, e.g. a grid cell merged from several writers: the copies are
+  made before taking the write lock, in 'cut', and swapped in along
+  with 'od'. Returns the number of pieces found, pinned in 'part', and
+  their number of copies in 'ncut' (-1 if they could not be made).
+*/
+static int ls_add_cut(ss_storage *ls, struct obj_data *od,
+                struct obj_data ***part, struct obj_data ***cut, int **ncut)
+{
+        struct obj_data **tab;
+        int i, n, num;
+
+        *part = NULL;
+        *cut = NULL;
+        *ncut = NULL;
+        num = ls_find_ods(ls, &od->obj_desc, &tab);
+        for (i = 0, n = 0; i < num; i++) {
+                if (bbox_include(&tab[i]->obj_desc.bb, &od->obj_desc.bb))
+                        obj_data_unref(tab[i]);
+                else
+                        tab[n++] = tab[i];
+        }
+        if (!n) {
+                free(tab);
+                return 0;
+        }
+
+        *cut = malloc(sizeof(**cut) * n * LS_CUT_MAX);
+        *ncut = malloc(sizeof(**ncut) * n);
+        for (i = 0; i < n; i++) {
+                if (*cut && *ncut)
+                        (*ncut)[i] = ls_cut(tab[i], &od->obj_desc.bb,
+                                        *cut + i * LS_CUT_MAX);
+                else if (*ncut)
+                        (*ncut)[i] = -1;
+        }
+        if (!*ncut) {
+                for (i = 0; i < n; i++)
+                        obj_data_unref(tab[i]);
+                free(tab);
+                free(*cut);
+                *cut = NULL;
+                return 0;
+        }
+        *part = tab;
+        return n;
+}
+
+static void ls_add_obj_evict(ss_storage *ls, struct obj_data *od, int any_version)
 {
         int index;
         struct list_head *bin;
-        struct obj_data *od_existing;
+        struct obj_data *od_existing, *t, **part, **cut;
+        int i, j, num_part, *ncut;
 
-        od_existing = ls_find_no_version(ls, &od->obj_desc);
-        if (od_existing) {
+        num_part = ls_add_cut(ls, od, &part, &cut, &ncut);
+
+        ABT_rwlock_wrlock(ls->lock);
+        index = od->obj_desc.version % ls->size_hash;
+        bin = &ls->obj_hash[index];
+
+        /* an object may overlap several stored pieces, e.g. grid cells */
+        list_for_each_entry_safe(od_existing, t, bin, struct obj_data, obj_entry) {
+                if (any_version ?
+                    !obj_desc_by_name_intersect(&od->obj_desc, &od_existing->obj_desc) :
+                    !obj_desc_equals_intersect(&od->obj_desc, &od_existing->obj_desc))
+                        continue;
 
             //update here to send rpc requests to inititate rpc call to update local object descriptor
-                od_existing->f_free = 1;
-                if (od_existing->refcnt == 0) {
-                        ls_remove(ls, od_existing);
-                        obj_data_free(od_existing);
+                /* Unlink first so no new reader can pin it; readers
+                   that already hold a reference keep copying from it
+                   and the last one to drop its reference frees it.
+                   An older version leaves the storage for good. */
+                if (od_existing->obj_desc.version != od->obj_desc.version) {
+                        ls_drop(ls, od_existing);
+                        continue;
                 }
-                else {
-                        fprintf(stderr, "'%s()': object eviction delayed.\n", __func__);
+                ls_remove(ls, od_existing);
+                od_existing->f_free = 1;
+
+                /* a piece put after the copies were made is evicted
+                   whole */
+                for (i = 0; i < num_part; i++) {
+                        if (part[i] != od_existing || ncut[i] < 0)
+                                continue;
+                        for (j = 0; j < ncut[i]; j++)
+                                ls_insert(ls, cut[i * LS_CUT_MAX + j], bin);
+                        ncut[i] = 0;
                 }
+                obj_data_unref(od_existing);
         }
-        index = od->obj_desc.version % ls->size_hash;
-        bin = &ls->obj_hash[index];
 
         /* NOTE: new object comes first in the list. */
-        list_add(&od->obj_entry, bin);
-        ls->num_obj++;
+        ls_insert(ls, od, bin);
+        ABT_rwlock_unlock(ls->lock);
+
+        /* copies of pieces evicted meanwhile by another put */
+        for (i = 0; i < num_part; i++) {
+                for (j = 0; j < ncut[i]; j++)
+                        obj_data_free(cut[i * LS_CUT_MAX + j]);
+                obj_data_unref(part[i]);
+        }
+        free(part);
+        free(cut);
+        free(ncut);
+}
+
+/*
+  Add an object to the local storage. Stored pieces of the same
+  variable that it overlaps, in any version of the same bin, are
+  evicted. The storage takes over the caller's reference to 'od'.
+*/
+void ls_add_obj(ss_storage *ls, struct obj_data *od)
+{
+        ls_add_obj_evict(ls, od, 1);
+}
+
+/*
+  Same as ls_add_obj(), but only overlapping pieces of the same
+  version are evicted; older versions are left to the retention GC.
+*/
+void ls_add_obj_version(ss_storage *ls, struct obj_data *od)
+{
+        ls_add_obj_evict(ls, od, 0);
 }
 
+/*
+  Find an object by name. The returned object is pinned and must be
+  released with obj_data_unref().
+*/
 struct obj_data* ls_lookup(ss_storage *ls, char *name)
 {
         struct obj_data *od;
         struct list_head *list;
         int i;
 
+        ABT_rwlock_rdlock(ls->lock);
         for (i = 0; i < ls->size_hash; i++) {
                 list = &ls->obj_hash[i];
 
                 list_for_each_entry(od, list, struct obj_data, obj_entry ) {
-                        if (strcmp(od->obj_desc.name, name) == 0)
+                        if (strcmp(od->obj_desc.name, name) == 0) {
+                                obj_data_ref(od);
+                                ABT_rwlock_unlock(ls->lock);
                                 return od;
+                        }
                 }
         }
+        ABT_rwlock_unlock(ls->lock);
 
         return NULL;
 }
 
-void ls_remove(ss_storage *ls, struct obj_data *od)
+/*
+  Unlink an object from the local storage. Deltas stored against it
+  keep its payload alive, and counted in ls->held_bytes until the last
+  of them is freed. Returns the bytes released. Caller must hold the
+  storage lock for writing.
+*/
+uint64_t ls_remove(ss_storage *ls, struct obj_data *od)
 {
+        uint64_t size = obj_data_stored_size(od);
+
         list_del(&od->obj_entry);
         ls->num_obj--;
+        ls->num_bytes -= size;
+        if (hg_atomic_decr32(&od->acct_refs) > 0) {
+                ls_held_add(ls, size);
+                return 0;
+        }
+        return size;
+}
+
+/*
+  Payload bytes held by the storage, including the objects evicted or
+  collected that deltas still depend on.
+*/
+uint64_t ls_bytes(ss_storage *ls)
+{
+        int64_t held = hg_atomic_get64(&ls->held_bytes);
+        uint64_t n;
+
+        ABT_rwlock_rdlock(ls->lock);
+        n = ls->num_bytes;
+        ABT_rwlock_unlock(ls->lock);
+
+        return held > 0 ? n + held : n;
+}
+
+/*
+  Unlink an object that leaves the storage for good (an older version
+  evicted, or collected) and drop the storage's reference to it. The
+  newest such version of each variable is remembered, see ls_dropped().
+  Returns the bytes released, see ls_remove(). Caller must hold the
+  storage lock for writing.
+*/
+uint64_t ls_drop(ss_storage *ls, struct obj_data *od)
+{
+        uint64_t size;
+        struct ls_drop *d;
+        int found = 0;
+
+        list_for_each_entry(d, &ls->drops, struct ls_drop, entry) {
+                if (strcmp(d->name, od->obj_desc.name) == 0) {
+                        found = 1;
+                        break;
+                }
+        }
+        if (found) {
+                if (od->obj_desc.version > d->version)
+                        d->version = od->obj_desc.version;
+        } else if ((d = malloc(sizeof(*d)))) {
+                memcpy(d->name, od->obj_desc.name, sizeof(d->name));
+                d->version = od->obj_desc.version;
+                list_add(&d->entry, &ls->drops);
+        } else {
+                ls->drops_lost = 1;
+        }
+
+        size = ls_remove(ls, od);
+        od->f_free = 1;
+        obj_data_unref(od);
+        return size;
+}
+
+/*
+  Whether a version of odsc->name at least as new as odsc->version
+  left the storage: a put of odsc may then replace data read before.
+*/
+int ls_dropped(ss_storage *ls, obj_descriptor *odsc)
+{
+        struct ls_drop *d;
+        int ret;
+
+        ABT_rwlock_rdlock(ls->lock);
+        ret = ls->drops_lost;
+        list_for_each_entry(d, &ls->drops, struct ls_drop, entry) {
+                if (strcmp(d->name, odsc->name) == 0) {
+                        ret |= d->version >= odsc->version;
+                        break;
+                }
+        }
+        ABT_rwlock_unlock(ls->lock);
+
+        return ret;
 }
 
 void ls_try_remove_free(ss_storage *ls, struct obj_data *od)
 {
         /* Note:  we   assume  the  object  data   is  allocated  with
-           obj_data_alloc(), i.e., the data follows the structure.  */
-        if (od->refcnt == 0) {
+           obj_data_alloc(). The memory is released once the last
+           reader drops its reference. */
+        ABT_rwlock_wrlock(ls->lock);
+        if (!od->f_free) {
                 ls_remove(ls, od);
-                if (od->data != od+1) {
-                        fprintf(stderr, "'%s()': we are about to free an object " 
-                              "with external allocation.\n", __func__);
+                od->f_free = 1;
+                obj_data_unref(od);
+        }
+        ABT_rwlock_unlock(ls->lock);
+}
+
+/*
+  Atomically replace the objects in 'old' with the ones in 'new' (e.g.
+  a compressed copy, or the same data split along a grid). Readers
+  that pinned an old object keep using it until they unref it. Fails
+  if one of the old objects was evicted in the meantime; the storage
+  takes over the caller's references to the new objects only on
+  success.
+*/
+int ls_swap(ss_storage *ls, struct obj_data **old, int nold,
+            struct obj_data **new, int nnew)
+{
+        struct list_head *bin;
+        double t_put = 0;
+        int i;
+
+        ABT_rwlock_wrlock(ls->lock);
+        for (i = 0; i < nold; i++) {
+                if (old[i]->f_free) {
+                        ABT_rwlock_unlock(ls->lock);
+                        return -ENOENT;
                 }
-                obj_data_free(od);
+                if (old[i]->t_put > t_put)
+                        t_put = old[i]->t_put;
+        }
+        for (i = 0; i < nnew; i++) {
+                if (nold)
+                        new[i]->t_put = t_put;
+                bin = &ls->obj_hash[new[i]->obj_desc.version % ls->size_hash];
+                ls_insert(ls, new[i], bin);
         }
+        for (i = 0; i < nold; i++) {
+                ls_remove(ls, old[i]);
+                old[i]->f_free = 1;
+        }
+        ABT_rwlock_unlock(ls->lock);
+
+        for (i = 0; i < nold; i++)
+                obj_data_unref(old[i]);
+
+        return 0;
+}
+
+int ls_replace(ss_storage *ls, struct obj_data *od, struct obj_data *new_od)
+{
+        return ls_swap(ls, &od, 1, &new_od, 1);
+}
+
+/*
+  Replace a piece that straddles the border of the deleted box 'bb' by
+  copies of what lies outside of it, or a point object by one with the
+  points outside of it. The caller holds a reference to 'od', which is
+  dropped here.
+*/
+static int ls_truncate(ss_storage *ls, struct obj_data *od, const struct bbox *bb)
+{
+        struct obj_data *new[LS_CUT_MAX];
+        int i, n, err;
+
+        n = ls_cut(od, bb, new);
+        err = n < 0 ? n : ls_swap(ls, &od, 1, new, n);
+        if (err)
+                for (i = 0; i < n; i++)
+                        obj_data_free(new[i]);
+
+        obj_data_unref(od);
+        return err;
+}
+
+/*
+  Delete the part of versions [ver_lo, ver_hi] of 'name' that lies in
+  'bb', or all of it if bb is NULL. Pieces inside the box are unlinked
+  in one sweep under the write lock; pieces that straddle its border
+  are then truncated. Readers that pinned a deleted piece keep it
+  until they unref it. Returns the number of pieces deleted or
+  truncated.
+*/
+int ls_delete(ss_storage *ls, const char *name, unsigned int ver_lo,
+                unsigned int ver_hi, const struct bbox *bb)
+{
+        struct obj_data *od, *t, **part = NULL, **tab;
+        struct list_head *bin;
+        unsigned int i, nbins;
+        int j, num = 0, num_part = 0, max_part = 0;
+
+        if (ver_lo > ver_hi)
+                return 0;
+        /* a short range only maps to a few bins */
+        nbins = ls->size_hash;
+        if (ver_hi - ver_lo < nbins)
+                nbins = ver_hi - ver_lo + 1;
+
+        ABT_rwlock_wrlock(ls->lock);
+        for (i = 0; i < nbins; i++) {
+                bin = &ls->obj_hash[(ver_lo + i) % ls->size_hash];
+                list_for_each_entry_safe(od, t, bin, struct obj_data, obj_entry) {
+                        if (od->obj_desc.version < ver_lo ||
+                            od->obj_desc.version > ver_hi ||
+                            strcmp(od->obj_desc.name, name) != 0)
+                                continue;
+                        if (bb && !bbox_does_intersect(&od->obj_desc.bb, bb))
+                                continue;
+
+                        if (bb && !bbox_include(&od->obj_desc.bb, bb)) {
+                                if (num_part == max_part) {
+                                        tab = realloc(part, sizeof(*part) *
+                                                (max_part ? 2 * max_part : 16));
+                                        if (!tab)
+                                                continue;
+                                        part = tab;
+                                        max_part = max_part ? 2 * max_part : 16;
+                                }
+                                obj_data_ref(od);
+                                part[num_part++] = od;
+                                continue;
+                        }
+
+                        ls_remove(ls, od);
+                        od->f_free = 1;
+                        obj_data_unref(od);
+                        num++;
+                }
+        }
+        ABT_rwlock_unlock(ls->lock);
+
+        /* the copies are made without holding the lock; a piece that a
+           newer put replaced in the meantime is left alone */
+        for (j = 0; j < num_part; j++)
+                if (ls_truncate(ls, part[j], bb) == 0)
+                        num++;
+        free(part);
+
+        return num;
 }
 
 /*
   Find  list of object_desriptors  in the  local storage  that has  the same  name and
-  version with the object descriptor 'odsc'.
+  version with the object descriptor 'odsc'. The table is allocated
+  here and returned in 'od_tab'; every object in it is pinned, so the
+  caller must obj_data_unref() each entry and free() the table.
 */
-int ls_find_ods(ss_storage *ls, obj_descriptor *odsc, struct obj_data **od_tab)
+int ls_find_ods(ss_storage *ls, obj_descriptor *odsc, struct obj_data ***od_tab)
 {
         struct obj_data *od;
         struct list_head *list;
         int index;
         int num_odsc = 0;
 
+        *od_tab = NULL;
+
+        ABT_rwlock_rdlock(ls->lock);
         index = odsc->version % ls->size_hash;
         list = &ls->obj_hash[index];
         list_for_each_entry(od, list, struct obj_data, obj_entry) {
-            if (obj_desc_equals_intersect(odsc, &od->obj_desc)){
-                od_tab[num_odsc++] = od;
+            if (obj_desc_equals_intersect(odsc, &od->obj_desc))
+                num_odsc++;
+        }
+
+        if (num_odsc) {
+            *od_tab = malloc(sizeof(**od_tab) * num_odsc);
+            if (!*od_tab) {
+                ABT_rwlock_unlock(ls->lock);
+                return 0;
+            }
+            num_odsc = 0;
+            list_for_each_entry(od, list, struct obj_data, obj_entry) {
+                if (obj_desc_equals_intersect(odsc, &od->obj_desc)){
+                    obj_data_ref(od);
+                    (*od_tab)[num_odsc++] = od;
+                }
             }
         }
+        ABT_rwlock_unlock(ls->lock);
+
         return num_odsc;
 }
 
+/*
+  Like ls_find_ods(), but also find the pieces of the coarser levels
+  that intersect the box of 'odsc' once refined by odsc->refine per
+  level. Pieces are returned coarsest level first.
+*/
+int ls_find_levels(ss_storage *ls, obj_descriptor *odsc,
+                struct obj_data ***od_tab)
+{
+        struct obj_data **tab = NULL, **t, **lt;
+        obj_descriptor q = *odsc;
+        uint64_t f;
+        int i, l, n = 0, num;
+
+        *od_tab = NULL;
+        for (l = 0; l <= (int)odsc->level; l++) {
+                f = ssd_level_factor(odsc->refine, odsc->level, l);
+                if (!f)
+                        continue;
+                q.level = l;
+                for (i = 0; i < q.bb.num_dims; i++) {
+                        q.bb.lb.c[i] = odsc->bb.lb.c[i] / f;
+                        q.bb.ub.c[i] = odsc->bb.ub.c[i] / f;
+                }
+                num = ls_find_ods(ls, &q, &lt);
+                if (!num)
+                        continue;
+                t = realloc(tab, sizeof(*tab) * (n + num));
+                if (!t) {
+                        for (i = 0; i < num; i++)
+                                obj_data_unref(lt[i]);
+                        free(lt);
+                        break;
+                }
+                tab = t;
+                memcpy(tab + n, lt, sizeof(*tab) * num);
+                n += num;
+                free(lt);
+        }
+        *od_tab = tab;
+
+        return n;
+}
+
 /*
   Search for an object in the local storage that is mapped to the same
   bin, and that has the same  name and object descriptor, but may have
-  different version.
+  different version. Caller must hold the storage lock.
 */
 struct obj_data *
 ls_find_no_version(ss_storage *ls, obj_descriptor *odsc)
@@ -409,6 +1236,9 @@ struct obj_data *obj_data_alloc(obj_descriptor *odsc)
     }
 	ALIGN_ADDR_QUAD_BYTES(od->data);
 	od->obj_desc = *odsc;
+    hg_atomic_init32(&od->refcnt, 1);
+    od->t_put = ABT_get_wtime();
+    od->numa_node = -1;
 
     return od;
 }
@@ -428,12 +1258,243 @@ struct obj_data *obj_data_alloc_with_data(obj_descriptor *odsc, const void *data
 }
 
 
+/*
+  Allocate an obj_data structure that takes over 'data' (which may be
+  NULL, e.g. for objects that hold a compressed payload).
+*/
+struct obj_data *obj_data_alloc_no_data(obj_descriptor *odsc, void *data)
+{
+        struct obj_data *od;
+
+        od = calloc(1, sizeof(*od));
+        if (!od) {
+                fprintf(stderr, "Malloc od error\n");
+                return NULL;
+        }
+        od->obj_desc = *odsc;
+        od->data = data;
+        hg_atomic_init32(&od->refcnt, 1);
+        od->t_put = ABT_get_wtime();
+        od->numa_node = -1;
+
+        return od;
+}
+
+/* Payloads smaller than this are not worth pages of their own. */
+#define MAP_MIN_SIZE    (64 * 1024)
+#define HUGE_2M         (2ULL << 20)
+#define HUGE_1G         (1ULL << 30)
+#define NUMA_MAX_NODES  1024
+/* from linux/mempolicy.h and linux/mman.h */
+#define NUMA_MPOL_PREFERRED 1
+#ifndef MAP_HUGE_SHIFT
+#define MAP_HUGE_SHIFT  26
+#endif
+
+static uint64_t round_up(uint64_t size, uint64_t align)
+{
+        return (size + align - 1) & ~(align - 1);
+}
+
+/*
+  Map 'len' bytes of huge pages of 2^shift bytes from the hugetlb pool.
+*/
+static void *map_hugetlb(uint64_t len, int shift)
+{
+#ifdef MAP_HUGETLB
+        void *p = mmap(NULL, len, PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB |
+                       (shift << MAP_HUGE_SHIFT), -1, 0);
+
+        return p == MAP_FAILED ? NULL : p;
+#else
+        return NULL;
+#endif
+}
+
+/*
+  Map 'len' bytes aligned on 2 MiB, so that the kernel can back them
+  with transparent huge pages.
+*/
+static void *map_thp(uint64_t len)
+{
+        char *p, *a;
+
+        p = mmap(NULL, len + HUGE_2M, PROT_READ | PROT_WRITE,
+                 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (p == MAP_FAILED)
+                return NULL;
+        a = (char *)round_up((uint64_t)p, HUGE_2M);
+        if (a > p)
+                munmap(p, a - p);
+        munmap(a + len, p + HUGE_2M - a);
+#ifdef MADV_HUGEPAGE
+        madvise(a, len, MADV_HUGEPAGE);
+#endif
+        return a;
+}
+
+/*
+  Map a payload of 'size' bytes with the largest pages allowed by
+  'pages' that the system can provide, down to regular pages. The
+  length of the mapping is stored in 'len'.
+*/
+static void *map_pages(uint64_t size, int pages, uint64_t *len)
+{
+        void *p;
+
+        if (pages >= OBJ_PAGES_1G && size >= HUGE_1G) {
+                *len = round_up(size, HUGE_1G);
+                if ((p = map_hugetlb(*len, 30)))
+                        return p;
+        }
+        if (pages >= OBJ_PAGES_2M && size >= HUGE_2M) {
+                *len = round_up(size, HUGE_2M);
+                if ((p = map_hugetlb(*len, 21)))
+                        return p;
+        }
+        if (pages >= OBJ_PAGES_THP && size >= HUGE_2M) {
+                *len = round_up(size, HUGE_2M);
+                if ((p = map_thp(*len)))
+                        return p;
+        }
+        *len = size;
+        p = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        return p == MAP_FAILED ? NULL : p;
+}
+
+/*
+  Take the pages of a mapping from NUMA node 'node' when they are first
+  touched, or from another node if it is full.
+*/
+static int numa_bind(void *p, uint64_t len, int node)
+{
+#ifdef SYS_mbind
+        unsigned long mask[NUMA_MAX_NODES / (8 * sizeof(long))];
+
+        memset(mask, 0, sizeof(mask));
+        mask[node / (8 * sizeof(long))] |= 1UL << (node % (8 * sizeof(long)));
+        return syscall(SYS_mbind, p, len, NUMA_MPOL_PREFERRED, mask,
+                       NUMA_MAX_NODES + 1, 0);
+#else
+        return -1;
+#endif
+}
+
+/*
+  Same as obj_data_alloc(), but the payload is mapped on pages of its
+  own: huge pages if 'pages' allows it, placed on NUMA node 'node' if
+  it is not negative. Falls back to obj_data_alloc() for small
+  objects, or if the pages cannot be mapped or bound.
+*/
+struct obj_data *obj_data_alloc_node(obj_descriptor *odsc, int node, int pages)
+{
+        struct obj_data *od;
+        uint64_t len, size = obj_data_size(odsc);
+        void *data;
+
+        if (node >= NUMA_MAX_NODES)
+                node = -1;
+        if (size < MAP_MIN_SIZE ||
+            (node < 0 && (pages == OBJ_PAGES_DEFAULT || size < HUGE_2M)))
+                return obj_data_alloc(odsc);
+
+        data = map_pages(size, pages, &len);
+        if (!data)
+                return obj_data_alloc(odsc);
+        if (node >= 0 && numa_bind(data, len, node) != 0) {
+                munmap(data, len);
+                return obj_data_alloc(odsc);
+        }
+        od = obj_data_alloc_no_data(odsc, data);
+        if (!od) {
+                munmap(data, len);
+                return NULL;
+        }
+        od->numa_node = node;
+        od->map_size = len;
+
+        return od;
+}
+
+/*
+  Release the raw payload of an object, e.g. once it is compressed.
+*/
+void obj_data_free_data(struct obj_data *od)
+{
+        if (!od->data)
+                return;
+        if (od->map_size)
+                munmap(od->data, od->map_size);
+        else
+                free(od->data);
+        od->data = NULL;
+        od->map_size = 0;
+}
+
+/*
+  Give a multi-field object the names of its obj_desc.num_fields fields,
+  packed FIELD_NAME_LEN bytes each.
+*/
+int obj_data_set_fields(struct obj_data *od, const char *names)
+{
+        uint32_t i, n = od->obj_desc.num_fields;
+
+        free(od->fields);
+        od->fields = NULL;
+        if (!n)
+                return 0;
+        od->fields = malloc(n * FIELD_NAME_LEN);
+        if (!od->fields)
+                return -ENOMEM;
+        memcpy(od->fields, names, n * FIELD_NAME_LEN);
+        for (i = 0; i < n; i++)
+                od->fields[i][FIELD_NAME_LEN - 1] = '\0';
+        return 0;
+}
+
+/*
+  Index of the field 'name' of a multi-field object, -1 if it has none.
+*/
+int obj_data_field(struct obj_data *od, const char *name)
+{
+        uint32_t i;
+
+        for (i = 0; i < od->obj_desc.num_fields && od->fields; i++)
+                if (strcmp(od->fields[i], name) == 0)
+                        return i;
+        return -1;
+}
+
+/*
+  Take an additional reference on an object.
+*/
+void obj_data_ref(struct obj_data *od)
+{
+    hg_atomic_incr32(&od->refcnt);
+}
+
+/*
+  Drop a reference on an object, and free it when this was the last
+  one.
+*/
+void obj_data_unref(struct obj_data *od)
+{
+    if(od && hg_atomic_decr32(&od->refcnt) == 0)
+        obj_data_free(od);
+}
 
 void obj_data_free(struct obj_data *od)
 {
     if(od){
-        if(od->data){
-        	free(od->data);
+        obj_data_free_data(od);
+        free(od->fields);
+        free(od->pidx);
+        free(od->comp);
+        if (od->delta_base) {
+            obj_data_release(od->delta_base);
+            obj_data_unref(od->delta_base);
         }
     	free(od);
     }
@@ -443,7 +1504,22 @@ void obj_data_free(struct obj_data *od)
 
 uint64_t obj_data_size(obj_descriptor *obj_desc)
 {
-    return obj_desc->size * bbox_volume(&obj_desc->bb);
+    uint64_t n = obj_desc->num_fields ? obj_desc->num_fields : 1;
+
+    if (obj_desc->kind == OBJ_POINTS)
+        return obj_desc->num_points *
+            (obj_desc->bb.num_dims * sizeof(uint64_t) + obj_desc->size);
+    return n * obj_desc->size * bbox_volume(&obj_desc->bb);
+}
+
+/*
+  Bytes of memory held by the payload of an object.
+*/
+uint64_t obj_data_stored_size(struct obj_data *od)
+{
+    if (od->comp)
+        return od->comp->total_size;
+    return obj_data_size(&od->obj_desc);
 }
 
 
@@ -477,6 +1553,7 @@ int obj_desc_equals_intersect(obj_descriptor *odsc1,
 {
         if (strcmp(odsc1->name, odsc2->name) == 0 &&
             odsc1->version == odsc2->version &&
+            odsc1->level == odsc2->level &&
             bbox_does_intersect(&odsc1->bb, &odsc2->bb))
                 return 1;
         return 0;
@@ -490,6 +1567,7 @@ int obj_desc_by_name_intersect(obj_descriptor *odsc1,
                 obj_descriptor *odsc2)
 {
         if (strcmp(odsc1->name, odsc2->name) == 0 &&
+            odsc1->level == odsc2->level &&
             bbox_does_intersect(&odsc1->bb, &odsc2->bb))
                 return 1;
         return 0;
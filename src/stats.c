@@ -0,0 +1,168 @@
+/*
+ * Copyright (c) 2020, Rutgers Discovery Informatics Institute, Rutgers University
+ *
+ * See COPYRIGHT in top-level directory.
+ */
+
+#include <inttypes.h>
+#include "stats.h"
+#include "ndstore-common.h"
+
+static const char *op_names[NDSTORE_STATS_NUM_OPS] = {
+        "put", "get", "get_pieces"
+};
+
+static const char *phase_names[NDSTORE_STATS_NUM_PHASES] = {
+        "decode", "lookup", "copy", "bulk", "respond", "total"
+};
+
+/* Mercury atomics have no fetch-and-add, so loop on compare-and-swap.
+   Handlers rarely collide on the same counter. */
+static inline void stats_add64(hg_atomic_int64_t *ptr, int64_t val)
+{
+        int64_t old;
+
+        do {
+                old = hg_atomic_get64(ptr);
+        } while (!hg_atomic_cas64(ptr, old, old + val));
+}
+
+static int stats_bucket(uint64_t ns)
+{
+        uint64_t us = ns / 1000;
+        int b = 0;
+
+        while (us > 1 && b < NDSTORE_STATS_HIST_BUCKETS - 1) {
+                us >>= 1;
+                b++;
+        }
+        return b;
+}
+
+const char *stats_op_name(int op)
+{
+        if (op < 0 || op >= NDSTORE_STATS_NUM_OPS)
+                return "unknown";
+        return op_names[op];
+}
+
+void stats_init(struct stats_rec *rec)
+{
+        int i, j, k;
+
+        for (i = 0; i < NDSTORE_STATS_NUM_OPS; i++) {
+                struct stats_op_rec *op = &rec->ops[i];
+
+                hg_atomic_init64(&op->count, 0);
+                hg_atomic_init64(&op->errors, 0);
+                hg_atomic_init64(&op->bytes_in, 0);
+                hg_atomic_init64(&op->bytes_out, 0);
+                for (j = 0; j < NDSTORE_STATS_NUM_PHASES; j++) {
+                        hg_atomic_init64(&op->time_ns[j], 0);
+                        for (k = 0; k < NDSTORE_STATS_HIST_BUCKETS; k++)
+                                hg_atomic_init64(&op->hist[j][k], 0);
+                }
+        }
+        hg_atomic_init64(&rec->gc_versions, 0);
+        hg_atomic_init64(&rec->gc_bytes, 0);
+        rec->start_time = ABT_get_wtime();
+}
+
+/*
+  Account one completed call of 'op'. The total is the sum of the
+  phases recorded in 't', so phases skipped on error paths cost nothing.
+*/
+void stats_record(struct stats_rec *rec, int op, struct stats_timer *t,
+                uint64_t bytes_in, uint64_t bytes_out, int err)
+{
+        struct stats_op_rec *r = &rec->ops[op];
+        uint64_t ns, total = 0;
+        int i;
+
+        hg_atomic_incr64(&r->count);
+        if (err)
+                hg_atomic_incr64(&r->errors);
+        if (bytes_in)
+                stats_add64(&r->bytes_in, bytes_in);
+        if (bytes_out)
+                stats_add64(&r->bytes_out, bytes_out);
+
+        for (i = 0; i < NDSTORE_STATS_PH_TOTAL; i++) {
+                if (t->phase[i] <= 0)
+                        continue;
+                ns = (uint64_t)(t->phase[i] * 1e9);
+                total += ns;
+                stats_add64(&r->time_ns[i], ns);
+                hg_atomic_incr64(&r->hist[i][stats_bucket(ns)]);
+        }
+        stats_add64(&r->time_ns[NDSTORE_STATS_PH_TOTAL], total);
+        hg_atomic_incr64(&r->hist[NDSTORE_STATS_PH_TOTAL][stats_bucket(total)]);
+}
+
+void stats_record_gc(struct stats_rec *rec, uint64_t versions, uint64_t bytes)
+{
+        if (versions)
+                stats_add64(&rec->gc_versions, versions);
+        if (bytes)
+                stats_add64(&rec->gc_bytes, bytes);
+}
+
+void stats_snapshot(struct stats_rec *rec, struct ndstore_stats *stats)
+{
+        int i, j, k;
+
+        memset(stats, 0, sizeof(*stats));
+        stats->uptime = ABT_get_wtime() - rec->start_time;
+        stats->gc_versions = hg_atomic_get64(&rec->gc_versions);
+        stats->gc_bytes = hg_atomic_get64(&rec->gc_bytes);
+        for (i = 0; i < NDSTORE_STATS_NUM_OPS; i++) {
+                struct stats_op_rec *r = &rec->ops[i];
+                struct ndstore_op_stats *o = &stats->ops[i];
+
+                o->count = hg_atomic_get64(&r->count);
+                o->errors = hg_atomic_get64(&r->errors);
+                o->bytes_in = hg_atomic_get64(&r->bytes_in);
+                o->bytes_out = hg_atomic_get64(&r->bytes_out);
+                for (j = 0; j < NDSTORE_STATS_NUM_PHASES; j++) {
+                        o->time_ns[j] = hg_atomic_get64(&r->time_ns[j]);
+                        for (k = 0; k < NDSTORE_STATS_HIST_BUCKETS; k++)
+                                o->hist[j][k] = hg_atomic_get64(&r->hist[j][k]);
+                }
+        }
+}
+
+int ndstore_stats_fprint(FILE *fp, const struct ndstore_stats *stats)
+{
+        int i, j, k;
+
+        if (!fp || !stats)
+                return NDSTORE_ERR_INVALID_ARG;
+
+        fprintf(fp, "{\"uptime\": %.6f, \"num_obj\": %" PRIu64
+                ", \"bytes_resident\": %" PRIu64 ", \"gc_versions\": %" PRIu64
+                ", \"gc_bytes\": %" PRIu64 ", \"ops\": {",
+                stats->uptime, stats->num_obj, stats->bytes_resident,
+                stats->gc_versions, stats->gc_bytes);
+        for (i = 0; i < NDSTORE_STATS_NUM_OPS; i++) {
+                const struct ndstore_op_stats *o = &stats->ops[i];
+
+                fprintf(fp, "%s\"%s\": {\"count\": %" PRIu64
+                        ", \"errors\": %" PRIu64 ", \"bytes_in\": %" PRIu64
+                        ", \"bytes_out\": %" PRIu64 ", \"phases\": {",
+                        i ? ", " : "", op_names[i], o->count, o->errors,
+                        o->bytes_in, o->bytes_out);
+                for (j = 0; j < NDSTORE_STATS_NUM_PHASES; j++) {
+                        fprintf(fp, "%s\"%s\": {\"time_ns\": %" PRIu64
+                                ", \"hist_us_log2\": [",
+                                j ? ", " : "", phase_names[j], o->time_ns[j]);
+                        for (k = 0; k < NDSTORE_STATS_HIST_BUCKETS; k++)
+                                fprintf(fp, "%s%" PRIu64, k ? ", " : "",
+                                        o->hist[j][k]);
+                        fprintf(fp, "]}");
+                }
+                fprintf(fp, "}}");
+        }
+        fprintf(fp, "}}\n");
+
+        return NDSTORE_SUCCESS;
+}
@@ -0,0 +1,140 @@
+/*
+ * Copyright (c) 2020, Rutgers Discovery Informatics Institute, Rutgers University
+ *
+ * See COPYRIGHT in top-level directory.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <unistd.h>
+#include "trace.h"
+#include "stats.h"
+
+struct trace_ring *trace_ring_alloc(uint64_t capacity)
+{
+        struct trace_ring *ring;
+        uint64_t i;
+
+        if (!capacity)
+                return NULL;
+
+        ring = malloc(sizeof(*ring));
+        if (!ring)
+                return NULL;
+        ring->ev = calloc(capacity, sizeof(*ring->ev));
+        if (!ring->ev) {
+                free(ring);
+                return NULL;
+        }
+        ring->capacity = capacity;
+        hg_atomic_init64(&ring->head, 0);
+        for (i = 0; i < capacity; i++)
+                hg_atomic_init64(&ring->ev[i].seq, 0);
+
+        return ring;
+}
+
+void trace_ring_free(struct trace_ring *ring)
+{
+        if (!ring)
+                return;
+        free(ring->ev);
+        free(ring);
+}
+
+/*
+  Copy an event into the next slot. The slot sequence number is
+  cleared while the payload is written, so a concurrent dump can tell a
+  torn slot from a complete one.
+*/
+void trace_ring_push(struct trace_ring *ring, const struct trace_event *ev)
+{
+        int64_t idx = hg_atomic_incr64(&ring->head) - 1;
+        struct trace_event *slot = &ring->ev[idx % ring->capacity];
+
+        hg_atomic_set64(&slot->seq, 0);
+        hg_atomic_fence();
+        slot->op = ev->op;
+        slot->tid = ev->tid;
+        memcpy(slot->name, ev->name, sizeof(slot->name));
+        slot->version = ev->version;
+        slot->bytes = ev->bytes;
+        slot->ret = ev->ret;
+        slot->t_start = ev->t_start;
+        slot->t_reg = ev->t_reg;
+        slot->t_sent = ev->t_sent;
+        slot->t_reply = ev->t_reply;
+        slot->t_end = ev->t_end;
+        slot->server_ns = ev->server_ns;
+        hg_atomic_fence();
+        hg_atomic_set64(&slot->seq, idx + 1);
+}
+
+static void trace_slice(FILE *fp, int *first, const char *name, int tid,
+                double ts, double dur)
+{
+        fprintf(fp, "%s{\"name\": \"%s\", \"ph\": \"X\", \"pid\": %d, "
+                "\"tid\": %d, \"ts\": %.3f, \"dur\": %.3f}",
+                *first ? "" : ",\n", name, (int)getpid(), tid,
+                ts * 1e6, dur * 1e6);
+        *first = 0;
+}
+
+/*
+  Write the events currently in the ring as a Chrome trace (JSON object
+  format), readable by chrome://tracing and Perfetto. Each call is a
+  slice on the track of its execution stream, with its phases nested
+  below it; the server time reported back is centred in the wait
+  phase, the remainder of which is network and queueing time.
+*/
+int trace_ring_dump_chrome(struct trace_ring *ring, FILE *fp)
+{
+        struct trace_event ev;
+        uint64_t i, n;
+        int64_t head, seq;
+        int first = 1;
+        char label[96];
+
+        head = hg_atomic_get64(&ring->head);
+        n = (uint64_t)head < ring->capacity ? (uint64_t)head : ring->capacity;
+
+        fprintf(fp, "{\"traceEvents\": [\n");
+        for (i = 0; i < n; i++) {
+                struct trace_event *slot = &ring->ev[(head - n + i) % ring->capacity];
+                double wait, server;
+
+                seq = hg_atomic_get64(&slot->seq);
+                if (!seq)
+                        continue;
+                hg_atomic_fence();
+                memcpy(&ev, slot, sizeof(ev));
+                hg_atomic_fence();
+                if (hg_atomic_get64(&slot->seq) != seq)
+                        continue;
+
+                snprintf(label, sizeof(label), "%s %.*s v%u",
+                        stats_op_name(ev.op), 64, ev.name, ev.version);
+                fprintf(fp, "%s{\"name\": \"%s\", \"ph\": \"X\", \"pid\": %d, "
+                        "\"tid\": %d, \"ts\": %.3f, \"dur\": %.3f, \"args\": "
+                        "{\"bytes\": %" PRIu64 ", \"ret\": %d, \"server_us\": %.3f}}",
+                        first ? "" : ",\n", label, (int)getpid(), ev.tid,
+                        ev.t_start * 1e6, (ev.t_end - ev.t_start) * 1e6,
+                        ev.bytes, ev.ret, ev.server_ns / 1e3);
+                first = 0;
+
+                wait = ev.t_reply - ev.t_sent;
+                server = ev.server_ns / 1e9;
+                if (server > wait)
+                        server = wait;
+                trace_slice(fp, &first, "register", ev.tid, ev.t_start, ev.t_reg - ev.t_start);
+                trace_slice(fp, &first, "send", ev.tid, ev.t_reg, ev.t_sent - ev.t_reg);
+                trace_slice(fp, &first, "wait", ev.tid, ev.t_sent, wait);
+                trace_slice(fp, &first, "server", ev.tid,
+                        ev.t_sent + (wait - server) / 2, server);
+                trace_slice(fp, &first, "complete", ev.tid, ev.t_reply, ev.t_end - ev.t_reply);
+        }
+        fprintf(fp, "\n]}\n");
+
+        return 0;
+}
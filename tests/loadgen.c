@@ -0,0 +1,601 @@
+/*
+ * Copyright (c) 2020, Rutgers Discovery Informatics Institute, Rutgers University
+ *
+ * See COPYRIGHT in top-level directory.
+ */
+
+/*
+ * End-to-end load generator. A single process runs clients x depth
+ * ULTs that issue a mix of puts and gets against one provider, and
+ * reports throughput and latency percentiles per operation.
+ *
+ * The global domain is split in blocks; a version of a variable is
+ * complete once every block of it has been put. Gets only target
+ * complete versions, picked at most 'lag' versions behind the latest.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <unistd.h>
+#include <math.h>
+#include <margo.h>
+#include <ndstore-client.h>
+
+#define MAX_DIMS 10
+#define VER_WINDOW 64
+/* Writers stay at most this many versions ahead of the newest complete
+ * one, since the server overwrites versions that map to the same bin. */
+#define MAX_AHEAD 2
+
+enum { OP_PUT = 0, OP_GET, NUM_OPS };
+static const char *op_names[NUM_OPS] = {"put", "get"};
+
+enum read_pattern { READ_BLOCK, READ_SHIFT, READ_RANDOM };
+
+struct config {
+    char *server_addr;
+    int ndims;
+    uint64_t gdim[MAX_DIMS];
+    uint64_t bdim[MAX_DIMS];
+    uint64_t nblocks[MAX_DIMS];
+    uint64_t total_blocks;
+    int num_vars;
+    size_t elem_size;
+    double write_ratio;
+    int clients;
+    int depth;
+    double duration;
+    uint64_t max_ops;
+    enum read_pattern pattern;
+    double zipf_theta;
+    int lag;
+    int preload;
+    int check;
+    uint16_t provider_id;
+    int wire_codec;
+    int pull;
+};
+
+/* progress of the writers, per variable */
+struct var_state {
+    unsigned int latest;            /* newest complete version */
+    uint64_t next_claim;            /* next block to write, counted from version 1 */
+    uint64_t done[VER_WINDOW];      /* completed blocks per version */
+};
+
+struct worker {
+    int id;
+    ndstore_provider_handle_t ph;
+    uint64_t rng;
+    void *buf;
+    double *lat[NUM_OPS];
+    size_t nlat[NUM_OPS], caplat[NUM_OPS];
+    uint64_t ops[NUM_OPS], errors[NUM_OPS], bytes[NUM_OPS], bad_data;
+};
+
+static struct config cfg_;
+static struct var_state *vars_;
+static double *zipf_cdf_;
+static double t_end_;
+
+static uint64_t rng_next(uint64_t *s)
+{
+    /* xorshift64* */
+    uint64_t x = *s;
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    *s = x;
+    return x * 0x2545F4914F6CDD1DULL;
+}
+
+static double rng_uniform(uint64_t *s)
+{
+    return (rng_next(s) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+static void zipf_init(int n, double theta)
+{
+    double sum = 0;
+    int i;
+
+    zipf_cdf_ = malloc(sizeof(*zipf_cdf_) * n);
+    for(i = 0; i < n; i++) {
+        sum += 1.0 / pow(i + 1, theta);
+        zipf_cdf_[i] = sum;
+    }
+    for(i = 0; i < n; i++)
+        zipf_cdf_[i] /= sum;
+}
+
+/* Variable index, rank 0 being the most popular for theta > 0. */
+static int pick_var(uint64_t *s)
+{
+    double u = rng_uniform(s);
+    int lo = 0, hi = cfg_.num_vars - 1;
+
+    while(lo < hi) {
+        int mid = (lo + hi) / 2;
+        if(zipf_cdf_[mid] < u)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+static void block_bounds(uint64_t blk, uint64_t *lb, uint64_t *ub)
+{
+    int d;
+
+    for(d = 0; d < cfg_.ndims; d++) {
+        lb[d] = (blk % cfg_.nblocks[d]) * cfg_.bdim[d];
+        ub[d] = lb[d] + cfg_.bdim[d] - 1;
+        blk /= cfg_.nblocks[d];
+    }
+}
+
+static uint64_t block_volume(void)
+{
+    uint64_t n = 1;
+    int d;
+
+    for(d = 0; d < cfg_.ndims; d++)
+        n *= cfg_.bdim[d];
+    return n;
+}
+
+static void fill_data(void *buf, uint64_t nelem, unsigned int ver)
+{
+    uint64_t i, n = nelem * cfg_.elem_size / sizeof(double);
+
+    for(i = 0; i < n; i++)
+        ((double*)buf)[i] = ver;
+}
+
+static int check_data(void *buf, uint64_t nelem, unsigned int ver)
+{
+    uint64_t i, n = nelem * cfg_.elem_size / sizeof(double);
+
+    for(i = 0; i < n; i++)
+        if(((double*)buf)[i] != ver)
+            return -1;
+    return 0;
+}
+
+static void record_latency(struct worker *w, int op, double lat)
+{
+    if(w->nlat[op] == w->caplat[op]) {
+        w->caplat[op] = w->caplat[op] ? 2 * w->caplat[op] : 4096;
+        w->lat[op] = realloc(w->lat[op], sizeof(double) * w->caplat[op]);
+    }
+    w->lat[op][w->nlat[op]++] = lat;
+}
+
+/* Mark a block of 'ver' complete and publish versions that are done. */
+static void complete_block(struct var_state *vs, unsigned int ver)
+{
+    vs->done[ver % VER_WINDOW]++;
+    while(vs->done[(vs->latest + 1) % VER_WINDOW] == cfg_.total_blocks) {
+        vs->done[(vs->latest + 1) % VER_WINDOW] = 0;
+        vs->latest++;
+    }
+}
+
+static int do_put(struct worker *w, int var)
+{
+    struct var_state *vs = &vars_[var];
+    uint64_t lb[MAX_DIMS], ub[MAX_DIMS], claim, nelem = block_volume();
+    unsigned int ver;
+    char name[64];
+    double t0;
+    int ret;
+
+    /* do not run too far ahead of the newest complete version */
+    if(vs->next_claim / cfg_.total_blocks + 1 > vs->latest + MAX_AHEAD)
+        return 1;
+    claim = vs->next_claim++;
+    ver = claim / cfg_.total_blocks + 1;
+    block_bounds(claim % cfg_.total_blocks, lb, ub);
+    sprintf(name, "lg_%d", var);
+    if(cfg_.check)
+        fill_data(w->buf, nelem, ver);
+
+    t0 = ABT_get_wtime();
+    ret = ndstore_put(w->ph, name, ver, cfg_.elem_size, cfg_.ndims, lb, ub, w->buf);
+    record_latency(w, OP_PUT, ABT_get_wtime() - t0);
+
+    w->ops[OP_PUT]++;
+    if(ret != NDSTORE_SUCCESS)
+        w->errors[OP_PUT]++;
+    else
+        w->bytes[OP_PUT] += nelem * cfg_.elem_size;
+    complete_block(vs, ver);
+
+    return ret;
+}
+
+static int do_get(struct worker *w, int var)
+{
+    struct var_state *vs = &vars_[var];
+    uint64_t lb[MAX_DIMS], ub[MAX_DIMS], nelem = block_volume();
+    unsigned int ver, lag;
+    char name[64];
+    double t0;
+    int d, ret;
+
+    if(vs->latest == 0)
+        return 1;
+    lag = cfg_.lag ? rng_next(&w->rng) % (cfg_.lag + 1) : 0;
+    ver = (lag < vs->latest) ? vs->latest - lag : 1;
+
+    switch(cfg_.pattern) {
+    case READ_BLOCK:
+        block_bounds(rng_next(&w->rng) % cfg_.total_blocks, lb, ub);
+        break;
+    case READ_SHIFT:
+        block_bounds(rng_next(&w->rng) % cfg_.total_blocks, lb, ub);
+        for(d = 0; d < cfg_.ndims; d++) {
+            lb[d] += cfg_.bdim[d] / 2;
+            if(lb[d] + cfg_.bdim[d] > cfg_.gdim[d])
+                lb[d] = cfg_.gdim[d] - cfg_.bdim[d];
+            ub[d] = lb[d] + cfg_.bdim[d] - 1;
+        }
+        break;
+    case READ_RANDOM:
+        for(d = 0; d < cfg_.ndims; d++) {
+            lb[d] = rng_next(&w->rng) % (cfg_.gdim[d] - cfg_.bdim[d] + 1);
+            ub[d] = lb[d] + cfg_.bdim[d] - 1;
+        }
+        break;
+    }
+    sprintf(name, "lg_%d", var);
+
+    t0 = ABT_get_wtime();
+    if(cfg_.pull)
+        ret = ndstore_get_pull(w->ph, name, ver, cfg_.elem_size, cfg_.ndims, lb, ub, w->buf);
+    else
+        ret = ndstore_get(w->ph, name, ver, cfg_.elem_size, cfg_.ndims, lb, ub, w->buf);
+    record_latency(w, OP_GET, ABT_get_wtime() - t0);
+
+    w->ops[OP_GET]++;
+    if(ret != NDSTORE_SUCCESS) {
+        w->errors[OP_GET]++;
+    } else {
+        w->bytes[OP_GET] += nelem * cfg_.elem_size;
+        if(cfg_.check && check_data(w->buf, nelem, ver) != 0)
+            w->bad_data++;
+    }
+
+    return ret;
+}
+
+static void worker_ult(void *arg)
+{
+    struct worker *w = (struct worker*)arg;
+    uint64_t n = 0;
+
+    while(ABT_get_wtime() < t_end_ && (!cfg_.max_ops || n < cfg_.max_ops)) {
+        int var = pick_var(&w->rng);
+
+        if(rng_uniform(&w->rng) < cfg_.write_ratio)
+            do_put(w, var);
+        else
+            do_get(w, var);
+        n++;
+    }
+}
+
+static int cmp_double(const void *a, const void *b)
+{
+    double x = *(const double*)a, y = *(const double*)b;
+    return (x > y) - (x < y);
+}
+
+static double percentile(double *v, size_t n, double p)
+{
+    size_t i;
+
+    if(!n)
+        return 0;
+    i = (size_t)(p * (n - 1) + 0.5);
+    return v[i];
+}
+
+static void report(struct worker *w, int nw, double elapsed)
+{
+    uint64_t ops, errors, bytes, bad = 0, total = 0;
+    double *lat, sum;
+    size_t n, k;
+    int op, i;
+
+    fprintf(stdout, "%-4s %10s %8s %12s %10s %10s %10s %10s %10s\n",
+            "op", "count", "errors", "ops/s", "MB/s",
+            "mean_us", "p50_us", "p99_us", "p999_us");
+    for(op = 0; op < NUM_OPS; op++) {
+        ops = errors = bytes = 0;
+        n = 0;
+        for(i = 0; i < nw; i++) {
+            ops += w[i].ops[op];
+            errors += w[i].errors[op];
+            bytes += w[i].bytes[op];
+            n += w[i].nlat[op];
+        }
+        lat = malloc(sizeof(*lat) * (n ? n : 1));
+        for(i = 0, k = 0; i < nw; i++) {
+            memcpy(&lat[k], w[i].lat[op], sizeof(*lat) * w[i].nlat[op]);
+            k += w[i].nlat[op];
+        }
+        qsort(lat, n, sizeof(*lat), cmp_double);
+        for(k = 0, sum = 0; k < n; k++)
+            sum += lat[k];
+        fprintf(stdout, "%-4s %10" PRIu64 " %8" PRIu64 " %12.1f %10.2f %10.1f %10.1f %10.1f %10.1f\n",
+                op_names[op], ops, errors, ops / elapsed, bytes / elapsed / 1e6,
+                n ? sum / n * 1e6 : 0, percentile(lat, n, 0.5) * 1e6,
+                percentile(lat, n, 0.99) * 1e6, percentile(lat, n, 0.999) * 1e6);
+        free(lat);
+        total += ops;
+    }
+    for(i = 0; i < nw; i++)
+        bad += w[i].bad_data;
+    fprintf(stdout, "total %" PRIu64 " ops in %.3f s, %.1f ops/s",
+            total, elapsed, total / elapsed);
+    if(cfg_.check)
+        fprintf(stdout, ", %" PRIu64 " gets with wrong data", bad);
+    fprintf(stdout, "\n");
+}
+
+static int parse_dims(char *str, uint64_t *out)
+{
+    int n = 0;
+    char *tok = strtok(str, ",x");
+
+    while(tok && n < MAX_DIMS) {
+        out[n++] = strtoull(tok, NULL, 10);
+        tok = strtok(NULL, ",x");
+    }
+    return n;
+}
+
+static void usage(const char *prog)
+{
+    fprintf(stderr,
+        "Usage: %s -s server_addr [options]\n"
+        "  -g dims      global domain, e.g. 64,64,64 (default 64,64,64)\n"
+        "  -b dims      block put by one writer, e.g. 16,16,16 (default 16,16,16)\n"
+        "  -v n         number of variables (default 4)\n"
+        "  -e bytes     element size (default 8)\n"
+        "  -w ratio     fraction of operations that are puts (default 0.5)\n"
+        "  -c n         clients (provider handles) per process (default 1)\n"
+        "  -q n         outstanding operations per client (default 1)\n"
+        "  -t sec       duration (default 10)\n"
+        "  -n ops       stop each ULT after this many operations (default unbounded)\n"
+        "  -r pattern   get pattern: block, shift or random (default block)\n"
+        "  -z theta     zipf skew of variable popularity, 0 is uniform (default 0)\n"
+        "  -l n         gets read up to n versions behind the latest (default 0)\n"
+        "  -p n         versions of every variable put before the run (default 1)\n"
+        "  -k           fill puts with the version and verify gets\n"
+        "  -i id        provider id (default 1)\n"
+        "  -x codec     compress transfers with lz4 or zstd (default none)\n"
+        "  -u           gets pull the stored pieces themselves\n", prog);
+}
+
+static int parse_args(int argc, char **argv)
+{
+    char gbuf[256] = "64,64,64", bbuf[256] = "16,16,16";
+    int opt, d, nb;
+
+    cfg_.num_vars = 4;
+    cfg_.elem_size = sizeof(double);
+    cfg_.write_ratio = 0.5;
+    cfg_.clients = 1;
+    cfg_.depth = 1;
+    cfg_.duration = 10;
+    cfg_.pattern = READ_BLOCK;
+    cfg_.preload = 1;
+    cfg_.provider_id = 1;
+
+    while((opt = getopt(argc, argv, "s:g:b:v:e:w:c:q:t:n:r:z:l:p:ki:x:u")) != -1) {
+        switch(opt) {
+        case 's': cfg_.server_addr = optarg; break;
+        case 'g': strncpy(gbuf, optarg, sizeof(gbuf)-1); break;
+        case 'b': strncpy(bbuf, optarg, sizeof(bbuf)-1); break;
+        case 'v': cfg_.num_vars = atoi(optarg); break;
+        case 'e': cfg_.elem_size = atoi(optarg); break;
+        case 'w': cfg_.write_ratio = atof(optarg); break;
+        case 'c': cfg_.clients = atoi(optarg); break;
+        case 'q': cfg_.depth = atoi(optarg); break;
+        case 't': cfg_.duration = atof(optarg); break;
+        case 'n': cfg_.max_ops = strtoull(optarg, NULL, 10); break;
+        case 'r':
+            if(!strcmp(optarg, "shift"))
+                cfg_.pattern = READ_SHIFT;
+            else if(!strcmp(optarg, "random"))
+                cfg_.pattern = READ_RANDOM;
+            else
+                cfg_.pattern = READ_BLOCK;
+            break;
+        case 'z': cfg_.zipf_theta = atof(optarg); break;
+        case 'l': cfg_.lag = atoi(optarg); break;
+        case 'p': cfg_.preload = atoi(optarg); break;
+        case 'k': cfg_.check = 1; break;
+        case 'i': cfg_.provider_id = atoi(optarg); break;
+        case 'u': cfg_.pull = 1; break;
+        case 'x':
+            if(!strcmp(optarg, "lz4"))
+                cfg_.wire_codec = NDSTORE_CODEC_LZ4;
+            else if(!strcmp(optarg, "zstd"))
+                cfg_.wire_codec = NDSTORE_CODEC_ZSTD;
+            else
+                return -1;
+            break;
+        default:
+            return -1;
+        }
+    }
+
+    cfg_.ndims = parse_dims(gbuf, cfg_.gdim);
+    nb = parse_dims(bbuf, cfg_.bdim);
+    if(!cfg_.server_addr || cfg_.ndims == 0 || nb != cfg_.ndims ||
+       cfg_.num_vars < 1 || cfg_.clients < 1 || cfg_.depth < 1 ||
+       cfg_.elem_size == 0 || cfg_.preload < 0)
+        return -1;
+    if(cfg_.check && cfg_.elem_size % sizeof(double)) {
+        fprintf(stderr, "-k needs an element size that is a multiple of %zu\n", sizeof(double));
+        return -1;
+    }
+    if(cfg_.lag + MAX_AHEAD >= 10)
+        fprintf(stderr, "warning: with -l %d gets may target versions the server "
+                "has already overwritten\n", cfg_.lag);
+
+    cfg_.total_blocks = 1;
+    for(d = 0; d < cfg_.ndims; d++) {
+        if(cfg_.bdim[d] == 0 || cfg_.bdim[d] > cfg_.gdim[d] ||
+           cfg_.gdim[d] % cfg_.bdim[d]) {
+            fprintf(stderr, "block size must divide the global domain\n");
+            return -1;
+        }
+        cfg_.nblocks[d] = cfg_.gdim[d] / cfg_.bdim[d];
+        cfg_.total_blocks *= cfg_.nblocks[d];
+    }
+
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    margo_instance_id mid;
+    ndstore_client_t ndcl = NDSTORE_CLIENT_NULL;
+    ndstore_provider_handle_t *ph;
+    hg_addr_t svr_addr = HG_ADDR_NULL;
+    char proto[64] = {0};
+    struct worker *w;
+    ABT_thread *ults;
+    ABT_xstream xstream;
+    ABT_pool pool;
+    double t0, elapsed;
+    int nw, i, ret;
+    uint64_t b, v;
+
+    if(parse_args(argc, argv) != 0) {
+        usage(argv[0]);
+        return -1;
+    }
+
+    for(i = 0; i < 63 && cfg_.server_addr[i] != '\0' && cfg_.server_addr[i] != ':'; i++)
+        proto[i] = cfg_.server_addr[i];
+
+    mid = margo_init(proto, MARGO_CLIENT_MODE, 1, 0);
+    if(mid == MARGO_INSTANCE_NULL) {
+        fprintf(stderr, "ERROR: margo_init()\n");
+        return -1;
+    }
+    ret = ndstore_client_init(mid, &ndcl);
+    if(ret != NDSTORE_SUCCESS) {
+        fprintf(stderr, "ERROR: ndstore_client_init() returned %d\n", ret);
+        margo_finalize(mid);
+        return -1;
+    }
+    if(cfg_.wire_codec != NDSTORE_CODEC_NONE) {
+        struct ndstore_var_policy wire;
+
+        ndstore_var_policy_init(&wire);
+        wire.codec = cfg_.wire_codec;
+        ret = ndstore_client_set_wire_compression(ndcl, &wire, 0);
+        if(ret != NDSTORE_SUCCESS) {
+            fprintf(stderr, "ERROR: codec not available in this build\n");
+            ndstore_client_finalize(ndcl);
+            margo_finalize(mid);
+            return -1;
+        }
+    }
+    if(margo_addr_lookup(mid, cfg_.server_addr, &svr_addr) != HG_SUCCESS) {
+        fprintf(stderr, "ERROR: margo_addr_lookup()\n");
+        ndstore_client_finalize(ndcl);
+        margo_finalize(mid);
+        return -1;
+    }
+
+    ph = calloc(cfg_.clients, sizeof(*ph));
+    for(i = 0; i < cfg_.clients; i++) {
+        ret = ndstore_provider_handle_create(ndcl, svr_addr, cfg_.provider_id, &ph[i]);
+        if(ret != NDSTORE_SUCCESS) {
+            fprintf(stderr, "ERROR: ndstore_provider_handle_create() returned %d\n", ret);
+            return -1;
+        }
+    }
+
+    vars_ = calloc(cfg_.num_vars, sizeof(*vars_));
+    zipf_init(cfg_.num_vars, cfg_.zipf_theta);
+
+    nw = cfg_.clients * cfg_.depth;
+    w = calloc(nw, sizeof(*w));
+    ults = calloc(nw, sizeof(*ults));
+    for(i = 0; i < nw; i++) {
+        w[i].id = i;
+        w[i].ph = ph[i / cfg_.depth];
+        w[i].rng = 0x9E3779B97F4A7C15ULL * (i + 1) + (uint64_t)getpid();
+        w[i].buf = malloc(block_volume() * cfg_.elem_size);
+        if(!w[i].buf) {
+            fprintf(stderr, "ERROR: could not allocate a block buffer\n");
+            return -1;
+        }
+    }
+
+    /* preload complete versions so that gets have something to read */
+    for(v = 0; v < (uint64_t)cfg_.preload; v++)
+        for(i = 0; i < cfg_.num_vars; i++)
+            for(b = 0; b < cfg_.total_blocks; b++)
+                if(do_put(&w[0], i) != NDSTORE_SUCCESS) {
+                    fprintf(stderr, "ERROR: preload put failed\n");
+                    return -1;
+                }
+    for(i = 0; i < nw; i++) {
+        w[i].ops[OP_PUT] = w[i].errors[OP_PUT] = w[i].bytes[OP_PUT] = 0;
+        w[i].nlat[OP_PUT] = 0;
+    }
+
+    ABT_xstream_self(&xstream);
+    ABT_xstream_get_main_pools(xstream, 1, &pool);
+
+    t0 = ABT_get_wtime();
+    t_end_ = t0 + cfg_.duration;
+    for(i = 0; i < nw; i++)
+        ABT_thread_create(pool, worker_ult, &w[i], ABT_THREAD_ATTR_NULL, &ults[i]);
+    for(i = 0; i < nw; i++) {
+        ABT_thread_join(ults[i]);
+        ABT_thread_free(&ults[i]);
+    }
+    elapsed = ABT_get_wtime() - t0;
+
+    fprintf(stdout, "# %d clients x %d depth, %d vars, write ratio %.2f, pattern %s, "
+            "zipf %.2f, lag %d\n", cfg_.clients, cfg_.depth, cfg_.num_vars,
+            cfg_.write_ratio, cfg_.pattern == READ_BLOCK ? "block" :
+            cfg_.pattern == READ_SHIFT ? "shift" : "random",
+            cfg_.zipf_theta, cfg_.lag);
+    report(w, nw, elapsed);
+
+    ret = 0;
+    for(i = 0; i < nw; i++) {
+        if(w[i].bad_data || w[i].errors[OP_PUT])
+            ret = -1;
+        free(w[i].buf);
+        free(w[i].lat[OP_PUT]);
+        free(w[i].lat[OP_GET]);
+    }
+    free(w);
+    free(ults);
+    free(vars_);
+    free(zipf_cdf_);
+
+    for(i = 0; i < cfg_.clients; i++)
+        ndstore_provider_handle_release(ph[i]);
+    free(ph);
+    ndstore_client_finalize(ndcl);
+    margo_addr_free(mid, svr_addr);
+    margo_finalize(mid);
+
+    return ret;
+}
@@ -10,25 +10,255 @@
 #include <margo.h>
 #include <ndstore-server.h>
 
+#define MAX_PROVIDERS 64
+#define MAX_NODES 16
+#define MAX_CPUS 1024
+
+/*
+ * One provider per line of the config file, e.g.
+ *
+ *   # id, handler xstreams, memory budget, NUMA nodes, huge pages
+ *   provider id=1 xstreams=2 budget=512M numa=0
+ *   provider id=2 xstreams=4 budget=16G numa=0,1 pages=2M copy_ults=16
+ *   provider id=3 results=256M
+ *   provider id=4 replicas=5,6
+ *   provider id=7 replicas=ofi+tcp://10.0.0.2:5000:1
+ *
+ * A provider with no xstreams (the default) shares margo's handler
+ * pool; otherwise it gets its own pool served by its own xstreams,
+ * bound to the cpus of the NUMA node if one is given. With several
+ * nodes, every node gets such a pool and xstreams: the provider
+ * spreads its objects over the nodes and copies the pieces of a get
+ * in the pool of their node, its handlers run in the first pool.
+ * Replicas are other providers of this server, or given as address:id
+ * providers of another one, which outlive a failure of this server.
+ */
+struct provider_conf {
+    uint16_t id;
+    int num_xstreams;
+    uint64_t budget;
+    enum ndstore_pages pages;
+    int copy_ults;
+    uint64_t results;
+    int num_replicas;
+    uint16_t replicas[MAX_PROVIDERS];
+    /* address of the server of each replica, NULL for this one */
+    char *replica_addrs[MAX_PROVIDERS];
+    int num_numa;
+    int numa[MAX_NODES];
+    ABT_pool pools[MAX_NODES];
+    ABT_xstream *xstreams;
+    ndstore_provider_t prov;
+};
+
+static uint64_t parse_size(const char *str)
+{
+    char *end;
+    uint64_t val = strtoull(str, &end, 10);
+
+    switch(*end) {
+    case 'G': case 'g': val <<= 10; /* fall through */
+    case 'M': case 'm': val <<= 10; /* fall through */
+    case 'K': case 'k': val <<= 10;
+    }
+    return val;
+}
+
+static int parse_config(const char *path, struct provider_conf *conf)
+{
+    char line[1024], *tok, *save;
+    int n = 0, lineno = 0;
+    FILE *fp;
+
+    fp = fopen(path, "r");
+    if(!fp) {
+        fprintf(stderr, "ERROR: could not open %s\n", path);
+        return -1;
+    }
+    while(fgets(line, sizeof(line), fp)) {
+        lineno++;
+        tok = strtok_r(line, " \t\n", &save);
+        if(!tok || tok[0] == '#')
+            continue;
+        if(strcmp(tok, "provider") != 0 || n == MAX_PROVIDERS) {
+            fprintf(stderr, "ERROR: %s:%d: unexpected '%s'\n", path, lineno, tok);
+            fclose(fp);
+            return -1;
+        }
+        memset(&conf[n], 0, sizeof(conf[n]));
+        conf[n].id = n + 1;
+        while((tok = strtok_r(NULL, " \t\n", &save))) {
+            if(strncmp(tok, "id=", 3) == 0)
+                conf[n].id = atoi(tok + 3);
+            else if(strncmp(tok, "xstreams=", 9) == 0)
+                conf[n].num_xstreams = atoi(tok + 9);
+            else if(strncmp(tok, "budget=", 7) == 0)
+                conf[n].budget = parse_size(tok + 7);
+            else if(strncmp(tok, "copy_ults=", 10) == 0)
+                conf[n].copy_ults = atoi(tok + 10);
+            else if(strncmp(tok, "results=", 8) == 0)
+                conf[n].results = parse_size(tok + 8);
+            else if(strcmp(tok, "pages=thp") == 0)
+                conf[n].pages = NDSTORE_PAGES_THP;
+            else if(strcmp(tok, "pages=2M") == 0)
+                conf[n].pages = NDSTORE_PAGES_2M;
+            else if(strcmp(tok, "pages=1G") == 0)
+                conf[n].pages = NDSTORE_PAGES_1G;
+            else if(strncmp(tok, "replicas=", 9) == 0) {
+                char *p, *colon, *save2;
+                int r;
+
+                p = strtok_r(tok + 9, ",", &save2);
+                while(p && conf[n].num_replicas < MAX_PROVIDERS) {
+                    r = conf[n].num_replicas++;
+                    /* the id follows the last ':' of an address */
+                    colon = strrchr(p, ':');
+                    if(colon) {
+                        conf[n].replica_addrs[r] = strndup(p, colon - p);
+                        p = colon + 1;
+                    }
+                    conf[n].replicas[r] = atoi(p);
+                    p = strtok_r(NULL, ",", &save2);
+                }
+            }
+            else if(strncmp(tok, "numa=", 5) == 0) {
+                char *p = tok + 5;
+
+                while(*p && conf[n].num_numa < MAX_NODES) {
+                    conf[n].numa[conf[n].num_numa++] = strtol(p, &p, 10);
+                    if(*p == ',')
+                        p++;
+                }
+            }
+            else {
+                fprintf(stderr, "ERROR: %s:%d: unknown key '%s'\n", path, lineno, tok);
+                fclose(fp);
+                return -1;
+            }
+        }
+        n++;
+    }
+    fclose(fp);
+
+    return n;
+}
+
+/* cpus of a NUMA node, from its sysfs cpulist, e.g. "0-15,32-47" */
+static int numa_cpus(int node, int *cpus, int max)
+{
+    char path[128], list[4096], *tok, *save;
+    int lo, hi, n = 0;
+    FILE *fp;
+
+    snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", node);
+    fp = fopen(path, "r");
+    if(!fp)
+        return 0;
+    if(!fgets(list, sizeof(list), fp))
+        list[0] = '\0';
+    fclose(fp);
+
+    for(tok = strtok_r(list, ",\n", &save); tok; tok = strtok_r(NULL, ",\n", &save)) {
+        if(sscanf(tok, "%d-%d", &lo, &hi) != 2)
+            hi = lo = atoi(tok);
+        for(; lo <= hi && n < max; lo++)
+            cpus[n++] = lo;
+    }
+    return n;
+}
+
+static int num_pools(struct provider_conf *c)
+{
+    return c->num_numa > 1 ? c->num_numa : 1;
+}
+
+static int start_xstreams(struct provider_conf *c)
+{
+    int cpus[MAX_CPUS];
+    int i, p, ret, num_cpus = 0;
+    ABT_xstream *xs;
+
+    c->xstreams = calloc(num_pools(c) * c->num_xstreams, sizeof(*c->xstreams));
+    if(!c->xstreams)
+        return -1;
+    for(p = 0; p < num_pools(c); p++) {
+        ret = ABT_pool_create_basic(ABT_POOL_FIFO_WAIT, ABT_POOL_ACCESS_MPMC,
+                ABT_TRUE, &c->pools[p]);
+        if(ret != ABT_SUCCESS)
+            return -1;
+
+        num_cpus = 0;
+        if(c->num_numa) {
+            num_cpus = numa_cpus(c->numa[p], cpus, MAX_CPUS);
+            if(num_cpus == 0)
+                fprintf(stderr, "WARNING: no cpus found for NUMA node %d\n", c->numa[p]);
+        }
+        xs = c->xstreams + p * c->num_xstreams;
+        for(i = 0; i < c->num_xstreams; i++) {
+            ret = ABT_xstream_create_basic(ABT_SCHED_BASIC_WAIT, 1, &c->pools[p],
+                    ABT_SCHED_CONFIG_NULL, &xs[i]);
+            if(ret != ABT_SUCCESS)
+                return -1;
+            if(num_cpus)
+                ABT_xstream_set_affinity(xs[i], num_cpus, cpus);
+        }
+    }
+    return 0;
+}
+
+static void stop_xstreams(struct provider_conf *c)
+{
+    int i;
+
+    for(i = 0; i < num_pools(c) * c->num_xstreams && c->xstreams; i++) {
+        if(c->xstreams[i] == ABT_XSTREAM_NULL)
+            continue;
+        ABT_xstream_join(c->xstreams[i]);
+        ABT_xstream_free(&c->xstreams[i]);
+    }
+    free(c->xstreams);
+}
 
 int main(int argc, char** argv)
 {
-    if(argc != 2) {
-        fprintf(stderr, "Usage: %s <listen-address>\n", argv[0]);
+    char *config = NULL;
+    int argi = 2;
+
+    if(argc >= 4 && strcmp(argv[2], "-c") == 0) {
+        config = argv[3];
+        argi = 4;
+    }
+    if(argc < 2 || (argc - argi != 0 && argc - argi != 2)) {
+        fprintf(stderr, "Usage: %s <listen-address> [-c <config-file>] [<stats-file> <stats-interval-sec>]\n", argv[0]);
         return -1;
     }
 
     hg_return_t hret          = HG_SUCCESS;
     int ret                   = 0;
     char* listen_addr_str     = argv[1];
-    uint16_t provider_id      = 1;
     margo_instance_id mid     = MARGO_INSTANCE_NULL;
-    ndstore_provider_t ndstore_prov = NDSTORE_PROVIDER_NULL;
     hg_addr_t my_addr         = HG_ADDR_NULL;
+    struct provider_conf conf[MAX_PROVIDERS];
+    int i, num_providers      = 1;
+
+    memset(conf, 0, sizeof(conf));
+    conf[0].id = 1;
+    if(config) {
+        num_providers = parse_config(config, conf);
+        if(num_providers <= 0) {
+            fprintf(stderr, "ERROR: no provider in %s\n", config);
+            return -1;
+        }
+    }
+
+    // argobots is initialized here so that the xstreams of the
+    // providers outlive margo_finalize()
+    ABT_init(0, NULL);
 
     // initialize margo
     mid = margo_init(listen_addr_str, MARGO_SERVER_MODE, 0, -1);
     if(mid == MARGO_INSTANCE_NULL) {
+        ABT_finalize();
         return -1;
     }
 
@@ -51,12 +281,57 @@ int main(int argc, char** argv)
     margo_addr_free(mid, my_addr);
     fprintf(stderr,"%s", my_addr_str);
 
-    // create the NDSTORE provider
-    ret = ndstore_provider_register(mid, 1, NDSTORE_ABT_POOL_DEFAULT, &ndstore_prov);
-    if(ret != NDSTORE_SUCCESS) {
-        fprintf(stderr, "ERROR: ndstore_provider_register() returned %d\n", ret);
-        ret = -1;
-        goto error;
+    // create the NDSTORE providers
+    for(i = 0; i < num_providers; i++) {
+        struct provider_conf *c = &conf[i];
+
+        c->pools[0] = NDSTORE_ABT_POOL_DEFAULT;
+        if(c->num_xstreams > 0 && start_xstreams(c) != 0) {
+            fprintf(stderr, "ERROR: could not start the xstreams of provider %d\n", c->id);
+            ret = -1;
+            goto error;
+        }
+
+        ret = ndstore_provider_register(mid, c->id, c->pools[0], &c->prov);
+        if(ret != NDSTORE_SUCCESS) {
+            fprintf(stderr, "ERROR: ndstore_provider_register() returned %d\n", ret);
+            ret = -1;
+            goto error;
+        }
+        ndstore_provider_set_mem_budget(c->prov, c->budget);
+        ndstore_provider_set_pages(c->prov, c->pages);
+        if(c->copy_ults > 0)
+            ndstore_provider_set_copy_ults(c->prov, c->copy_ults);
+        if(c->results > 0)
+            ndstore_provider_set_result_cache(c->prov, c->results);
+        if(c->num_numa > 0)
+            ndstore_provider_set_numa(c->prov, c->num_numa, c->numa,
+                    c->num_xstreams > 0 ? c->pools : NULL);
+        if(c->num_replicas > 0) {
+            const char *addrs[MAX_PROVIDERS];
+            int j;
+
+            for(j = 0; j < c->num_replicas; j++)
+                addrs[j] = c->replica_addrs[j] ? c->replica_addrs[j] : my_addr_str;
+            ndstore_provider_set_replicas(c->prov, c->num_replicas, addrs,
+                    c->replicas);
+        }
+
+        if(argc - argi == 2) {
+            char path[1024];
+
+            // one stats file per provider
+            if(num_providers > 1)
+                snprintf(path, sizeof(path), "%s.%d", argv[argi], c->id);
+            else
+                snprintf(path, sizeof(path), "%s", argv[argi]);
+            ret = ndstore_provider_stats_enable_dump(c->prov, path, atof(argv[argi+1]));
+            if(ret != NDSTORE_SUCCESS) {
+                fprintf(stderr, "ERROR: ndstore_provider_stats_enable_dump() returned %d\n", ret);
+                ret = -1;
+                goto error;
+            }
+        }
     }
 
 
@@ -64,6 +339,12 @@ int main(int argc, char** argv)
     margo_wait_for_finalize(mid);
 
 finish:
+    for(i = 0; i < num_providers; i++) {
+        stop_xstreams(&conf[i]);
+        while(conf[i].num_replicas > 0)
+            free(conf[i].replica_addrs[--conf[i].num_replicas]);
+    }
+    ABT_finalize();
     return ret;
 error:
     margo_finalize(mid);
@@ -0,0 +1,882 @@
+/*
+ * Copyright (c) 2020, Rutgers Discovery Informatics Institute, Rutgers University
+ *
+ * See COPYRIGHT in top-level directory.
+ */
+
+/*
+ * Behavioural checks of the storage features of a provider. Each case
+ * puts data with a known pattern, reads it back through the feature
+ * under test and verifies every element.
+ *
+ * Usage: ./test_features server_addr case [provider_id [peer_addr server_pid]]
+ *
+ * peer_addr is another server, holding replicas of the providers of
+ * server_addr, and server_pid the process of server_addr, which the
+ * case may kill.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <unistd.h>
+#include <signal.h>
+#include <sys/types.h>
+#include <margo.h>
+#include <ndstore-client.h>
+
+/* versions a provider holds before overwriting the oldest, see
+ * MAX_VERSIONS in ss_data.h */
+#define SERVER_VERSIONS 10
+
+struct test_ctx {
+    margo_instance_id mid;
+    ndstore_client_t client;
+    ndstore_provider_handle_t ph;
+    hg_addr_t addr;
+    uint16_t provider_id;
+    const char *peer;
+    pid_t server_pid;
+};
+
+/* value of element (i, j) of version 'ver' put by writer 'w' */
+static double pattern(int w, unsigned int ver, uint64_t i, uint64_t j)
+{
+    return w * 1e6 + ver * 1e3 + i + j * 0.5;
+}
+
+static double *fill_2d(int w, unsigned int ver, uint64_t *lb, uint64_t *ub)
+{
+    uint64_t i, j, k = 0;
+    double *buf;
+
+    buf = malloc(sizeof(*buf) * (ub[0] - lb[0] + 1) * (ub[1] - lb[1] + 1));
+    for(j = lb[1]; j <= ub[1]; j++)
+        for(i = lb[0]; i <= ub[0]; i++)
+            buf[k++] = pattern(w, ver, i, j);
+    return buf;
+}
+
+/*
+ * Checks a box read back from the provider; writer_of() tells which
+ * writer last put element (i, j).
+ */
+static int check_2d(const char *what, const double *buf, unsigned int ver,
+        uint64_t *lb, uint64_t *ub, int (*writer_of)(uint64_t, uint64_t))
+{
+    uint64_t i, j, k = 0;
+    double want;
+
+    for(j = lb[1]; j <= ub[1]; j++)
+        for(i = lb[0]; i <= ub[0]; i++, k++) {
+            want = pattern(writer_of(i, j), ver, i, j);
+            if(buf[k] != want) {
+                fprintf(stderr, "%s: element (%" PRIu64 ", %" PRIu64 ") of "
+                        "version %u is %g, expected %g\n", what, i, j, ver,
+                        buf[k], want);
+                return -1;
+            }
+        }
+    return 0;
+}
+
+static int put_2d(struct test_ctx *t, const char *var, int w, unsigned int ver,
+        uint64_t lb0, uint64_t lb1, uint64_t ub0, uint64_t ub1)
+{
+    uint64_t lb[2] = {lb0, lb1}, ub[2] = {ub0, ub1};
+    double *buf = fill_2d(w, ver, lb, ub);
+    int ret;
+
+    ret = ndstore_put(t->ph, var, ver, sizeof(double), 2, lb, ub, buf);
+    free(buf);
+    if(ret != NDSTORE_SUCCESS)
+        fprintf(stderr, "ndstore_put(%s, %u) returned %d\n", var, ver, ret);
+    return ret;
+}
+
+static int set_policy(struct test_ctx *t, const char *var,
+        const struct ndstore_var_policy *policy)
+{
+    int ret = ndstore_set_var_policy(t->ph, var, policy);
+
+    if(ret != NDSTORE_SUCCESS)
+        fprintf(stderr, "ndstore_set_var_policy(%s) returned %d\n", var, ret);
+    return ret;
+}
+
+/* background ULTs (rechunking, compression, GC) run after the put */
+static void settle(void)
+{
+    usleep(500000);
+}
+
+static int first_writer(uint64_t i, uint64_t j)
+{
+    (void)i;
+    (void)j;
+    return 1;
+}
+
+static int get_check_2d(struct test_ctx *t, const char *var, unsigned int ver,
+        uint64_t *lb, uint64_t *ub, int (*writer_of)(uint64_t, uint64_t))
+{
+    double *buf = malloc(sizeof(*buf) * (ub[0] - lb[0] + 1) * (ub[1] - lb[1] + 1));
+    int ret;
+
+    ret = ndstore_get(t->ph, var, ver, sizeof(double), 2, lb, ub, buf);
+    if(ret != NDSTORE_SUCCESS)
+        fprintf(stderr, "%s: ndstore_get(%u) returned %d\n", var, ver, ret);
+    else
+        ret = check_2d(var, buf, ver, lb, ub, writer_of);
+    free(buf);
+    return ret;
+}
+
+/* a get of data the provider no longer holds must fail, not return
+ * stale bytes */
+static int get_missing_2d(struct test_ctx *t, const char *var, unsigned int ver,
+        uint64_t *lb, uint64_t *ub)
+{
+    double *buf = malloc(sizeof(*buf) * (ub[0] - lb[0] + 1) * (ub[1] - lb[1] + 1));
+    int ret;
+
+    ret = ndstore_get(t->ph, var, ver, sizeof(double), 2, lb, ub, buf);
+    free(buf);
+    if(ret != NDSTORE_ERR_UNKNOWN_OBJ) {
+        fprintf(stderr, "%s: ndstore_get(%u) of freed data returned %d\n",
+                var, ver, ret);
+        return -1;
+    }
+    return 0;
+}
+
+static int merge_writer(uint64_t i, uint64_t j)
+{
+    (void)j;
+    return i < 8 ? 3 : 2;
+}
+
+/*
+ * Two writers fill one grid cell, which the provider merges; then the
+ * first one re-puts its half. The other half must survive.
+ */
+static int test_merge(struct test_ctx *t)
+{
+    struct ndstore_var_policy policy;
+    uint64_t lb[2] = {0, 0}, ub[2] = {15, 7};
+
+    ndstore_var_policy_init(&policy);
+    policy.grid[0] = 16;
+    policy.grid[1] = 8;
+    if(set_policy(t, "merge", &policy) != NDSTORE_SUCCESS ||
+       put_2d(t, "merge", 1, 1, 0, 0, 7, 7) != NDSTORE_SUCCESS ||
+       put_2d(t, "merge", 2, 1, 8, 0, 15, 7) != NDSTORE_SUCCESS)
+        return -1;
+    settle();
+    if(put_2d(t, "merge", 3, 1, 0, 0, 7, 7) != NDSTORE_SUCCESS)
+        return -1;
+    settle();
+
+    return get_check_2d(t, "merge", 1, lb, ub, merge_writer);
+}
+
+/*
+ * Delta-encoded versions, keyframes every 3: the provider overwrites
+ * the oldest versions, which the deltas of the next ones depend on.
+ */
+static int test_delta(struct test_ctx *t)
+{
+    struct ndstore_var_policy policy;
+    uint64_t lb[2] = {0, 0}, ub[2] = {31, 31};
+    uint64_t slb[2] = {5, 3}, sub[2] = {20, 30};
+    unsigned int ver;
+
+    ndstore_var_policy_init(&policy);
+    policy.codec = ndstore_codec_available(NDSTORE_CODEC_ZSTD) ?
+        NDSTORE_CODEC_ZSTD : NDSTORE_CODEC_LZ4;
+    policy.delta_keyframe = 3;
+    if(!ndstore_codec_available(policy.codec)) {
+        fprintf(stderr, "delta: no lossless codec in this build, skipped\n");
+        return 0;
+    }
+    if(set_policy(t, "delta", &policy) != NDSTORE_SUCCESS)
+        return -1;
+    for(ver = 1; ver <= SERVER_VERSIONS + 2; ver++)
+        if(put_2d(t, "delta", 1, ver, 0, 0, 31, 31) != NDSTORE_SUCCESS)
+            return -1;
+    for(ver = 3; ver <= SERVER_VERSIONS + 2; ver++)
+        if(get_check_2d(t, "delta", ver, lb, ub, first_writer) != 0 ||
+           get_check_2d(t, "delta", ver, slb, sub, first_writer) != 0)
+            return -1;
+    return 0;
+}
+
+static unsigned int replica_round;
+
+static int replica_writer(uint64_t i, uint64_t j)
+{
+    (void)i;
+    (void)j;
+    return replica_round;
+}
+
+/*
+ * Overwrites through a handle that also reads from a replica of the
+ * provider on another server (the provider of the same id on
+ * peer_addr): every get must see the put just before it, whichever of
+ * the two serves it. Then the provider's server is killed, and the
+ * replica must serve the last put alone.
+ */
+static int test_replica(struct test_ctx *t)
+{
+    uint64_t lb[2] = {0, 0}, ub[2] = {63, 63};
+    hg_addr_t peer;
+    int i, ret;
+
+    if(!t->peer || t->server_pid <= 0) {
+        fprintf(stderr, "replica: needs peer_addr and server_pid\n");
+        return -1;
+    }
+    if(margo_addr_lookup(t->mid, t->peer, &peer) != HG_SUCCESS) {
+        fprintf(stderr, "replica: margo_addr_lookup(%s) failed\n", t->peer);
+        return -1;
+    }
+    ret = ndstore_provider_handle_add_replica(t->ph, peer, t->provider_id);
+    margo_addr_free(t->mid, peer);
+    if(ret != NDSTORE_SUCCESS) {
+        fprintf(stderr, "ndstore_provider_handle_add_replica() returned %d\n", ret);
+        return -1;
+    }
+    for(replica_round = 1; replica_round <= 16 && !ret; replica_round++) {
+        ret = put_2d(t, "replica", replica_round, 1, 0, 0, 63, 63);
+        for(i = 0; i < 2 && !ret; i++)
+            ret = get_check_2d(t, "replica", 1, lb, ub, replica_writer);
+    }
+    if(ret)
+        return ret;
+
+    /* the replica catches up with the last put */
+    settle();
+    if(kill(t->server_pid, SIGKILL) != 0) {
+        perror("replica: kill");
+        return -1;
+    }
+    replica_round = 16;
+    for(i = 0; i < 4 && !ret; i++)
+        ret = get_check_2d(t, "replica", 1, lb, ub, replica_writer);
+    return ret;
+}
+
+/*
+ * Retention: keep the 2 newest versions and the multiples of 3. The GC
+ * ULT frees the others within about a second.
+ */
+static int test_retention(struct test_ctx *t)
+{
+    struct ndstore_var_policy policy;
+    uint64_t lb[2] = {0, 0}, ub[2] = {31, 15};
+    unsigned int ver;
+    int ret = 0;
+
+    ndstore_var_policy_init(&policy);
+    policy.keep_last = 2;
+    policy.keep_every = 3;
+    if(set_policy(t, "retention", &policy) != NDSTORE_SUCCESS)
+        return -1;
+    for(ver = 1; ver <= 7; ver++)
+        if(put_2d(t, "retention", 1, ver, 0, 0, 31, 15) != NDSTORE_SUCCESS)
+            return -1;
+    sleep(2);
+    settle();
+    for(ver = 1; ver <= 7 && !ret; ver++) {
+        if(ver >= 6 || ver % 3 == 0)
+            ret = get_check_2d(t, "retention", ver, lb, ub, first_writer);
+        else
+            ret = get_missing_2d(t, "retention", ver, lb, ub);
+    }
+    return ret;
+}
+
+static int delete_2d(struct test_ctx *t, const char *var, unsigned int ver_lo,
+        unsigned int ver_hi, uint64_t *lb, uint64_t *ub)
+{
+    int ret = ndstore_delete(t->ph, var, ver_lo, ver_hi, lb ? 2 : 0, lb, ub);
+
+    if(ret != NDSTORE_SUCCESS)
+        fprintf(stderr, "ndstore_delete(%s, %u, %u) returned %d\n", var,
+                ver_lo, ver_hi, ret);
+    return ret;
+}
+
+/*
+ * Deletes a box out of the middle of a piece, which the provider cuts
+ * down to the frame around it, then whole versions.
+ */
+static int test_delete(struct test_ctx *t)
+{
+    uint64_t lb[2] = {0, 0}, ub[2] = {31, 31};
+    uint64_t dlb[2] = {8, 8}, dub[2] = {15, 23};
+    uint64_t xlb[2] = {4, 4}, xub[2] = {11, 11};
+    uint64_t keep[4][2][2] = {
+        {{0, 0}, {7, 31}}, {{16, 0}, {31, 31}},
+        {{8, 0}, {15, 7}}, {{8, 24}, {15, 31}},
+    };
+    unsigned int ver;
+    int i;
+
+    for(ver = 1; ver <= 4; ver++)
+        if(put_2d(t, "delete", 1, ver, 0, 0, 31, 31) != NDSTORE_SUCCESS)
+            return -1;
+    if(delete_2d(t, "delete", 1, 1, dlb, dub) != NDSTORE_SUCCESS)
+        return -1;
+    for(i = 0; i < 4; i++)
+        if(get_check_2d(t, "delete", 1, keep[i][0], keep[i][1], first_writer) != 0)
+            return -1;
+    if(get_missing_2d(t, "delete", 1, dlb, dub) != 0 ||
+       get_missing_2d(t, "delete", 1, xlb, xub) != 0 ||
+       get_missing_2d(t, "delete", 1, lb, ub) != 0 ||
+       get_check_2d(t, "delete", 2, lb, ub, first_writer) != 0)
+        return -1;
+
+    if(delete_2d(t, "delete", 2, 3, NULL, NULL) != NDSTORE_SUCCESS)
+        return -1;
+    for(ver = 2; ver <= 3; ver++)
+        if(get_missing_2d(t, "delete", ver, lb, ub) != 0)
+            return -1;
+    return get_check_2d(t, "delete", 4, lb, ub, first_writer);
+}
+
+static int put_fields_2d(struct test_ctx *t, unsigned int ver,
+        uint64_t lb0, uint64_t lb1, uint64_t ub0, uint64_t ub1)
+{
+    const char *names[3] = {"u", "v", "w"};
+    uint64_t lb[2] = {lb0, lb1}, ub[2] = {ub0, ub1};
+    void *data[3];
+    int k, ret;
+
+    /* field k holds the pattern of writer k + 1 */
+    for(k = 0; k < 3; k++)
+        data[k] = fill_2d(k + 1, ver, lb, ub);
+    ret = ndstore_put_fields(t->ph, "fields", ver, sizeof(double), 2, lb, ub,
+            3, names, data);
+    for(k = 0; k < 3; k++)
+        free(data[k]);
+    if(ret != NDSTORE_SUCCESS)
+        fprintf(stderr, "ndstore_put_fields(%u) returned %d\n", ver, ret);
+    return ret;
+}
+
+static int field_w(uint64_t i, uint64_t j)
+{
+    (void)i;
+    (void)j;
+    return 3;
+}
+
+/*
+ * Two multi-field pieces; a get spanning both reads two of the three
+ * fields, in the reverse order.
+ */
+static int test_fields(struct test_ctx *t)
+{
+    const char *names[2] = {"w", "u"};
+    const char *absent[2] = {"u", "p"};
+    uint64_t lb[2] = {4, 2}, ub[2] = {27, 13};
+    size_t n = (ub[0] - lb[0] + 1) * (ub[1] - lb[1] + 1);
+    void *data[2];
+    int ret;
+
+    if(put_fields_2d(t, 1, 0, 0, 15, 15) != NDSTORE_SUCCESS ||
+       put_fields_2d(t, 1, 16, 0, 31, 15) != NDSTORE_SUCCESS)
+        return -1;
+    data[0] = malloc(sizeof(double) * n);
+    data[1] = malloc(sizeof(double) * n);
+    ret = ndstore_get_fields(t->ph, "fields", 1, sizeof(double), 2, lb, ub,
+            2, names, data);
+    if(ret != NDSTORE_SUCCESS)
+        fprintf(stderr, "ndstore_get_fields() returned %d\n", ret);
+    else if(check_2d("fields w", data[0], 1, lb, ub, field_w) != 0 ||
+            check_2d("fields u", data[1], 1, lb, ub, first_writer) != 0)
+        ret = -1;
+    else if(ndstore_get_fields(t->ph, "fields", 1, sizeof(double), 2, lb, ub,
+                2, absent, data) == NDSTORE_SUCCESS) {
+        fprintf(stderr, "ndstore_get_fields() of a missing field succeeded\n");
+        ret = -1;
+    }
+    free(data[0]);
+    free(data[1]);
+    return ret;
+}
+
+#define POINTS_DOMAIN 100
+#define POINTS_NUM 1000
+
+/*
+ * Points scattered over a 100 x 100 domain by two puts; gets of a box
+ * must return each point in it exactly once, with its value.
+ */
+static int test_points(struct test_ctx *t)
+{
+    uint64_t lb[2] = {10, 20}, ub[2] = {49, 79};
+    uint64_t *coords, *out_coords, n, want = 0, k;
+    double *values, *out_values;
+    int *count;
+    unsigned int seed = 12345;
+    int ret = -1;
+
+    coords = malloc(sizeof(*coords) * 2 * POINTS_NUM);
+    values = malloc(sizeof(*values) * POINTS_NUM);
+    count = calloc(POINTS_DOMAIN * POINTS_DOMAIN, sizeof(*count));
+    for(k = 0; k < POINTS_NUM; k++) {
+        seed = seed * 1103515245 + 12345;
+        coords[2 * k] = (seed >> 8) % POINTS_DOMAIN;
+        seed = seed * 1103515245 + 12345;
+        coords[2 * k + 1] = (seed >> 8) % POINTS_DOMAIN;
+        values[k] = pattern(1, 1, coords[2 * k], coords[2 * k + 1]);
+        if(coords[2 * k] >= lb[0] && coords[2 * k] <= ub[0] &&
+           coords[2 * k + 1] >= lb[1] && coords[2 * k + 1] <= ub[1]) {
+            count[coords[2 * k + 1] * POINTS_DOMAIN + coords[2 * k]]++;
+            want++;
+        }
+    }
+    out_coords = malloc(sizeof(*out_coords) * 2 * want);
+    out_values = malloc(sizeof(*out_values) * want);
+
+    if(ndstore_put_points(t->ph, "points", 1, sizeof(double), 2, POINTS_NUM / 2,
+           coords, values) != NDSTORE_SUCCESS ||
+       ndstore_put_points(t->ph, "points", 1, sizeof(double), 2, POINTS_NUM / 2,
+           coords + POINTS_NUM, values + POINTS_NUM / 2) != NDSTORE_SUCCESS) {
+        fprintf(stderr, "ndstore_put_points() failed\n");
+        goto out;
+    }
+
+    /* count only, then too little room: nothing copied either way */
+    n = 0;
+    if(ndstore_get_points(t->ph, "points", 1, sizeof(double), 2, lb, ub,
+           0, NULL, NULL, &n) != NDSTORE_ERR_SIZE || n != want) {
+        fprintf(stderr, "points: counted %" PRIu64 " points, expected %"
+                PRIu64 "\n", n, want);
+        goto out;
+    }
+    if(ndstore_get_points(t->ph, "points", 1, sizeof(double), 2, lb, ub,
+           want - 1, out_coords, out_values, &n) != NDSTORE_ERR_SIZE) {
+        fprintf(stderr, "points: get into too small buffers did not fail\n");
+        goto out;
+    }
+
+    ret = ndstore_get_points(t->ph, "points", 1, sizeof(double), 2, lb, ub,
+            want, out_coords, out_values, &n);
+    if(ret != NDSTORE_SUCCESS || n != want) {
+        fprintf(stderr, "points: ndstore_get_points() returned %d with %"
+                PRIu64 " points, expected %" PRIu64 "\n", ret, n, want);
+        ret = -1;
+        goto out;
+    }
+    for(k = 0; k < n && !ret; k++) {
+        uint64_t x = out_coords[2 * k], y = out_coords[2 * k + 1];
+
+        if(x < lb[0] || x > ub[0] || y < lb[1] || y > ub[1] ||
+           count[y * POINTS_DOMAIN + x]-- <= 0) {
+            fprintf(stderr, "points: unexpected point (%" PRIu64 ", %" PRIu64
+                    ")\n", x, y);
+            ret = -1;
+        } else if(out_values[k] != pattern(1, 1, x, y)) {
+            fprintf(stderr, "points: point (%" PRIu64 ", %" PRIu64 ") is %g, "
+                    "expected %g\n", x, y, out_values[k], pattern(1, 1, x, y));
+            ret = -1;
+        }
+    }
+
+out:
+    free(coords);
+    free(values);
+    free(count);
+    free(out_coords);
+    free(out_values);
+    return ret;
+}
+
+static int put_level_2d(struct test_ctx *t, int level,
+        uint64_t lb0, uint64_t lb1, uint64_t ub0, uint64_t ub1)
+{
+    uint64_t lb[2] = {lb0, lb1}, ub[2] = {ub0, ub1};
+    double *buf = fill_2d(level + 1, 1, lb, ub);
+    int ret;
+
+    ret = ndstore_put_level(t->ph, "amr", 1, sizeof(double), 2, level, lb, ub, buf);
+    free(buf);
+    if(ret != NDSTORE_SUCCESS)
+        fprintf(stderr, "ndstore_put_level(%d) returned %d\n", level, ret);
+    return ret;
+}
+
+static int amr_level1(uint64_t i, uint64_t j)
+{
+    (void)i;
+    (void)j;
+    return 2;
+}
+
+/* level 2 patch [12, 19]^2, level 1 patch [4, 11]^2, level 0 [0, 7]^2 */
+static double amr_value(uint64_t i, uint64_t j)
+{
+    if(i >= 12 && i <= 19 && j >= 12 && j <= 19)
+        return pattern(3, 1, i, j);
+    if(i / 2 >= 4 && i / 2 <= 11 && j / 2 >= 4 && j / 2 <= 11)
+        return pattern(2, 1, i / 2, j / 2);
+    return pattern(1, 1, i / 4, j / 4);
+}
+
+static int get_amr(struct test_ctx *t, uint64_t *lb, uint64_t *ub)
+{
+    double *buf = malloc(sizeof(*buf) * (ub[0] - lb[0] + 1) * (ub[1] - lb[1] + 1));
+    uint64_t i, j, k = 0;
+    int ret;
+
+    ret = ndstore_get_level(t->ph, "amr", 1, sizeof(double), 2, 2, 2, lb, ub, buf);
+    if(ret != NDSTORE_SUCCESS)
+        fprintf(stderr, "amr: ndstore_get_level() returned %d\n", ret);
+    for(j = lb[1]; j <= ub[1] && !ret; j++)
+        for(i = lb[0]; i <= ub[0] && !ret; i++, k++)
+            if(buf[k] != amr_value(i, j)) {
+                fprintf(stderr, "amr: element (%" PRIu64 ", %" PRIu64 ") is %g, "
+                        "expected %g\n", i, j, buf[k], amr_value(i, j));
+                ret = -1;
+            }
+    free(buf);
+    return ret;
+}
+
+/*
+ * Three refinement levels, ratio 2: a get at the finest level takes
+ * each element from the finest patch that covers it.
+ */
+static int test_amr(struct test_ctx *t)
+{
+    uint64_t lb[2] = {0, 0}, ub[2] = {31, 31};
+    uint64_t slb[2] = {3, 5}, sub[2] = {29, 30};
+    uint64_t plb[2] = {4, 4}, pub[2] = {11, 11};
+    double *buf;
+    int ret;
+
+    if(put_level_2d(t, 0, 0, 0, 7, 7) != NDSTORE_SUCCESS ||
+       put_level_2d(t, 1, 4, 4, 11, 11) != NDSTORE_SUCCESS ||
+       put_level_2d(t, 2, 12, 12, 19, 19) != NDSTORE_SUCCESS)
+        return -1;
+    if(get_amr(t, lb, ub) != 0 || get_amr(t, slb, sub) != 0)
+        return -1;
+
+    /* without a ratio, only the patches of the level itself */
+    buf = malloc(sizeof(*buf) * 32 * 32);
+    ret = ndstore_get_level(t->ph, "amr", 1, sizeof(double), 2, 1, 0, plb, pub, buf);
+    if(ret != NDSTORE_SUCCESS)
+        fprintf(stderr, "amr: ndstore_get_level(1) returned %d\n", ret);
+    else
+        ret = check_2d("amr level 1", buf, 1, plb, pub, amr_level1);
+    if(!ret && ndstore_get_level(t->ph, "amr", 1, sizeof(double), 2, 1, 0,
+                lb, ub, buf) != NDSTORE_ERR_UNKNOWN_OBJ) {
+        fprintf(stderr, "amr: get of level 1 outside its patch did not fail\n");
+        ret = -1;
+    }
+    free(buf);
+    return ret;
+}
+
+static int halves_writer(uint64_t i, uint64_t j)
+{
+    (void)j;
+    return i < 16 ? 1 : 2;
+}
+
+/*
+ * A time series of a box across the two pieces of each version, in one
+ * call; a range reaching past the last version put must fail.
+ */
+static int test_versions(struct test_ctx *t)
+{
+    uint64_t lb[2] = {9, 3}, ub[2] = {22, 12};
+    size_t n = (ub[0] - lb[0] + 1) * (ub[1] - lb[1] + 1);
+    double *buf;
+    unsigned int ver;
+    int ret;
+
+    for(ver = 1; ver <= 4; ver++)
+        if(put_2d(t, "versions", 1, ver, 0, 0, 15, 15) != NDSTORE_SUCCESS ||
+           put_2d(t, "versions", 2, ver, 16, 0, 31, 15) != NDSTORE_SUCCESS)
+            return -1;
+    buf = malloc(sizeof(*buf) * n * 5);
+    ret = ndstore_get_versions(t->ph, "versions", 1, 4, sizeof(double), 2,
+            lb, ub, buf);
+    if(ret != NDSTORE_SUCCESS)
+        fprintf(stderr, "ndstore_get_versions() returned %d\n", ret);
+    for(ver = 1; ver <= 4 && !ret; ver++)
+        ret = check_2d("versions", buf + (ver - 1) * n, ver, lb, ub, halves_writer);
+    if(!ret && ndstore_get_versions(t->ph, "versions", 2, 5, sizeof(double), 2,
+                lb, ub, buf) == NDSTORE_SUCCESS) {
+        fprintf(stderr, "ndstore_get_versions() of a missing version succeeded\n");
+        ret = -1;
+    }
+    free(buf);
+    return ret;
+}
+
+static int cache_round;
+
+static int cache_writer(uint64_t i, uint64_t j)
+{
+    (void)i;
+    (void)j;
+    return cache_round;
+}
+
+/*
+ * A caching reader and a second client that overwrites, deletes or
+ * lets the GC collect what it read: after the provider's notification
+ * the reader must see the change. The reader's own puts would drop its
+ * entries locally, so they cannot show that the provider reports them.
+ */
+static int test_cache(struct test_ctx *t)
+{
+    struct test_ctx w = *t;
+    struct ndstore_var_policy policy;
+    uint64_t lb[2] = {0, 0}, ub[2] = {31, 31};
+    int ret;
+
+    ret = ndstore_client_cache_enable(t->client, 1 << 20);
+    if(ret != NDSTORE_SUCCESS) {
+        fprintf(stderr, "ndstore_client_cache_enable() returned %d\n", ret);
+        return -1;
+    }
+    if(ndstore_client_init(t->mid, &w.client) != NDSTORE_SUCCESS)
+        return -1;
+    ret = ndstore_provider_handle_create(w.client, t->addr, t->provider_id, &w.ph);
+    if(ret != NDSTORE_SUCCESS) {
+        ndstore_client_finalize(w.client);
+        return -1;
+    }
+
+    /* overwrite */
+    ret = -1;
+    cache_round = 1;
+    if(put_2d(&w, "cache", 1, 1, 0, 0, 31, 31) != NDSTORE_SUCCESS ||
+       get_check_2d(t, "cache", 1, lb, ub, cache_writer) != 0)
+        goto out;
+    cache_round = 2;
+    if(put_2d(&w, "cache", 2, 1, 0, 0, 31, 31) != NDSTORE_SUCCESS)
+        goto out;
+    settle();
+    if(get_check_2d(t, "cache", 1, lb, ub, cache_writer) != 0)
+        goto out;
+
+    /* re-put of a version the provider evicted meanwhile */
+    cache_round = 3;
+    if(put_2d(&w, "cache", 1, 1 + SERVER_VERSIONS, 0, 0, 31, 31) != NDSTORE_SUCCESS ||
+       put_2d(&w, "cache", 3, 1, 0, 0, 31, 31) != NDSTORE_SUCCESS)
+        goto out;
+    settle();
+    if(get_check_2d(t, "cache", 1, lb, ub, cache_writer) != 0)
+        goto out;
+
+    /* versions collected by the GC, then deleted */
+    ndstore_var_policy_init(&policy);
+    policy.keep_last = 1;
+    if(set_policy(&w, "cache_gc", &policy) != NDSTORE_SUCCESS ||
+       put_2d(&w, "cache_gc", 1, 1, 0, 0, 31, 31) != NDSTORE_SUCCESS ||
+       get_check_2d(t, "cache_gc", 1, lb, ub, first_writer) != 0 ||
+       put_2d(&w, "cache_gc", 1, 2, 0, 0, 31, 31) != NDSTORE_SUCCESS ||
+       get_check_2d(t, "cache_gc", 2, lb, ub, first_writer) != 0)
+        goto out;
+    sleep(2);
+    settle();
+    if(get_missing_2d(t, "cache_gc", 1, lb, ub) != 0 ||
+       delete_2d(&w, "cache_gc", 2, 2, NULL, NULL) != NDSTORE_SUCCESS)
+        goto out;
+    settle();
+    ret = get_missing_2d(t, "cache_gc", 2, lb, ub);
+
+out:
+    ndstore_provider_handle_release(w.ph);
+    ndstore_client_finalize(w.client);
+    return ret;
+}
+
+/*
+ * Two providers that forward to the same replica (provider_id + 2, see
+ * shared_replica.conf), each numbering its updates on its own: the
+ * replica must not serve the clients of one of them by the updates it
+ * applied from the other.
+ */
+static int test_shared(struct test_ctx *t)
+{
+    struct test_ctx b = *t;
+    uint64_t lb[2] = {0, 0}, ub[2] = {63, 63};
+    int i, k, ret;
+
+    ret = ndstore_provider_handle_create(t->client, t->addr, t->provider_id + 1, &b.ph);
+    if(ret != NDSTORE_SUCCESS) {
+        fprintf(stderr, "ndstore_provider_handle_create() returned %d\n", ret);
+        return -1;
+    }
+    if(ndstore_provider_handle_add_replica(t->ph, t->addr, t->provider_id + 2) != NDSTORE_SUCCESS ||
+       ndstore_provider_handle_add_replica(b.ph, t->addr, t->provider_id + 2) != NDSTORE_SUCCESS) {
+        fprintf(stderr, "ndstore_provider_handle_add_replica() failed\n");
+        ndstore_provider_handle_release(b.ph);
+        return -1;
+    }
+    /* the first provider runs ahead of the second */
+    for(replica_round = 1; replica_round <= 16 && !ret; replica_round++) {
+        for(k = 0; k < 4 && !ret; k++)
+            ret = put_2d(t, "shared_a", replica_round, 1, 0, 0, 63, 63);
+        if(!ret)
+            ret = put_2d(&b, "shared_b", replica_round, 1, 0, 0, 63, 63);
+        for(i = 0; i < 2 && !ret; i++)
+            ret = get_check_2d(&b, "shared_b", 1, lb, ub, replica_writer);
+        for(i = 0; i < 2 && !ret; i++)
+            ret = get_check_2d(t, "shared_a", 1, lb, ub, replica_writer);
+    }
+    ndstore_provider_handle_release(b.ph);
+    return ret;
+}
+
+/*
+ * Retention on a provider replicated to provider_id + 2 (see
+ * shared_replica.conf): the versions the provider collects must be
+ * gone from the replica too, whether read through the handle or from
+ * the replica directly.
+ */
+static int test_replica_gc(struct test_ctx *t)
+{
+    struct test_ctx r = *t;
+    struct ndstore_var_policy policy;
+    uint64_t lb[2] = {0, 0}, ub[2] = {31, 31};
+    unsigned int ver;
+    int i, ret;
+
+    ret = ndstore_provider_handle_create(t->client, t->addr, t->provider_id + 2, &r.ph);
+    if(ret != NDSTORE_SUCCESS) {
+        fprintf(stderr, "ndstore_provider_handle_create() returned %d\n", ret);
+        return -1;
+    }
+    ret = -1;
+    if(ndstore_provider_handle_add_replica(t->ph, t->addr, t->provider_id + 2) != NDSTORE_SUCCESS) {
+        fprintf(stderr, "ndstore_provider_handle_add_replica() failed\n");
+        goto out;
+    }
+    ndstore_var_policy_init(&policy);
+    policy.keep_last = 1;
+    if(set_policy(t, "replica_gc", &policy) != NDSTORE_SUCCESS)
+        goto out;
+    for(ver = 1; ver <= 3; ver++)
+        if(put_2d(t, "replica_gc", 1, ver, 0, 0, 31, 31) != NDSTORE_SUCCESS)
+            goto out;
+    sleep(2);
+    settle();
+
+    for(ver = 1; ver <= 2; ver++) {
+        if(get_missing_2d(&r, "replica_gc", ver, lb, ub) != 0)
+            goto out;
+        for(i = 0; i < 2; i++)
+            if(get_missing_2d(t, "replica_gc", ver, lb, ub) != 0)
+                goto out;
+    }
+    if(get_check_2d(&r, "replica_gc", 3, lb, ub, first_writer) != 0)
+        goto out;
+    ret = 0;
+    for(i = 0; i < 2 && !ret; i++)
+        ret = get_check_2d(t, "replica_gc", 3, lb, ub, first_writer);
+
+out:
+    ndstore_provider_handle_release(r.ph);
+    return ret;
+}
+
+static const struct {
+    const char *name;
+    int (*run)(struct test_ctx *);
+    /* the case caches, which needs a margo instance in server mode */
+    int listen;
+} cases[] = {
+    {"merge", test_merge},
+    {"delta", test_delta},
+    {"replica", test_replica},
+    {"shared", test_shared},
+    {"replica_gc", test_replica_gc},
+    {"retention", test_retention},
+    {"delete", test_delete},
+    {"fields", test_fields},
+    {"points", test_points},
+    {"amr", test_amr},
+    {"versions", test_versions},
+    {"cache", test_cache, 1},
+};
+
+int main(int argc, char **argv)
+{
+    struct test_ctx t;
+    char proto[64] = {0};
+    int (*run)(struct test_ctx *) = NULL;
+    int listen = 0;
+    size_t c;
+    int i, ret;
+
+    if(argc < 3) {
+        fprintf(stderr, "Usage: %s server_addr case [provider_id [peer_addr server_pid]]\n", argv[0]);
+        return -1;
+    }
+    for(c = 0; c < sizeof(cases) / sizeof(cases[0]); c++)
+        if(strcmp(cases[c].name, argv[2]) == 0) {
+            run = cases[c].run;
+            listen = cases[c].listen;
+        }
+    if(!run) {
+        fprintf(stderr, "unknown case '%s'\n", argv[2]);
+        return -1;
+    }
+    memset(&t, 0, sizeof(t));
+    t.provider_id = argc > 3 ? atoi(argv[3]) : 1;
+    if(argc > 5) {
+        t.peer = argv[4];
+        t.server_pid = atoi(argv[5]);
+    }
+
+    for(i = 0; i < 63 && argv[1][i] != '\0' && argv[1][i] != ':'; i++)
+        proto[i] = argv[1][i];
+
+    /* handlers run on the progress thread, the main one may be asleep */
+    if(listen)
+        t.mid = margo_init(proto, MARGO_SERVER_MODE, 1, -1);
+    else
+        t.mid = margo_init(proto, MARGO_CLIENT_MODE, 1, 0);
+    if(t.mid == MARGO_INSTANCE_NULL) {
+        fprintf(stderr, "ERROR: margo_init()\n");
+        return -1;
+    }
+    ret = ndstore_client_init(t.mid, &t.client);
+    if(ret != NDSTORE_SUCCESS) {
+        fprintf(stderr, "ERROR: ndstore_client_init() returned %d\n", ret);
+        margo_finalize(t.mid);
+        return -1;
+    }
+    if(margo_addr_lookup(t.mid, argv[1], &t.addr) != HG_SUCCESS) {
+        fprintf(stderr, "ERROR: margo_addr_lookup()\n");
+        ndstore_client_finalize(t.client);
+        margo_finalize(t.mid);
+        return -1;
+    }
+    ret = ndstore_provider_handle_create(t.client, t.addr, t.provider_id, &t.ph);
+    if(ret != NDSTORE_SUCCESS) {
+        fprintf(stderr, "ERROR: ndstore_provider_handle_create() returned %d\n", ret);
+        return -1;
+    }
+
+    ret = run(&t);
+    fprintf(stdout, "%s: %s\n", argv[2], ret ? "FAILED" : "ok");
+
+    ndstore_provider_handle_release(t.ph);
+    ndstore_client_finalize(t.client);
+    margo_addr_free(t.mid, t.addr);
+    margo_finalize(t.mid);
+
+    return ret ? -1 : 0;
+}
@@ -22,5 +22,87 @@ elif [ $1 -eq 4 ]; then
 	A=$(cat server.addr)
 	./test_writer $A 1 3 1 1 1 1 4 4 4 8
 	./test_reader $A 1 3 1 1 1 1 4 4 2 8
+elif [ $1 -eq 5 ]; then
+	./ndstore_server sm >&server.addr &
+	sleep 2
+	A=$(cat server.addr)
+	./loadgen -s $A -g 16,16,16 -b 8,8,8 -v 4 -c 2 -q 4 -t 2 -r shift -z 0.9 -l 2 -k
+	./loadgen -s $A -g 16,16,16 -b 8,8,8 -v 4 -c 2 -q 4 -t 2 -r shift -u -k
+elif [ $1 -eq 6 ]; then
+	./ndstore_server sm -c $(dirname $0)/providers.conf >&server.addr &
+	sleep 2
+	A=$(cat server.addr)
+	(./loadgen -s $A -i 1 -g 16,16,16 -b 8,8,8 -v 2 -t 2 -k &
+	 ./loadgen -s $A -i 2 -g 32,32,32 -b 16,16,16 -v 2 -c 2 -q 4 -t 2 -k; wait)
+elif [ $1 -eq 7 ]; then
+	./ndstore_server sm >&server.addr &
+	sleep 2
+	A=$(cat server.addr)
+	./test_features $A merge
+elif [ $1 -eq 8 ]; then
+	./ndstore_server sm >&server.addr &
+	sleep 2
+	A=$(cat server.addr)
+	./test_features $A delta
+elif [ $1 -eq 9 ]; then
+	# the replica runs in a server of its own, the test kills the primary
+	./ndstore_server sm >&replica.addr &
+	R=$!
+	sleep 2
+	B=$(cat replica.addr)
+	echo "provider id=1 replicas=$B:1" > primary.conf
+	./ndstore_server sm -c primary.conf >&server.addr &
+	P=$!
+	sleep 2
+	A=$(cat server.addr)
+	./test_features $A replica 1 $B $P
+	ret=$?
+	kill $P $R 2>/dev/null
+	exit $ret
+elif [ $1 -eq 10 ]; then
+	./ndstore_server sm >&server.addr &
+	sleep 2
+	A=$(cat server.addr)
+	./test_features $A retention
+elif [ $1 -eq 11 ]; then
+	./ndstore_server sm >&server.addr &
+	sleep 2
+	A=$(cat server.addr)
+	./test_features $A delete
+elif [ $1 -eq 12 ]; then
+	./ndstore_server sm >&server.addr &
+	sleep 2
+	A=$(cat server.addr)
+	./test_features $A fields
+elif [ $1 -eq 13 ]; then
+	./ndstore_server sm >&server.addr &
+	sleep 2
+	A=$(cat server.addr)
+	./test_features $A points
+elif [ $1 -eq 14 ]; then
+	./ndstore_server sm >&server.addr &
+	sleep 2
+	A=$(cat server.addr)
+	./test_features $A amr
+elif [ $1 -eq 15 ]; then
+	./ndstore_server sm >&server.addr &
+	sleep 2
+	A=$(cat server.addr)
+	./test_features $A versions
+elif [ $1 -eq 16 ]; then
+	./ndstore_server sm >&server.addr &
+	sleep 2
+	A=$(cat server.addr)
+	./test_features $A cache
+elif [ $1 -eq 17 ]; then
+	./ndstore_server sm -c $(dirname $0)/shared_replica.conf >&server.addr &
+	sleep 2
+	A=$(cat server.addr)
+	./test_features $A shared
+elif [ $1 -eq 18 ]; then
+	./ndstore_server sm -c $(dirname $0)/shared_replica.conf >&server.addr &
+	sleep 2
+	A=$(cat server.addr)
+	./test_features $A replica_gc
 fi
 kill $!
\ No newline at end of file